@@ -0,0 +1,369 @@
+#pragma once
+
+// ============================================================
+// NATIVE ARDUINO CORE (host build of the MUD)
+// ============================================================
+//
+// Just enough of the Arduino-ESP32 core for src/ESP32MUD.cpp to compile
+// and run unchanged on Linux or macOS under `pio run -e native`:
+//
+//   String          std::string underneath, Arduino semantics on top
+//   Print / Stream  as in the core, incl. printf and readStringUntil
+//   Serial          stdin / stdout
+//   millis/micros   monotonic clock, zero at process start
+//   ESP             restart re-executes the binary; heap figures are
+//                   modelled on the C3's 320 KB
+//
+// LittleFS (FS.h / LittleFS.h), WiFiServer / WiFiClient (WiFi.h) and
+// HTTPClient live in their own headers, as on the device.  Nothing here
+// is compiled into the firmware; library.json limits it to the native
+// platform.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <functional>
+
+using std::min;
+using std::max;
+
+#define HEX 16
+#define DEC 10
+#define OCT 8
+#define BIN 2
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// ============================================================
+// String
+// ============================================================
+
+class String {
+public:
+    String() {}
+    String(const char *c) : s(c ? c : "") {}
+    String(const String &o) = default;
+    String(String &&o) = default;
+    String &operator=(const String &o) = default;
+    String &operator=(String &&o) = default;
+    String &operator=(const char *c) { s = c ? c : ""; return *this; }
+
+    explicit String(char c) : s(1, c) {}
+    explicit String(unsigned char v, unsigned char base = 10) { fromUnsigned(v, base); }
+    explicit String(int v, unsigned char base = 10) { fromSigned(v, base); }
+    explicit String(unsigned int v, unsigned char base = 10) { fromUnsigned(v, base); }
+    explicit String(long v, unsigned char base = 10) { fromSigned(v, base); }
+    explicit String(unsigned long v, unsigned char base = 10) { fromUnsigned(v, base); }
+    explicit String(long long v, unsigned char base = 10) { fromSigned(v, base); }
+    explicit String(unsigned long long v, unsigned char base = 10) { fromUnsigned(v, base); }
+    explicit String(float v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+    explicit String(double v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+
+    unsigned int length() const { return s.size(); }
+    bool isEmpty() const { return s.empty(); }
+    const char *c_str() const { return s.c_str(); }
+    char *begin() { return &s[0]; }
+    char *end() { return &s[0] + s.size(); }
+    bool reserve(unsigned int n) { s.reserve(n); return true; }
+
+    // Out-of-range reads give 0, as on the device
+    char operator[](unsigned int i) const { return i < s.size() ? s[i] : 0; }
+    char &operator[](unsigned int i) {
+        static char dummy;
+        if (i >= s.size()) { dummy = 0; return dummy; }
+        return s[i];
+    }
+    char charAt(unsigned int i) const { return (*this)[i]; }
+    void setCharAt(unsigned int i, char c) { if (i < s.size()) s[i] = c; }
+
+    explicit operator bool() const { return true; }
+
+    String &operator+=(const String &o) { s += o.s; return *this; }
+    String &operator+=(const char *c) { if (c) s += c; return *this; }
+    String &operator+=(char c) { s += c; return *this; }
+    String &operator+=(unsigned char v) { return *this += String(v); }
+    String &operator+=(int v) { return *this += String(v); }
+    String &operator+=(unsigned int v) { return *this += String(v); }
+    String &operator+=(long v) { return *this += String(v); }
+    String &operator+=(unsigned long v) { return *this += String(v); }
+    String &operator+=(long long v) { return *this += String(v); }
+    String &operator+=(unsigned long long v) { return *this += String(v); }
+    String &operator+=(float v) { return *this += String(v); }
+    String &operator+=(double v) { return *this += String(v); }
+
+    bool concat(const String &o) { s += o.s; return true; }
+    bool concat(const char *c) { if (c) s += c; return true; }
+    bool concat(const char *c, unsigned int n) { if (c) s.append(c, n); return true; }
+    bool concat(char c) { s += c; return true; }
+    bool concat(int v) { *this += v; return true; }
+    bool concat(unsigned int v) { *this += v; return true; }
+    bool concat(long v) { *this += v; return true; }
+    bool concat(unsigned long v) { *this += v; return true; }
+    bool concat(float v) { *this += v; return true; }
+    bool concat(double v) { *this += v; return true; }
+
+    bool operator==(const String &o) const { return s == o.s; }
+    bool operator==(const char *c) const { return s == (c ? c : ""); }
+    bool operator!=(const String &o) const { return s != o.s; }
+    bool operator!=(const char *c) const { return !(*this == c); }
+    bool operator<(const String &o) const { return s < o.s; }
+    bool operator>(const String &o) const { return s > o.s; }
+    bool operator<=(const String &o) const { return s <= o.s; }
+    bool operator>=(const String &o) const { return s >= o.s; }
+    int compareTo(const String &o) const { return strcmp(s.c_str(), o.s.c_str()); }
+    bool equals(const String &o) const { return s == o.s; }
+    bool equals(const char *c) const { return *this == c; }
+    bool equalsIgnoreCase(const String &o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+
+    bool startsWith(const String &p) const { return startsWith(p, 0); }
+    bool startsWith(const String &p, unsigned int offset) const {
+        return offset <= s.size() && s.size() - offset >= p.s.size() && s.compare(offset, p.s.size(), p.s) == 0;
+    }
+    bool endsWith(const String &p) const {
+        return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0;
+    }
+
+    int indexOf(char c, unsigned int from = 0) const { return found(s.find(c, from)); }
+    int indexOf(const String &t, unsigned int from = 0) const { return found(s.find(t.s, from)); }
+    int indexOf(const char *t, unsigned int from = 0) const { return found(s.find(t ? t : "", from)); }
+    int lastIndexOf(char c) const { return found(s.rfind(c)); }
+    int lastIndexOf(char c, unsigned int from) const { return found(s.rfind(c, from)); }
+    int lastIndexOf(const String &t) const { return found(s.rfind(t.s)); }
+    int lastIndexOf(const String &t, unsigned int from) const { return found(s.rfind(t.s, from)); }
+
+    String substring(unsigned int from) const { return substring(from, s.size()); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= s.size()) return String();
+        if (to > s.size()) to = s.size();
+        String r;
+        r.s = s.substr(from, to - from);
+        return r;
+    }
+
+    void replace(char a, char b) { std::replace(s.begin(), s.end(), a, b); }
+    void replace(const String &a, const String &b) {
+        if (a.s.empty()) return;
+        size_t pos = 0;
+        while ((pos = s.find(a.s, pos)) != std::string::npos) {
+            s.replace(pos, a.s.size(), b.s);
+            pos += b.s.size();
+        }
+    }
+    void remove(unsigned int index) { if (index < s.size()) s.erase(index); }
+    void remove(unsigned int index, unsigned int count) { if (index < s.size()) s.erase(index, count); }
+    void toLowerCase() { for (auto &c : s) c = tolower((unsigned char)c); }
+    void toUpperCase() { for (auto &c : s) c = toupper((unsigned char)c); }
+    void trim() {
+        size_t b = 0, e = s.size();
+        while (b < e && isspace((unsigned char)s[b])) b++;
+        while (e > b && isspace((unsigned char)s[e - 1])) e--;
+        s = s.substr(b, e - b);
+    }
+
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return (float)atof(s.c_str()); }
+    double toDouble() const { return atof(s.c_str()); }
+
+    void getBytes(unsigned char *buf, unsigned int size, unsigned int index = 0) const {
+        if (!size || !buf) return;
+        size_t n = index < s.size() ? s.size() - index : 0;
+        if (n > size - 1) n = size - 1;
+        memcpy(buf, s.data() + index, n);
+        buf[n] = 0;
+    }
+    void toCharArray(char *buf, unsigned int size, unsigned int index = 0) const {
+        getBytes((unsigned char *)buf, size, index);
+    }
+
+private:
+    std::string s;
+
+    static int found(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+
+    void fromUnsigned(unsigned long long v, unsigned base) {
+        if (base < 2 || base > 16) base = 10;
+        char buf[66];
+        char *p = buf + sizeof(buf) - 1;
+        *p = 0;
+        do { *--p = "0123456789abcdef"[v % base]; v /= base; } while (v);
+        s = p;
+    }
+    void fromSigned(long long v, unsigned base) {
+        if (base == 10 && v < 0) {
+            fromUnsigned(0ULL - (unsigned long long)v, 10);
+            s.insert(s.begin(), '-');
+        } else if (base == 10) {
+            fromUnsigned((unsigned long long)v, 10);
+        } else {
+            // Other bases print the two's complement, as the core does
+            fromUnsigned((unsigned long)v, base);
+        }
+    }
+    void fromDouble(double v, unsigned decimals) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+        s = buf;
+    }
+};
+
+inline String operator+(const String &a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, const char *b) { String r(a); r += b; return r; }
+inline String operator+(const char *a, const String &b) { String r(a); r += b; return r; }
+inline String operator+(const String &a, char c) { String r(a); r += c; return r; }
+inline String operator+(const String &a, unsigned char v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, int v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, unsigned int v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, long v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, unsigned long v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, long long v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, unsigned long long v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, float v) { String r(a); r += v; return r; }
+inline String operator+(const String &a, double v) { String r(a); r += v; return r; }
+inline bool operator==(const char *a, const String &b) { return b == a; }
+inline bool operator!=(const char *a, const String &b) { return b != a; }
+
+// ============================================================
+// Print / Stream
+// ============================================================
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buf, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buf++);
+        return n;
+    }
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *buf, size_t size) { return write((const uint8_t *)buf, size); }
+    virtual void flush() {}
+
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(int v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned int v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(long long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(unsigned long long v, int base = DEC) { return print(String(v, (unsigned char)base)); }
+    size_t print(double v, int decimals = 2) { return print(String(v, (unsigned int)decimals)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(const T &v, int format) { size_t n = print(v, format); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeoutMs) { _timeout = timeoutMs; }
+    unsigned long getTimeout() const { return _timeout; }
+
+    // These wait up to the timeout for more data, like the core's
+    size_t readBytes(char *buf, size_t length);
+    size_t readBytes(uint8_t *buf, size_t length) { return readBytes((char *)buf, length); }
+    String readStringUntil(char terminator);
+    String readString();
+
+protected:
+    unsigned long _timeout = 1000;
+    int timedRead();
+};
+
+// ============================================================
+// IPAddress
+// ============================================================
+
+class IPAddress {
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { octets[0] = a; octets[1] = b; octets[2] = c; octets[3] = d; }
+    explicit IPAddress(uint32_t networkOrder) { memcpy(octets, &networkOrder, 4); }
+    uint8_t operator[](int i) const { return octets[i]; }
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return String(buf);
+    }
+    operator String() const { return toString(); }
+
+private:
+    uint8_t octets[4] = {0, 0, 0, 0};
+};
+
+// ============================================================
+// Serial (stdin / stdout)
+// ============================================================
+
+class HWSerial : public Stream {
+public:
+    void begin(unsigned long baud);
+    void end() {}
+    operator bool() const { return true; }    // a host process always has its console
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    void flush() override;
+    using Print::write;
+
+    using Print::print;
+    using Print::println;
+    size_t print(const IPAddress &ip) { return print(ip.toString()); }
+    size_t println(const IPAddress &ip) { return println(ip.toString()); }
+
+private:
+    int peeked = -1;
+};
+
+extern HWSerial Serial;
+
+// ============================================================
+// Timing, random numbers, chip
+// ============================================================
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class EspClass {
+public:
+    void restart();                  // re-executes this binary with the same arguments
+    uint32_t getSketchSize();
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz() { return 160; }
+};
+
+extern EspClass ESP;
@@ -0,0 +1,12 @@
+#pragma once
+#include <Arduino.h>
+
+// ============================================================
+// NATIVE ESP MAIL CLIENT
+// ============================================================
+//
+// Mail goes out through sendESP32mail.php on the HTTP job queue; the
+// sketch only declares an SMTP session, so these are empty.
+
+class SMTP_Status {};
+class SMTPSession {};
@@ -0,0 +1,69 @@
+#pragma once
+#include <Arduino.h>
+#include <memory>
+
+// ============================================================
+// NATIVE FILESYSTEM (POSIX directory standing in for flash)
+// ============================================================
+//
+// File and FS as in the ESP32 core: a File is a shared handle (copies
+// refer to the same open file, closed when the last copy goes), name()
+// is the last path component, and a directory opened with open() lists
+// its entries through openNextFile().  Paths are the device's absolute
+// paths ("/rooms.txt") under the root LittleFS.begin() chose.
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+struct NativeFileImpl;
+
+class File : public Stream {
+public:
+    File() {}
+    explicit File(std::shared_ptr<NativeFileImpl> impl) : impl(impl) {}
+
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size);
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    void flush() override;
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    explicit operator bool() const;
+
+    const char *name() const;
+    const char *path() const;
+    bool isDirectory() const;
+    File openNextFile(const char *mode = "r");
+    void rewindDirectory();
+    time_t getLastWrite();
+
+private:
+    std::shared_ptr<NativeFileImpl> impl;
+};
+
+class FS {
+public:
+    File open(const char *path, const char *mode = "r", bool create = false);
+    File open(const String &path, const char *mode = "r", bool create = false) { return open(path.c_str(), mode, create); }
+    bool exists(const char *path);
+    bool exists(const String &path) { return exists(path.c_str()); }
+    bool remove(const char *path);
+    bool remove(const String &path) { return remove(path.c_str()); }
+    bool rename(const char *from, const char *to);
+    bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+    bool mkdir(const char *path);
+    bool mkdir(const String &path) { return mkdir(path.c_str()); }
+    bool rmdir(const char *path);
+    bool rmdir(const String &path) { return rmdir(path.c_str()); }
+
+protected:
+    std::string root;               // host directory that "/" maps to
+
+    std::string hostPath(const char *path) const;
+};
@@ -0,0 +1,79 @@
+#pragma once
+#include <WiFi.h>
+#include <vector>
+
+// ============================================================
+// NATIVE HTTPCLIENT
+// ============================================================
+//
+// Plain HTTP/1.1 to a server on this machine (localhost or 127.x.x.x),
+// so the job queue, weather, jokes and mail can be run against a local
+// stand-in (scripts/mail_standin.py, the test stub servers).  Requests to
+// any other host, and every https:// URL, fail the way an unreachable
+// server does on the device: the native build never talks to the live
+// site, and the world keeps running down the error branches.
+//
+// One request per begin(); the connection is closed by end().  The body
+// may be sized by Content-Length, chunked, or run to the close.
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_NOT_MODIFIED 304
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_NO_STREAM (-6)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient {
+public:
+    HTTPClient() {}
+    ~HTTPClient() { end(); }
+
+    bool begin(const String &url);
+    bool begin(WiFiClient &client, const String &url) { (void)client; return begin(url); }
+    void end();
+
+    void setConnectTimeout(int32_t ms) { connectTimeoutMs = ms; }
+    void setTimeout(uint16_t ms) { readTimeoutMs = ms; }
+    void setReuse(bool reuse) { (void)reuse; }
+    void addHeader(const String &name, const String &value);
+    void collectHeaders(const char *headerKeys[], const size_t count);
+    String header(const char *name);
+    bool hasHeader(const char *name);
+
+    int GET() { return sendRequest("GET", String()); }
+    int POST(const String &payload) { return sendRequest("POST", payload); }
+    int sendRequest(const char *type, const String &payload);
+
+    bool connected();
+    int getSize() { return contentLength; }
+    String getString();
+    WiFiClient *getStreamPtr() { return client.connected() ? &client : nullptr; }
+    int writeToStream(Stream *stream);
+
+    static String errorToString(int error);
+
+private:
+    struct Header { String name; String value; };
+
+    String host;
+    uint16_t port = 80;
+    String path;
+    bool local = false;                     // a host this build may reach
+    int32_t connectTimeoutMs = 5000;
+    uint16_t readTimeoutMs = 5000;
+    std::vector<Header> requestHeaders;
+    std::vector<Header> responseHeaders;    // the collected names; values filled per response
+    WiFiClient client;
+    int contentLength = -1;
+    bool chunked = false;
+    long bodyLeft = -1;                     // bytes left in the body (or chunk); -1 = to the close
+    bool bodyDone = false;
+    String bodyCache;                       // getString() result, kept for a second call
+
+    bool readLine(String &line);
+    int readSome(uint8_t *buf, size_t size);
+    bool waitReadable();
+    int readBody(Stream *to, String *into);
+};
@@ -0,0 +1,26 @@
+#pragma once
+#include <FS.h>
+
+// ============================================================
+// NATIVE LITTLEFS
+// ============================================================
+//
+// begin() mounts $MUD_FS_ROOT (default ./native_fs).  A root that does not
+// exist yet is created and filled with the files in $MUD_FS_SEED (default
+// ./data), the same set `pio run -t uploadfs` puts on the device.  Sizes
+// are reported against the 0x2E0000 byte littlefs partition in no_ota.csv.
+
+#ifndef NATIVE_FS_BYTES
+#define NATIVE_FS_BYTES 0x2E0000        // build with -D NATIVE_FS_BYTES=... to model another partition
+#endif
+
+class LittleFSFS : public FS {
+public:
+    bool begin(bool formatOnFail = false, const char *basePath = "/littlefs",
+               uint8_t maxOpenFiles = 10, const char *partitionLabel = "spiffs");
+    void end() {}
+    size_t totalBytes() { return NATIVE_FS_BYTES; }
+    size_t usedBytes();
+};
+
+extern LittleFSFS LittleFS;
@@ -0,0 +1,322 @@
+#include <Arduino.h>
+#include "NativeHost.h"
+#include "NativeReplay.h"
+
+#include <chrono>
+#include <thread>
+#include <set>
+#include <vector>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// ============================================================
+// Print / Stream
+// ============================================================
+
+size_t Print::printf(const char *format, ...) {
+    char small[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    if ((size_t)len < sizeof(small)) return write((const uint8_t *)small, len);
+
+    std::vector<char> big(len + 1);
+    va_start(args, format);
+    vsnprintf(big.data(), big.size(), format, args);
+    va_end(args);
+    return write((const uint8_t *)big.data(), len);
+}
+
+int Stream::timedRead() {
+    unsigned long start = millis();
+    do {
+        int c = read();
+        if (c >= 0) return c;
+        delay(1);
+    } while (millis() - start < _timeout);
+    return -1;
+}
+
+size_t Stream::readBytes(char *buf, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        int c = timedRead();
+        if (c < 0) break;
+        buf[count++] = (char)c;
+    }
+    return count;
+}
+
+String Stream::readStringUntil(char terminator) {
+    String ret;
+    int c = timedRead();
+    while (c >= 0 && c != terminator) {
+        ret += (char)c;
+        c = timedRead();
+    }
+    return ret;
+}
+
+String Stream::readString() {
+    String ret;
+    int c = timedRead();
+    while (c >= 0) {
+        ret += (char)c;
+        c = timedRead();
+    }
+    return ret;
+}
+
+// ============================================================
+// Serial
+// ============================================================
+
+HWSerial Serial;
+
+// A replay's serial input comes from the journal instead of stdin
+static std::string serialFeed;
+static size_t serialFeedPos = 0;
+
+void nativeSerialFeed(const std::string &text) {
+    serialFeed.erase(0, serialFeedPos);
+    serialFeedPos = 0;
+    serialFeed += text;
+}
+
+void HWSerial::begin(unsigned long baud) {
+    (void)baud;
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+}
+
+int HWSerial::available() {
+    if (peeked >= 0) return 1;
+    if (nativeReplaying()) return (int)(serialFeed.size() - serialFeedPos);
+    int n = 0;
+    if (ioctl(STDIN_FILENO, FIONREAD, &n) < 0) return 0;
+    return n;
+}
+
+int HWSerial::read() {
+    if (peeked >= 0) {
+        int c = peeked;
+        peeked = -1;
+        return c;
+    }
+    if (available() <= 0) return -1;
+    if (nativeReplaying()) return (unsigned char)serialFeed[serialFeedPos++];
+    unsigned char c;
+    return ::read(STDIN_FILENO, &c, 1) == 1 ? c : -1;
+}
+
+int HWSerial::peek() {
+    if (peeked < 0) peeked = read();
+    return peeked;
+}
+
+size_t HWSerial::write(uint8_t c) {
+    return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t HWSerial::write(const uint8_t *buf, size_t size) {
+    return fwrite(buf, 1, size, stdout);
+}
+
+void HWSerial::flush() {
+    fflush(stdout);
+}
+
+// ============================================================
+// Timing and random numbers
+// ============================================================
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+bool nativeVirtualClock = false;
+uint64_t nativeClockUs = 0;
+
+unsigned long millis() {
+    if (nativeVirtualClock) return (unsigned long)(nativeClockUs / 1000);
+    return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long micros() {
+    if (nativeVirtualClock) return (unsigned long)nativeClockUs;
+    return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - bootTime).count();
+}
+
+void delay(unsigned long ms) {
+    if (nativeVirtualClock) {
+        nativeClockUs += (uint64_t)ms * 1000;
+        return;
+    }
+    fflush(stdout);
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    if (nativeVirtualClock) {
+        nativeClockUs += us;
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+void yield() {}
+
+// As in the ESP32 core: the hardware generator until randomSeed(), then
+// newlib's rand(), whose sequence is reproduced here so a seed journaled
+// on the device draws the same numbers on the host
+static bool seeded = false;
+static uint64_t randNext = 1;
+
+static uint32_t newlibRand() {
+    randNext = randNext * 6364136223846793005ULL + 1;
+    return (uint32_t)((randNext >> 32) & 0x7fffffff);
+}
+
+long random(long howbig) {
+    if (howbig == 0) return 0;
+    if (howbig < 0) return random(0, -howbig);
+    uint32_t val = seeded ? newlibRand() : (uint32_t)::random();
+    return (long)(val % (unsigned long)howbig);
+}
+
+long random(long howsmall, long howbig) {
+    if (howsmall >= howbig) return howsmall;
+    return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+    if (nativeReplaying()) seed = nativeReplaySeed();
+    if (seed == 0) return;
+    randNext = (uint32_t)seed;
+    seeded = true;
+}
+
+// ============================================================
+// ESP
+// ============================================================
+
+EspClass ESP;
+
+static const uint32_t NATIVE_HEAP_BYTES = 320 * 1024;   // the C3's DRAM
+static uint32_t minFreeHeap = NATIVE_HEAP_BYTES;
+static std::vector<char *> savedArgs;
+
+void nativeSaveArgs(int argc, char **argv) {
+    savedArgs.assign(argv, argv + argc);
+    savedArgs.push_back(nullptr);
+}
+
+void EspClass::restart() {
+    if (nativeReplaying()) nativeReplayFinish("the game rebooted");
+    // Sockets are close-on-exec, so the new image starts with none open
+    printf("[NATIVE] Restarting %s\n", savedArgs.empty() ? "" : savedArgs[0]);
+    fflush(stdout);
+    if (!savedArgs.empty()) execv("/proc/self/exe", savedArgs.data());
+    if (!savedArgs.empty()) execvp(savedArgs[0], savedArgs.data());
+    perror("[NATIVE] restart failed");
+    exit(1);
+}
+
+uint32_t EspClass::getSketchSize() {
+    struct stat st;
+    if (!savedArgs.empty() && stat(savedArgs[0], &st) == 0) return (uint32_t)st.st_size;
+    return 0;
+}
+
+uint32_t EspClass::getHeapSize() {
+    return NATIVE_HEAP_BYTES;
+}
+
+// What the sketch has allocated, counted against the device's heap
+uint32_t EspClass::getFreeHeap() {
+    size_t used = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    used = mallinfo2().uordblks;
+#endif
+    uint32_t freeBytes = used >= NATIVE_HEAP_BYTES ? 0 : NATIVE_HEAP_BYTES - (uint32_t)used;
+    if (freeBytes < minFreeHeap) minFreeHeap = freeBytes;
+    return freeBytes;
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    getFreeHeap();
+    return minFreeHeap;
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+    return getFreeHeap();
+}
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(micros() * getCpuFreqMHz());
+}
+
+// ============================================================
+// main
+// ============================================================
+
+// Never destroyed: sockets held by the sketch's globals close during exit
+static std::set<int> &watchedFds = *new std::set<int>;
+static bool stdinOpen = true;      // stops being watched at end of file
+
+void nativeWatchFd(int fd) {
+    watchedFds.insert(fd);
+}
+
+void nativeUnwatchFd(int fd) {
+    watchedFds.erase(fd);
+}
+
+void nativeIdleWait(int timeoutMs) {
+    if (timeoutMs <= 0) return;
+    std::vector<pollfd> fds;
+    fds.reserve(watchedFds.size() + 1);
+    if (stdinOpen) fds.push_back({STDIN_FILENO, POLLIN, 0});
+    for (int fd : watchedFds) fds.push_back({fd, POLLIN, 0});
+    fflush(stdout);
+    if (poll(fds.data(), fds.size(), timeoutMs) <= 0 || !stdinOpen) return;
+
+    // Readable with nothing to read is end of file (e.g. stdin from /dev/null)
+    if ((fds[0].revents & (POLLIN | POLLHUP)) && Serial.available() <= 0) stdinOpen = false;
+}
+
+// A unit test (pio test -e native) brings its own main() and calls into
+// the sketch directly
+#ifndef PIO_UNIT_TESTING
+
+void setup();
+void loop();
+
+int main(int argc, char **argv) {
+    if (argc > 1 && !strcmp(argv[1], "--replay")) return nativeReplayMain(argc, argv);
+
+    nativeSaveArgs(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    srandom((unsigned)time(nullptr) ^ ((unsigned)getpid() << 16));
+
+    setup();
+    for (;;) {
+        loop();
+        nativeIdleWait(NATIVE_IDLE_WAIT_MS);
+    }
+}
+
+#else
+
+// A test of a header alone still links the replay driver, which calls these
+__attribute__((weak)) void setup() {}
+__attribute__((weak)) void loop() {}
+
+#endif
@@ -0,0 +1,305 @@
+#include <LittleFS.h>
+#include "NativeHost.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+LittleFSFS LittleFS;
+
+// ============================================================
+// File
+// ============================================================
+
+struct NativeFileImpl {
+    FILE *fp = nullptr;
+    DIR *dir = nullptr;
+    std::string path;               // device path, e.g. "/data/pot.txt"
+    std::string host;               // where it really lives
+    bool writable = false;
+    size_t readSize = 0;            // size of a read-only file, taken at open
+
+    ~NativeFileImpl() { close(); }
+
+    void close() {
+        if (fp) fclose(fp);
+        if (dir) closedir(dir);
+        fp = nullptr;
+        dir = nullptr;
+    }
+};
+
+static std::string joinPath(const std::string &dir, const char *name) {
+    std::string p = dir;
+    if (p.empty() || p.back() != '/') p += '/';
+    return p + name;
+}
+
+int File::available() {
+    if (!impl || !impl->fp) return 0;
+    long pos = ftell(impl->fp);
+    size_t total = size();
+    return pos >= 0 && (size_t)pos < total ? (int)(total - pos) : 0;
+}
+
+int File::read() {
+    if (!impl || !impl->fp) return -1;
+    int c = fgetc(impl->fp);
+    return c == EOF ? -1 : c;
+}
+
+int File::read(uint8_t *buf, size_t size) {
+    if (!impl || !impl->fp) return -1;
+    return (int)fread(buf, 1, size, impl->fp);
+}
+
+int File::peek() {
+    if (!impl || !impl->fp) return -1;
+    int c = fgetc(impl->fp);
+    if (c == EOF) return -1;
+    ungetc(c, impl->fp);
+    return c;
+}
+
+size_t File::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t File::write(const uint8_t *buf, size_t size) {
+    if (!impl || !impl->fp) return 0;
+    return fwrite(buf, 1, size, impl->fp);
+}
+
+void File::flush() {
+    if (impl && impl->fp) fflush(impl->fp);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+    if (!impl || !impl->fp) return false;
+    int whence = mode == SeekCur ? SEEK_CUR : mode == SeekEnd ? SEEK_END : SEEK_SET;
+    return fseek(impl->fp, (long)pos, whence) == 0;
+}
+
+size_t File::position() const {
+    if (!impl || !impl->fp) return 0;
+    long pos = ftell(impl->fp);
+    return pos < 0 ? 0 : (size_t)pos;
+}
+
+size_t File::size() const {
+    if (!impl || !impl->fp) return 0;
+    if (!impl->writable) return impl->readSize;
+    fflush(impl->fp);
+    struct stat st;
+    return fstat(fileno(impl->fp), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+void File::close() {
+    if (impl) impl->close();
+    impl.reset();
+}
+
+File::operator bool() const {
+    return impl && (impl->fp || impl->dir);
+}
+
+const char *File::name() const {
+    if (!impl) return nullptr;
+    size_t slash = impl->path.rfind('/');
+    return impl->path.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+}
+
+const char *File::path() const {
+    return impl ? impl->path.c_str() : nullptr;
+}
+
+bool File::isDirectory() const {
+    return impl && impl->dir;
+}
+
+File File::openNextFile(const char *mode) {
+    if (!impl || !impl->dir) return File();
+    while (struct dirent *entry = readdir(impl->dir)) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        return LittleFS.open(joinPath(impl->path, entry->d_name).c_str(), mode);
+    }
+    return File();
+}
+
+void File::rewindDirectory() {
+    if (impl && impl->dir) rewinddir(impl->dir);
+}
+
+time_t File::getLastWrite() {
+    struct stat st;
+    if (!impl || stat(impl->host.c_str(), &st) != 0) return 0;
+    return st.st_mtime;
+}
+
+// ============================================================
+// FS
+// ============================================================
+
+std::string FS::hostPath(const char *path) const {
+    std::string p = path ? path : "";
+    if (p.empty() || p[0] != '/') p = "/" + p;
+    while (p.size() > 1 && p.back() == '/') p.pop_back();
+    return p == "/" ? root : root + p;
+}
+
+static bool makeParents(const std::string &host) {
+    for (size_t slash = host.find('/', 1); slash != std::string::npos; slash = host.find('/', slash + 1)) {
+        std::string dir = host.substr(0, slash);
+        if (::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+File FS::open(const char *path, const char *mode, bool create) {
+    auto impl = std::make_shared<NativeFileImpl>();
+    impl->host = hostPath(path);
+    impl->path = impl->host.substr(root.size());
+    if (impl->path.empty()) impl->path = "/";
+
+    struct stat st;
+    bool exists = stat(impl->host.c_str(), &st) == 0;
+    if (exists && S_ISDIR(st.st_mode)) {
+        impl->dir = opendir(impl->host.c_str());
+        return impl->dir ? File(impl) : File();
+    }
+
+    bool reading = mode && mode[0] == 'r' && mode[1] != '+';
+    if (!exists && reading) return File();
+    if (!exists && create) makeParents(impl->host);
+
+    // Always binary; "r" / "w" / "a" and their "+" forms as given
+    std::string fmode = mode && *mode ? mode : "r";
+    if (fmode.find('b') == std::string::npos) fmode += 'b';
+    impl->fp = fopen(impl->host.c_str(), fmode.c_str());
+    if (!impl->fp) return File();
+    impl->writable = !reading;
+    impl->readSize = exists ? (size_t)st.st_size : 0;
+    return File(impl);
+}
+
+bool FS::exists(const char *path) {
+    struct stat st;
+    return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char *path) {
+    return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to) {
+    return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char *path) {
+    std::string host = hostPath(path);
+    return ::mkdir(host.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+bool FS::rmdir(const char *path) {
+    return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+// ============================================================
+// LittleFS
+// ============================================================
+
+static bool copyFile(const std::string &from, const std::string &to) {
+    FILE *in = fopen(from.c_str(), "rb");
+    if (!in) return false;
+    FILE *out = fopen(to.c_str(), "wb");
+    if (!out) {
+        fclose(in);
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+    return true;
+}
+
+// Copy a directory tree, like uploading a filesystem image
+int nativeCopyTree(const std::string &from, const std::string &to) {
+    DIR *dir = opendir(from.c_str());
+    if (!dir) return 0;
+    int copied = 0;
+    while (struct dirent *entry = readdir(dir)) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        std::string src = joinPath(from, entry->d_name);
+        std::string dst = joinPath(to, entry->d_name);
+        struct stat st;
+        if (stat(src.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) {
+            ::mkdir(dst.c_str(), 0755);
+            copied += nativeCopyTree(src, dst);
+        } else if (copyFile(src, dst)) {
+            copied++;
+        }
+    }
+    closedir(dir);
+    return copied;
+}
+
+bool nativeRemoveTree(const std::string &path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) return errno == ENOENT;
+    if (!S_ISDIR(st.st_mode)) return unlink(path.c_str()) == 0;
+    DIR *dir = opendir(path.c_str());
+    if (!dir) return false;
+    bool ok = true;
+    while (struct dirent *entry = readdir(dir)) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        ok = nativeRemoveTree(joinPath(path, entry->d_name)) && ok;
+    }
+    closedir(dir);
+    return ::rmdir(path.c_str()) == 0 && ok;
+}
+
+bool LittleFSFS::begin(bool formatOnFail, const char *basePath, uint8_t maxOpenFiles, const char *partitionLabel) {
+    (void)basePath;
+    (void)maxOpenFiles;
+    (void)partitionLabel;
+
+    const char *env = getenv("MUD_FS_ROOT");
+    root = env && *env ? env : "native_fs";
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+
+    struct stat st;
+    if (stat(root.c_str(), &st) == 0) return S_ISDIR(st.st_mode);
+    if (!formatOnFail) return false;
+
+    if (!makeParents(root + "/") ) return false;
+    const char *seed = getenv("MUD_FS_SEED");
+    std::string seedDir = seed && *seed ? seed : "data";
+    int copied = nativeCopyTree(seedDir, root);
+    printf("[NATIVE] Created filesystem %s (%d files from %s)\n", root.c_str(), copied, seedDir.c_str());
+    return true;
+}
+
+// Whole 4 KB blocks per file, as littlefs allocates them
+static size_t treeBytes(const std::string &dirPath) {
+    DIR *dir = opendir(dirPath.c_str());
+    if (!dir) return 0;
+    size_t total = 4096;
+    while (struct dirent *entry = readdir(dir)) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+        std::string p = joinPath(dirPath, entry->d_name);
+        struct stat st;
+        if (stat(p.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) total += treeBytes(p);
+        else total += ((size_t)st.st_size + 4095) / 4096 * 4096;
+    }
+    closedir(dir);
+    return total;
+}
+
+size_t LittleFSFS::usedBytes() {
+    return treeBytes(root);
+}
@@ -0,0 +1,194 @@
+#include <HTTPClient.h>
+#include <poll.h>
+#include <strings.h>
+
+// ============================================================
+// Request
+// ============================================================
+
+bool HTTPClient::begin(const String &url) {
+    end();
+    host = "";
+    path = "/";
+    port = 80;
+    local = false;
+    requestHeaders.clear();
+
+    if (!url.startsWith("http://")) return true;    // https: fails at GET/POST, as if unreachable
+    String rest = url.substring(7);
+    int slash = rest.indexOf('/');
+    String hostPort = slash < 0 ? rest : rest.substring(0, slash);
+    if (slash >= 0) path = rest.substring(slash);
+    int colon = hostPort.indexOf(':');
+    host = colon < 0 ? hostPort : hostPort.substring(0, colon);
+    if (colon >= 0) port = (uint16_t)hostPort.substring(colon + 1).toInt();
+    if (host.length() == 0 || port == 0) return false;
+
+    local = host == "localhost" || host.startsWith("127.");
+    return true;
+}
+
+void HTTPClient::end() {
+    client.stop();
+    contentLength = -1;
+    chunked = false;
+    bodyLeft = -1;
+    bodyDone = false;
+    bodyCache = "";
+    for (Header &h : responseHeaders) h.value = "";
+}
+
+void HTTPClient::addHeader(const String &name, const String &value) {
+    requestHeaders.push_back({name, value});
+}
+
+void HTTPClient::collectHeaders(const char *headerKeys[], const size_t count) {
+    responseHeaders.clear();
+    for (size_t i = 0; i < count; i++) responseHeaders.push_back({String(headerKeys[i]), String()});
+}
+
+String HTTPClient::header(const char *name) {
+    for (const Header &h : responseHeaders)
+        if (strcasecmp(h.name.c_str(), name) == 0) return h.value;
+    return String();
+}
+
+bool HTTPClient::hasHeader(const char *name) {
+    return header(name).length() > 0;
+}
+
+int HTTPClient::sendRequest(const char *type, const String &payload) {
+    if (!local) return HTTPC_ERROR_CONNECTION_REFUSED;
+    if (!client.connect(host.c_str(), port, connectTimeoutMs)) return HTTPC_ERROR_CONNECTION_REFUSED;
+
+    String request = String(type) + " " + path + " HTTP/1.1\r\n";
+    request += "Host: " + host + ":" + String(port) + "\r\n";
+    request += "User-Agent: ESP32HTTPClient\r\nConnection: close\r\n";
+    for (const Header &h : requestHeaders) request += h.name + ": " + h.value + "\r\n";
+    if (payload.length() > 0 || strcmp(type, "POST") == 0) request += "Content-Length: " + String(payload.length()) + "\r\n";
+    request += "\r\n";
+    request += payload;
+    if (client.write((const uint8_t *)request.c_str(), request.length()) != request.length())
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+
+    // Status line: "HTTP/1.1 200 OK"
+    String line;
+    if (!readLine(line)) return HTTPC_ERROR_READ_TIMEOUT;
+    int space = line.indexOf(' ');
+    if (!line.startsWith("HTTP/") || space < 0) return HTTPC_ERROR_CONNECTION_LOST;
+    int code = line.substring(space + 1).toInt();
+
+    for (;;) {
+        if (!readLine(line)) return HTTPC_ERROR_READ_TIMEOUT;
+        if (line.length() == 0) break;
+        int colon = line.indexOf(':');
+        if (colon < 0) continue;
+        String name = line.substring(0, colon);
+        String value = line.substring(colon + 1);
+        value.trim();
+        if (strcasecmp(name.c_str(), "Content-Length") == 0) contentLength = value.toInt();
+        if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0 && strcasecmp(value.c_str(), "chunked") == 0) chunked = true;
+        for (Header &h : responseHeaders)
+            if (strcasecmp(h.name.c_str(), name.c_str()) == 0) h.value = value;
+    }
+
+    if (chunked) contentLength = -1;
+    bodyLeft = chunked ? 0 : contentLength;
+    if (code == 204 || code == 304 || strcmp(type, "HEAD") == 0) bodyDone = true;
+    return code;
+}
+
+// ============================================================
+// Response body
+// ============================================================
+
+bool HTTPClient::connected() {
+    return client.connected() || client.available() > 0;
+}
+
+bool HTTPClient::waitReadable() {
+    if (client.available() > 0) return true;
+    if (client.fd() < 0) return false;
+    pollfd pfd = {client.fd(), POLLIN, 0};
+    return poll(&pfd, 1, readTimeoutMs) == 1;
+}
+
+// Bytes read; 0 once the server has closed; -1 on timeout
+int HTTPClient::readSome(uint8_t *buf, size_t size) {
+    if (!waitReadable()) return client.fd() < 0 ? 0 : -1;
+    int n = client.read(buf, size);
+    return n > 0 ? n : 0;
+}
+
+bool HTTPClient::readLine(String &line) {
+    line = "";
+    for (;;) {
+        uint8_t c;
+        int n = readSome(&c, 1);
+        if (n <= 0) return n == 0 && line.length() > 0;
+        if (c == '\n') break;
+        if (c != '\r') line += (char)c;
+    }
+    return true;
+}
+
+// Copy the body into a stream or a String, undoing chunked encoding
+int HTTPClient::readBody(Stream *to, String *into) {
+    if (bodyDone) return 0;
+    int total = 0;
+    uint8_t buf[1024];
+    for (;;) {
+        if (chunked && bodyLeft == 0) {
+            String line;
+            if (!readLine(line)) return HTTPC_ERROR_READ_TIMEOUT;
+            if (line.length() == 0 && !readLine(line)) return HTTPC_ERROR_READ_TIMEOUT;   // CRLF after a chunk
+            bodyLeft = strtol(line.c_str(), nullptr, 16);
+            if (bodyLeft == 0) {
+                while (readLine(line) && line.length() > 0) {}    // trailers
+                break;
+            }
+        }
+        if (!chunked && bodyLeft == 0) break;
+
+        size_t want = sizeof(buf);
+        if (bodyLeft > 0 && (size_t)bodyLeft < want) want = (size_t)bodyLeft;
+        int n = readSome(buf, want);
+        if (n < 0) return HTTPC_ERROR_READ_TIMEOUT;
+        if (n == 0) {
+            if (bodyLeft < 0) break;                    // sized by the close
+            return HTTPC_ERROR_CONNECTION_LOST;
+        }
+        if (to) to->write(buf, n);
+        if (into) into->concat((const char *)buf, n);
+        total += n;
+        if (bodyLeft > 0) bodyLeft -= n;
+    }
+    bodyDone = true;
+    return total;
+}
+
+String HTTPClient::getString() {
+    if (!bodyDone) {
+        String body;
+        if (readBody(nullptr, &body) >= 0) bodyCache = body;
+    }
+    return bodyCache;
+}
+
+int HTTPClient::writeToStream(Stream *stream) {
+    if (!stream) return HTTPC_ERROR_NO_STREAM;
+    if (!client.connected() && client.available() <= 0 && !bodyDone) return HTTPC_ERROR_NOT_CONNECTED;
+    return readBody(stream, nullptr);
+}
+
+String HTTPClient::errorToString(int error) {
+    switch (error) {
+        case HTTPC_ERROR_CONNECTION_REFUSED: return "connection refused";
+        case HTTPC_ERROR_SEND_HEADER_FAILED: return "send header failed";
+        case HTTPC_ERROR_NOT_CONNECTED: return "not connected";
+        case HTTPC_ERROR_CONNECTION_LOST: return "connection lost";
+        case HTTPC_ERROR_NO_STREAM: return "no stream";
+        case HTTPC_ERROR_READ_TIMEOUT: return "read Timeout";
+        default: return String();
+    }
+}
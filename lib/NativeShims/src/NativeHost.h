@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <string>
+
+// ============================================================
+// NATIVE HOST GLUE (shared by the shim sources, not the sketch)
+// ============================================================
+//
+// main() runs setup() once and then loop() forever.  Between loops it
+// sleeps in poll() on stdin and every open socket for up to
+// NATIVE_IDLE_WAIT_MS, so an idle server does not spin a core while
+// input still wakes it at once.
+
+#ifndef NATIVE_IDLE_WAIT_MS
+#define NATIVE_IDLE_WAIT_MS 1           // build with -D NATIVE_IDLE_WAIT_MS=0 to spin like the device
+#endif
+
+void nativeWatchFd(int fd);
+void nativeUnwatchFd(int fd);
+void nativeIdleWait(int timeoutMs);
+
+void nativeSaveArgs(int argc, char **argv);
+
+// Copy a directory tree (the filesystem seed); remove one (replay scratch)
+int nativeCopyTree(const std::string &from, const std::string &to);
+bool nativeRemoveTree(const std::string &path);
+
+// ------------------------------------------------------------
+// Replay (NativeReplay.cpp)
+// ------------------------------------------------------------
+// While a journal is replayed the clock is virtual: millis() and micros()
+// stand still within a pass and delay() moves them on instead of sleeping.
+
+extern bool nativeVirtualClock;
+extern uint64_t nativeClockUs;
+
+// A connection: a real socket, or a replayed one fed from the journal
+struct NativeSocket {
+    int fd;
+    int replaySlot = -1;            // player slot the journal gave it
+    std::string input;              // journaled lines not read yet
+    size_t inputPos = 0;
+    bool peerOpen = true;
+
+    explicit NativeSocket(int fd);
+    ~NativeSocket() { close(); }
+    void close();
+};
+
+int nativeReplayMain(int argc, char **argv);
+void nativeReplayFinish(const char *why);
+uint32_t nativeReplaySeed();
+void nativeSerialFeed(const std::string &text);
+void nativeReplayOutput(NativeSocket &sock, const uint8_t *buf, size_t size);
+
+class WiFiClient;
+WiFiClient nativeReplayAccept(uint16_t port);
@@ -0,0 +1,519 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include "NativeHost.h"
+#include "NativeReplay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <vector>
+#include <limits.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+
+// ============================================================
+// NATIVE REPLAY DRIVER
+// ============================================================
+//
+//     program --replay <journal> --fs <dir> [--transcript <file>] [--slowest <n>]
+//
+// Runs setup() and then one loop() per journaled pass (src/ReplayJournal.h)
+// against a scratch copy of <dir>, which should hold the filesystem as it
+// was when the recording booted (e.g. a backup taken before the reboot).
+// The clock, time(), random() and the players' connections all come from
+// the journal and nothing waits on real time, so a replay runs as fast as
+// the host allows and the same journal always gives the same run.
+//
+// Everything the players were sent goes to the transcript; diffing two
+// transcripts shows whether a change altered the game.  Each loop() is
+// timed on the host clock, and the report at the end (on stderr) gives the
+// spread and the slowest passes by their uptime in the recording.
+//
+// The scratch copy is MUD_FS_ROOT (default replay_fs).  It is deleted and
+// copied afresh on every run, so it must be one an earlier replay made.
+
+// Record tags, as written by src/ReplayJournal.h
+enum : uint8_t {
+    JR_PASS_MAX = 0x7F, JR_RUN = 0x80, JR_PASS, JR_ACCEPT, JR_LINE, JR_CLOSE,
+    JR_SERIAL, JR_READY, JR_NOW, JR_CUT, JR_END
+};
+
+void setup();
+void loop();
+
+static const uint8_t JOURNAL_VERSION = 1;
+static const size_t JOURNAL_HEADER_BYTES = 15;
+static const char SCRATCH_MARK[] = "/.replay_scratch";
+
+struct ReplayEvent {
+    uint8_t tag;
+    int slot;
+    std::string text;
+};
+
+struct ReplayPass {
+    uint64_t ms = 0;                // uptime in the recording
+    uint32_t nowOffset = 0;         // JR_NOW
+    int tickLimit = -1;             // JR_CUT
+    std::vector<ReplayEvent> events;
+};
+
+// ------------------------------------------------------------
+// Reading the journal
+// ------------------------------------------------------------
+
+class JournalReader {
+public:
+    uint32_t seed = 0;
+    uint16_t port = 0;
+    uint64_t startMs = 0;
+    bool ready = false;             // setup() finished in the recording
+    uint64_t readyMs = 0;
+    uint32_t readyWall = 0;
+    bool ended = false;             // JR_END seen
+    std::string error;
+
+    bool load(const char *path) {
+        FILE *f = fopen(path, "rb");
+        if (!f) {
+            error = std::string("cannot open ") + path;
+            return false;
+        }
+        uint8_t chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+        fclose(f);
+
+        if (data.size() < JOURNAL_HEADER_BYTES || memcmp(data.data(), "MUDJ", 4) != 0) {
+            error = "not a journal";
+            return false;
+        }
+        if (data[4] != JOURNAL_VERSION) {
+            error = "journal version " + std::to_string(data[4]) + " (this build reads " +
+                    std::to_string(JOURNAL_VERSION) + ")";
+            return false;
+        }
+        seed = le(5, 4);
+        port = (uint16_t)le(9, 2);
+        startMs = clockMs = le(11, 4);
+        pos = JOURNAL_HEADER_BYTES;
+
+        // Records ahead of the first pass belong to setup()
+        ReplayPass setupPass;
+        return readEvents(setupPass);
+    }
+
+    // The next pass and the events read in it; false at the end
+    bool next(ReplayPass &pass) {
+        pass.nowOffset = 0;
+        pass.tickLimit = -1;
+        pass.events.clear();
+
+        if (runLeft > 0) {
+            runLeft--;
+        } else {
+            if (ended || pos >= data.size()) return false;
+            uint8_t tag = data[pos++];
+            uint32_t dt = 0;
+            if (tag <= JR_PASS_MAX) {
+                dt = tag;
+            } else if (tag == JR_PASS) {
+                if (!varint(dt)) return false;
+            } else if (tag == JR_RUN) {
+                if (!varint(runLeft) || runLeft == 0) return fail("empty run");
+                runLeft--;
+                dt = 1;
+            } else if (tag == JR_END) {
+                ended = true;
+                return false;
+            } else {
+                return fail("record outside a pass");
+            }
+            clockMs += dt;
+            pass.ms = clockMs;
+            return runLeft > 0 || readEvents(pass);
+        }
+        clockMs += 1;
+        pass.ms = clockMs;
+        return runLeft > 0 || readEvents(pass);
+    }
+
+private:
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    uint64_t clockMs = 0;
+    uint32_t runLeft = 0;
+
+    uint32_t le(size_t at, int n) const {
+        uint32_t v = 0;
+        for (int i = 0; i < n; i++) v |= (uint32_t)data[at + i] << (8 * i);
+        return v;
+    }
+
+    bool fail(const char *what) {
+        if (error.empty()) error = std::string(what) + " at byte " + std::to_string(pos);
+        return false;
+    }
+
+    bool varint(uint32_t &v) {
+        v = 0;
+        for (int shift = 0; shift < 35; shift += 7) {
+            if (pos >= data.size()) return fail("journal cut off");
+            uint8_t b = data[pos++];
+            v |= (uint32_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return true;
+        }
+        return fail("bad number");
+    }
+
+    bool text(std::string &s) {
+        uint32_t len;
+        if (!varint(len)) return false;
+        if (len > data.size() - pos) return fail("journal cut off");
+        s.assign((const char *)data.data() + pos, len);
+        pos += len;
+        return true;
+    }
+
+    // Event records up to the next pass
+    bool readEvents(ReplayPass &pass) {
+        while (pos < data.size() && data[pos] > JR_PASS && data[pos] != JR_END) {
+            uint8_t tag = data[pos++];
+            uint32_t a = 0, b = 0;
+            ReplayEvent ev = {tag, -1, ""};
+            switch (tag) {
+            case JR_ACCEPT:
+            case JR_CLOSE:
+                if (!varint(a)) return false;
+                ev.slot = (int)a;
+                pass.events.push_back(ev);
+                break;
+            case JR_LINE:
+                if (!varint(a) || !text(ev.text)) return false;
+                ev.slot = (int)a;
+                pass.events.push_back(ev);
+                break;
+            case JR_SERIAL:
+                if (!text(ev.text)) return false;
+                pass.events.push_back(ev);
+                break;
+            case JR_READY:
+                if (!varint(a) || !varint(b)) return false;
+                ready = true;
+                readyMs = a;
+                readyWall = b;
+                break;
+            case JR_NOW:
+                if (!varint(pass.nowOffset)) return false;
+                break;
+            case JR_CUT:
+                if (!varint(a)) return false;
+                pass.tickLimit = (int)a;
+                break;
+            default:
+                return fail("unknown record");
+            }
+        }
+        if (pos < data.size() && data[pos] == JR_END) {
+            pos++;
+            ended = true;
+        }
+        return true;
+    }
+};
+
+// ------------------------------------------------------------
+// Driver state
+// ------------------------------------------------------------
+
+struct SlowPass {
+    uint64_t ms;
+    uint32_t us;
+    std::string what;
+};
+
+static struct {
+    bool active = false;
+    const char *journalPath = "";
+    JournalReader reader;
+    ReplayPass pass;
+    bool inPass = false;
+    std::deque<std::shared_ptr<NativeSocket>> accepts;     // this pass's new connections
+    std::map<int, std::shared_ptr<NativeSocket>> conns;     // by journaled slot
+
+    FILE *transcript = nullptr;
+    int transcriptSlot = -1;        // whose output the transcript is showing
+
+    uint64_t passes = 0, connections = 0, lines = 0, serialLines = 0;
+    uint64_t setupUs = 0;
+    std::vector<uint32_t> passUs;
+    std::vector<SlowPass> slowest;
+    size_t keepSlowest = 10;
+    std::chrono::steady_clock::time_point started;
+} replay;
+
+bool nativeReplaying() {
+    return replay.active;
+}
+
+uint32_t nativeReplaySeed() {
+    return replay.reader.seed;
+}
+
+static void advanceClockTo(uint64_t ms) {
+    nativeClockUs = std::max(nativeClockUs, ms * 1000);
+}
+
+void nativeReplayReady() {
+    if (replay.active && replay.reader.ready) advanceClockTo(replay.reader.readyMs);
+}
+
+void nativeReplayNow() {
+    if (replay.active && replay.inPass) advanceClockTo(replay.pass.ms + replay.pass.nowOffset);
+}
+
+int nativeReplayTickLimit() {
+    return replay.active && replay.inPass ? replay.pass.tickLimit : -1;
+}
+
+// time() follows the journal's clock, anchored where setup() finished
+extern "C" time_t time(time_t *out) noexcept {
+    time_t now;
+    if (replay.active && replay.reader.ready) {
+        int64_t ms = (int64_t)(nativeClockUs / 1000) - (int64_t)replay.reader.readyMs;
+        now = (time_t)replay.reader.readyWall + (time_t)(ms / 1000);
+    } else {
+        timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        now = ts.tv_sec;
+    }
+    if (out) *out = now;
+    return now;
+}
+
+WiFiClient nativeReplayAccept(uint16_t port) {
+    if (port != replay.reader.port || replay.accepts.empty()) return WiFiClient();
+    std::shared_ptr<NativeSocket> sock = replay.accepts.front();
+    replay.accepts.pop_front();
+    return WiFiClient(sock);
+}
+
+// ------------------------------------------------------------
+// Transcript
+// ------------------------------------------------------------
+
+static std::string uptime(uint64_t ms) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%02llu:%02llu:%02llu.%03llu",
+             (unsigned long long)(ms / 3600000), (unsigned long long)(ms / 60000 % 60),
+             (unsigned long long)(ms / 1000 % 60), (unsigned long long)(ms % 1000));
+    return buf;
+}
+
+static void transcriptNote(int slot, const char *what, const std::string &text = "") {
+    if (!replay.transcript) return;
+    fprintf(replay.transcript, "\n[%s slot %d %s]%s%s\n", uptime(millis()).c_str(), slot, what,
+            text.empty() ? "" : " ", text.c_str());
+    replay.transcriptSlot = -1;
+}
+
+void nativeReplayOutput(NativeSocket &sock, const uint8_t *buf, size_t size) {
+    if (!replay.transcript) return;
+    if (replay.transcriptSlot != sock.replaySlot) {
+        fprintf(replay.transcript, "\n[%s slot %d >]\n", uptime(millis()).c_str(), sock.replaySlot);
+        replay.transcriptSlot = sock.replaySlot;
+    }
+    fwrite(buf, 1, size, replay.transcript);
+}
+
+// ------------------------------------------------------------
+// Running the journal
+// ------------------------------------------------------------
+
+static void applyEvents(const ReplayPass &pass) {
+    for (const ReplayEvent &ev : pass.events) {
+        switch (ev.tag) {
+        case JR_ACCEPT: {
+            auto sock = std::make_shared<NativeSocket>(-1);
+            sock->replaySlot = ev.slot;
+            replay.conns[ev.slot] = sock;
+            replay.accepts.push_back(sock);
+            replay.connections++;
+            transcriptNote(ev.slot, "connects");
+            break;
+        }
+        case JR_LINE: {
+            auto it = replay.conns.find(ev.slot);
+            if (it == replay.conns.end()) break;
+            it->second->input += ev.text + "\n";
+            replay.lines++;
+            transcriptNote(ev.slot, "<", ev.text);
+            break;
+        }
+        case JR_CLOSE: {
+            auto it = replay.conns.find(ev.slot);
+            if (it == replay.conns.end()) break;
+            it->second->peerOpen = false;
+            replay.conns.erase(it);
+            transcriptNote(ev.slot, "hangs up");
+            break;
+        }
+        case JR_SERIAL:
+            nativeSerialFeed(ev.text + "\n");
+            replay.serialLines++;
+            break;
+        }
+    }
+}
+
+// What happened in a pass, for the slowest-pass list
+static std::string describe(const ReplayPass &pass) {
+    for (const ReplayEvent &ev : pass.events) {
+        if (ev.tag == JR_LINE) return "slot " + std::to_string(ev.slot) + ": " + ev.text;
+        if (ev.tag == JR_SERIAL) return "serial: " + ev.text;
+        if (ev.tag == JR_ACCEPT) return "slot " + std::to_string(ev.slot) + " connects";
+    }
+    return pass.tickLimit >= 0 ? "no input (tick budget cut)" : "no input";
+}
+
+static void recordPass(uint32_t us) {
+    replay.passUs.push_back(us);
+    auto &slow = replay.slowest;
+    if (slow.size() == replay.keepSlowest && (slow.empty() || us <= slow.back().us)) return;
+    SlowPass s = {replay.pass.ms, us, describe(replay.pass)};
+    slow.insert(std::upper_bound(slow.begin(), slow.end(), s,
+                                 [](const SlowPass &a, const SlowPass &b) { return a.us > b.us; }),
+                s);
+    if (slow.size() > replay.keepSlowest) slow.pop_back();
+}
+
+static uint32_t percentile(std::vector<uint32_t> &v, int pct) {
+    if (v.empty()) return 0;
+    size_t k = (v.size() - 1) * pct / 100;
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+void nativeReplayFinish(const char *why) {
+    double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - replay.started).count();
+    uint64_t playedMs = millis() - replay.reader.startMs;
+    if (replay.transcript) fclose(replay.transcript);
+    fflush(stdout);
+
+    fprintf(stderr, "[REPLAY] %s: seed %lu, port %u, %s of play\n", replay.journalPath,
+            (unsigned long)replay.reader.seed, replay.reader.port, uptime(playedMs).c_str());
+    fprintf(stderr, "[REPLAY] %llu passes, %llu connections, %llu lines, %llu serial commands\n",
+            (unsigned long long)replay.passes, (unsigned long long)replay.connections,
+            (unsigned long long)replay.lines, (unsigned long long)replay.serialLines);
+    fprintf(stderr, "[REPLAY] replayed in %.2f s (setup %.1f ms, %.0fx real time); stopped: %s\n", wallS,
+            replay.setupUs / 1000.0, wallS > 0 ? playedMs / 1000.0 / wallS : 0.0, why);
+    if (!replay.passUs.empty()) {
+        uint32_t maxUs = *std::max_element(replay.passUs.begin(), replay.passUs.end());
+        uint32_t p50 = percentile(replay.passUs, 50);
+        uint32_t p90 = percentile(replay.passUs, 90);
+        uint32_t p99 = percentile(replay.passUs, 99);
+        fprintf(stderr, "[REPLAY] loop() per pass: p50 %u us, p90 %u us, p99 %u us, max %u us\n",
+                p50, p90, p99, maxUs);
+        fprintf(stderr, "[REPLAY] slowest passes (uptime in the recording):\n");
+        for (const SlowPass &s : replay.slowest)
+            fprintf(stderr, "[REPLAY]   %s %8u us  %s\n", uptime(s.ms).c_str(), s.us, s.what.c_str());
+    }
+    if (!replay.reader.error.empty()) {
+        fprintf(stderr, "[REPLAY] journal error: %s\n", replay.reader.error.c_str());
+        exit(1);
+    }
+    exit(0);
+}
+
+static int usage(const char *program) {
+    fprintf(stderr, "usage: %s --replay <journal> --fs <dir> [--transcript <file>] [--slowest <n>]\n", program);
+    return 2;
+}
+
+// Fresh scratch copy of the recorded filesystem
+static bool prepareFilesystem(const std::string &from) {
+    const char *env = getenv("MUD_FS_ROOT");
+    std::string root = env && *env ? env : "replay_fs";
+    while (root.size() > 1 && root.back() == '/') root.pop_back();
+
+    char fromReal[PATH_MAX], rootReal[PATH_MAX];
+    if (!realpath(from.c_str(), fromReal)) {
+        fprintf(stderr, "[REPLAY] no filesystem at %s\n", from.c_str());
+        return false;
+    }
+    struct stat st;
+    if (stat(root.c_str(), &st) == 0) {
+        if (realpath(root.c_str(), rootReal) && !strcmp(fromReal, rootReal)) {
+            fprintf(stderr, "[REPLAY] --fs must not be the scratch directory %s\n", root.c_str());
+            return false;
+        }
+        if (stat((root + SCRATCH_MARK).c_str(), &st) != 0) {
+            fprintf(stderr, "[REPLAY] %s exists and was not made by a replay; set MUD_FS_ROOT\n", root.c_str());
+            return false;
+        }
+        nativeRemoveTree(root);
+    }
+    if (mkdir(root.c_str(), 0755) != 0) {
+        fprintf(stderr, "[REPLAY] cannot create %s\n", root.c_str());
+        return false;
+    }
+    FILE *mark = fopen((root + SCRATCH_MARK).c_str(), "w");
+    if (mark) fclose(mark);
+    nativeCopyTree(fromReal, root);
+    setenv("MUD_FS_ROOT", root.c_str(), 1);
+    return true;
+}
+
+int nativeReplayMain(int argc, char **argv) {
+    if (argc < 3) return usage(argv[0]);
+    replay.journalPath = argv[2];
+    const char *fsDir = nullptr;
+    const char *transcriptPath = nullptr;
+    for (int i = 3; i < argc; i++) {
+        if (!strcmp(argv[i], "--fs") && i + 1 < argc) fsDir = argv[++i];
+        else if (!strcmp(argv[i], "--transcript") && i + 1 < argc) transcriptPath = argv[++i];
+        else if (!strcmp(argv[i], "--slowest") && i + 1 < argc) replay.keepSlowest = (size_t)atoi(argv[++i]);
+        else return usage(argv[0]);
+    }
+    if (!fsDir) return usage(argv[0]);
+
+    if (!replay.reader.load(replay.journalPath)) {
+        fprintf(stderr, "[REPLAY] %s: %s\n", replay.journalPath, replay.reader.error.c_str());
+        return 1;
+    }
+    if (!prepareFilesystem(fsDir)) return 1;
+    if (transcriptPath && !(replay.transcript = fopen(transcriptPath, "w"))) {
+        fprintf(stderr, "[REPLAY] cannot write %s\n", transcriptPath);
+        return 1;
+    }
+
+    nativeSaveArgs(argc, argv);
+    replay.active = true;
+    nativeVirtualClock = true;
+    nativeClockUs = replay.reader.startMs * 1000;
+    replay.started = std::chrono::steady_clock::now();
+
+    setup();
+    replay.setupUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - replay.started).count();
+
+    while (replay.reader.next(replay.pass)) {
+        advanceClockTo(replay.pass.ms);
+        applyEvents(replay.pass);
+
+        replay.inPass = true;
+        auto t0 = std::chrono::steady_clock::now();
+        loop();
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+        replay.inPass = false;
+        replay.accepts.clear();
+        replay.passes++;
+        recordPass((uint32_t)us);
+    }
+    nativeReplayFinish(!replay.reader.error.empty() ? "journal error"
+                       : replay.reader.ended         ? "end of journal"
+                                                     : "journal cut off (recording still running?)");
+    return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+// ============================================================
+// NATIVE REPLAY HOOKS (called from src/ReplayJournal.h)
+// ============================================================
+//
+// The program replays a journal when started with --replay; see
+// NativeReplay.cpp.  Outside a replay these do nothing.
+
+bool nativeReplaying();
+void nativeReplayReady();           // setup() is done: jump to its recorded time
+void nativeReplayNow();             // loop() takes "now": jump to the recorded time
+int nativeReplayTickLimit();        // tick runs the recorded pass made, or -1
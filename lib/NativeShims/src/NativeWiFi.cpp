@@ -0,0 +1,265 @@
+#include <WiFi.h>
+#include "NativeHost.h"
+#include "NativeReplay.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+WiFiClass WiFi;
+
+// Non-blocking and not inherited by ESP.restart()'s exec
+static void prepareSocket(int fd) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// ============================================================
+// WiFiClient
+// ============================================================
+
+NativeSocket::NativeSocket(int fd) : fd(fd) {
+    if (fd >= 0) nativeWatchFd(fd);
+}
+
+void NativeSocket::close() {
+    peerOpen = false;
+    if (fd < 0) return;
+    nativeUnwatchFd(fd);
+    ::close(fd);
+    fd = -1;
+}
+
+// A connection the replay driver feeds from the journal
+static bool replayed(const std::shared_ptr<NativeSocket> &sock) {
+    return sock && sock->replaySlot >= 0;
+}
+
+WiFiClient::WiFiClient(int fd) : sock(std::make_shared<NativeSocket>(fd)) {}
+
+int WiFiClient::connect(const char *host, uint16_t port) {
+    return connect(host, port, 3000);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port, int32_t timeoutMs) {
+    stop();
+    if (nativeReplaying()) return 0;        // a replay has no network
+
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *res = nullptr;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || !res) return 0;
+
+    int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return 0;
+    }
+    prepareSocket(fd);
+
+    int rc = ::connect(fd, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (rc != 0 && errno == EINPROGRESS) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (poll(&pfd, 1, timeoutMs) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0)
+            rc = 0;
+    }
+    if (rc != 0) {
+        ::close(fd);
+        return 0;
+    }
+
+    sock = std::make_shared<NativeSocket>(fd);
+    return 1;
+}
+
+uint8_t WiFiClient::connected() {
+    if (replayed(sock)) return sock->peerOpen || sock->inputPos < sock->input.size();
+    if (!sock || sock->fd < 0) return 0;
+    char c;
+    ssize_t n = recv(sock->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n > 0) return 1;
+    if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        sock->close();              // peer went away
+        return 0;
+    }
+    return 1;
+}
+
+void WiFiClient::stop() {
+    sock.reset();
+}
+
+int WiFiClient::available() {
+    if (replayed(sock)) return (int)(sock->input.size() - sock->inputPos);
+    if (!sock || sock->fd < 0) return 0;
+    int n = 0;
+    return ioctl(sock->fd, FIONREAD, &n) == 0 ? n : 0;
+}
+
+int WiFiClient::read() {
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size) {
+    if (replayed(sock)) {
+        size_t n = std::min(size, sock->input.size() - sock->inputPos);
+        memcpy(buf, sock->input.data() + sock->inputPos, n);
+        sock->inputPos += n;
+        return n > 0 ? (int)n : -1;
+    }
+    if (!sock || sock->fd < 0) return -1;
+    ssize_t n = recv(sock->fd, buf, size, MSG_DONTWAIT);
+    return n > 0 ? (int)n : -1;
+}
+
+int WiFiClient::peek() {
+    if (replayed(sock)) return sock->inputPos < sock->input.size() ? (uint8_t)sock->input[sock->inputPos] : -1;
+    if (!sock || sock->fd < 0) return -1;
+    uint8_t c;
+    return recv(sock->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 1 ? c : -1;
+}
+
+size_t WiFiClient::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size) {
+    if (replayed(sock)) {
+        if (!sock->peerOpen) return 0;
+        nativeReplayOutput(*sock, buf, size);
+        return size;
+    }
+    if (!sock || sock->fd < 0) return 0;
+    size_t sent = 0;
+    unsigned long start = millis();
+    while (sent < size) {
+        ssize_t n = send(sock->fd, buf + sent, size - sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n > 0) {
+            sent += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            millis() - start < NATIVE_WRITE_TIMEOUT_MS) {
+            pollfd pfd = {sock->fd, POLLOUT, 0};
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        sock->close();              // reset, or the reader stopped reading
+        break;
+    }
+    return sent;
+}
+
+int WiFiClient::fd() const {
+    return sock ? sock->fd : -1;
+}
+
+IPAddress WiFiClient::remoteIP() const {
+    sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+    if (!sock || sock->fd < 0 || getpeername(sock->fd, (sockaddr *)&addr, &len) != 0) return IPAddress();
+    return IPAddress((uint32_t)addr.sin_addr.s_addr);
+}
+
+uint16_t WiFiClient::remotePort() const {
+    sockaddr_in addr = {};
+    socklen_t len = sizeof(addr);
+    if (!sock || sock->fd < 0 || getpeername(sock->fd, (sockaddr *)&addr, &len) != 0) return 0;
+    return ntohs(addr.sin_port);
+}
+
+int WiFiClient::setNoDelay(bool nodelay) {
+    if (!sock || sock->fd < 0) return -1;
+    int flag = nodelay ? 1 : 0;
+    return setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+// ============================================================
+// WiFiServer
+// ============================================================
+
+void WiFiServer::begin(uint16_t newPort) {
+    if (newPort) port = newPort;
+    end();
+    if (nativeReplaying()) return;          // connections come from the journal
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    prepareSocket(fd);
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, maxClients > 0 ? maxClients : 4) != 0) {
+        printf("[NATIVE] Cannot listen on port %u: %s\n", port, strerror(errno));
+        ::close(fd);
+        return;
+    }
+    listenFd = fd;
+    nativeWatchFd(listenFd);
+}
+
+void WiFiServer::end() {
+    if (listenFd < 0) return;
+    nativeUnwatchFd(listenFd);
+    ::close(listenFd);
+    listenFd = -1;
+}
+
+WiFiClient WiFiServer::accept() {
+    if (nativeReplaying()) return nativeReplayAccept(port);
+    if (listenFd < 0) return WiFiClient();
+    int fd = ::accept(listenFd, nullptr, nullptr);
+    if (fd < 0) return WiFiClient();
+    prepareSocket(fd);
+    WiFiClient client(fd);
+    if (noDelay) client.setNoDelay(true);
+    return client;
+}
+
+// ============================================================
+// Time
+// ============================================================
+
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *server1,
+                const char *server2, const char *server3) {
+    (void)gmtOffsetSec;
+    (void)daylightOffsetSec;
+    (void)server1;
+    (void)server2;
+    (void)server3;
+}
+
+bool getLocalTime(struct tm *info, uint32_t ms) {
+    (void)ms;
+    time_t now = time(nullptr);
+    localtime_r(&now, info);
+    return info->tm_year > (2016 - 1900);
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <Arduino.h>
+#include <memory>
+
+// ============================================================
+// NATIVE WIFI (BSD sockets)
+// ============================================================
+//
+// The radio is always up: WiFi.status() is WL_CONNECTED and localIP() is
+// the loopback address.  WiFiServer listens on a real TCP port on every
+// interface and WiFiClient wraps the accepted (or connected) socket, so
+// any telnet client can play against the host build.  During a --replay
+// no port is opened: the MUD port's connections are the journaled ones and
+// outbound connects fail.
+//
+// As in the ESP32 core, copies of a WiFiClient share one socket, which is
+// closed when the last copy is stopped or destroyed; reads never block,
+// and a write waits for room in the send buffer for up to
+// NATIVE_WRITE_TIMEOUT_MS before dropping the connection.
+
+#ifndef NATIVE_WRITE_TIMEOUT_MS
+#define NATIVE_WRITE_TIMEOUT_MS 5000    // build with -D NATIVE_WRITE_TIMEOUT_MS=... to change
+#endif
+
+struct NativeSocket;
+
+class Client : public Stream {
+public:
+    virtual int connect(const char *host, uint16_t port) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+};
+
+class WiFiClient : public Client {
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd);
+    explicit WiFiClient(std::shared_ptr<NativeSocket> sock) : sock(std::move(sock)) {}
+
+    int connect(const char *host, uint16_t port) override;
+    int connect(const char *host, uint16_t port, int32_t timeoutMs);
+    uint8_t connected() override;
+    void stop() override;
+
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size);
+    int peek() override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *buf, size_t size) override;
+    using Print::write;
+    void flush() override {}
+
+    int fd() const;
+    IPAddress remoteIP() const;
+    uint16_t remotePort() const;
+    int setNoDelay(bool nodelay);
+    int setTimeout(uint32_t seconds) { Stream::setTimeout(seconds * 1000); return 0; }
+
+    explicit operator bool() { return connected(); }
+    bool operator==(const WiFiClient &o) const { return sock == o.sock; }
+    bool operator!=(const WiFiClient &o) const { return sock != o.sock; }
+
+private:
+    std::shared_ptr<NativeSocket> sock;
+};
+
+class WiFiServer {
+public:
+    WiFiServer(uint16_t port = 80, uint8_t maxClients = 4) : port(port), maxClients(maxClients) {}
+    ~WiFiServer() { end(); }
+
+    void begin(uint16_t port = 0);
+    void end();
+    WiFiClient accept();             // a new connection, or an empty client
+    WiFiClient available() { return accept(); }
+    void setNoDelay(bool nodelay) { noDelay = nodelay; }
+    explicit operator bool() const { return listenFd >= 0; }
+
+private:
+    uint16_t port;
+    uint8_t maxClients;
+    int listenFd = -1;
+    bool noDelay = false;
+};
+
+typedef enum {
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL,
+    WL_SCAN_COMPLETED,
+    WL_CONNECTED,
+    WL_CONNECT_FAILED,
+    WL_CONNECTION_LOST,
+    WL_DISCONNECTED
+} wl_status_t;
+
+typedef enum { WIFI_OFF = 0, WIFI_STA, WIFI_AP, WIFI_AP_STA } wifi_mode_t;
+
+class WiFiClass {
+public:
+    bool mode(wifi_mode_t) { return true; }
+    wl_status_t begin(const char *ssid, const char *pass) { (void)ssid; (void)pass; return WL_CONNECTED; }
+    bool disconnect(bool wifiOff = false) { (void)wifiOff; return true; }
+    wl_status_t status() { return WL_CONNECTED; }
+    bool isConnected() { return true; }
+    IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+    int8_t RSSI() { return -40; }
+};
+
+extern WiFiClass WiFi;
+
+// The host clock is already set; these only read it
+void configTime(long gmtOffsetSec, int daylightOffsetSec, const char *server1,
+                const char *server2 = nullptr, const char *server3 = nullptr);
+bool getLocalTime(struct tm *info, uint32_t ms = 5000);
@@ -5,22 +5,36 @@
  * Retrieves unread emails from the Post Office POP3 mailbox
  * and marks them as read for the next sync.
  * 
- * Called by ESP32 MUD when a player enters the Post Office
+ * Polled by the ESP32 MUD every couple of minutes; letters are filed into
+ * per-player mailboxes on the device.
  * 
  * Query parameters:
  *   player=<playername> (optional, for logging)
+ *   since=<messageId>   (optional) last message the device has filed.  That
+ *                       message and every Post Office reply before it are
+ *                       deleted, and only newer messages are returned.
  * 
- * Returns JSON array of email objects:
- * [
- *   {
- *     "to": "recipient@example.com",
- *     "from": "sender@example.com",
- *     "subject": "...",
- *     "body": "...",
- *     "messageId": "unique ID for tracking"
- *   },
- *   ...
- * ]
+ * Request headers:
+ *   If-None-Match: <etag>  answered with 304 (no body) when nothing changed
+ * 
+ * Returns JSON:
+ * {
+ *   "success": true,
+ *   "emails": [
+ *     {
+ *       "to": "recipient@example.com",
+ *       "from": "sender@example.com",
+ *       "subject": "...",
+ *       "body": "...",
+ *       "recipient": "playername found in the body (may be empty)",
+ *       "displayName": "...",
+ *       "messageId": "POP3 UIDL - stable across polls"
+ *     },
+ *     ...
+ *   ],
+ *   "count": N,
+ *   "errors": []
+ * }
  */
 
 // POP3 Configuration
@@ -88,29 +102,76 @@ try {
         throw new Exception("STAT command failed: $response");
     }
     
-    // Retrieve each unread message
+    // Unique ids let the device's cursor survive across sessions
+    $uids = [];
+    fputs($socket, "UIDL\r\n");
+    $response = fgets($socket);
+    if (strpos($response, '+OK') !== false) {
+        while (true) {
+            $line = fgets($socket);
+            if ($line === false || $line === ".\r\n" || $line === ".\n") {
+                break;
+            }
+            $parts = preg_split('/\s+/', trim($line));
+            if (count($parts) >= 2) {
+                $uids[(int)$parts[0]] = $parts[1];
+            }
+        }
+    }
+    
+    // Acknowledge: the device has filed everything up to and including $since
+    $since = isset($_GET['since']) ? $_GET['since'] : '';
+    $cursor = 0;
+    if ($since !== '') {
+        $found = array_search($since, $uids, true);
+        if ($found !== false) {
+            $cursor = $found;
+        }
+    }
+    $deleted = [];
+    for ($msg_num = 1; $msg_num <= $cursor; $msg_num++) {
+        $headers = readMessageLines($socket, "TOP $msg_num 0");
+        $email = $headers === null ? null : parseEmail($headers);
+        if ($email && isPostOfficeReply($email)) {
+            error_log("[POP3] Message $msg_num acknowledged by device, deleting");
+            fputs($socket, "DELE $msg_num\r\n");
+            $response = fgets($socket);
+            if (strpos($response, '+OK') === false) {
+                error_log("[POP3] Warning: Could not mark message $msg_num as deleted");
+            } else {
+                $deleted[$msg_num] = true;
+            }
+        }
+    }
+    
+    // Nothing changed in the mailbox since the device's last full response?
+    $remaining = [];
     for ($msg_num = 1; $msg_num <= $message_count; $msg_num++) {
+        if (!isset($deleted[$msg_num])) {
+            $remaining[] = isset($uids[$msg_num]) ? $uids[$msg_num] : "n$msg_num";
+        }
+    }
+    $etag = '"' . md5(implode(',', $remaining)) . '"';
+    header("ETag: $etag");
+    if (isset($_SERVER['HTTP_IF_NONE_MATCH']) && trim($_SERVER['HTTP_IF_NONE_MATCH']) === $etag) {
+        error_log("[POP3] No change since last poll");
+        fputs($socket, "QUIT\r\n");
+        fclose($socket);
+        http_response_code(304);
+        exit;
+    }
+    
+    // Retrieve each message after the cursor (deleted once the device acknowledges it)
+    for ($msg_num = $cursor + 1; $msg_num <= $message_count; $msg_num++) {
         error_log("[POP3] Retrieving message $msg_num");
         
         // RETR command retrieves the full message
-        fputs($socket, "RETR $msg_num\r\n");
-        $response = fgets($socket);
-        if (strpos($response, '+OK') === false) {
+        $message_lines = readMessageLines($socket, "RETR $msg_num");
+        if ($message_lines === null) {
             error_log("[POP3] Failed to retrieve message $msg_num");
             continue;
         }
         
-        // Read message body (lines until a line with just ".")
-        $message_lines = [];
-        while (true) {
-            $line = fgets($socket);
-            if ($line === false || $line === ".\r\n" || $line === ".\n") {
-                break;
-            }
-            // Remove the trailing \r\n
-            $message_lines[] = rtrim($line, "\r\n");
-        }
-        
         // Parse email headers and body
         $email = parseEmail($message_lines);
         
@@ -121,17 +182,9 @@ try {
                 continue;
             }
             
-            // FILTER: Only accept emails TO the Post Office address (replies to our outgoing mail)
-            // This ensures we only get emails that are replies TO esperthertu_post_office@storyboardacs.com
-            if (stripos($email['to'], 'esperthertu_post_office') === false) {
-                error_log("[POP3] Email not addressed to Post Office. To: " . $email['to'] . " - leaving untouched");
-                continue;
-            }
-            
-            // FILTER: Only accept emails NOT from the post office itself
-            // We only want player REPLIES, not our outgoing system emails
-            if (stripos($email['from'], 'esperthertu_post_office') !== false) {
-                error_log("[POP3] Skipping system email from: " . $email['from'] . " - leaving untouched");
+            // FILTER: Only player replies TO the Post Office, not our own outgoing mail
+            if (!isPostOfficeReply($email)) {
+                error_log("[POP3] Not a reply to the Post Office. From: " . $email['from'] . " To: " . $email['to'] . " - leaving untouched");
                 continue;
             }
             
@@ -155,16 +208,8 @@ try {
             
             // Store this email with display name
             $email['displayName'] = $displayName;
-            $email['messageId'] = "$msg_num-" . time();
+            $email['messageId'] = isset($uids[$msg_num]) ? $uids[$msg_num] : "$msg_num-" . time();
             $emails[] = $email;
-            
-            // Mark as deleted ONLY if we successfully processed it
-            error_log("[POP3] Marking message $msg_num as deleted");
-            fputs($socket, "DELE $msg_num\r\n");
-            $response = fgets($socket);
-            if (strpos($response, '+OK') === false) {
-                error_log("[POP3] Warning: Could not mark message $msg_num as deleted");
-            }
         }
     }
     
@@ -313,6 +358,37 @@ function parseEmail($lines) {
     return $email;
 }
 
+/**
+ * Send RETR/TOP and collect the multi-line answer (null on -ERR)
+ */
+function readMessageLines($socket, $command) {
+    fputs($socket, "$command\r\n");
+    $response = fgets($socket);
+    if ($response === false || strpos($response, '+OK') === false) {
+        return null;
+    }
+    
+    // Read message (lines until a line with just ".")
+    $lines = [];
+    while (true) {
+        $line = fgets($socket);
+        if ($line === false || $line === ".\r\n" || $line === ".\n") {
+            break;
+        }
+        // Remove the trailing \r\n
+        $lines[] = rtrim($line, "\r\n");
+    }
+    return $lines;
+}
+
+/**
+ * Only player replies TO the Post Office address, not our own outgoing mail
+ */
+function isPostOfficeReply($email) {
+    return stripos($email['to'], 'esperthertu_post_office') !== false &&
+           stripos($email['from'], 'esperthertu_post_office') === false;
+}
+
 /**
  * Check if an email has already been read
  * (For now, we'll assume all retrieved emails are unread)
@@ -0,0 +1,128 @@
+#!/usr/bin/env python
+# Local stand-in for retrieveESP32mail.php
+#
+# Serves the same JSON, ETag / If-None-Match and since=<messageId> cursor
+# semantics from an in-memory mailbox, so the device's background mail poll
+# can be exercised without the real POP3 account.
+#
+#   python scripts/mail_standin.py [port]
+#
+# Build the firmware against it with
+#   build_flags = ... -D MAIL_POLL_URL=\"http://<pc-ip>:8090/retrieveESP32mail.php\"
+#
+# Queue a reply (recipient is found in the body, as in the real endpoint):
+#   curl -d "player=bob&from=friend@example.com&text=Hello there" http://localhost:8090/inject
+# Inspect the mailbox:
+#   curl http://localhost:8090/mailbox
+
+import hashlib
+import json
+import re
+import sys
+import threading
+from http.server import BaseHTTPRequestHandler, HTTPServer
+from urllib.parse import parse_qs, urlparse
+
+POST_OFFICE = "esperthertu_post_office@storyboardacs.com"
+
+lock = threading.Lock()
+mailbox = []        # list of dicts, oldest first (POP3 message order)
+next_uid = 1
+
+
+def make_message(player, sender, text, subject):
+    global next_uid
+    uid = "standin%06d" % next_uid
+    next_uid += 1
+    quoted = "A message from %s - The Adventurer:" % player.capitalize() if player else ""
+    body = "A letter from %s.\n\nIt reads,\n\n%s\n\n%s" % (sender, text, quoted)
+    match = re.search(r"a message from\s+(\w+)", body, re.I)
+    return {
+        "uid": uid,
+        "to": POST_OFFICE,
+        "from": sender,
+        "subject": subject,
+        "body": body,
+        "recipient": match.group(1) if match else "",
+    }
+
+
+def display_name(msg):
+    if msg["recipient"]:
+        return msg["recipient"]
+    return msg["from"].split("@")[0]
+
+
+class Handler(BaseHTTPRequestHandler):
+    def send_json(self, code, payload, etag=None):
+        data = json.dumps(payload).encode("utf-8")
+        self.send_response(code)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(data)))
+        if etag:
+            self.send_header("ETag", etag)
+        self.end_headers()
+        self.wfile.write(data)
+
+    def do_GET(self):
+        url = urlparse(self.path)
+        query = parse_qs(url.query)
+
+        if url.path == "/mailbox":
+            with lock:
+                self.send_json(200, mailbox)
+            return
+
+        if not url.path.endswith("retrieveESP32mail.php"):
+            self.send_json(404, {"error": "not found"})
+            return
+
+        since = query.get("since", [""])[0]
+        with lock:
+            # Acknowledge everything up to and including the cursor
+            uids = [m["uid"] for m in mailbox]
+            if since in uids:
+                acked = uids.index(since) + 1
+                print("[STANDIN] since=%s acknowledges %d message(s)" % (since, acked))
+                del mailbox[:acked]
+
+            etag = '"%s"' % hashlib.md5(",".join(m["uid"] for m in mailbox).encode()).hexdigest()
+            if self.headers.get("If-None-Match", "").strip() == etag:
+                self.send_response(304)
+                self.send_header("ETag", etag)
+                self.end_headers()
+                return
+
+            emails = [{
+                "to": m["to"],
+                "from": m["from"],
+                "subject": m["subject"],
+                "body": m["body"],
+                "recipient": m["recipient"],
+                "displayName": display_name(m),
+                "messageId": m["uid"],
+            } for m in mailbox]
+
+        self.send_json(200, {"success": True, "emails": emails, "count": len(emails), "errors": []}, etag)
+
+    def do_POST(self):
+        url = urlparse(self.path)
+        if url.path != "/inject":
+            self.send_json(404, {"error": "not found"})
+            return
+        length = int(self.headers.get("Content-Length", "0"))
+        form = parse_qs(self.rfile.read(length).decode("utf-8"))
+        msg = make_message(form.get("player", [""])[0],
+                           form.get("from", ["someone@example.com"])[0],
+                           form.get("text", ["Hello from the real world!"])[0],
+                           form.get("subject", ["Re: Esperthertu Post Office Delivery!"])[0])
+        with lock:
+            mailbox.append(msg)
+        print("[STANDIN] Queued %s for '%s'" % (msg["uid"], msg["recipient"]))
+        self.send_json(200, {"queued": msg["uid"]})
+
+
+if __name__ == "__main__":
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 8090
+    print("[STANDIN] Mail stand-in listening on port %d" % port)
+    HTTPServer(("", port), Handler).serve_forever()
@@ -0,0 +1,39 @@
+#!/usr/bin/env python
+# Build manifest.crc for a YMODEM batch upload
+#
+# The device stages every file of a batch as <name>.part and only swaps the
+# set in once the batch has finished.  When manifest.crc is sent in the same
+# batch, each listed file must also match its size and CRC32 or nothing is
+# installed.
+#
+#   python scripts/make_upload_manifest.py data/rooms.txt data/items.vxd
+#
+# writes manifest.crc next to the first file; send it along with the files.
+
+import os
+import sys
+import zlib
+
+
+def crc32_of(path):
+    crc = 0
+    with open(path, "rb") as f:
+        for chunk in iter(lambda: f.read(65536), b""):
+            crc = zlib.crc32(chunk, crc)
+    return crc & 0xFFFFFFFF
+
+
+if __name__ == "__main__":
+    files = sys.argv[1:]
+    if not files:
+        print("usage: make_upload_manifest.py <file> [file ...]")
+        sys.exit(1)
+
+    lines = ["# name size crc32"]
+    for path in files:
+        lines.append("%s %d %08x" % (os.path.basename(path), os.path.getsize(path), crc32_of(path)))
+
+    out = os.path.join(os.path.dirname(files[0]), "manifest.crc")
+    with open(out, "w", newline="\n") as f:
+        f.write("\n".join(lines) + "\n")
+    print("Wrote %s (%d file(s))" % (out, len(files)))
@@ -0,0 +1,375 @@
+#!/usr/bin/env python
+# Multi-client load generator and latency benchmark for the MUD
+#
+# Opens N telnet sessions against a running server (the board, or the
+# native build on a PC), logs each one in as its own character, then
+# replays a weighted command mix for a while and reports throughput and
+# round-trip latency per command.
+#
+#   python scripts/mud_loadtest.py 192.168.1.42 4000 --clients 10 --duration 60
+#   python scripts/mud_loadtest.py localhost 4000 --mix social --think 100
+#   python scripts/mud_loadtest.py localhost 4000 --mix-file chess.json
+#   python scripts/mud_loadtest.py localhost 4000 --fail-p99 250   # exit 1 if slower
+#
+# Characters are named Loadbota, Loadbotb, ... and created on first use
+# (password "loadtest1"), so later runs log straight in.
+#
+# A round trip is the time from sending a line to the "> " prompt the
+# server prints after running it.  Unsolicited output (combat rounds,
+# other players talking) is read and counted but not timed.
+#
+# A mix is a list of [weight, [command, ...]] entries; each pick runs its
+# commands in order, so "play 2", "e2e4", "resign" stay together.  In
+# commands, {exit} is one of the room's obvious exits, {npc} the last word
+# of something "is here.", {item} the last word of an item lying in the
+# room and {player} another bot's name.  A pick whose placeholder has
+# nothing to fill it is skipped.  --mix-file takes the same list as JSON.
+
+import argparse
+import json
+import random
+import re
+import socket
+import sys
+import threading
+import time
+
+PASSWORD = "loadtest1"
+PROMPT = b"> "
+
+MIXES = {
+    # Everything at once, roughly what a busy evening looks like
+    "standard": [
+        [30, ["{exit}"]],
+        [15, ["look"]],
+        [6, ["inventory"]],
+        [4, ["score"]],
+        [4, ["who"]],
+        [5, ["get {item}"]],
+        [4, ["get all", "drop all"]],
+        [6, ["kill {npc}"]],
+        [6, ["say hello everyone"]],
+        [3, ["tell {player} hi there"]],
+        [2, ["shout anyone around?"]],
+        [3, ["map"]],
+        [2, ["weather"]],
+        [2, ["play 2", "e2e4", "board", "resign"]],
+    ],
+    "explore": [
+        [60, ["{exit}"]],
+        [25, ["look"]],
+        [10, ["map"]],
+        [5, ["where"]],
+    ],
+    "social": [
+        [40, ["say {word} {word}"]],
+        [20, ["tell {player} {word}"]],
+        [10, ["shout {word}"]],
+        [20, ["who"]],
+        [10, ["look"]],
+    ],
+    "items": [
+        [30, ["get {item}"]],
+        [20, ["get all", "drop all"]],
+        [25, ["inventory"]],
+        [15, ["look"]],
+        [10, ["{exit}"]],
+    ],
+    "combat": [
+        [50, ["kill {npc}"]],
+        [20, ["look"]],
+        [20, ["{exit}"]],
+        [10, ["score"]],
+    ],
+    "chess": [
+        [60, ["play 2", "e2e4", "d2d4", "board", "resign"]],
+        [40, ["look"]],
+    ],
+}
+
+WORDS = ["hello", "anyone", "seen", "the", "dragon", "gold", "tavern", "north", "quest", "help"]
+
+IAC = 255
+
+
+def bot_name(i, prefix):
+    # Names are letters only
+    suffix = ""
+    i += 1
+    while i > 0:
+        i, r = divmod(i - 1, 26)
+        suffix = chr(ord("a") + r) + suffix
+    return prefix + suffix
+
+
+def strip_telnet(data):
+    # Drop IAC option negotiation (three bytes each)
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        if data[i] == IAC:
+            i += 3
+            continue
+        out.append(data[i])
+        i += 1
+    return bytes(out)
+
+
+def percentile(sorted_vals, pct):
+    if not sorted_vals:
+        return 0.0
+    k = max(0, min(len(sorted_vals) - 1, int(round(pct / 100.0 * len(sorted_vals) + 0.5)) - 1))
+    return sorted_vals[k]
+
+
+class Stats:
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.samples = {}       # verb -> [ms, ...]
+        self.timeouts = {}      # verb -> count
+        self.logins = []
+        self.failed = []        # (bot, reason)
+        self.bytes_in = 0
+
+    def add(self, verb, ms):
+        with self.lock:
+            self.samples.setdefault(verb, []).append(ms)
+
+    def timeout(self, verb):
+        with self.lock:
+            self.timeouts[verb] = self.timeouts.get(verb, 0) + 1
+
+    def fail(self, bot, reason):
+        with self.lock:
+            self.failed.append((bot, reason))
+
+
+class Bot(threading.Thread):
+    def __init__(self, index, args, mix, stats, others, stop_at):
+        threading.Thread.__init__(self, daemon=True)
+        self.name_ = bot_name(index, args.prefix)
+        self.args = args
+        self.mix = mix
+        self.total_weight = sum(w for w, _ in mix)
+        self.stats = stats
+        self.others = others
+        self.stop_at = stop_at
+        self.rng = random.Random(args.seed * 1000 + index)
+        self.sock = None
+        self.buf = b""
+        self.room = ""
+
+    # ---- socket helpers ----
+
+    def read_until(self, marker, timeout):
+        # Read until marker ends a line or starts the output; returns the
+        # text up to it (the rest stays buffered), or None on timeout
+        deadline = time.time() + timeout
+        while True:
+            text = strip_telnet(self.buf)
+            at = 0 if text.startswith(marker) else text.find(b"\n" + marker)
+            if at >= 0:
+                end = text.index(marker, at) + len(marker)
+                self.buf = text[end:]
+                return text[:end].decode("utf-8", "replace")
+            left = deadline - time.time()
+            if left <= 0:
+                return None
+            self.sock.settimeout(left)
+            try:
+                chunk = self.sock.recv(65536)
+            except socket.timeout:
+                return None
+            if not chunk:
+                raise ConnectionError("server closed the connection")
+            with self.stats.lock:
+                self.stats.bytes_in += len(chunk)
+            self.buf += chunk
+
+    def drain(self):
+        # Take unsolicited output (combat, chat) before sending the next line
+        self.sock.setblocking(False)
+        try:
+            while True:
+                chunk = self.sock.recv(65536)
+                if not chunk:
+                    raise ConnectionError("server closed the connection")
+                with self.stats.lock:
+                    self.stats.bytes_in += len(chunk)
+        except BlockingIOError:
+            pass
+        finally:
+            self.sock.setblocking(True)
+        self.buf = b""
+
+    def send(self, line):
+        self.sock.sendall(line.encode("utf-8") + b"\r\n")
+
+    # ---- session ----
+
+    def login(self):
+        # Every answer during login is followed by the prompt, like commands
+        started = time.time()
+        self.sock = socket.create_connection((self.args.host, self.args.port), timeout=10)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        try:
+            greeted = self.read_until(b"Enter your name:", 15) is not None
+        except ConnectionError:
+            greeted = False
+        if not greeted:
+            raise ConnectionError("no name prompt (every slot taken?)")
+
+        self.send(self.name_)
+        reply = self.read_until(PROMPT, 10)
+        if reply is None or "password" not in reply:
+            raise ConnectionError("name refused: %r" % (reply or "")[-80:])
+        self.send(PASSWORD)
+
+        text = self.read_until(PROMPT, 10)
+        if text is not None and "Choose your race" in text:
+            self.send("0")
+            text = self.read_until(PROMPT, 10)
+        if text is None or "Obvious exits:" not in text:
+            raise ConnectionError("login refused")
+        self.room = text
+        with self.stats.lock:
+            self.stats.logins.append((time.time() - started) * 1000.0)
+
+    def fill(self, command):
+        def exits():
+            m = re.search(r"Obvious exits: *(.*)", self.room)
+            return [e.strip() for e in m.group(1).split(",") if e.strip() and e.strip() != "none"] if m else []
+
+        def here(pattern):
+            return [m.group(1).lower() for m in re.finditer(pattern, self.room, re.M)]
+
+        choices = {
+            "{exit}": exits,
+            "{npc}": lambda: [n for n in here(r"^.*?(\w+) is here\.\s*$") if n not in self.others],
+            "{item}": lambda: here(r"^(?:A|An|The) (?:[\w' -]*? )?(\w+)\.\s*$"),
+            "{player}": lambda: [o for o in self.others if o != self.name_.lower()],
+            "{word}": lambda: WORDS,
+        }
+        for key, options in choices.items():
+            while key in command:
+                opts = options()
+                if not opts:
+                    return None
+                command = command.replace(key, self.rng.choice(opts), 1)
+        return command
+
+    def pick(self):
+        r = self.rng.uniform(0, self.total_weight)
+        for weight, commands in self.mix:
+            r -= weight
+            if r <= 0:
+                return commands
+        return self.mix[-1][1]
+
+    def run_command(self, command):
+        verb = command.split()[0].lower() if command.strip() else "(empty)"
+        self.drain()
+        started = time.time()
+        self.send(command)
+        text = self.read_until(PROMPT, self.args.timeout)
+        if text is None:
+            self.stats.timeout(verb)
+            return
+        self.stats.add(verb, (time.time() - started) * 1000.0)
+        if "Obvious exits:" in text:
+            self.room = text
+
+    def run(self):
+        try:
+            self.login()
+            while time.time() < self.stop_at:
+                for template in self.pick():
+                    command = self.fill(template)
+                    if command is None:
+                        break
+                    self.run_command(command)
+                think = self.args.think / 1000.0
+                time.sleep(self.rng.uniform(0.5 * think, 1.5 * think))
+            self.send("quit")
+        except (ConnectionError, OSError) as e:
+            self.stats.fail(self.name_, str(e))
+        finally:
+            if self.sock:
+                self.sock.close()
+
+
+def report(stats, elapsed, args):
+    total = sum(len(v) for v in stats.samples.values())
+    print()
+    print("=== LOAD TEST %s:%d  %d clients  %.0f s ===" % (args.host, args.port, args.clients, elapsed))
+    logins = sorted(stats.logins)
+    print("logins: %d ok, %d failed   login p50 %.1f ms  max %.1f ms" %
+          (len(logins), len(stats.failed), percentile(logins, 50), logins[-1] if logins else 0))
+    print("commands: %d  (%.1f/s)   bytes in: %d  (%.1f KB/s)" %
+          (total, total / elapsed if elapsed else 0, stats.bytes_in, stats.bytes_in / 1024.0 / elapsed if elapsed else 0))
+    print()
+    print("%-12s %7s %8s %8s %8s %8s %8s %8s" % ("command", "count", "timeout", "avg", "p50", "p90", "p99", "max"))
+
+    everything = []
+    for verb in sorted(stats.samples, key=lambda v: -len(stats.samples[v])):
+        vals = sorted(stats.samples[verb])
+        everything.extend(vals)
+        print("%-12s %7d %8d %8.1f %8.1f %8.1f %8.1f %8.1f" % (
+            verb[:12], len(vals), stats.timeouts.get(verb, 0), sum(vals) / len(vals),
+            percentile(vals, 50), percentile(vals, 90), percentile(vals, 99), vals[-1]))
+    for verb in stats.timeouts:
+        if verb not in stats.samples:
+            print("%-12s %7d %8d" % (verb[:12], 0, stats.timeouts[verb]))
+
+    everything.sort()
+    p99 = percentile(everything, 99)
+    if everything:
+        print("%-12s %7d %8d %8.1f %8.1f %8.1f %8.1f %8.1f" % (
+            "(all)", len(everything), sum(stats.timeouts.values()), sum(everything) / len(everything),
+            percentile(everything, 50), percentile(everything, 90), p99, everything[-1]))
+    print("(milliseconds, send to prompt)")
+
+    for bot, reason in stats.failed:
+        print("[FAIL] %s: %s" % (bot, reason))
+    return p99
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="MUD load generator")
+    parser.add_argument("host")
+    parser.add_argument("port", type=int, nargs="?", default=4000)
+    parser.add_argument("--clients", type=int, default=10, help="concurrent sessions (default 10; the server has as many as \"debug slots\" shows)")
+    parser.add_argument("--duration", type=float, default=60, help="seconds of traffic after login")
+    parser.add_argument("--think", type=float, default=250, help="mean pause between picks, ms")
+    parser.add_argument("--ramp", type=float, default=0.2, help="seconds between connects")
+    parser.add_argument("--timeout", type=float, default=10, help="seconds to wait for a prompt")
+    parser.add_argument("--mix", default="standard", choices=sorted(MIXES))
+    parser.add_argument("--mix-file", help="JSON list of [weight, [command, ...]]")
+    parser.add_argument("--prefix", default="Loadbot", help="character name prefix (letters only)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--fail-p99", type=float, help="exit 1 when the overall p99 is above this many ms")
+    args = parser.parse_args()
+
+    mix = MIXES[args.mix]
+    if args.mix_file:
+        with open(args.mix_file) as f:
+            mix = json.load(f)
+
+    stats = Stats()
+    names = [bot_name(i, args.prefix).lower() for i in range(args.clients)]
+    started = time.time()
+    stop_at = started + args.ramp * args.clients + args.duration
+    bots = []
+    for i in range(args.clients):
+        bot = Bot(i, args, mix, stats, names, stop_at)
+        bot.start()
+        bots.append(bot)
+        time.sleep(args.ramp)
+    for bot in bots:
+        bot.join()
+    elapsed = time.time() - started
+
+    p99 = report(stats, elapsed, args)
+    if args.fail_p99 is not None and p99 > args.fail_p99:
+        print("[FAIL] p99 %.1f ms is above %.1f ms" % (p99, args.fail_p99))
+        sys.exit(1)
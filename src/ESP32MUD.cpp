@@ -10,6 +10,11 @@
 #include <qrcode.h>
 #include <ESP_Mail_Client.h>
 #include "YmodemBootloader.h"
+#include "MultipartStream.h"
+#include "HttpJobQueue.h"
+#include "TickScheduler.h"
+#include "LatencyHistogram.h"
+#include "ReplayJournal.h"
 #include "version.h"  // Auto-generated at build time  VERSION INFO Auto generated version Number
 #include "chess_game.h"
 #include <mcu-max.h>  // Strong chess engine library
@@ -47,10 +52,14 @@ int base64_decode(uint8_t *output, int outlen, const char *input) {
 
 
 
-#define MAX_PLAYERS    10
+#ifndef MAX_PLAYERS
+#define MAX_PLAYERS    32             // session slots at most; how many are allocated depends on the heap at boot
+#endif
 #define MAX_INVENTORY 32
 #define MAX_WEIGHT 10
-#define MAX_NPCS       50
+#ifndef MAX_NPCS
+#define MAX_NPCS       50             // NPC pool slots (instances + clones); build with -D MAX_NPCS=n to change
+#endif
 #define NPC_RESPAWN_SECONDS 600
 #define MAX_OUTPUT_WIDTH 80   // Word wrap for descriptions and long text (MUD convention)
 #define MAX_QRCODE_WIDTH 100  // QR code display width for better reliability with longer messages
@@ -175,10 +184,11 @@ struct WeatherData {
 struct WeatherRequest {
     bool pending;             // Is a request in progress?
     bool isForecast;          // true for forecast, false for current
-    String query;             // City name or empty for local
+    String query;             // Cache key: "c:"/"f:" + normalised city
     bool isLocalQuery;        // true if no location specified (will show as Esperthertu)
     unsigned long startTime;  // When request started (for timeout)
     String ipAddress;         // Player's IP for local lookup
+    uint32_t jobId;           // Latest HTTP job for this request (0 = not yet submitted)
 };
 
 // High-Low card game structures
@@ -193,8 +203,7 @@ struct HighLowSession {
     Card card1, card2, card3;    // current hand
     int card1Value, card2Value;  // may differ from card.value if Ace is involved
     bool gameActive;             // true if player is actively playing
-    bool awaitingAceDeclaration; // waiting for player to declare Ace high/low
-    bool awaitingContinue;       // waiting for player to press Enter or type 'end'
+    bool awaitingAceDeclaration; // waiting for player to declare Ace high/low (no betting meanwhile)
     bool betWasPot;              // true if player bet the entire pot
     int gameRoomX, gameRoomY, gameRoomZ;  // track which room the game started in
 };
@@ -222,6 +231,7 @@ struct Letter {
     String body;             // email body text
     String messageId;        // unique ID for tracking
     String displayName;      // display name (playername if found, or sender email part)
+    String recipient;        // playername the server found in the body (may be empty)
 };
 
 bool warned5min  = false;
@@ -231,9 +241,6 @@ bool warned30sec = false;
 bool warned5sec  = false;
 
 
-
-unsigned long lastShopRestock = 0;
-
 // Global shops vector
 std::vector<Shop> shops;
 
@@ -243,35 +250,180 @@ std::vector<Tavern> taverns;
 // Global post office vector
 std::vector<PostOffice> postOffices;
 
+// =============================
+// MAIL POLL + LOCAL MAILBOXES
+// =============================
+// The post office inbox is polled in the background (conditional GET with
+// the last ETag, plus a last-id cursor that also acknowledges what we have
+// stored so the server can delete it).  Letters are filed into per-player
+// mailbox files in LittleFS; letters whose recipient isn't a known player
+// go to the unclaimed box and are handed to whoever checks mail next.
+// mailIndex counts waiting letters per box so entering a post office
+// never touches flash (or the network) when there is nothing to deliver.
+#ifndef MAIL_POLL_URL
+#define MAIL_POLL_URL "https://www.storyboardacs.com/retrieveESP32mail.php"
+#endif
+#define MAIL_CURSOR_PATH "/mailpoll.txt"
+#define MAIL_UNCLAIMED "_unclaimed"            // mailbox for letters with no known recipient
+const unsigned long MAIL_POLL_INTERVAL = 120000UL;  // background poll every 2 minutes
+
+struct MailPollState {
+    String etag;                  // ETag of the last full response (sent as If-None-Match)
+    String lastMessageId;         // cursor: newest message already filed locally
+    uint32_t jobId = 0;           // poll in flight (0 = none)
+    unsigned long nextPollTime = 0;
+    unsigned long lastPollTime = 0;
+    uint32_t polls = 0;
+    uint32_t notModified = 0;     // 304 answers
+    uint32_t filed = 0;           // letters written to mailboxes
+    uint32_t duplicates = 0;      // letters skipped by the cursor
+    uint32_t failures = 0;
+};
+
+MailPollState mailPoll;
+std::map<String, int> mailIndex;  // mailbox (lowercase player or MAIL_UNCLAIMED) -> letters waiting
+
 // Global weather system
-WeatherData lastWeatherData;           // Last retrieved weather
-WeatherRequest currentWeatherRequest;  // Current async request state
+WeatherData lastWeatherData;                  // Last retrieved weather
+std::vector<WeatherRequest> weatherRequests;  // In-flight requests, one per city+kind (shared by all askers)
 const int WEATHER_REQUEST_TIMEOUT = 5000; // 5 second timeout
+#ifndef WEATHER_GEOCODE_URL
+#define WEATHER_GEOCODE_URL "http://geocoding-api.open-meteo.com/v1/search"  // build with -D to use a stand-in
+#endif
+#ifndef WEATHER_FORECAST_URL
+#define WEATHER_FORECAST_URL "http://api.open-meteo.com/v1/forecast"
+#endif
+
+// Weather caches: geocodes are kept until evicted, results for weatherCacheTtlMs
+struct GeoCacheEntry {
+    String city;              // normalised city name
+    String latitude;
+    String longitude;
+    unsigned long lastUsed;
+};
+
+struct WeatherCacheEntry {
+    String key;               // "c:" (current) or "f:" (forecast) + normalised city
+    WeatherData data;
+    unsigned long lastUsed;
+};
+
+struct WeatherCacheStats {
+    uint32_t geoHits = 0;
+    uint32_t geoMisses = 0;
+    uint32_t weatherHits = 0;
+    uint32_t weatherMisses = 0;
+    uint32_t coalesced = 0;   // requests that joined a fetch already in flight
+};
+
+const int GEO_CACHE_SIZE = 16;
+const int WEATHER_CACHE_SIZE = 8;
+unsigned long weatherCacheTtlMs = 10UL * 60UL * 1000UL;  // 10 minutes (debug weather ttl <minutes>)
+std::vector<GeoCacheEntry> geoCache;
+std::vector<WeatherCacheEntry> weatherCache;
+WeatherCacheStats weatherCacheStats;
+
+// High-Low game sessions (one per player slot, allocated with the session pool)
+HighLowSession *highLowSessions = nullptr;
+
+// Chess game sessions (one per player slot, allocated with the session pool)
+ChessSession *chessSessions = nullptr;
+const unsigned long CHESS_PROMOTION_TIMEOUT = 30000UL;  // unanswered promotion becomes a Queen
+
+// Deferred output (one queue per player slot)
+// Dramatic pauses (death, quest dialog, the chess local "thinking") are
+// queued with a release time instead of delay()ing inside loop(), so only
+// the recipient waits.  Input from a player with lines still pending is
+// left in the socket until the queue drains, as it was when we blocked.
+struct DeferredLine {
+    unsigned long releaseAt;
+    String text;
+    std::function<void(Player &)> action;   // if set, run instead of printing text
+};
+
+struct DeferredOutput {
+    std::vector<DeferredLine> lines;         // in release order
+    unsigned long tail = 0;                  // when the next queued line may go out
+};
 
-// High-Low game sessions (one per player)
-HighLowSession highLowSessions[MAX_PLAYERS];
+DeferredOutput *deferredOutput = nullptr;        // maxPlayers of them
+
+// Pending prompt (one per player slot)
+// Multi-step interactions (login, password change, High-Low questions,
+// chess promotion) ask with setPrompt() and receive the player's next line
+// through the continuation, instead of polling the socket or special-casing
+// the input loop.  Handlers may chain the next question with setPrompt().
+enum PromptInput {
+    PROMPT_TEXT,      // non-empty line; blank lines get the usual "What?"
+    PROMPT_SECRET,    // like PROMPT_TEXT, but a password: masked in the replay journal
+    PROMPT_ANY        // blank line is an answer too ("press Enter")
+};
+
+enum PromptResult {
+    PROMPT_DONE,      // answered
+    PROMPT_RETRY,     // not acceptable - keep waiting (handler says why)
+    PROMPT_PASS,      // not for us - keep waiting, run the line as a command
+    PROMPT_ABANDON    // drop the prompt and run the line as a command
+};
+
+typedef std::function<PromptResult(Player &p, int index, const String &line)> PromptHandler;
+typedef std::function<void(Player &p, int index)> PromptTimeoutHandler;
+
+struct PendingPrompt {
+    bool active = false;
+    PromptInput input = PROMPT_TEXT;
+    PromptHandler onInput;
+    PromptTimeoutHandler onTimeout;  // optional; prompt is dropped either way
+    unsigned long startedAt = 0;
+    unsigned long timeoutMs = 0;     // 0 = wait forever
+    uint32_t serial = 0;             // bumped whenever the prompt changes
+};
 
-// Chess game sessions (one per player)
-ChessSession chessSessions[MAX_PLAYERS];
+PendingPrompt *pendingPrompts = nullptr;         // maxPlayers of them
 
 // Global High-Low pot (shared by all players)
 int globalHighLowPot = 50;
 
 // =============================
-// JOKE SYSTEM (Inn Keeper at 249,248,50) - NON-BLOCKING ASYNC
+// JOKE SYSTEM (Inn Keeper at 249,248,50) - PREFETCHED POOL
 // =============================
+// Jokes are fetched in the background into a small ring buffer so one is
+// always ready when the Inn Keeper speaks.  Hashes of every joke told
+// recently are kept (ring + set) to avoid repeats; a joke counts as seen
+// when it is told, not when it is fetched.  Both survive reboots via
+// /jokepool.txt.
+#define JOKE_POOL_SIZE 8                    // prefetched jokes kept ready
+#define JOKE_SEEN_SIZE 128                  // recent joke hashes remembered for dedup
+const unsigned long JOKE_PREFETCH_INTERVAL = 30000UL;  // idle refill pace (no one in the inn)
+const unsigned long JOKE_PREFETCH_BUSY     = 2000UL;   // refill pace while the inn is occupied
+const unsigned long JOKE_SAVE_INTERVAL     = 60000UL;  // min gap between pool writes (flash wear)
+const char* JOKE_POOL_PATH = "/jokepool.txt";
+
 struct JokeSession {
     bool active = false;                    // timer running when players in room
-    unsigned long nextJokeTime = 0;         // when to fetch next joke
-    String currentJoke = "";                // stored joke text
-    String currentJokeId = "";              // joke ID to prevent repeats
-    std::vector<String> usedJokeIds;        // list of joke IDs already shown
+    unsigned long nextJokeTime = 0;         // when the Inn Keeper tells the next joke
+    String currentJoke = "";                // joke being told
+    
+    // Prefetched jokes (ring buffer)
+    String pool[JOKE_POOL_SIZE];
+    uint32_t poolHash[JOKE_POOL_SIZE];      // dedup hash of each pooled joke
+    int poolHead = 0;                       // oldest joke
+    int poolCount = 0;
+    
+    // Recently seen joke hashes (ring for eviction order + set for lookup)
+    uint32_t seenRing[JOKE_SEEN_SIZE];
+    int seenHead = 0;
+    int seenCount = 0;
+    std::set<uint32_t> seenSet;
     
     // Async HTTP state
     bool requestPending = false;            // HTTP request in flight
-    unsigned long requestStartTime = 0;     // when request was initiated
-    HTTPClient* httpClient = nullptr;       // pointer to active HTTP client
-    const int REQUEST_TIMEOUT = 5000;       // 5 second timeout for HTTP request
+    uint32_t jobId = 0;                     // HTTP job id
+    unsigned long nextPrefetchTime = 0;
+    
+    // Persistence
+    bool dirty = false;
+    unsigned long lastSaveTime = 0;
 };
 
 JokeSession innKeeperJokes;
@@ -431,6 +583,7 @@ String unescapeNewlines(const String &s);
 String sanitizeMsg(const String &in);
 bool npcNameMatches(const String &npcName, const String &arg);
 bool isValidPassword(const String &s);
+bool passwordMatches(const String &lowerTyped, const char *stored);
 
 // Combat and death
 void handlePlayerDeath(Player &p);
@@ -444,6 +597,8 @@ void cmdQrCode(Player &p, const String &input);
 void drawPlayerMap(Player &p);
 void cmdMap(Player &p);
 void cmdTownMap(Player &p);
+void cmdWhere(Player &p, const String &args);
+void cmdPath(Player &p, const String &args);
 void cmdReadSign(Player &p, const String &input);
 void cmdBuy(Player &p, const String &arg);
 void cmdSell(Player &p, const String &arg);
@@ -486,6 +641,7 @@ void startHighLowGame(Player &p, int playerIndex);
 void dealHighLowHand(Player &p, int playerIndex);
 void processHighLowBet(Player &p, int playerIndex, int betAmount, bool potBet = false);
 void declareAceValue(Player &p, int playerIndex, int aceValue);
+void promptHighLowAce(Player &p, int playerIndex);
 void promptHighLowContinue(Player &p, int playerIndex);
 void endHighLowGame(Player &p, int playerIndex);
 String getCardName(const Card &card);
@@ -501,14 +657,56 @@ String formatChessMoveWithPieces(int fromR, int fromC, int toR, int toC, unsigne
 void startChessGame(Player &p, int playerIndex, ChessSession &session);
 void processChessMove(Player &p, int playerIndex, ChessSession &session, String moveStr);
 void endChessGame(Player &p, int playerIndex);
-
-bool checkAndSpawnMailLetters(Player &p);  // Returns true if mail was found and letters spawned
-bool fetchMailFromServer(const String &playerName, std::vector<Letter> &letters);
+void playEngineMove(Player &p, ChessSession &session, bool foundEngineMove,
+                    int bestFromR, int bestFromC, int bestToR, int bestToC);
+void playPlayerChessMove(Player &p, int playerIndex, ChessSession &session,
+                         int fromRow, int fromCol, int toRow, int toCol,
+                         const String &moveStr, unsigned char promoteTo);
+
+bool checkAndSpawnMailLetters(Player &p, bool reportNoMail);  // Returns true if letters were delivered
+bool parseMailResponse(const JsonPathExtractor &json, std::vector<Letter> &letters);
+void spawnMailLetters(Player *owner, const String &ownerName, int x, int y, int z, std::vector<Letter> &letters);
+Player *findHttpJobOwner(int slot, const String &name);
+int findPlayerSlot(Player &p);
 String extractPlayerNameFromEmail(const String &emailBody);
 
 
-// File upload handler
-void handleFileUploadRequest(WiFiClient &client);
+// File upload server
+void updateUploadServer(unsigned long now);
+
+// Boot profiler
+void bootStage(const char *name);
+void bootEvent(const char *name);
+void writeBootReport();
+
+// Compiled NPC definitions
+void compileNpcTemplates();
+int findNpcTemplate(const String &npcId);
+
+// Room graph, distance fields and NPC movement
+void voxelDelta(int d, int &dx, int &dy, int &dz);
+void loadRoomGraph();
+void roomFieldsReset();
+void roomCacheClear();
+void updateNpcMovement(unsigned long now);
+
+// Game tick tasks
+void registerGameTicks();
+
+// Latency profiling
+void printLatencyReport(Print &out);
+void resetLatency();
+void recordCommand(Player &p, const String &verb, const String &args, uint32_t us, uint32_t bytes);
+void saveSlowCommands();
+void loadSlowCommands();
+void printCommandReport(Print &out);
+void printSlowCommands(Print &out);
+void resetCommandStats();
+
+// World snapshot (warm restart)
+bool saveWorldSnapshot();
+bool loadWorldSnapshot();
+void restoreSnapshotSessions(Player &p, int index);
 
 // =============================
 // Item and NPC definition system
@@ -525,17 +723,55 @@ struct NpcDefinition {
     std::map<std::string, std::string> attributes;
 };
 
+// NpcDefinition compiled once at load so combat and the NPC ticks never
+// look attributes up by string (see compileNpcTemplates)
+const int NPC_DIALOG_LINES = 3;
+
+struct NpcTemplate {
+    String npcId;
+    String name;                      // display name ("creature" if undefined)
+    String desc;
+    int hp;
+    int gold;
+    int attack;
+    int defense;
+    int xp;
+    bool aggressive;
+    String dialog[NPC_DIALOG_LINES];  // dialog_1..dialog_3 ("" if undefined)
+};
+
+// Aggro list
+// An NPC keeps threat for the few players who have attacked it (or it has
+// attacked), by session slot.  Hitting it adds the damage done; it fights
+// back against whoever present has the most.  Small and inline, so death,
+// respawn and retargeting never walk the player slots.
+#ifndef NPC_AGGRO_SLOTS
+#define NPC_AGGRO_SLOTS 4             // players one NPC tracks; build with -D NPC_AGGRO_SLOTS=n to change
+#endif
+
+struct AggroEntry {
+    int8_t player;                    // session slot in players[]
+    uint16_t threat;
+};
+
+const unsigned long COMBAT_ROUND_MS = 3000UL;   // between a player's rounds, and an NPC's strikes
+
+const int NPC_HOME_ROUTE_STEPS = 32;  // exits an NPC out of range keeps on its way home
+
 struct NpcInstance {
     int x, y, z;                // current position
     int spawnX, spawnY, spawnZ; // original spawn point
     String npcId;
     String parentId;
+    int templateIndex = -1;         // into npcTemplates
     int hp;
     int gold;
     bool alive;
     unsigned long respawnTime = 0;  // 0 = not scheduled
-    bool hostileTo[MAX_PLAYERS];   // per-player hostility
+    AggroEntry aggro[NPC_AGGRO_SLOTS];  // players it is hostile to, packed at the front
+    uint8_t aggroCount = 0;
     int targetPlayer;              // index of the player it's actively fighting
+    unsigned long nextStrikeTime = 0;  // it fights back once a round, whoever's round it is
 
     unsigned long nextDialogTime = 0;
     int dialogIndex = 0;
@@ -544,9 +780,199 @@ struct NpcInstance {
 
     bool suppressDeathMessage;
 
+    bool mobile = false;            // mobileFlag from npcs.vxi: wanders near its spawn
+    unsigned long nextMoveTime = 0; // 0 = not scheduled yet
+    uint8_t homeRoute[NPC_HOME_ROUTE_STEPS / 2] = {};  // exits home, 4 bits each (see chooseNpcExit)
+    uint8_t homeRouteLen = 0;
+    uint8_t homeRoutePos = 0;
+    uint16_t homeRouteRoom = 0;     // room the next route step leaves from
+
+    int16_t poolId = -1;            // stable slot in npcInstances
+    int16_t nextAtVoxel = -1;       // next NPC in the same voxel bucket
+    uint16_t generation = 0;        // bumped when the slot stops holding this NPC (see NpcHandle)
+
+};
+
+static_assert(MAX_PLAYERS <= 127, "AggroEntry::player holds a session slot");
+
+// A reference to an NPC kept across ticks (Player::combatTarget): its pool
+// slot and that slot's generation when it was taken.  Once the slot is
+// emptied or its NPC respawns the generations differ and
+// npcInstances.get() returns nullptr, rather than whatever lives there now.
+struct NpcHandle {
+    int16_t id = -1;
+    uint16_t generation = 0;
+};
+
+int npcAggroFind(const NpcInstance &npc, int playerIndex) {
+    for (int i = 0; i < npc.aggroCount; i++) {
+        if (npc.aggro[i].player == playerIndex) return i;
+    }
+    return -1;
+}
+
+bool npcHostileTo(const NpcInstance &npc, int playerIndex) {
+    return npcAggroFind(npc, playerIndex) >= 0;
+}
+
+// Make the NPC hostile to a player, or more so.  A full list gives up
+// its lowest-threat entry.
+void npcAddThreat(NpcInstance &npc, int playerIndex, int threat) {
+    int i = npcAggroFind(npc, playerIndex);
+    if (i < 0) {
+        if (npc.aggroCount < NPC_AGGRO_SLOTS) {
+            i = npc.aggroCount++;
+        } else {
+            i = 0;
+            for (int j = 1; j < npc.aggroCount; j++) {
+                if (npc.aggro[j].threat < npc.aggro[i].threat) i = j;
+            }
+        }
+        npc.aggro[i].player = (int8_t)playerIndex;
+        npc.aggro[i].threat = 0;
+    }
+    uint32_t t = npc.aggro[i].threat + (threat > 0 ? threat : 0);
+    npc.aggro[i].threat = t > 0xFFFF ? 0xFFFF : (uint16_t)t;
+}
+
+void npcDropAggro(NpcInstance &npc, int playerIndex) {
+    int i = npcAggroFind(npc, playerIndex);
+    if (i < 0) return;
+    npc.aggro[i] = npc.aggro[--npc.aggroCount];
+}
+
+void npcClearAggro(NpcInstance &npc) {
+    npc.aggroCount = 0;
+    npc.targetPlayer = -1;
+}
+
+// =============================================================
+// NPC POOL
+// =============================================================
+//
+// NPC instances live in a fixed array of MAX_NPCS slots.  A slot never
+// moves, so its index is the NPC's stable id.  Slots are refilled when the
+// world is reset or restored from a snapshot, and a respawn brings a new
+// life into the same slot, so anything that holds on to an NPC between
+// ticks keeps an NpcHandle instead of a pointer.  Every NPC is also
+// chained into a small voxel hash, so "who is in this room" walks one
+// short chain instead of every NPC and never allocates.
+//
+// Anything that changes an NPC's x/y/z must go through moveTo().
+
+const int NPC_VOXEL_BUCKETS = 64;   // power of two
+
+// Result of a room query: up to MAX_NPCS pointers, on the stack
+struct NpcRoomList {
+    NpcInstance *items[MAX_NPCS];
+    int count = 0;
+
+    NpcInstance **begin() { return items; }
+    NpcInstance **end() { return items + count; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+};
+
+class NpcPool {
+public:
+    NpcPool() { clear(); }
+
+    NpcInstance *begin() { return slots; }
+    NpcInstance *end() { return slots + used; }
+    int size() const { return used; }
+    int capacity() const { return MAX_NPCS; }
+    NpcInstance &operator[](int id) { return slots[id]; }
+
+    // Copy npc into the next free slot; nullptr when the pool is full
+    NpcInstance *add(const NpcInstance &npc) {
+        if (used >= MAX_NPCS) return nullptr;
+        NpcInstance &slot = slots[used];
+        uint16_t generation = slot.generation;   // the slot's, not the copy's
+        slot = npc;
+        slot.generation = generation;
+        slot.poolId = used++;
+        link(slot);
+        return &slot;
+    }
+
+    NpcHandle handle(const NpcInstance &npc) const {
+        NpcHandle h;
+        h.id = npc.poolId;
+        h.generation = npc.generation;
+        return h;
+    }
+
+    // The NPC a handle was taken from, or nullptr if its slot has moved on
+    NpcInstance *get(NpcHandle h) {
+        if (h.id < 0 || h.id >= used || slots[h.id].generation != h.generation) return nullptr;
+        return &slots[h.id];
+    }
+
+    // The NPC in this slot starts a new life (respawn): old handles go stale
+    void renew(NpcInstance &npc) { npc.generation++; }
+
+    void moveTo(NpcInstance &npc, int x, int y, int z) {
+        unlink(npc);
+        npc.x = x;
+        npc.y = y;
+        npc.z = z;
+        link(npc);
+    }
+
+    // Live NPCs standing in this voxel
+    NpcRoomList at(int x, int y, int z) {
+        NpcRoomList out;
+        for (int id = heads[bucketOf(x, y, z)]; id >= 0; id = slots[id].nextAtVoxel) {
+            NpcInstance &n = slots[id];
+            if (n.alive && n.x == x && n.y == y && n.z == z) out.items[out.count++] = &n;
+        }
+        return out;
+    }
+
+    // Empty every slot; handles into them go stale
+    void clear() {
+        for (int i = 0; i < used; i++) {
+            uint16_t generation = slots[i].generation;
+            slots[i] = NpcInstance();
+            slots[i].generation = generation + 1;
+        }
+        used = 0;
+        for (int b = 0; b < NPC_VOXEL_BUCKETS; b++) heads[b] = -1;
+    }
+
+private:
+    NpcInstance slots[MAX_NPCS];
+    int16_t heads[NPC_VOXEL_BUCKETS];
+    int used = 0;
+
+    static int bucketOf(int x, int y, int z) {
+        uint32_t h = ((uint32_t)x * 73856093u) ^ ((uint32_t)y * 19349663u) ^ ((uint32_t)z * 83492791u);
+        return (int)(h & (NPC_VOXEL_BUCKETS - 1));
+    }
+
+    // Chains are kept in id order, so room queries list NPCs in the same
+    // order as a scan of the whole pool would
+    void link(NpcInstance &npc) {
+        int16_t *link = &heads[bucketOf(npc.x, npc.y, npc.z)];
+        while (*link >= 0 && *link < npc.poolId) link = &slots[*link].nextAtVoxel;
+        npc.nextAtVoxel = *link;
+        *link = npc.poolId;
+    }
+
+    void unlink(NpcInstance &npc) {
+        int16_t *link = &heads[bucketOf(npc.x, npc.y, npc.z)];
+        while (*link >= 0) {
+            if (*link == npc.poolId) {
+                *link = npc.nextAtVoxel;
+                npc.nextAtVoxel = -1;
+                return;
+            }
+            link = &slots[*link].nextAtVoxel;
+        }
+    }
 };
 
-std::vector<NpcInstance*> getNPCsAt(int x, int y, int z);
+NpcRoomList getNPCsAt(int x, int y, int z);
 
 // =============================================================
 // Core item engine: Parent/Child + Ownership Model
@@ -564,7 +990,7 @@ struct WorldItem {
     String name;
     String ownerName;
     String parentName;
-    int value;
+    int value = 0;
     int nextWorldItemId = 1;
     int dialogIndex = 0;
     int dialogOrder[3] = {0, 1, 2};
@@ -649,8 +1075,52 @@ enum DebugDestination {
     DEBUG_TO_TELNET = 2
 };
 
+// Bytes written to any player's connection since boot.  Sampled around
+// each command to get the size of its output.
+uint32_t telnetBytesOut = 0;
+
+// A player's telnet connection; counts what is written through it
+class PlayerClient : public WiFiClient {
+public:
+    PlayerClient() {}
+    PlayerClient(const WiFiClient &c) : WiFiClient(c) {}
+    PlayerClient &operator=(const WiFiClient &c) {
+        WiFiClient::operator=(c);
+        return *this;
+    }
+
+    using WiFiClient::write;
+    size_t write(uint8_t c) override {
+        telnetBytesOut++;
+        return WiFiClient::write(c);
+    }
+    size_t write(const uint8_t *buf, size_t size) override {
+        telnetBytesOut += size;
+        return WiFiClient::write(buf, size);
+    }
+};
+
+// questIndex: 0–9 for questid 1–10
+// stepIndex : 0–9 for step 1–10
+struct QuestFlags {
+    uint16_t steps[10] = {0};   // bit stepIndex of steps[questIndex]
+    uint16_t done = 0;          // bit questIndex: quest completed
+
+    bool stepDone(int q, int s) const { return steps[q] & (1u << s); }
+    bool completed(int q) const { return done & (1u << q); }
+
+    void setStep(int q, int s, bool on) {
+        if (on) steps[q] |= (1u << s);
+        else    steps[q] &= ~(1u << s);
+    }
+    void setCompleted(int q, bool on) {
+        if (on) done |= (1u << q);
+        else    done &= ~(1u << q);
+    }
+};
+
 struct Player {
-    WiFiClient client;
+    PlayerClient client;
     bool active;
     bool loggedIn;
     bool IsWizard;
@@ -679,9 +1149,8 @@ struct Player {
     bool wimpMode;
     int  carryCapacity;
 
-    // Each player has their own current Room instance
-    Room currentRoom;
-
+    // The room itself is parsed on demand into the shared room cache
+    // (playerRoom()), rather than a ~780 byte copy kept in every session
     // Also track explicit voxel coordinates for convenience
     int roomX;
     int roomY;
@@ -704,18 +1173,15 @@ struct Player {
     // Healing timer
     unsigned long lastHealCheck;
 
-    // questStepDone[questIndex][stepIndex]
-    // questIndex: 0–9 for questid 1–10
-    // stepIndex : 0–9 for step 1–10
-    bool questStepDone[10][10];
-    bool questCompleted[10];
+    // Quest progress, one bit per step (22 bytes instead of 110)
+    QuestFlags quests;
 
     // Voxel debug flag
     bool sendVoxel;
 
     bool inCombat = false;
     unsigned long nextCombatTime = 0;
-    NpcInstance* combatTarget = nullptr;
+    NpcHandle combatTarget;             // resolve with npcInstances.get()
 
     // Drunkenness system (0 = drunk, 6 = sober)
     int drunkenness = 6;
@@ -725,12 +1191,10 @@ struct Player {
     int fullness = 6;
     unsigned long lastFullnessRecoveryCheck = 0;
 
-    // Visited voxels tracker for mapper utility (max 500 visited rooms)
-    struct VisitedVoxel {
-        int x, y, z;
-    };
-    std::vector<VisitedVoxel> visitedVoxels;
-    static const int MAX_VISITED_VOXELS = 500;
+    // Visited rooms for the mapper utility, as sorted room ordinals
+    // (roomOrdinal(); max 500 visited rooms)
+    std::vector<uint16_t> visitedRooms;
+    static const int MAX_VISITED_ROOMS = 500;
     
     // Map tracker toggle
     bool mapTrackerEnabled = false;
@@ -792,7 +1256,8 @@ std::map<std::string, ItemDefinition> itemDefs;
 std::vector<WorldItem> worldItems;
 
 std::map<std::string, NpcDefinition> npcDefs;
-std::vector<NpcInstance> npcInstances;
+std::vector<NpcTemplate> npcTemplates;
+NpcPool npcInstances;
 
 
 // Global quest registry
@@ -803,12 +1268,169 @@ WiFiServer* server = nullptr;
 // =====================================================
 // FILE UPLOAD SERVER (WiFi-based, runs on port 8080)
 // =====================================================
+#ifndef FILE_UPLOAD_SERVER
+#define FILE_UPLOAD_SERVER 0          // build with -D FILE_UPLOAD_SERVER=1 to open port 8080
+#endif
 WiFiServer* fileUploadServer = nullptr;
+String fileUploadKey;                 // 4th line of credentials.txt; no key, no server
 const int FILE_UPLOAD_PORT = 8080;
+const int UPLOAD_MAX_CONNECTIONS = 2;              // concurrent transfers; more get a 503
+const size_t UPLOAD_SLICE_BYTES = 1024;            // bytes moved per connection per loop()
+const unsigned int UPLOAD_MAX_HEADER_BYTES = 4096;
+const unsigned long UPLOAD_IDLE_TIMEOUT = 5000UL;  // drop a connection stalled this long
+const unsigned long UPLOAD_CLOSE_LINGER = 100UL;   // wait after the response before stop()
+const char *UPLOAD_PART_SUFFIX = ".upload";         // a file part is written to /<name>.upload first
+const char *UPLOAD_COMMIT_JOURNAL = "/upload_commit.txt";
+
+// Serial YMODEM upload window at boot (the native build turns it off)
+#ifndef YMODEM_BOOT_WINDOW_MS
+#define YMODEM_BOOT_WINDOW_MS 5000    // build with -D YMODEM_BOOT_WINDOW_MS=0 to boot straight into the MUD
+#endif
+
+// =====================================================
+// BOOT PROFILE (per-stage timing of setup(), see writeBootReport)
+// =====================================================
+struct BootStage {
+    const char *name;
+    unsigned long startMs;
+    unsigned long durationMs;   // 0 for events
+    uint32_t freeHeapAfter;
+    bool isEvent;
+};
+
+const int MAX_BOOT_STAGES = 32;
+const char *BOOT_REPORT_PATH = "/boot_report.txt";
+BootStage bootStages[MAX_BOOT_STAGES];
+int bootStageCount = 0;
+int bootOpenStage = -1;
+bool bootWifiNoted = false;
+
+// =====================================================
+// WORLD SNAPSHOT (binary warm restart, see saveWorldSnapshot)
+// =====================================================
+const char *WORLD_SNAPSHOT_PATH = "/world.snap";
+const char *WORLD_SNAPSHOT_TMP_PATH = "/world.snap.tmp";
+const uint32_t WORLD_SNAPSHOT_MAGIC = 0x50414E53;    // "SNAP"
+const uint16_t WORLD_SNAPSHOT_VERSION = 2;
+const size_t WORLD_SNAPSHOT_HEADER_SIZE = 20;
+const size_t WORLD_SNAPSHOT_MAX_BYTES = 96UL * 1024UL;
+const unsigned long SNAPSHOT_SESSION_HOLD = 15UL * 60UL * 1000UL;  // restored games wait this long for their players
+
+// A game in progress at the scheduled reboot, handed back on login
+struct SnapshotGameSession {
+    String playerName;
+    bool isChess;
+    HighLowSession highLow;
+    ChessSession chess;
+};
+
+std::vector<SnapshotGameSession> snapshotSessions;
+unsigned long snapshotSessionsExpireAt = 0;
+String worldSnapshotStatus = "No snapshot this boot.";
+
+// =====================================================
+// NPC MOVEMENT (mobile NPCs wander, see updateNpcMovement)
+// =====================================================
+const unsigned long NPC_MOVE_MIN_MS = 20000UL;    // pause between steps of one NPC
+const unsigned long NPC_MOVE_MAX_MS = 60000UL;
+const int NPC_MOVE_SCAN_PER_LOOP = 16;            // pool slots examined per movement tick
+const int NPC_MOVES_PER_LOOP = 4;                 // steps actually taken per movement tick
+const int NPC_WANDER_RADIUS = 6;                  // max distance from spawn, per axis
+const int NPC_FIELD_ROOMS_PER_TICK = 64;          // rooms a homing search expands per movement tick
+
+int npcMoveCursor = 0;                            // round-robin position in npcInstances
+
+// =====================================================
+// GAME TICKS (periodic world work, see TickScheduler.h)
+// =====================================================
+const uint32_t TICK_BUDGET_US = 20000;            // game ticks per loop() before input is read again
+
+TickScheduler gameTicks;
+
+// =====================================================
+// LATENCY PROFILING (see LatencyHistogram.h, "debug latency")
+// =====================================================
+const int LATENCY_TICK_TASKS = 12;                // tick tasks (by id) that get a histogram
+
+enum LatencySlot {
+    LAT_LOOP,                                     // one whole loop() pass
+    LAT_INPUT,                                    // accepting and reading players, commands included
+    LAT_COMMAND,                                  // handleCommand alone
+    LAT_OUTPUT,                                   // paced output and prompt timeouts
+    LAT_TICKS,                                    // gameTicks.run, all due tasks together
+    LAT_UPLOAD,                                   // upload/backup port
+    LAT_ROOM_LOOKUP,                              // FindVoxel (reads flash)
+    LAT_TICK_FIRST,                               // then one per tick task
+    LAT_SLOTS = LAT_TICK_FIRST + LATENCY_TICK_TASKS
+};
+
+const char *latencySlotNames[LAT_TICK_FIRST] = {
+    "loop", "input", "command", "output", "ticks", "upload", "room lookup"
+};
+
+#if LATENCY_PROFILING
+LatencyHistogram latency[LAT_SLOTS];
+#endif
+
+// Per-verb command timing and the slow command log ("debug commands",
+// "debug slow").  The log is written at the scheduled reboot and read
+// back at boot, so a slow command just before a restart is not lost.
+const int COMMAND_STATS_MAX_VERBS = 40;           // distinct verbs tracked; the rest share "(other)"
+const uint32_t SLOW_COMMAND_US = 50000;           // commands this slow or slower are logged
+const int SLOW_COMMAND_LOG_SIZE = 16;             // newest kept
+const char *SLOW_COMMAND_LOG_PATH = "/slowcmds.txt";
+
+struct CommandStats {
+    char verb[12];
+    CoarseLatencyHistogram hist;
+    uint64_t bytesOut = 0;
+    uint32_t maxBytes = 0;
+};
+
+struct SlowCommand {
+    uint32_t when;                                // UTC seconds, 0 if the clock was not set
+    uint32_t us;
+    uint32_t bytes;
+    char player[20];
+    char verb[12];
+    char args[40];
+};
+
+#if LATENCY_PROFILING
+std::vector<CommandStats> commandStats;
+SlowCommand slowCommands[SLOW_COMMAND_LOG_SIZE];
+int slowCommandCount = 0;                         // entries ever logged; ring index is count % size
+#endif
 
-Player players[MAX_PLAYERS];
+// Player slots, sized at boot by allocateSessionPool(); MAX_PLAYERS is
+// only the ceiling.  Everything that walks the players stops at maxPlayers.
+Player *players = nullptr;
+int    maxPlayers = 0;
 int    npcCount = 0;
 
+// Times one command and counts its output, from construction to the end
+// of handleCommand
+struct CommandProbe {
+    Player &p;
+    const String &verb;
+    const String &args;
+    uint32_t start;
+    uint32_t bytesAtStart;
+
+    CommandProbe(Player &player, const String &v, const String &a)
+        : p(player), verb(v), args(a), start(latencyCycles()), bytesAtStart(telnetBytesOut) {}
+    ~CommandProbe() {
+        recordCommand(p, verb, args, (latencyCycles() - start) / latencyCyclesPerUs,
+                      telnetBytesOut - bytesAtStart);
+    }
+};
+
+#if LATENCY_PROFILING
+#define COMMAND_PROBE(p, verb, args) CommandProbe commandProbe(p, verb, args)
+#else
+#define COMMAND_PROBE(p, verb, args) do {} while (0)
+#endif
+
 // Per-NPC attack cooldown (3s rounds like players)
 unsigned long npcNextAttack[MAX_NPCS] = {0};
 
@@ -1016,6 +1638,7 @@ bool sendEmailViaSMTP(const String &recipientEmail, const String &message, const
 }
 
 void safeReboot() {
+    journalEnd("reboot");   // keep the tail of a recording
     delay(50);
     ESP.restart();
 }
@@ -1026,7 +1649,7 @@ void safeReboot() {
 int countPlayersInRoom(int x, int y, int z) {
     // Count how many active, logged-in players are in a specific room
     int count = 0;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (players[i].active && players[i].loggedIn && 
             players[i].roomX == x && players[i].roomY == y && players[i].roomZ == z) {
             count++;
@@ -1036,204 +1659,412 @@ int countPlayersInRoom(int x, int y, int z) {
 }
 
 // =============================
-// JOKE API SYSTEM - NON-BLOCKING ASYNC HELPERS
+// DEFERRED OUTPUT
 // =============================
 
-// Helper: Extract JSON string value, properly handling escaped quotes
-// Looks for "fieldName":"value" and extracts value, stopping at closing quote that's not escaped
-String extractJsonString(const String &json, const String &fieldName) {
-    // Try both formats: "field":"value" and "field": "value" (with space)
-    String searchKey1 = "\"" + fieldName + "\":\"";
-    String searchKey2 = "\"" + fieldName + "\": \"";
-    
-    int keyIdx = json.indexOf(searchKey1);
-    int searchLen = searchKey1.length();
-    
-    if (keyIdx == -1) {
-        keyIdx = json.indexOf(searchKey2);
-        searchLen = searchKey2.length();
-    }
+// Print msg once earlier queued lines are out, then hold the next line for
+// pauseAfterMs.  "println(a); delay(500);" becomes "queueOutput(p, a, 500);"
+void queueOutputEntry(Player &p, const String &msg, std::function<void(Player &)> action, unsigned long pauseAfterMs) {
+    int slot = findPlayerSlot(p);
+    if (slot < 0) return;
+    DeferredOutput &q = deferredOutput[slot];
+    unsigned long now = millis();
     
-    if (keyIdx == -1) {
-        Serial.println("[JOKE PARSE] Could not find field: " + fieldName);
-        return "";
+    if (q.lines.empty() && (long)(now - q.tail) >= 0) {
+        // Nothing pending - goes out right away
+        if (action) action(p);
+        else p.client.println(msg);
+        q.tail = now + pauseAfterMs;
+        return;
     }
     
-    int startIdx = keyIdx + searchLen;
-    int idx = startIdx;
-    
-    Serial.printf("[JOKE PARSE] Found field '%s' at index %d, starting extraction at %d\n", fieldName.c_str(), keyIdx, startIdx);
-    
-    // Find closing quote, properly handling escaped characters
-    while (idx < json.length()) {
-        if (json[idx] == '\\' && idx + 1 < json.length()) {
-            // Skip escaped character (including \n, \r, \", etc.)
-            idx += 2;
-        } else if (json[idx] == '"') {
-            // Found unescaped closing quote
-            String result = json.substring(startIdx, idx);
-            Serial.printf("[JOKE PARSE] Extracted %d chars: %s\n", result.length(), result.substring(0, 50).c_str());
-            return result;
-        } else {
-            idx++;
+    DeferredLine line;
+    line.releaseAt = q.lines.empty() ? q.tail : std::max(q.tail, q.lines.back().releaseAt);
+    line.text = msg;
+    line.action = action;
+    q.lines.push_back(line);
+    q.tail = line.releaseAt + pauseAfterMs;
+}
+
+void queueOutput(Player &p, const String &msg, unsigned long pauseAfterMs = 0) {
+    queueOutputEntry(p, msg, nullptr, pauseAfterMs);
+}
+
+// Run fn in sequence with queued output (immediately if nothing is pending)
+void queueAction(Player &p, std::function<void(Player &)> fn, unsigned long pauseAfterMs = 0) {
+    queueOutputEntry(p, "", fn, pauseAfterMs);
+}
+
+// Hold output for pauseMs without printing anything
+void queuePause(Player &p, unsigned long pauseMs) {
+    int slot = findPlayerSlot(p);
+    if (slot < 0) return;
+    DeferredOutput &q = deferredOutput[slot];
+    unsigned long now = millis();
+    if (q.lines.empty() && (long)(now - q.tail) >= 0) q.tail = now;
+    q.tail += pauseMs;
+}
+
+// Lines (or a pause) still pending for this slot
+bool hasDeferredOutput(int slot) {
+    const DeferredOutput &q = deferredOutput[slot];
+    return !q.lines.empty() || (long)(millis() - q.tail) < 0;
+}
+
+void clearDeferredOutput(int slot) {
+    deferredOutput[slot].lines.clear();
+    deferredOutput[slot].tail = millis();
+}
+
+// Release due lines; call every loop
+void pumpDeferredOutput(unsigned long now) {
+    for (int i = 0; i < maxPlayers; i++) {
+        DeferredOutput &q = deferredOutput[i];
+        if (q.lines.empty()) continue;
+        
+        Player &p = players[i];
+        if (!p.active) {
+            clearDeferredOutput(i);
+            continue;
+        }
+        
+        size_t released = 0;
+        while (released < q.lines.size() && (long)(now - q.lines[released].releaseAt) >= 0) {
+            // Take a copy: an action may queue more output for this player
+            DeferredLine line = q.lines[released];
+            released++;
+            if (line.action) line.action(p);
+            else p.client.println(line.text);
+        }
+        if (released == 0) continue;
+        q.lines.erase(q.lines.begin(), q.lines.begin() + released);
+        
+        // The command prompt went out before these lines - repeat it
+        if (q.lines.empty()) {
+            p.client.print("> ");
         }
     }
-    
-    Serial.println("[JOKE PARSE] No closing quote found!");
-    return "";  // No closing quote found
 }
 
-// Initiate an async joke fetch (non-blocking - just starts the request)
-void startJokeFetch() {
-    if (innKeeperJokes.requestPending) {
-        Serial.println("[JOKE] Request already pending, skipping");
-        return; // Already fetching
+// =============================
+// PENDING PROMPTS
+// =============================
+
+// Ask a question; the next line from this player goes to onInput
+void setPrompt(Player &p, int index, const String &question, PromptInput input, PromptHandler onInput,
+               unsigned long timeoutMs = 0, PromptTimeoutHandler onTimeout = nullptr) {
+    PendingPrompt &pp = pendingPrompts[index];
+    pp.active = true;
+    pp.input = input;
+    pp.onInput = onInput;
+    pp.onTimeout = onTimeout;
+    pp.startedAt = millis();
+    pp.timeoutMs = timeoutMs;
+    pp.serial++;
+    if (question.length() > 0) {
+        p.client.println(question);
+    }
+}
+
+bool promptPending(int index) {
+    return pendingPrompts[index].active;
+}
+
+void clearPrompt(int index) {
+    PendingPrompt &pp = pendingPrompts[index];
+    pp.active = false;
+    pp.onInput = nullptr;
+    pp.onTimeout = nullptr;
+    pp.serial++;
+}
+
+// Offer a line to the slot's pending prompt.  Returns true if it was
+// consumed, false if it should be handled as a normal command.
+bool dispatchPrompt(Player &p, int index, const String &line) {
+    PendingPrompt &pp = pendingPrompts[index];
+    if (!pp.active) return false;
+    if (line.length() == 0 && pp.input != PROMPT_ANY) return false;
+
+    // Copy: the handler may replace or clear the prompt it is running from
+    PromptHandler handler = pp.onInput;
+    uint32_t serial = pp.serial;
+    PromptResult result = handler(p, index, line);
+    bool unchanged = (pp.serial == serial);
+
+    switch (result) {
+        case PROMPT_DONE:
+            if (unchanged) clearPrompt(index);
+            return true;
+        case PROMPT_RETRY:
+            return true;
+        case PROMPT_PASS:
+            return false;
+        case PROMPT_ABANDON:
+            if (unchanged) clearPrompt(index);
+            return false;
     }
-    
-    Serial.println("[JOKE] Creating HTTPClient...");
-    innKeeperJokes.httpClient = new HTTPClient();
-    
-    // Build URL with excluded joke IDs
-    String jokeUrl = "https://v2.jokeapi.dev/joke/Any?blacklistFlags=nsfw,racist";
-    
-    // Add exclude parameter if we have used jokes
-    if (innKeeperJokes.usedJokeIds.size() > 0) {
-        jokeUrl += "&exclude=";
-        for (size_t i = 0; i < innKeeperJokes.usedJokeIds.size(); i++) {
-            jokeUrl += innKeeperJokes.usedJokeIds[i];
-            if (i < innKeeperJokes.usedJokeIds.size() - 1) {
-                jokeUrl += ",";
-            }
+    return true;
+}
+
+// Expire prompts nobody answered; call every loop
+void updatePromptTimeouts(unsigned long now) {
+    for (int i = 0; i < maxPlayers; i++) {
+        PendingPrompt &pp = pendingPrompts[i];
+        if (!pp.active || pp.timeoutMs == 0) continue;
+        if (now - pp.startedAt < pp.timeoutMs) continue;
+
+        PromptTimeoutHandler handler = pp.onTimeout;
+        uint32_t serial = pp.serial;
+        if (handler && players[i].active) {
+            handler(players[i], i);
         }
-        Serial.printf("[JOKE] Excluding %d previously used jokes\n", innKeeperJokes.usedJokeIds.size());
-    }
-    
-    Serial.println("[JOKE] Attempting to begin connection to: " + jokeUrl);
-    if (innKeeperJokes.httpClient->begin(jokeUrl)) {
-        innKeeperJokes.httpClient->setConnectTimeout(3000);
-        innKeeperJokes.httpClient->setTimeout(5000);
-        Serial.println("[JOKE] Sending GET request...");
-        innKeeperJokes.httpClient->GET();  // Send request, don't wait for response
-        innKeeperJokes.requestPending = true;
-        innKeeperJokes.requestStartTime = millis();
-        Serial.println("[JOKE] Async request initiated at " + String(innKeeperJokes.requestStartTime));
-    } else {
-        Serial.println("[JOKE] Failed to begin HTTP connection");
-        delete innKeeperJokes.httpClient;
-        innKeeperJokes.httpClient = nullptr;
+        if (pp.serial == serial) clearPrompt(i);
     }
 }
 
-// Check if async joke fetch is complete and process response (non-blocking)
-bool checkJokeFetchComplete() {
-    if (!innKeeperJokes.requestPending || !innKeeperJokes.httpClient) {
-        Serial.printf("[JOKE] Early return: requestPending=%d, httpClient=%p\n", innKeeperJokes.requestPending, innKeeperJokes.httpClient);
-        return false;
-    }
-    
-    unsigned long now = millis();
-    unsigned long elapsed = now - innKeeperJokes.requestStartTime;
-    
-    Serial.printf("[JOKE] Checking fetch: elapsed=%lu ms\n", elapsed);
-    
-    // Check for timeout (10 seconds)
-    if (elapsed > 10000) {
-        Serial.println("[JOKE] Request timeout after 10 seconds");
-        innKeeperJokes.httpClient->end();
-        delete innKeeperJokes.httpClient;
-        innKeeperJokes.httpClient = nullptr;
-        innKeeperJokes.requestPending = false;
-        return false;
-    }
-    
-    // Give request at least 200ms to complete
-    if (elapsed < 200) {
-        Serial.printf("[JOKE] Waiting... only %.0f ms elapsed\n", (float)elapsed);
-        return false; // Not enough time for response yet
-    }
-    
-    // Try to get response
-    int httpCode = innKeeperJokes.httpClient->getSize();
-    Serial.printf("[JOKE] HTTP getSize() returned: %d\n", httpCode);
-    
-    if (httpCode == -1) {
-        // Still waiting or error
-        Serial.println("[JOKE] Still waiting for response (-1)");
-        return false;
-    }
-    
-    // Response available - parse it
-    Serial.println("[JOKE] Response available, calling getString()...");
-    String payload = innKeeperJokes.httpClient->getString();
-    innKeeperJokes.httpClient->end();
-    delete innKeeperJokes.httpClient;
-    innKeeperJokes.httpClient = nullptr;
-    innKeeperJokes.requestPending = false;
-    
-    Serial.println("[JOKE] Response received, size: " + String(payload.length()));
-    Serial.println("[JOKE] Response snippet: " + payload.substring(0, 100));
-    
-    // Check if it's an error response
-    if (payload.indexOf("\"error\":true") != -1) {
-        Serial.println("[JOKE] API returned error response");
-        return false;
-    }
-    
-    // Extract joke ID first (to track what we've used)
-    String jokeId = extractJsonString(payload, "id");
-    if (jokeId.length() > 0) {
-        innKeeperJokes.currentJokeId = jokeId;
-        Serial.println("[JOKE] Joke ID: " + jokeId);
+// =============================
+// JOKE API SYSTEM - NON-BLOCKING ASYNC HELPERS
+// =============================
+
+// FNV-1a hash used for joke dedup
+uint32_t jokeHash(const String &s) {
+    uint32_t h = 2166136261UL;
+    for (unsigned int i = 0; i < s.length(); i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619UL;
     }
-    
-    // Extract joke text
-    String jokeText = "";
-    
-    // Look for "type": "single" or "type": "twopart"
-    if (payload.indexOf("\"single\"") != -1) {
-        Serial.println("[JOKE] Detected single joke format");
-        // Single joke - extract "joke" field
-        jokeText = extractJsonString(payload, "joke");
-    } else if (payload.indexOf("\"twopart\"") != -1) {
-        Serial.println("[JOKE] Detected two-part joke format");
-        // Two-part joke - extract "setup" + " " + "delivery"
-        String setup = extractJsonString(payload, "setup");
-        String delivery = extractJsonString(payload, "delivery");
-        jokeText = setup + " " + delivery;
+    return h;
+}
+
+bool jokeSeen(uint32_t h) {
+    return innKeeperJokes.seenSet.count(h) > 0;
+}
+
+void markJokeSeen(uint32_t h) {
+    JokeSession &j = innKeeperJokes;
+    if (j.seenCount == JOKE_SEEN_SIZE) {
+        // Forget the oldest hash
+        j.seenSet.erase(j.seenRing[j.seenHead]);
+        j.seenRing[j.seenHead] = h;
+        j.seenHead = (j.seenHead + 1) % JOKE_SEEN_SIZE;
     } else {
-        Serial.println("[JOKE] Unknown joke format!");
-        Serial.println("[JOKE] Full payload: " + payload);
+        j.seenRing[(j.seenHead + j.seenCount) % JOKE_SEEN_SIZE] = h;
+        j.seenCount++;
     }
-    
-    // Handle Unicode escape sequences
-    jokeText.replace("\\\"", "\"");
-    jokeText.replace("\\n", "\n");
-    jokeText.replace("\\\\", "\\");
-    
-    // Validate: joke must be at least 10 characters long
-    if (jokeText.length() >= 10) {
-        innKeeperJokes.currentJoke = jokeText;
-        // Add ID to used list to prevent repeats
-        if (jokeId.length() > 0) {
-            innKeeperJokes.usedJokeIds.push_back(jokeId);
-            Serial.printf("[JOKE] Added to used list (now %d jokes tracked)\n", innKeeperJokes.usedJokeIds.size());
-        }
-        Serial.println("[JOKE] Successfully fetched joke: " + jokeText.substring(0, 40) + "...");
-        return true;
-    } else {
-        Serial.println("[JOKE] Joke text too short (len=" + String(jokeText.length()) + "), retrying...");
-        Serial.println("[JOKE] Extracted text: " + jokeText);
-        return false;
+    j.seenSet.insert(h);
+}
+
+bool jokePooled(uint32_t h) {
+    JokeSession &j = innKeeperJokes;
+    for (int i = 0; i < j.poolCount; i++) {
+        if (j.poolHash[(j.poolHead + i) % JOKE_POOL_SIZE] == h) return true;
     }
+    return false;
 }
 
-void checkGlobalRebootCountdown(unsigned long now) {
-    long remaining = (long)(nextGlobalRespawn - now);
+bool pushPooledJoke(const String &text, uint32_t h) {
+    JokeSession &j = innKeeperJokes;
+    if (j.poolCount >= JOKE_POOL_SIZE) return false;
+    int slot = (j.poolHead + j.poolCount) % JOKE_POOL_SIZE;
+    j.pool[slot] = text;
+    j.poolHash[slot] = h;
+    j.poolCount++;
+    return true;
+}
 
-    if (remaining <= 0) {
+// Take the oldest joke to tell; it is marked seen here, so a fetched joke
+// that is never told stays in the rotation
+bool popPooledJoke(String &text) {
+    JokeSession &j = innKeeperJokes;
+    if (j.poolCount == 0) return false;
+    text = j.pool[j.poolHead];
+    markJokeSeen(j.poolHash[j.poolHead]);
+    j.pool[j.poolHead] = "";
+    j.poolHead = (j.poolHead + 1) % JOKE_POOL_SIZE;
+    j.poolCount--;
+    return true;
+}
+
+// Pool file escapes: backslash, newline, CR, tab and double quote
+String escapeJokeText(const String &s) {
+    String out;
+    out.reserve(s.length() + 8);
+    for (unsigned int i = 0; i < s.length(); i++) {
+        char c = s[i];
+        if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\t') out += "\\t";
+        else if (c == '"') out += "\\\"";
+        else out += c;
+    }
+    return out;
+}
+
+String unescapeJokeText(const String &s) {
+    String out;
+    out.reserve(s.length());
+    for (unsigned int i = 0; i < s.length(); i++) {
+        if (s[i] == '\\' && i + 1 < s.length()) {
+            char next = s[++i];
+            if (next == 'n') out += '\n';
+            else if (next == 'r') out += '\r';
+            else if (next == 't') out += '\t';
+            else out += next;           // \\ and \"
+            continue;
+        }
+        out += s[i];
+    }
+    return out;
+}
+
+// Persist pool + seen hashes.  Format: "J|<hash>|<joke>" (escaped as above)
+// and "S|<hash>"
+void saveJokePool() {
+    File f = LittleFS.open(JOKE_POOL_PATH, "w");
+    if (!f) {
+        Serial.println("[JOKE] Failed to save joke pool");
+        return;
+    }
+    JokeSession &j = innKeeperJokes;
+    for (int i = 0; i < j.poolCount; i++) {
+        int slot = (j.poolHead + i) % JOKE_POOL_SIZE;
+        f.println("J|" + String(j.poolHash[slot]) + "|" + escapeJokeText(j.pool[slot]));
+    }
+    for (int i = 0; i < j.seenCount; i++) {
+        f.println("S|" + String(j.seenRing[(j.seenHead + i) % JOKE_SEEN_SIZE]));
+    }
+    f.close();
+    j.dirty = false;
+    j.lastSaveTime = millis();
+}
+
+void loadJokePool() {
+    File f = LittleFS.open(JOKE_POOL_PATH, "r");
+    if (!f) return;
+    while (f.available()) {
+        String line = f.readStringUntil('\n');
+        line.trim();
+        if (line.startsWith("J|")) {
+            int bar = line.indexOf('|', 2);
+            if (bar < 0) continue;
+            uint32_t h = (uint32_t)strtoul(line.substring(2, bar).c_str(), nullptr, 10);
+            pushPooledJoke(unescapeJokeText(line.substring(bar + 1)), h);
+        } else if (line.startsWith("S|")) {
+            markJokeSeen((uint32_t)strtoul(line.substring(2).c_str(), nullptr, 10));
+        }
+    }
+    f.close();
+    Serial.printf("[JOKE] Loaded %d pooled jokes, %d seen hashes\n", innKeeperJokes.poolCount, innKeeperJokes.seenCount);
+}
+
+// Parse a JokeAPI response into jokeId / jokeText
+bool parseJokePayload(const JsonPathExtractor &json, String &jokeId, String &jokeText) {
+    // Check if it's an error response
+    if (json.get("error") == "true") {
+        Serial.println("[JOKE] API returned error response");
+        return false;
+    }
+    
+    jokeId = json.get("id");
+    jokeText = "";
+    String type = json.get("type");
+    
+    // Look for "type": "single" or "type": "twopart"
+    if (type == "single") {
+        // Single joke - extract "joke" field
+        jokeText = json.get("joke");
+    } else if (type == "twopart") {
+        // Two-part joke - extract "setup" + " " + "delivery"
+        jokeText = json.get("setup") + " " + json.get("delivery");
+    } else {
+        Serial.println("[JOKE] Unknown joke format: " + type);
+    }
+    
+    // Validate: joke must be at least 10 characters long
+    if (jokeText.length() < 10) {
+        Serial.println("[JOKE] Joke text too short (len=" + String(jokeText.length()) + ")");
+        return false;
+    }
+    return true;
+}
+
+// Queue a background fetch to top up the pool (non-blocking)
+void startJokeFetch() {
+    if (innKeeperJokes.requestPending) {
+        return; // Already fetching
+    }
+    
+    HttpJob *job = new HttpJob();
+    job->url = "https://v2.jokeapi.dev/joke/Any?blacklistFlags=nsfw,racist";
+    job->json.want("error");
+    job->json.want("type");
+    job->json.want("id");
+    job->json.want("joke");
+    job->json.want("setup");
+    job->json.want("delivery");
+    job->connectTimeoutMs = 3000;
+    job->timeoutMs = 5000;
+    job->onComplete = [](HttpJob &done) {
+        innKeeperJokes.requestPending = false;
+        innKeeperJokes.jobId = 0;
+        
+        if (!done.ok()) {
+            Serial.println("[JOKE] Fetch failed (code " + String(done.httpCode) + ")");
+            return;
+        }
+        
+        String jokeId, jokeText;
+        if (!parseJokePayload(done.json, jokeId, jokeText)) {
+            return;
+        }
+        
+        // Dedup on the API id when present, otherwise on the text
+        uint32_t h = jokeHash(jokeId.length() > 0 ? "id:" + jokeId : jokeText);
+        if (jokeSeen(h) || jokePooled(h)) {
+            Serial.println("[JOKE] Duplicate joke " + jokeId + " discarded");
+            return;
+        }
+        if (pushPooledJoke(jokeText, h)) {
+            innKeeperJokes.dirty = true;
+            Serial.printf("[JOKE] Pooled joke %s (%d ready)\n", jokeId.c_str(), innKeeperJokes.poolCount);
+        }
+    };
+    
+    innKeeperJokes.jobId = httpJobSubmit(job);
+    innKeeperJokes.requestPending = (innKeeperJokes.jobId != 0);
+}
+
+// Keep the pool topped up and flushed to flash; call from the joke tick
+void updateJokePool(unsigned long now) {
+    JokeSession &j = innKeeperJokes;
+    
+    if (j.poolCount < JOKE_POOL_SIZE && !j.requestPending &&
+        (long)(now - j.nextPrefetchTime) >= 0 && WiFi.status() == WL_CONNECTED) {
+        startJokeFetch();
+        j.nextPrefetchTime = now + (j.active ? JOKE_PREFETCH_BUSY : JOKE_PREFETCH_INTERVAL);
+    }
+    
+    if (j.dirty && now - j.lastSaveTime >= JOKE_SAVE_INTERVAL) {
+        saveJokePool();
+    }
+}
+
+void checkGlobalRebootCountdown(unsigned long now) {
+    long remaining = (long)(nextGlobalRespawn - now);
+
+    if (remaining <= 0) {
         broadcastToAll("The world collapses in blinding light!");
         delay(200);
+        // Players are saved where they stand so they (and any game they
+        // were playing) come back there after the restart
+        for (int i = 0; i < maxPlayers; i++) {
+            if (players[i].active && players[i].loggedIn) savePlayerToFS(players[i]);
+        }
         saveWorldItems();  // Save world state before reboot
+        saveWorldSnapshot();  // Binary image for a warm restart (falls back to the text files)
+        saveSlowCommands();
+        if (innKeeperJokes.dirty) saveJokePool();
         safeReboot();   // ESP.restart() inside here
         return;
     }
@@ -1278,7 +2109,7 @@ bool onQuestEvent(Player &p,
     for (int q = 0; q < 10; q++) {
 
         // Skip completed quests
-        if (p.questCompleted[q])
+        if (p.quests.completed(q))
             continue;
 
         int questId = q + 1;
@@ -1293,7 +2124,7 @@ bool onQuestEvent(Player &p,
         for (int s = 0; s < (int)quest.steps.size(); s++) {
 
             // Skip already completed steps
-            if (p.questStepDone[q][s])
+            if (p.quests.stepDone(q, s))
                 continue;
 
             QuestStep &step = quest.steps[s];
@@ -1304,7 +2135,7 @@ bool onQuestEvent(Player &p,
             if (step.task == "give") {
                 if (item == step.item && target == step.target) {
 
-                    p.questStepDone[q][s] = true;
+                    p.quests.setStep(q, s, true);
 
                     if (p.IsWizard)
                         debugPrint(p, "Quest step complete: gave " + step.item + " to " + step.target);
@@ -1319,7 +2150,7 @@ bool onQuestEvent(Player &p,
             if (step.task == "kill") {
                 if (target == step.target) {
 
-                    p.questStepDone[q][s] = true;
+                    p.quests.setStep(q, s, true);
 
                     if (p.IsWizard)
                         debugPrint(p, "Quest step complete: killed " + step.target);
@@ -1334,7 +2165,7 @@ bool onQuestEvent(Player &p,
             if (step.task == "say") {
                 if (phrase.equalsIgnoreCase(step.phrase)) {
 
-                    p.questStepDone[q][s] = true;
+                    p.quests.setStep(q, s, true);
 
                     if (p.IsWizard)
                         debugPrint(p, "Quest step complete: said \"" + step.phrase + "\"");
@@ -1351,7 +2182,7 @@ bool onQuestEvent(Player &p,
                     y == step.targetY &&
                     z == step.targetZ) {
 
-                    p.questStepDone[q][s] = true;
+                    p.quests.setStep(q, s, true);
 
                     if (p.IsWizard)
                         debugPrint(p, "Quest step complete: reached " +
@@ -1375,14 +2206,14 @@ CHECK_COMPLETE:
             bool allDone = true;
 
             for (int s = 0; s < (int)quest.steps.size(); s++) {
-                if (!p.questStepDone[q][s]) {
+                if (!p.quests.stepDone(q, s)) {
                     allDone = false;
                     break;
                 }
             }
 
             if (allDone) {
-                p.questCompleted[q] = true;
+                p.quests.setCompleted(q, true);
                 savePlayerToFS(p);
 
                 // --------------------------------------------------------
@@ -1398,19 +2229,17 @@ CHECK_COMPLETE:
                         int nl = dialog.indexOf('\n', start);
 
                         if (nl == -1) {
-                            p.client.println(dialog.substring(start));
-                            delay(500);   // ⭐ 0.5‑second pause after final line
+                            queueOutput(p, dialog.substring(start), 500);   // ⭐ 0.5‑second pause after final line
                             break;
                         }
 
-                        p.client.println(dialog.substring(start, nl));
-                        delay(500);       // ⭐ 0.5‑second pause between lines
+                        queueOutput(p, dialog.substring(start, nl), 500);   // ⭐ 0.5‑second pause between lines
 
                         start = nl + 1;
                     }
 
                 } else {
-                    p.client.println("You have completed this quest! ->  " + quest.name);
+                    queueOutput(p, "You have completed this quest! ->  " + quest.name);
                 }
 
                 // --------------------------------------------------------
@@ -1430,10 +2259,10 @@ CHECK_COMPLETE:
                 // SHOW REWARD MESSAGE (unified, friendly)
                 // --------------------------------------------------------
                 if (quest.rewardXp > 0 || quest.rewardGold > 0) {
-                    p.client.println("Quest complete: " + quest.name + 
+                    queueOutput(p, "Quest complete: " + quest.name + 
                         ". You feel more experienced and wealthy.");
                 } else {
-                    p.client.println("Quest complete: " + quest.name + ".");
+                    queueOutput(p, "Quest complete: " + quest.name + ".");
                 }
 
                 // --------------------------------------------------------
@@ -1441,15 +2270,11 @@ CHECK_COMPLETE:
                 // --------------------------------------------------------
                 if (quest.unloadNpcId.length() > 0) {
 
-                    for (auto &n : npcInstances) {
+                    for (NpcInstance *np : getNPCsAt(p.roomX, p.roomY, p.roomZ)) {
+                        NpcInstance &n = *np;
 
-                        if (!n.alive) continue;
                         if (n.hp <= 0) continue;
 
-                        // Must be in same room
-                        if (n.x != p.roomX || n.y != p.roomY || n.z != p.roomZ)
-                            continue;
-
                         // Match by NPC ID (not name)
                         if (n.npcId != quest.unloadNpcId)
                             continue;
@@ -1463,10 +2288,7 @@ CHECK_COMPLETE:
                         n.respawnTime = millis() + (30UL * 60UL * 1000UL);
 
                         // Clear hostility
-                        for (int i = 0; i < MAX_PLAYERS; i++)
-                            n.hostileTo[i] = false;
-
-                        n.targetPlayer = -1;
+                        npcClearAggro(n);
 
                         // ⭐ Reset immediately so next combat death is normal
                         n.suppressDeathMessage = false;
@@ -1571,7 +2393,7 @@ void unloadQuestNpc(const String &npcId) {
         if (npc.npcId == npcId && npc.alive) {
             npc.alive = false;
             npc.hp = 0;
-            npc.x = npc.y = npc.z = -9999;   // remove from world
+            npcInstances.moveTo(npc, -9999, -9999, -9999);   // remove from world
         }
     }
 }
@@ -1584,8 +2406,8 @@ void markQuestStep(Player &p, const QuestStep &step) {
     if (sIdx < 0 || sIdx >= 10) return;
 
     // Only mark if not already done
-    if (!p.questStepDone[qIdx][sIdx]) {
-        p.questStepDone[qIdx][sIdx] = true;
+    if (!p.quests.stepDone(qIdx, sIdx)) {
+        p.quests.setStep(qIdx, sIdx, true);
     }
 
     // After marking, check if the quest is now complete
@@ -1599,7 +2421,7 @@ void checkQuestCompletion(Player &p, int questId) {
     int qIdx = questIdToIndex(questId);
     if (qIdx < 0 || qIdx >= 10) return;
 
-    if (p.questCompleted[qIdx]) return; // already done
+    if (p.quests.completed(qIdx)) return; // already done
 
     QuestDef &qd = it->second;
 
@@ -1609,7 +2431,7 @@ void checkQuestCompletion(Player &p, int questId) {
     for (const QuestStep &step : qd.steps) {
         int sIdx = stepToIndex(step.step);
         if (sIdx < 0 || sIdx >= 10) continue;
-        if (!p.questStepDone[qIdx][sIdx]) {
+        if (!p.quests.stepDone(qIdx, sIdx)) {
             allDone = false;
             break;
         }
@@ -1618,7 +2440,7 @@ void checkQuestCompletion(Player &p, int questId) {
     if (!allDone) return;
 
     // Mark quest complete
-    p.questCompleted[qIdx] = true;
+    p.quests.setCompleted(qIdx, true);
     p.questsCompleted++;
 
     // ⭐ QUEST REWARDS
@@ -1654,7 +2476,7 @@ void checkQuestCompletion(Player &p, int questId) {
 
 void telnetDebug(const String &msg) {
     // Send debug output to ALL connected players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (players[i].active && players[i].client.connected()) {
             players[i].client.println("[DBG] " + msg);
         }
@@ -1749,6 +2571,352 @@ void buildRoomIndexesIfNeeded(bool forceRebuild = false) {
     Serial.println("[IDX/BIN] Complete");
 }
 
+// =============================
+// Room graph (in RAM)
+// =============================
+//
+// Every room in rooms.txt, read once at boot, so code that walks the map
+// on its own (NPC movement, path finding, the map displays) never has to
+// go through FindVoxel and flash.  roomNodes is sorted by voxel key and a
+// room's index in it is its ordinal.
+//
+// A room's exits are a mask in Direction order, kept only when the room
+// on the other side exists, so following one is a binary search for the
+// neighbour.  Portals leading to a known room are listed in roomPortals
+// and flagged with bit ROOM_EXIT_PORTAL.  8 bytes a room; no edge list.
+
+const int ROOM_EXIT_PORTAL = 10;    // the "direction" of a portal step
+
+struct RoomNode {
+    int16_t x, y, z;
+    uint16_t exits;     // bit d set = exit in Direction d (or ROOM_EXIT_PORTAL)
+};
+
+struct RoomPortal {
+    uint16_t from, to;  // room ordinals
+    String command;     // what a player types to use it
+};
+
+std::vector<RoomNode> roomNodes;
+std::vector<RoomPortal> roomPortals;   // sorted by from
+
+static bool roomNodeBefore(const RoomNode &a, const RoomNode &b) {
+    return packVoxelKey(a.x, a.y, a.z) < packVoxelKey(b.x, b.y, b.z);
+}
+
+// Ordinal of the room at x,y,z, or -1
+int roomOrdinal(int x, int y, int z) {
+    if (x < INT16_MIN || x > INT16_MAX || y < INT16_MIN || y > INT16_MAX ||
+        z < INT16_MIN || z > INT16_MAX) return -1;
+    RoomNode key = { (int16_t)x, (int16_t)y, (int16_t)z, 0 };
+    auto it = std::lower_bound(roomNodes.begin(), roomNodes.end(), key, roomNodeBefore);
+    if (it == roomNodes.end() || it->x != x || it->y != y || it->z != z) return -1;
+    return (int)(it - roomNodes.begin());
+}
+
+const RoomPortal *roomPortalFrom(int room) {
+    for (auto &portal : roomPortals) {
+        if (portal.from == room) return &portal;
+        if (portal.from > room) break;
+    }
+    return nullptr;
+}
+
+// Room reached from room through exit dir (or ROOM_EXIT_PORTAL), or -1
+int roomNeighbor(int room, int dir) {
+    if (room < 0 || room >= (int)roomNodes.size()) return -1;
+    const RoomNode &n = roomNodes[room];
+    if (!(n.exits & (1 << dir))) return -1;
+
+    if (dir == ROOM_EXIT_PORTAL) {
+        const RoomPortal *portal = roomPortalFrom(room);
+        return portal ? portal->to : -1;
+    }
+
+    int dx, dy, dz;
+    voxelDelta(dir, dx, dy, dz);
+    return roomOrdinal(n.x + dx, n.y + dy, n.z + dz);
+}
+
+void loadRoomGraph() {
+    roomNodes.clear();
+    roomPortals.clear();
+    roomFieldsReset();
+    roomCacheClear();
+
+    // Ordinals are about to be renumbered; visited lists would point elsewhere
+    for (int i = 0; i < maxPlayers; i++) players[i].visitedRooms.clear();
+
+    File f = LittleFS.open("/rooms.txt", "r");
+    if (!f) {
+        Serial.println("[GRAPH] rooms.txt missing, NPCs will not move");
+        return;
+    }
+
+    // rooms.txt columns 5..14 in Direction order
+    static const int exitBit[10] = {
+        DIR_NORTH, DIR_SOUTH, DIR_EAST, DIR_WEST,
+        DIR_NE, DIR_NW, DIR_SE, DIR_SW, DIR_UP, DIR_DOWN
+    };
+
+    // Portal targets are resolved once every room is known
+    struct PendingPortal { int16_t x, y, z, px, py, pz; String command; };
+    std::vector<PendingPortal> pending;
+
+    unsigned long start = millis();
+    if (f.available()) f.readStringUntil('\n');   // skip header
+
+    while (f.available()) {
+        String line = f.readStringUntil('\n');
+        line.trim();
+        if (line.length() < 10) continue;
+
+        // Start of fields 0..18, split on plain commas like parseRoomCSV
+        int field[19];
+        int count = 0;
+        int from = 0;
+        while (count < 19) {
+            field[count++] = from;
+            int comma = line.indexOf(',', from);
+            if (comma < 0) break;
+            from = comma + 1;
+        }
+        if (count < 15) continue;
+
+        const char *text = line.c_str();
+        int x = atoi(text + field[0]);
+        int y = atoi(text + field[1]);
+        int z = atoi(text + field[2]);
+        if (x < INT16_MIN || x > INT16_MAX || y < INT16_MIN || y > INT16_MAX ||
+            z < INT16_MIN || z > INT16_MAX) continue;
+
+        RoomNode r = { (int16_t)x, (int16_t)y, (int16_t)z, 0 };
+        for (int i = 0; i < 10; i++) {
+            if (atoi(text + field[5 + i]) != 0) r.exits |= (1 << exitBit[i]);
+        }
+        roomNodes.push_back(r);
+
+        // Portal: px,py,pz,command
+        if (count >= 19 && text[field[15]] != ',' && text[field[15]] != '\0') {
+            int commandEnd = line.indexOf(',', field[18]);
+            PendingPortal portal = {
+                r.x, r.y, r.z,
+                (int16_t)atoi(text + field[15]), (int16_t)atoi(text + field[16]), (int16_t)atoi(text + field[17]),
+                line.substring(field[18], commandEnd < 0 ? line.length() : commandEnd)
+            };
+            pending.push_back(portal);
+        }
+
+        if (roomNodes.size() % 500 == 0) yield();
+    }
+    f.close();
+
+    if (roomNodes.size() > 0xFFFF) {
+        Serial.println("[GRAPH] More than 65535 rooms, room graph disabled");
+        roomNodes.clear();
+        return;
+    }
+
+    std::sort(roomNodes.begin(), roomNodes.end(), roomNodeBefore);
+    roomNodes.shrink_to_fit();
+
+    // Drop exits that lead nowhere, so every set bit is a real step
+    int dropped = 0;
+    for (auto &n : roomNodes) {
+        for (int d = 0; d < 10; d++) {
+            if (!(n.exits & (1 << d))) continue;
+            int dx, dy, dz;
+            voxelDelta(d, dx, dy, dz);
+            if (roomOrdinal(n.x + dx, n.y + dy, n.z + dz) < 0) {
+                n.exits &= ~(1 << d);
+                dropped++;
+            }
+        }
+    }
+
+    for (auto &p : pending) {
+        int fromRoom = roomOrdinal(p.x, p.y, p.z);
+        int toRoom = roomOrdinal(p.px, p.py, p.pz);
+        if (fromRoom < 0 || toRoom < 0) continue;
+        RoomPortal portal = { (uint16_t)fromRoom, (uint16_t)toRoom, p.command };
+        roomPortals.push_back(portal);
+        roomNodes[fromRoom].exits |= (1 << ROOM_EXIT_PORTAL);
+    }
+    std::sort(roomPortals.begin(), roomPortals.end(),
+              [](const RoomPortal &a, const RoomPortal &b) { return a.from < b.from; });
+
+    Serial.printf("[GRAPH] %u rooms, %u portals (%u bytes), %d dead-end exits dropped, in %lums\n",
+                  (unsigned)roomNodes.size(), (unsigned)roomPortals.size(),
+                  (unsigned)(roomNodes.size() * sizeof(RoomNode)), dropped,
+                  millis() - start);
+}
+
+// =============================
+// Room distance fields
+// =============================
+//
+// A distance field gives, for every room, how many steps it is from one
+// target room and which exit to take first, so "how far" and "which way"
+// are both a single array read.  Cells pack the steps in bits 0..11 and
+// the direction in bits 12..15.  A field is built by a breadth-first
+// search backwards from the target (one-way exits are honoured) and kept
+// in a small LRU cache for the landmarks and "path" targets: 2 bytes a
+// room per slot.
+//
+// An NPC walking home does not use the cache.  Its search starts at its
+// spawn room, stops as soon as it reaches the NPC (that partial field
+// still holds the whole route) and runs NPC_FIELD_ROOMS_PER_TICK rooms
+// per movement tick; the NPC then copies the route and follows it on its
+// own.  So any number of NPC homes costs one search each, and no tick
+// pays for more than one slice of one.
+
+const uint16_t ROOM_FIELD_UNREACHABLE = 0x0FFF;
+const int ROOM_FIELD_HERE = 15;          // direction of the target room itself
+const int ROOM_FIELD_SLOTS = 3;
+
+struct RoomField {
+    int target = -1;
+    bool complete = false;      // false: search stopped early, unlisted rooms unknown
+    uint32_t lastUsed = 0;
+    std::vector<uint16_t> cells;
+
+    int steps(int room) const { return cells[room] & 0x0FFF; }
+    int nextDir(int room) const { return cells[room] >> 12; }
+    bool reaches(int room) const { return steps(room) != ROOM_FIELD_UNREACHABLE; }
+};
+
+RoomField roomFields[ROOM_FIELD_SLOTS];
+uint32_t roomFieldClock = 0;
+
+// A breadth-first search that can be run a slice at a time
+struct RoomFieldSearch {
+    RoomField field;
+    int stopAt = -1;            // room that ends the search early (-1: none)
+    bool done = true;
+    std::vector<uint16_t> queue;
+    size_t head = 0;
+};
+
+RoomFieldSearch npcHomeSearch;   // the one homing search in progress
+NpcHandle npcHomeSearchFor;      // the NPC it is for
+
+// Places players are pointed to by "where" and "path"
+struct RoomLandmark {
+    const char *name;
+    int x, y, z;
+};
+
+const RoomLandmark roomLandmarks[] = {
+    { "bank",        254, 245, 50 },
+    { "post office", 252, 248, 50 },
+    { "church",      250, 250, 50 },   // where players start and respawn
+};
+const int ROOM_LANDMARK_COUNT = sizeof(roomLandmarks) / sizeof(roomLandmarks[0]);
+
+void roomFieldSearchEnd(RoomFieldSearch &search) {
+    search.field.target = -1;
+    search.done = true;
+    search.field.cells.clear();
+    search.field.cells.shrink_to_fit();
+    search.queue.clear();
+    search.queue.shrink_to_fit();
+}
+
+// Room ordinals change with the graph: drop every field and route
+void roomFieldsReset() {
+    for (auto &field : roomFields) {
+        field.target = -1;
+        field.complete = false;
+        field.cells.clear();
+        field.cells.shrink_to_fit();
+    }
+    roomFieldSearchEnd(npcHomeSearch);
+    for (auto &npc : npcInstances) npc.homeRouteLen = 0;
+}
+
+void roomFieldSearchBegin(RoomFieldSearch &search, int target, int stopAt) {
+    int total = roomNodes.size();
+    std::vector<uint16_t> &cells = search.field.cells;
+    cells.assign(total, ROOM_FIELD_UNREACHABLE | (ROOM_FIELD_HERE << 12));
+    search.field.target = target;
+    search.field.complete = false;
+    search.stopAt = stopAt;
+    search.queue.clear();
+    search.queue.reserve(total);
+    search.head = 0;
+    cells[target] = (uint16_t)(ROOM_FIELD_HERE << 12);
+    search.done = (target == stopAt);
+    if (!search.done) search.queue.push_back((uint16_t)target);
+}
+
+// Expand up to budget rooms (0 = no limit); true once the search is done
+bool roomFieldSearchRun(RoomFieldSearch &search, int budget) {
+    std::vector<uint16_t> &cells = search.field.cells;
+    int expanded = 0;
+
+    while (!search.done && search.head < search.queue.size()) {
+        if (budget > 0 && expanded++ >= budget) return false;
+        int room = search.queue[search.head++];
+        int steps = (cells[room] & 0x0FFF) + 1;
+        if (steps >= ROOM_FIELD_UNREACHABLE) continue;
+
+        const RoomNode &n = roomNodes[room];
+
+        // Rooms with an exit in direction d that lands here
+        for (int d = 0; d < 10; d++) {
+            int dx, dy, dz;
+            voxelDelta(d, dx, dy, dz);
+            int prev = roomOrdinal(n.x - dx, n.y - dy, n.z - dz);
+            if (prev < 0 || (cells[prev] & 0x0FFF) != ROOM_FIELD_UNREACHABLE) continue;
+            if (!(roomNodes[prev].exits & (1 << d))) continue;
+            cells[prev] = (uint16_t)(steps | (d << 12));
+            if (prev == search.stopAt) search.done = true;
+            search.queue.push_back((uint16_t)prev);
+        }
+
+        for (auto &portal : roomPortals) {
+            if (portal.to != room) continue;
+            if ((cells[portal.from] & 0x0FFF) != ROOM_FIELD_UNREACHABLE) continue;
+            cells[portal.from] = (uint16_t)(steps | (ROOM_EXIT_PORTAL << 12));
+            if (portal.from == search.stopAt) search.done = true;
+            search.queue.push_back(portal.from);
+        }
+    }
+    if (!search.done) {
+        search.done = true;
+        search.field.complete = true;
+    }
+    return true;
+}
+
+// Field leading to target, built on a miss unless build is false
+const RoomField *roomFieldTo(int target, bool build = true) {
+    if (target < 0 || target >= (int)roomNodes.size()) return nullptr;
+
+    RoomField *slot = &roomFields[0];
+    for (auto &field : roomFields) {
+        if (field.target == target) {
+            field.lastUsed = ++roomFieldClock;
+            return &field;
+        }
+        if (field.lastUsed < slot->lastUsed) slot = &field;
+    }
+    if (!build) return nullptr;
+
+    unsigned long start = millis();
+    RoomFieldSearch search;
+    roomFieldSearchBegin(search, target, -1);
+    roomFieldSearchRun(search, 0);
+    slot->cells.swap(search.field.cells);
+    slot->complete = true;
+    slot->target = target;
+    slot->lastUsed = ++roomFieldClock;
+
+    const RoomNode &n = roomNodes[target];
+    Serial.printf("[GRAPH] Distance field to (%d,%d,%d) built in %lums\n", n.x, n.y, n.z, millis() - start);
+    return slot;
+}
+
 
 
 
@@ -1874,6 +3042,7 @@ VoxelResult FindVoxel(int x, int y, int z) {
   res.line = "NOT_FOUND";
   uint64_t targetKey = packVoxelKey(x, y, z);
   unsigned long start = millis();
+  LATENCY_SCOPE(latency[LAT_ROOM_LOOKUP]);
 
   File bin = LittleFS.open("/rooms.bin", "r");
   long foundOffset = -1;
@@ -2095,7 +3264,7 @@ void announceToRoom(int x, int y, int z, const String &msg, int excludeIndex) {
 void announceToRoomExcept(int x, int y, int z, const String &msg, int excludeA, int excludeB) {
     String cleaned = ensurePunctuation(msg);
     String wrappedMsg = wordWrap(cleaned, MAX_OUTPUT_WIDTH);
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         if (i == excludeA || i == excludeB) continue;
 
@@ -2120,32 +3289,97 @@ void announceToRoomExcept(int x, int y, int z, const String &msg, int excludeA,
 }
 
 
-bool loadRoomForPlayer(Player &p, int x, int y, int z) {
-  VoxelResult vr = FindVoxel(x, y, z);
-  if (vr.line == "NOT_FOUND") {
-    return false;
-  }
+// =============================
+// Room cache
+// =============================
+//
+// Players no longer carry a parsed copy of their room: playerRoom() finds
+// it here by the player's roomX/Y/Z, and a miss goes through FindVoxel
+// and parseRoomCSV.  allocateSessionPool() gives the cache one slot per
+// player plus ROOM_CACHE_SLOTS spare for rooms looked at but not stood in
+// (exits, scrying, movement), so every occupied room stays cached and a
+// command never pays for a flash read of the room it runs in.  The least
+// recently used slot is reused.  A Room& from playerRoom() stays valid
+// until roomCacheSlots other rooms have been looked up, so callers must
+// not hold it across a loop over players.
+
+#ifndef ROOM_CACHE_SLOTS
+#define ROOM_CACHE_SLOTS 8                  // spare slots beyond one per player; -D ROOM_CACHE_SLOTS=n
+#endif
+
+struct RoomCacheSlot {
+    Room room;
+    bool valid = false;
+    uint32_t lastUsed = 0;
+};
 
-  Room r = parseRoomCSV(vr.line);
+static RoomCacheSlot roomCacheBootSlot;     // until allocateSessionPool() sizes the cache
+RoomCacheSlot *roomCache = &roomCacheBootSlot;
+int roomCacheSlots = 1;
+uint32_t roomCacheClock = 0;
+uint32_t roomCacheHits = 0;
+uint32_t roomCacheMisses = 0;
 
-  // Assign to player's current room
-  p.currentRoom = r;
-  p.roomX = r.x;
-  p.roomY = r.y;
-  p.roomZ = r.z;
+void roomCacheClear() {
+    for (int i = 0; i < roomCacheSlots; i++) roomCache[i].valid = false;
+}
 
-  // Track this voxel as visited
-  uint64_t voxelKey = packVoxelKey(x, y, z);
-  bool alreadyVisited = false;
-  for (const auto &visited : p.visitedVoxels) {
-    if (visited.x == x && visited.y == y && visited.z == z) {
-      alreadyVisited = true;
-      break;
+// The room at x,y,z, or nullptr if rooms.txt has none
+Room *cachedRoom(int x, int y, int z) {
+    RoomCacheSlot *victim = &roomCache[0];
+    for (int i = 0; i < roomCacheSlots; i++) {
+        RoomCacheSlot &slot = roomCache[i];
+        if (slot.valid && slot.room.x == x && slot.room.y == y && slot.room.z == z) {
+            slot.lastUsed = ++roomCacheClock;
+            roomCacheHits++;
+            return &slot.room;
+        }
+        if (!slot.valid || (victim->valid && slot.lastUsed < victim->lastUsed)) victim = &slot;
     }
+
+    roomCacheMisses++;
+    VoxelResult vr = FindVoxel(x, y, z);
+    if (vr.line == "NOT_FOUND") return nullptr;
+
+    victim->room = parseRoomCSV(vr.line);
+    victim->valid = true;
+    victim->lastUsed = ++roomCacheClock;
+    return &victim->room;
+}
+
+// The room the player is standing in.  Should rooms.txt have lost it, an
+// empty room at the player's coordinates (no exits, no portal).
+Room &playerRoom(Player &p) {
+    Room *r = cachedRoom(p.roomX, p.roomY, p.roomZ);
+    if (r) return *r;
+
+    static Room nowhere;
+    nowhere = parseRoomCSV("");
+    nowhere.x = p.roomX;
+    nowhere.y = p.roomY;
+    nowhere.z = p.roomZ;
+    return nowhere;
+}
+
+bool hasVisitedRoom(const Player &p, int room) {
+    return room >= 0 && std::binary_search(p.visitedRooms.begin(), p.visitedRooms.end(), (uint16_t)room);
+}
+
+bool loadRoomForPlayer(Player &p, int x, int y, int z) {
+  Room *r = cachedRoom(x, y, z);
+  if (!r) {
+    return false;
   }
-  
-  if (!alreadyVisited && p.visitedVoxels.size() < Player::MAX_VISITED_VOXELS) {
-    p.visitedVoxels.push_back({x, y, z});
+
+  p.roomX = r->x;
+  p.roomY = r->y;
+  p.roomZ = r->z;
+
+  // Track this room as visited
+  int room = roomOrdinal(x, y, z);
+  if (room >= 0 && p.visitedRooms.size() < Player::MAX_VISITED_ROOMS) {
+    auto it = std::lower_bound(p.visitedRooms.begin(), p.visitedRooms.end(), (uint16_t)room);
+    if (it == p.visitedRooms.end() || *it != room) p.visitedRooms.insert(it, (uint16_t)room);
   }
 
   return true;
@@ -2507,6 +3741,58 @@ void loadAllNPCDefinitions() {
 
     Serial.printf("[NPCS] Loaded %d NPC definitions. npcDefs.size()=%d\n",
                   count, npcDefs.size());
+
+    compileNpcTemplates();
+}
+
+// Build npcTemplates from npcDefs.  Instances keep an index into it, so
+// only call this before any instances exist (i.e. at boot).
+void compileNpcTemplates() {
+    npcTemplates.clear();
+    npcTemplates.reserve(npcDefs.size());
+
+    for (auto &pair : npcDefs) {
+        auto &attrs = pair.second.attributes;
+        auto text = [&attrs](const char *key, const char *fallback) {
+            auto it = attrs.find(key);
+            return String(it != attrs.end() ? it->second.c_str() : fallback);
+        };
+        auto number = [&attrs](const char *key, int fallback) {
+            auto it = attrs.find(key);
+            return it != attrs.end() ? strToInt(it->second) : fallback;
+        };
+
+        NpcTemplate t;
+        t.npcId = pair.first.c_str();
+        t.name = text("name", "creature");
+        t.desc = text("desc", "");
+        t.hp = number("hp", 1);
+        t.gold = number("gold", 0);
+        t.attack = number("attack", 1);
+        t.defense = number("defense", 5);
+        t.xp = number("xp", 5);
+        t.aggressive = number("aggressive", 0) == 1;
+        for (int i = 0; i < NPC_DIALOG_LINES; i++) {
+            String key = "dialog_" + String(i + 1);
+            t.dialog[i] = text(key.c_str(), "");
+        }
+        npcTemplates.push_back(t);
+    }
+
+    Serial.printf("[NPCS] Compiled %d NPC templates.\n", (int)npcTemplates.size());
+}
+
+int findNpcTemplate(const String &npcId) {
+    for (int i = 0; i < (int)npcTemplates.size(); i++) {
+        if (npcTemplates[i].npcId == npcId) return i;
+    }
+    return -1;
+}
+
+// The instance's compiled definition, or nullptr if it has none
+const NpcTemplate *npcTemplateOf(const NpcInstance &npc) {
+    if (npc.templateIndex < 0 || npc.templateIndex >= (int)npcTemplates.size()) return nullptr;
+    return &npcTemplates[npc.templateIndex];
 }
 
 
@@ -3035,7 +4321,7 @@ void announceToRoomWrapped(int x, int y, int z, const String &msg, int excludeIn
     String cleaned = ensurePunctuation(msg);
     String wrappedMsg = wordWrap(cleaned, MAX_OUTPUT_WIDTH);
     
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         if (i == excludeIndex) continue;
 
@@ -3218,7 +4504,7 @@ void announceDialogToRoom(int x, int y, int z, const String &speaker, const Stri
         }
     }
     
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         if (i == excludeIndex) continue;
 
@@ -3416,37 +4702,606 @@ void saveWorldItems() {
 }
 
 
-void cmdResetWorldItems(Player &p, const String &args) {
-
-    // Wizard-only safety
-    if (!p.IsWizard) {
-        p.client.println("What?");
-        return;
-    }
+// =============================================================
+// WORLD SNAPSHOT (warm restart across the scheduled reboot)
+// =============================================================
+//
+// Just before the 6-hour reboot the live world is written to
+// WORLD_SNAPSHOT_PATH as one binary image: world items, NPC instances
+// (HP, gold, position, respawn timers), shop stock, the High-Low pot and
+// any chess / High-Low games in progress.  The next boot loads it in
+// place of items.vxi / world_items.vxi / npcs.vxi and deletes it, so it is
+// only ever used once, straight after the reboot that wrote it.
+//
+// Layout (little-endian):
+//   header  magic u32, version u16, reserved u16, source signature u32,
+//           payload length u32, payload CRC32 u32
+//   payload pot, items, NPCs, shops, sessions (see saveWorldSnapshot)
+//
+// The source signature covers the size and mtime of the data files the
+// text loaders read, plus the firmware build stamp; a snapshot taken
+// against other data or another build is ignored and the world is parsed
+// from text as usual.
+
+// Buffered payload writer with a running CRC32
+struct SnapshotWriter {
+    File &file;
+    uint8_t buf[512];
+    size_t used = 0;
+    uint32_t crc = 0;
+    uint32_t length = 0;
+    bool failed = false;
+
+    explicit SnapshotWriter(File &f) : file(f) {}
+
+    void bytes(const void *data, size_t len) {
+        const uint8_t *p = (const uint8_t *)data;
+        crc = ymodem_crc32Update(crc, p, len);
+        length += len;
+        while (len > 0) {
+            size_t take = sizeof(buf) - used;
+            if (take > len) take = len;
+            memcpy(buf + used, p, take);
+            used += take;
+            p += take;
+            len -= take;
+            if (used == sizeof(buf)) flush();
+        }
+    }
+
+    void flush() {
+        if (used > 0 && file.write(buf, used) != used) failed = true;
+        used = 0;
+    }
+
+    void u8(uint8_t v) { bytes(&v, 1); }
+    void u16(uint16_t v) {
+        uint8_t b[2] = { (uint8_t)v, (uint8_t)(v >> 8) };
+        bytes(b, 2);
+    }
+    void u32(uint32_t v) {
+        uint8_t b[4] = { (uint8_t)v, (uint8_t)(v >> 8), (uint8_t)(v >> 16), (uint8_t)(v >> 24) };
+        bytes(b, 4);
+    }
+    void i32(int v) { u32((uint32_t)v); }
+    void str(const char *s, size_t len) {
+        if (len > 0xFFFF) len = 0xFFFF;
+        u16((uint16_t)len);
+        bytes(s, len);
+    }
+    void str(const String &s) { str(s.c_str(), s.length()); }
+    void str(const std::string &s) { str(s.c_str(), s.size()); }
+};
 
-    p.client.println("Resetting world items to default...");
+// Bounds-checked reader over the loaded payload
+struct SnapshotReader {
+    const uint8_t *data;
+    size_t length;
+    size_t pos = 0;
+    bool failed = false;
 
-    // ---------------------------------------------------------
-    // 1. CLEAR ALL NON-INVENTORY WORLD ITEMS
-    // ---------------------------------------------------------
-    for (int i = 0; i < (int)worldItems.size(); ) {
-        WorldItem &wi = worldItems[i];
+    SnapshotReader(const uint8_t *d, size_t len) : data(d), length(len) {}
 
-        // Keep items owned by players
-        if (wi.ownerName.length() > 0) {
-            i++;
-            continue;
+    bool take(void *out, size_t len) {
+        if (failed || length - pos < len) {
+            failed = true;
+            memset(out, 0, len);
+            return false;
         }
-
-        // Remove everything else
-        worldItems.erase(worldItems.begin() + i);
+        memcpy(out, data + pos, len);
+        pos += len;
+        return true;
     }
 
-    // ---------------------------------------------------------
-    // 2. DELETE THE WORLD-ITEM SAVE FILE (LittleFS)
-    // ---------------------------------------------------------
-    if (LittleFS.exists("/world_items.vxi")) {
-        LittleFS.remove("/world_items.vxi");
+    uint8_t u8() { uint8_t v; take(&v, 1); return v; }
+    uint16_t u16() {
+        uint8_t b[2];
+        take(b, 2);
+        return (uint16_t)(b[0] | (b[1] << 8));
+    }
+    uint32_t u32() {
+        uint8_t b[4];
+        take(b, 4);
+        return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    }
+    int i32() { return (int)u32(); }
+    String str() {
+        uint16_t len = u16();
+        if (failed || length - pos < len) {
+            failed = true;
+            return "";
+        }
+        String s;
+        s.reserve(len);
+        for (uint16_t i = 0; i < len; i++) s += (char)data[pos + i];
+        pos += len;
+        return s;
+    }
+};
+
+uint32_t worldSnapshotSignature() {
+    static const char *sources[] = { "/items.vxd", "/items.vxi", "/npcs.vxd", "/npcs.vxi" };
+
+    uint32_t sig = 0;
+    for (const char *path : sources) {
+        uint32_t facts[2] = { 0xFFFFFFFF, 0 };   // size, mtime (missing file = all ones)
+        File f = LittleFS.open(path, "r");
+        if (f) {
+            facts[0] = (uint32_t)f.size();
+            facts[1] = (uint32_t)f.getLastWrite();
+            f.close();
+        }
+        sig = ymodem_crc32Update(sig, (const uint8_t *)path, strlen(path));
+        sig = ymodem_crc32Update(sig, (const uint8_t *)facts, sizeof(facts));
+    }
+
+    String build = String(COMPILE_DATE) + " " + String(COMPILE_TIME);
+    return ymodem_crc32Update(sig, (const uint8_t *)build.c_str(), build.length());
+}
+
+// Milliseconds until a millis() deadline, 0 if it has passed
+static uint32_t snapshotRemaining(unsigned long deadline, unsigned long now) {
+    long left = (long)(deadline - now);
+    return left > 0 ? (uint32_t)left : 0;
+}
+
+static void writeSnapshotCard(SnapshotWriter &w, const Card &c) {
+    w.u8((uint8_t)c.value);
+    w.u8((uint8_t)c.suit);
+    w.u8(c.isAce ? 1 : 0);
+}
+
+static Card readSnapshotCard(SnapshotReader &r) {
+    Card c;
+    c.value = r.u8();
+    c.suit = r.u8();
+    c.isAce = r.u8() != 0;
+    return c;
+}
+
+bool saveWorldSnapshot() {
+    unsigned long started = millis();
+
+    File f = LittleFS.open(WORLD_SNAPSHOT_TMP_PATH, "w");
+    if (!f) {
+        Serial.println("[SNAPSHOT] Cannot create " + String(WORLD_SNAPSHOT_TMP_PATH));
+        return false;
+    }
+
+    // Header is filled in once the payload length and CRC are known
+    uint8_t header[WORLD_SNAPSHOT_HEADER_SIZE] = {0};
+    f.write(header, sizeof(header));
+
+    SnapshotWriter w(f);
+    unsigned long now = millis();
+
+    w.i32(globalHighLowPot);
+
+    // World items: the same set saveWorldItems() keeps (top-level
+    // inventory comes back with its owner's save file).  Only attributes
+    // that differ from the item's template are stored.
+    uint32_t itemCount = 0;
+    for (auto &wi : worldItems) {
+        bool inWorld = (wi.ownerName.length() == 0) && (wi.x >= 0 && wi.y >= 0 && wi.z >= 0);
+        bool inContainer = (wi.ownerName.length() > 0) && (wi.parentName.length() > 0);
+        if (inWorld || inContainer) itemCount++;
+    }
+    w.u32(itemCount);
+
+    for (auto &wi : worldItems) {
+        bool inWorld = (wi.ownerName.length() == 0) && (wi.x >= 0 && wi.y >= 0 && wi.z >= 0);
+        bool inContainer = (wi.ownerName.length() > 0) && (wi.parentName.length() > 0);
+        if (!inWorld && !inContainer) continue;
+
+        w.i32(wi.x);
+        w.i32(wi.y);
+        w.i32(wi.z);
+        w.str(wi.name);
+        w.str(wi.ownerName);
+        w.str(wi.parentName);
+        w.i32(wi.value);
+        w.i32(wi.nextWorldItemId);
+        w.i32(wi.dialogIndex);
+        for (int i = 0; i < 3; i++) w.u8((uint8_t)wi.dialogOrder[i]);
+
+        const std::map<std::string, std::string> *defAttrs = nullptr;
+        auto def = itemDefs.find(std::string(wi.name.c_str()));
+        if (def != itemDefs.end()) defAttrs = &def->second.attributes;
+
+        std::vector<const std::pair<const std::string, std::string> *> overrides;
+        for (auto &kv : wi.attributes) {
+            if (defAttrs) {
+                auto jt = defAttrs->find(kv.first);
+                if (jt != defAttrs->end() && jt->second == kv.second) continue;
+            }
+            overrides.push_back(&kv);
+        }
+        w.u16((uint16_t)overrides.size());
+        for (auto *kv : overrides) {
+            w.str(kv->first);
+            w.str(kv->second);
+        }
+    }
+
+    // NPC instances (hostility and combat targets belong to connections,
+    // which do not survive the reboot)
+    w.u32((uint32_t)npcInstances.size());
+    for (auto &npc : npcInstances) {
+        w.str(npc.npcId);
+        w.str(npc.parentId);
+        w.i32(npc.x);
+        w.i32(npc.y);
+        w.i32(npc.z);
+        w.i32(npc.spawnX);
+        w.i32(npc.spawnY);
+        w.i32(npc.spawnZ);
+        w.i32(npc.hp);
+        w.i32(npc.gold);
+        w.u8(npc.alive ? 1 : 0);
+        w.u8(npc.respawnTime != 0 ? 1 : 0);
+        w.u32(npc.respawnTime != 0 ? snapshotRemaining(npc.respawnTime, now) : 0);
+        w.u32(snapshotRemaining(npc.nextDialogTime, now));
+        w.i32(npc.dialogIndex);
+        for (int i = 0; i < 3; i++) w.u8((uint8_t)npc.dialogOrder[i]);
+        w.i32(npc.combatDialogCounter);
+        w.u8(npc.mobile ? 1 : 0);
+    }
+
+    // Shop stock, by shop location and item id (names and prices come
+    // from initializeShops(), so a price change still takes effect)
+    w.u16((uint16_t)shops.size());
+    for (auto &shop : shops) {
+        w.i32(shop.x);
+        w.i32(shop.y);
+        w.i32(shop.z);
+        w.u16((uint16_t)shop.inventory.size());
+        for (auto &item : shop.inventory) {
+            w.str(item.itemId);
+            w.i32(item.quantity);
+        }
+    }
+
+    // Games in progress, keyed by player name
+    uint16_t sessionCount = 0;
+    for (int i = 0; i < maxPlayers; i++) {
+        if (!players[i].active || !players[i].loggedIn) continue;
+        if (highLowSessions[i].gameActive) sessionCount++;
+        if (chessSessions[i].gameActive && !chessSessions[i].gameEnded) sessionCount++;
+    }
+    w.u16(sessionCount);
+
+    for (int i = 0; i < maxPlayers; i++) {
+        if (!players[i].active || !players[i].loggedIn) continue;
+
+        HighLowSession &hl = highLowSessions[i];
+        if (hl.gameActive) {
+            w.str(players[i].name, strlen(players[i].name));
+            w.u8(0);
+            w.i32(hl.gameRoomX);
+            w.i32(hl.gameRoomY);
+            w.i32(hl.gameRoomZ);
+            w.u16((uint16_t)hl.deck.size());
+            for (auto &c : hl.deck) writeSnapshotCard(w, c);
+        }
+
+        ChessSession &cs = chessSessions[i];
+        if (cs.gameActive && !cs.gameEnded) {
+            w.str(players[i].name, strlen(players[i].name));
+            w.u8(1);
+            w.i32(cs.gameRoomX);
+            w.i32(cs.gameRoomY);
+            w.i32(cs.gameRoomZ);
+            w.bytes(cs.board, sizeof(cs.board));
+            w.u8(cs.playerIsWhite ? 1 : 0);
+            w.u8(cs.isBlackToMove ? 1 : 0);
+            w.i32(cs.moveCount);
+            w.str(cs.lastEngineMove);
+            w.str(cs.lastPlayerMove);
+        }
+    }
+
+    w.flush();
+
+    uint32_t sig = worldSnapshotSignature();
+    uint8_t *h = header;
+    auto put16 = [&h](uint16_t v) { *h++ = (uint8_t)v; *h++ = (uint8_t)(v >> 8); };
+    auto put32 = [&h](uint32_t v) { for (int i = 0; i < 4; i++) *h++ = (uint8_t)(v >> (8 * i)); };
+    put32(WORLD_SNAPSHOT_MAGIC);
+    put16(WORLD_SNAPSHOT_VERSION);
+    put16(0);
+    put32(sig);
+    put32(w.length);
+    put32(w.crc);
+
+    bool ok = !w.failed && f.seek(0) && f.write(header, sizeof(header)) == sizeof(header);
+    f.close();
+
+    if (!ok || w.length + WORLD_SNAPSHOT_HEADER_SIZE > WORLD_SNAPSHOT_MAX_BYTES) {
+        LittleFS.remove(WORLD_SNAPSHOT_TMP_PATH);
+        Serial.println("[SNAPSHOT] Write failed; next boot will load from text");
+        return false;
+    }
+
+    LittleFS.remove(WORLD_SNAPSHOT_PATH);
+    if (!LittleFS.rename(WORLD_SNAPSHOT_TMP_PATH, WORLD_SNAPSHOT_PATH)) {
+        LittleFS.remove(WORLD_SNAPSHOT_TMP_PATH);
+        Serial.println("[SNAPSHOT] Rename failed; next boot will load from text");
+        return false;
+    }
+
+    Serial.printf("[SNAPSHOT] Saved %u items, %u NPCs, %u games (%u bytes) in %lums\n",
+                  (unsigned)itemCount, (unsigned)npcInstances.size(), (unsigned)sessionCount,
+                  (unsigned)(w.length + WORLD_SNAPSHOT_HEADER_SIZE), millis() - started);
+    return true;
+}
+
+// Restore the world from WORLD_SNAPSHOT_PATH.  Call after the item/NPC
+// definitions and initializeShops().  Returns false (world untouched) if
+// there is no usable snapshot; the caller then loads from text.
+bool loadWorldSnapshot() {
+    if (!LittleFS.exists(WORLD_SNAPSHOT_PATH)) {
+        worldSnapshotStatus = "Cold boot: no snapshot found.";
+        return false;
+    }
+
+    unsigned long started = millis();
+    File f = LittleFS.open(WORLD_SNAPSHOT_PATH, "r");
+    size_t size = f ? f.size() : 0;
+
+    auto reject = [&f](const String &why) {
+        if (f) f.close();
+        LittleFS.remove(WORLD_SNAPSHOT_PATH);   // single use, good or bad
+        worldSnapshotStatus = "Cold boot: snapshot " + why + ".";
+        Serial.println("[SNAPSHOT] Ignored: " + why);
+        return false;
+    };
+
+    if (!f) return reject("unreadable");
+    if (size < WORLD_SNAPSHOT_HEADER_SIZE || size > WORLD_SNAPSHOT_MAX_BYTES) return reject("has a bad size");
+
+    std::vector<uint8_t> image(size);
+    if (f.read(image.data(), size) != size) return reject("is truncated");
+    f.close();
+
+    SnapshotReader header(image.data(), WORLD_SNAPSHOT_HEADER_SIZE);
+    uint32_t magic = header.u32();
+    uint16_t version = header.u16();
+    header.u16();
+    uint32_t sig = header.u32();
+    uint32_t payloadLen = header.u32();
+    uint32_t payloadCrc = header.u32();
+
+    if (magic != WORLD_SNAPSHOT_MAGIC) return reject("is not a snapshot");
+    if (version != WORLD_SNAPSHOT_VERSION) return reject("is version " + String(version));
+    if (payloadLen != size - WORLD_SNAPSHOT_HEADER_SIZE) return reject("is truncated");
+    const uint8_t *payload = image.data() + WORLD_SNAPSHOT_HEADER_SIZE;
+    if (ymodem_crc32Update(0, payload, payloadLen) != payloadCrc) return reject("failed its CRC");
+    if (sig != worldSnapshotSignature()) return reject("is from other data files or firmware");
+
+    // Parse into locals first so a malformed payload leaves the world alone
+    SnapshotReader r(payload, payloadLen);
+    int pot = r.i32();
+
+    std::vector<WorldItem> items;
+    uint32_t itemCount = r.u32();
+    for (uint32_t n = 0; n < itemCount && !r.failed; n++) {
+        WorldItem wi;
+        wi.x = r.i32();
+        wi.y = r.i32();
+        wi.z = r.i32();
+        wi.name = r.str();
+        wi.ownerName = r.str();
+        wi.parentName = r.str();
+        wi.value = r.i32();
+        wi.nextWorldItemId = r.i32();
+        wi.dialogIndex = r.i32();
+        for (int i = 0; i < 3; i++) wi.dialogOrder[i] = r.u8();
+
+        auto def = itemDefs.find(std::string(wi.name.c_str()));
+        if (def != itemDefs.end()) wi.attributes = def->second.attributes;
+        uint16_t overrides = r.u16();
+        for (uint16_t i = 0; i < overrides && !r.failed; i++) {
+            String key = r.str();
+            String val = r.str();
+            wi.attributes[std::string(key.c_str())] = std::string(val.c_str());
+        }
+        items.push_back(wi);
+    }
+
+    unsigned long now = millis();
+    std::vector<NpcInstance> npcs;
+    uint32_t npcTotal = r.u32();
+    for (uint32_t n = 0; n < npcTotal && !r.failed; n++) {
+        NpcInstance npc;
+        npc.npcId = r.str();
+        npc.parentId = r.str();
+        npc.x = r.i32();
+        npc.y = r.i32();
+        npc.z = r.i32();
+        npc.spawnX = r.i32();
+        npc.spawnY = r.i32();
+        npc.spawnZ = r.i32();
+        npc.hp = r.i32();
+        npc.gold = r.i32();
+        npc.alive = r.u8() != 0;
+        bool respawnScheduled = r.u8() != 0;
+        uint32_t respawnIn = r.u32();
+        npc.respawnTime = respawnScheduled ? (now + respawnIn) | 1 : 0;
+        npc.nextDialogTime = now + r.u32();
+        npc.dialogIndex = r.i32();
+        for (int i = 0; i < 3; i++) npc.dialogOrder[i] = r.u8();
+        npc.combatDialogCounter = r.i32();
+        npc.mobile = r.u8() != 0;
+        npc.suppressDeathMessage = false;
+        npcClearAggro(npc);
+
+        npc.templateIndex = findNpcTemplate(npc.npcId);
+        if (npc.templateIndex < 0) continue;
+        npcs.push_back(npc);
+    }
+
+    struct StockEntry { int x, y, z; String itemId; int quantity; };
+    std::vector<StockEntry> stock;
+    uint16_t shopCount = r.u16();
+    for (uint16_t s = 0; s < shopCount && !r.failed; s++) {
+        int x = r.i32();
+        int y = r.i32();
+        int z = r.i32();
+        uint16_t lines = r.u16();
+        for (uint16_t i = 0; i < lines && !r.failed; i++) {
+            StockEntry e;
+            e.x = x;
+            e.y = y;
+            e.z = z;
+            e.itemId = r.str();
+            e.quantity = r.i32();
+            stock.push_back(e);
+        }
+    }
+
+    std::vector<SnapshotGameSession> games;
+    uint16_t sessionCount = r.u16();
+    for (uint16_t s = 0; s < sessionCount && !r.failed; s++) {
+        SnapshotGameSession g;
+        g.playerName = r.str();
+        g.isChess = r.u8() != 0;
+        int rx = r.i32();
+        int ry = r.i32();
+        int rz = r.i32();
+
+        if (g.isChess) {
+            ChessSession &cs = g.chess;
+            cs.gameActive = true;
+            cs.gameEnded = false;
+            cs.gameRoomX = rx;
+            cs.gameRoomY = ry;
+            cs.gameRoomZ = rz;
+            r.take(cs.board, sizeof(cs.board));
+            cs.playerIsWhite = r.u8() != 0;
+            cs.isBlackToMove = r.u8() != 0;
+            cs.moveCount = r.i32();
+            cs.lastEngineMove = r.str();
+            cs.lastPlayerMove = r.str();
+            cs.endReason = "";
+        } else {
+            HighLowSession &hl = g.highLow;
+            hl.gameActive = true;
+            hl.awaitingAceDeclaration = false;
+            hl.betWasPot = false;
+            hl.gameRoomX = rx;
+            hl.gameRoomY = ry;
+            hl.gameRoomZ = rz;
+            uint16_t deckSize = r.u16();
+            for (uint16_t i = 0; i < deckSize && !r.failed; i++) hl.deck.push_back(readSnapshotCard(r));
+        }
+        games.push_back(g);
+    }
+
+    if (r.failed || r.pos != payloadLen) return reject("is malformed");
+
+    LittleFS.remove(WORLD_SNAPSHOT_PATH);
+
+    // Commit
+    globalHighLowPot = pot > 0 ? pot : 50;
+    worldItems.swap(items);
+    linkWorldItemParents();
+    npcInstances.clear();
+    int npcsSkipped = 0;
+    for (auto &npc : npcs) {
+        if (!npcInstances.add(npc)) npcsSkipped++;
+    }
+    if (npcsSkipped > 0) {
+        Serial.printf("[WARN] NPC pool full (MAX_NPCS=%d), %d snapshot NPCs skipped\n", MAX_NPCS, npcsSkipped);
+    }
+    for (auto &e : stock) {
+        for (auto &shop : shops) {
+            if (shop.x != e.x || shop.y != e.y || shop.z != e.z) continue;
+            for (auto &item : shop.inventory) {
+                if (item.itemId == e.itemId) item.quantity = e.quantity;
+            }
+        }
+    }
+    snapshotSessions.swap(games);
+    snapshotSessionsExpireAt = millis() + SNAPSHOT_SESSION_HOLD;
+
+    worldSnapshotStatus = "Warm boot: restored " + String(worldItems.size()) + " items, " +
+                          String(npcInstances.size()) + " NPCs, " + String(snapshotSessions.size()) +
+                          " games from " + String(size) + " bytes in " + String(millis() - started) + "ms.";
+    Serial.println("[SNAPSHOT] " + worldSnapshotStatus);
+    return true;
+}
+
+// Hand a game saved at the last reboot back to its player, if they have
+// logged in again in the room it was being played in
+void restoreSnapshotSessions(Player &p, int index) {
+    if (snapshotSessions.empty() || index < 0 || index >= maxPlayers) return;
+
+    if ((long)(millis() - snapshotSessionsExpireAt) >= 0) {
+        snapshotSessions.clear();
+        return;
+    }
+
+    for (size_t i = 0; i < snapshotSessions.size(); ) {
+        SnapshotGameSession &g = snapshotSessions[i];
+        if (!g.playerName.equalsIgnoreCase(p.name)) {
+            i++;
+            continue;
+        }
+
+        int rx = g.isChess ? g.chess.gameRoomX : g.highLow.gameRoomX;
+        int ry = g.isChess ? g.chess.gameRoomY : g.highLow.gameRoomY;
+        int rz = g.isChess ? g.chess.gameRoomZ : g.highLow.gameRoomZ;
+
+        if (p.roomX == rx && p.roomY == ry && p.roomZ == rz) {
+            if (g.isChess) {
+                chessSessions[index] = g.chess;
+                p.client.println("");
+                p.client.println("Your chess game survived the world's reformation.");
+                renderChessBoard(p, chessSessions[index]);
+            } else {
+                highLowSessions[index] = g.highLow;
+                p.client.println("");
+                p.client.println("The dealer gathers your cards from before the world's reformation and deals again.");
+                dealHighLowHand(p, index);
+            }
+        }
+        snapshotSessions.erase(snapshotSessions.begin() + i);
+    }
+}
+
+
+
+void cmdResetWorldItems(Player &p, const String &args) {
+
+    // Wizard-only safety
+    if (!p.IsWizard) {
+        p.client.println("What?");
+        return;
+    }
+
+    p.client.println("Resetting world items to default...");
+
+    // ---------------------------------------------------------
+    // 1. CLEAR ALL NON-INVENTORY WORLD ITEMS
+    // ---------------------------------------------------------
+    for (int i = 0; i < (int)worldItems.size(); ) {
+        WorldItem &wi = worldItems[i];
+
+        // Keep items owned by players
+        if (wi.ownerName.length() > 0) {
+            i++;
+            continue;
+        }
+
+        // Remove everything else
+        worldItems.erase(worldItems.begin() + i);
+    }
+
+    // ---------------------------------------------------------
+    // 2. DELETE THE WORLD-ITEM SAVE FILE (LittleFS)
+    // ---------------------------------------------------------
+    if (LittleFS.exists("/world_items.vxi")) {
+        LittleFS.remove("/world_items.vxi");
     }
 
     // ---------------------------------------------------------
@@ -3473,17 +5328,8 @@ void cmdResetWorldItems(Player &p, const String &args) {
 
 
 
-std::vector<NpcInstance*> getNPCsAt(int x, int y, int z) {
-    std::vector<NpcInstance*> result;
-
-    for (auto &npc : npcInstances) {
-        if (!npc.alive) continue;
-        if (npc.x == x && npc.y == y && npc.z == z) {
-            result.push_back(&npc);
-        }
-    }
-
-    return result;
+NpcRoomList getNPCsAt(int x, int y, int z) {
+    return npcInstances.at(x, y, z);
 }
 
 
@@ -3521,17 +5367,18 @@ void loadNPCInstance(const String &line) {
     String npcId = fields[3];
     int mobileFlag = (idx >= 5) ? fields[4].toInt() : 0;
 
-    // Must have a definition (std::string key)
-    std::string key = npcId.c_str();
-    if (!npcDefs.count(key)) {
+    // Must have a definition
+    int templateIndex = findNpcTemplate(npcId);
+    if (templateIndex < 0) {
         Serial.println("[WARN] Unknown NPC ID in instance: " + npcId);
         return;
     }
 
-    auto &def = npcDefs[key];
+    const NpcTemplate &tpl = npcTemplates[templateIndex];
 
     NpcInstance npc;
     npc.npcId = npcId;
+    npc.templateIndex = templateIndex;
 
     // Position from instance file
     npc.x = x;
@@ -3541,27 +5388,16 @@ void loadNPCInstance(const String &line) {
     npc.spawnX = x;
     npc.spawnY = y;
     npc.spawnZ = z;
+    npc.mobile = (mobileFlag != 0);
 
-    // Stats from definition (std::string → String → int)
-    if (def.attributes.count("hp")) {
-        npc.hp = String(def.attributes.at("hp").c_str()).toInt();
-    } else {
-        npc.hp = 1;
-    }
-
-    if (def.attributes.count("gold")) {
-        npc.gold = String(def.attributes.at("gold").c_str()).toInt();
-    } else {
-        npc.gold = 0;
-    }
+    // Stats from definition
+    npc.hp = tpl.hp;
+    npc.gold = tpl.gold;
 
     npc.alive = true;
     npc.respawnTime = 0;
     npc.suppressDeathMessage = false;
-    npc.targetPlayer = -1;
-
-    for (int i = 0; i < MAX_PLAYERS; i++)
-        npc.hostileTo[i] = false;
+    npcClearAggro(npc);
 
     // Dialog setup
     npc.dialogIndex = 0;
@@ -3578,7 +5414,9 @@ void loadNPCInstance(const String &line) {
 
     npc.nextDialogTime = millis() + random(3000, 30001);
 
-    npcInstances.push_back(npc);
+    if (!npcInstances.add(npc)) {
+        Serial.println("[WARN] NPC pool full (MAX_NPCS=" + String(MAX_NPCS) + "), skipped: " + line);
+    }
 }
 
 
@@ -3741,6 +5579,171 @@ void voxelDelta(int d, int &dx, int &dy, int &dz) {
   }
 }
 
+// =============================================================
+// NPC MOVEMENT
+// =============================================================
+//
+// Mobile NPCs (mobileFlag=1 in npcs.vxi) take a random exit now and then,
+// staying within NPC_WANDER_RADIUS of their spawn.  One that finds itself
+// outside that range (rooms.txt changed under a snapshot, or the radius
+// was lowered) walks home: a search from its spawn room runs a slice per
+// tick (see RoomFieldSearch) and the NPC keeps the first
+// NPC_HOME_ROUTE_STEPS exits of the route it finds, searching again from
+// where it stands when those run out.  Each movement tick (every TICK_MS)
+// looks at the next NPC_MOVE_SCAN_PER_LOOP pool slots, round robin, takes
+// at most NPC_MOVES_PER_LOOP steps and expands at most
+// NPC_FIELD_ROOMS_PER_TICK rooms of search, so the cost of a tick does not
+// grow with the number of NPCs.  Every NPC keeps its own timer, first set
+// at a random point in the window, so they do not all move on the same
+// tick.  Exits come from the room graph; nothing here touches flash.
+
+// Someone is fighting it or has attacked it: it stays put
+bool npcIsEngaged(const NpcInstance &npc) {
+    if (npc.targetPlayer >= 0) return true;
+    return npc.aggroCount > 0;
+}
+
+static bool npcInRange(const NpcInstance &npc, int x, int y, int z) {
+    return abs(x - npc.spawnX) <= NPC_WANDER_RADIUS &&
+           abs(y - npc.spawnY) <= NPC_WANDER_RADIUS &&
+           abs(z - npc.spawnZ) <= NPC_WANDER_RADIUS;
+}
+
+static int npcRouteDir(const NpcInstance &npc, int step) {
+    return (npc.homeRoute[step / 2] >> ((step & 1) * 4)) & 0x0F;
+}
+
+// Copy the route from room out of a finished search, as far as it goes
+static void npcTakeRoute(NpcInstance &npc, const RoomField &field, int room) {
+    npc.homeRouteLen = 0;
+    npc.homeRoutePos = 0;
+    npc.homeRouteRoom = room;
+    memset(npc.homeRoute, 0, sizeof(npc.homeRoute));
+
+    while (npc.homeRouteLen < NPC_HOME_ROUTE_STEPS && room != field.target && field.reaches(room)) {
+        int d = field.nextDir(room);
+        npc.homeRoute[npc.homeRouteLen / 2] |= d << ((npc.homeRouteLen & 1) * 4);
+        npc.homeRouteLen++;
+        room = roomNeighbor(room, d);
+        if (room < 0) break;
+    }
+}
+
+// Run a slice of the homing search, handing the route over once it is found
+static void advanceNpcHomeSearch() {
+    if (npcHomeSearch.field.target < 0) return;
+    if (!roomFieldSearchRun(npcHomeSearch, NPC_FIELD_ROOMS_PER_TICK)) return;
+
+    NpcInstance *npc = npcInstances.get(npcHomeSearchFor);
+    if (npc) {
+        int room = roomOrdinal(npc->x, npc->y, npc->z);
+        if (room == npcHomeSearch.stopAt) npcTakeRoute(*npc, npcHomeSearch.field, room);
+    }
+    roomFieldSearchEnd(npcHomeSearch);
+}
+
+// Exit to take from room: the next step of the route home when out of
+// range, else a random exit that stays in range.  -1 = stay put this turn.
+static int chooseNpcExit(NpcInstance &npc, int room) {
+    if (!npcInRange(npc, npc.x, npc.y, npc.z)) {
+        if (npc.homeRoutePos < npc.homeRouteLen && npc.homeRouteRoom == room) {
+            return npcRouteDir(npc, npc.homeRoutePos++);
+        }
+        npc.homeRouteLen = 0;
+
+        // One search at a time; the others wait their turn
+        int home = roomOrdinal(npc.spawnX, npc.spawnY, npc.spawnZ);
+        if (home >= 0 && npcHomeSearch.field.target < 0) {
+            roomFieldSearchBegin(npcHomeSearch, home, room);
+            npcHomeSearchFor = npcInstances.handle(npc);
+        }
+        return -1;
+    }
+
+    npc.homeRouteLen = 0;
+    const RoomNode &here = roomNodes[room];
+    int choices[10];
+    int count = 0;
+    for (int d = 0; d < 10; d++) {
+        if (!(here.exits & (1 << d))) continue;
+        int dx, dy, dz;
+        voxelDelta(d, dx, dy, dz);
+        if (!npcInRange(npc, here.x + dx, here.y + dy, here.z + dz)) continue;
+        choices[count++] = d;
+    }
+    if (count == 0) return -1;
+    return choices[random(0, count)];
+}
+
+// Take one step.  Returns false when the NPC stayed put.
+bool stepNpc(NpcInstance &npc) {
+    int room = roomOrdinal(npc.x, npc.y, npc.z);
+    if (room < 0) return false;
+
+    int d = chooseNpcExit(npc, room);
+    if (d < 0) return false;
+    int next = roomNeighbor(room, d);
+    if (next < 0) return false;
+
+    int oldX = npc.x;
+    int oldY = npc.y;
+    int oldZ = npc.z;
+    const RoomNode &to = roomNodes[next];
+    npcInstances.moveTo(npc, to.x, to.y, to.z);
+    npc.homeRouteRoom = next;
+
+    // Text is only built for rooms somebody is standing in
+    bool seenLeaving = countPlayersInRoom(oldX, oldY, oldZ) > 0;
+    bool seenArriving = countPlayersInRoom(npc.x, npc.y, npc.z) > 0;
+    if (!seenLeaving && !seenArriving) return true;
+
+    const NpcTemplate *tpl = npcTemplateOf(npc);
+    if (!tpl) return true;
+
+    String who = addArticle(tpl->name);
+    if (who.length() > 0) who.setCharAt(0, toupper(who.charAt(0)));
+
+    if (seenLeaving) {
+        String msg = (d == ROOM_EXIT_PORTAL) ? who + " vanishes through the portal."
+                                             : who + " leaves " + String(dirNames[d]) + ".";
+        announceToRoom(oldX, oldY, oldZ, msg, -1);
+    }
+    if (seenArriving) {
+        String msg = (d == ROOM_EXIT_PORTAL) ? who + " steps out of thin air."
+                                             : who + " arrives from the " + oppositeDir(dirNames[d]) + ".";
+        announceToRoom(npc.x, npc.y, npc.z, msg, -1);
+    }
+    return true;
+}
+
+void updateNpcMovement(unsigned long now) {
+    int total = npcInstances.size();
+    if (total == 0 || roomNodes.empty()) return;
+
+    advanceNpcHomeSearch();
+
+    int scans = (total < NPC_MOVE_SCAN_PER_LOOP) ? total : NPC_MOVE_SCAN_PER_LOOP;
+    int moves = 0;
+
+    for (int s = 0; s < scans && moves < NPC_MOVES_PER_LOOP; s++) {
+        if (npcMoveCursor >= total) npcMoveCursor = 0;
+        NpcInstance &npc = npcInstances[npcMoveCursor++];
+
+        if (!npc.mobile || !npc.alive) continue;
+
+        if (npc.nextMoveTime == 0) {
+            npc.nextMoveTime = now + random(0, NPC_MOVE_MAX_MS + 1);
+            continue;
+        }
+        if (now < npc.nextMoveTime) continue;
+
+        npc.nextMoveTime = now + random(NPC_MOVE_MIN_MS, NPC_MOVE_MAX_MS + 1);
+        if (npcIsEngaged(npc)) continue;
+
+        if (stepNpc(npc)) moves++;
+    }
+}
+
 // =============================
 // Utility: case-insensitive partial match
 // =============================
@@ -3869,7 +5872,7 @@ int findItemInRoomOrInventory(Player &p, const String &targetRaw) {
     // -----------------------------------------
     // 2. SEARCH ROOM
     // -----------------------------------------
-    Room &r = p.currentRoom;
+    Room &r = playerRoom(p);
 
     for (int i = 0; i < (int)worldItems.size(); i++) {
         WorldItem &wi = worldItems[i];
@@ -3913,39 +5916,66 @@ void consumeWorldItem(Player &p, int worldIndex) {
 }
 
 
-void checkNPCAggro(Player &p) {
+static bool npcSees(const NpcInstance &npc, const Player &p) {
+    return p.active && p.loggedIn && p.roomX == npc.x && p.roomY == npc.y && p.roomZ == npc.z;
+}
 
-    // Resolve playerIndex
-    int playerIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (&players[i] == &p) {
-            playerIndex = i;
-            break;
+// Each round, threat from players who are not in the NPC's room fades by
+// a quarter; an entry that reaches nothing is dropped
+void npcDecayThreat(NpcInstance &npc) {
+    for (int i = npc.aggroCount - 1; i >= 0; i--) {
+        AggroEntry &e = npc.aggro[i];
+        if (npcSees(npc, players[e.player])) continue;
+        uint16_t fade = e.threat / 4 + 1;
+        if (e.threat > fade) e.threat -= fade;
+        else npc.aggro[i] = npc.aggro[--npc.aggroCount];
+    }
+}
+
+// Aim the NPC at the player with the most threat who is still in its
+// room; -1 (no target) if none of them is
+int npcRetarget(NpcInstance &npc) {
+    int best = -1;
+    uint16_t bestThreat = 0;
+    for (int i = 0; i < npc.aggroCount; i++) {
+        const AggroEntry &e = npc.aggro[i];
+        if (!npcSees(npc, players[e.player])) continue;
+        if (best < 0 || e.threat > bestThreat) {
+            best = e.player;
+            bestThreat = e.threat;
         }
     }
-    if (playerIndex == -1) return;
+    npc.targetPlayer = best;
+    return best;
+}
+
+// The connection in the slot is gone, or a new one has it: nothing may
+// hold a grudge from whoever had it before
+void npcForgetPlayer(int playerIndex) {
+    for (auto &npc : npcInstances) {
+        npcDropAggro(npc, playerIndex);
+        if (npc.targetPlayer == playerIndex) npcRetarget(npc);
+    }
+}
+
+// The player in slot playerIndex has just arrived: an NPC here that was
+// fighting them takes it up again, an aggressive one attacks
+void checkNPCAggro(Player &p, int playerIndex) {
 
     auto npcsHere = getNPCsAt(p.roomX, p.roomY, p.roomZ);
 
     for (auto npc : npcsHere) {
-        // SAFE lookup into npcDefs using std::string key
-        std::string key = npc->npcId.c_str();
-        auto it = npcDefs.find(key);
-        if (it == npcDefs.end()) {
-            continue;
-        }
-
-        auto &def = it->second;
+        const NpcTemplate *tpl = npcTemplateOf(*npc);
+        if (!tpl) continue;
 
         // ---------------------------------------------
         // PASSIVE NPC: resume combat if previously hostile
         // ---------------------------------------------
-        if (npc->alive &&
-            npc->hostileTo[playerIndex] &&
-            npc->targetPlayer == playerIndex) {
+        if (npc->alive && npcHostileTo(*npc, playerIndex) &&
+            (npc->targetPlayer == playerIndex || npcRetarget(*npc) == playerIndex)) {
 
             p.inCombat = true;
-            p.combatTarget = npc;
+            p.combatTarget = npcInstances.handle(*npc);
             p.nextCombatTime = millis() + 1000;
             return;
         }
@@ -3953,20 +5983,18 @@ void checkNPCAggro(Player &p) {
         // ---------------------------------------------
         // AGGRESSIVE NPC: auto-aggro on sight
         // ---------------------------------------------
-        if (npc->alive &&
-            def.attributes.count("aggressive") &&
-            def.attributes.at("aggressive") == "1") {
+        if (npc->alive && tpl->aggressive) {
 
             // ⭐ REQUIRED FOR COMBAT LOOP TO WORK ⭐
-            npc->hostileTo[playerIndex] = true;
-            npc->targetPlayer = playerIndex;
+            npcAddThreat(*npc, playerIndex, 1);
+            npcRetarget(*npc);
 
             // Start combat for THIS player
             p.inCombat = true;
-            p.combatTarget = npc;
+            p.combatTarget = npcInstances.handle(*npc);
             p.nextCombatTime = millis() + 1000;
 
-            String npcName = def.attributes.at("name").c_str();
+            const String &npcName = tpl->name;
             p.client.println("The " + npcName + " snarls and attacks you!");
             broadcastRoomExcept(
                 p,
@@ -3981,31 +6009,28 @@ void checkNPCAggro(Player &p) {
 
 
 NpcInstance* findNPCInRoom(Player &p, const String &id) {
-    for (auto &n : npcInstances) {
-        if (!n.alive) continue;
+    for (NpcInstance *np : getNPCsAt(p.roomX, p.roomY, p.roomZ)) {
+        NpcInstance &n = *np;
         if (n.hp <= 0) continue;
 
-        if (n.x == p.roomX && n.y == p.roomY && n.z == p.roomZ) {
-            // Try matching by ID first
-            if (n.npcId == id) {
-                return &n;
-            }
+        // Try matching by ID first
+        if (n.npcId == id) {
+            return &n;
+        }
+        
+        // Also try matching by display name (case-insensitive, partial match)
+        const NpcTemplate *tpl = npcTemplateOf(n);
+        if (tpl) {
+            String npcName = tpl->name;
+            String searchStr = id;
             
-            // Also try matching by display name (case-insensitive, partial match)
-            std::string key = std::string(n.npcId.c_str());
-            auto it = npcDefs.find(key);
-            if (it != npcDefs.end()) {
-                String npcName = it->second.attributes.at("name").c_str();
-                String searchStr = id;
-                
-                // Convert both to lowercase for case-insensitive comparison
-                npcName.toLowerCase();
-                searchStr.toLowerCase();
-                
-                // Check if search string is contained in the NPC name
-                if (npcName.indexOf(searchStr) != -1) {
-                    return &n;
-                }
+            // Convert both to lowercase for case-insensitive comparison
+            npcName.toLowerCase();
+            searchStr.toLowerCase();
+            
+            // Check if search string is contained in the NPC name
+            if (npcName.indexOf(searchStr) != -1) {
+                return &n;
             }
         }
     }
@@ -4592,7 +6617,7 @@ String getTitle(Player &p) {
 
 // Announce entry to other players in the same voxel
 void announceEntry(Player &p, const char *name) {
-  for (int i = 0; i < MAX_PLAYERS; i++) {
+  for (int i = 0; i < maxPlayers; i++) {
     if (!players[i].active) continue;
     if (&players[i] == &p) continue;
     if (players[i].roomX == p.roomX &&
@@ -4934,7 +6959,7 @@ int createWorldItem(const String &itemName, const String &parentName) {
 
 
 void cmdPortal(Player &p, int index) {
-    Room &r = p.currentRoom;
+    Room &r = playerRoom(p);
 
     if (!r.hasPortal) {
         p.client.println("Nothing happens.");
@@ -5038,7 +7063,7 @@ void movePlayer(Player &p, int index, const char *dir) {
         return;
     }
 
-    Room &cur = p.currentRoom;
+    Room &cur = playerRoom(p);
     bool canGo = false;
 
     switch (d) {
@@ -5071,7 +7096,7 @@ void movePlayer(Player &p, int index, const char *dir) {
     int tz = oldZ + dz;
 
     // If player leaves the Game Parlor, end any active chess game
-    if (oldX == 247 && oldY == 248 && oldZ == 50 && index >= 0 && index < MAX_PLAYERS) {
+    if (oldX == 247 && oldY == 248 && oldZ == 50 && index >= 0 && index < maxPlayers) {
         if (chessSessions[index].gameActive) {
             chessSessions[index].gameActive = false;
             p.client.println("Your chess game has been abandoned due to leaving the Game Parlor.");
@@ -5100,7 +7125,7 @@ void movePlayer(Player &p, int index, const char *dir) {
         );
     }
 
-    // Load new room — THIS updates p.currentRoom internally
+    // Load new room — THIS updates p.roomX/Y/Z internally
     if (!loadRoomForPlayer(p, tx, ty, tz)) {
         p.client.println("The path seems blocked.");
         return;
@@ -5131,25 +7156,27 @@ void movePlayer(Player &p, int index, const char *dir) {
     // QUEST HOOK — reach quests fire here
     onQuestEvent(p, "reach", "", "", "", p.roomX, p.roomY, p.roomZ);
 
-    // Send voxel coords to mapper
-    if (p.sendVoxel) {
-        p.client.print("(");
-        p.client.print(p.roomX);
-        p.client.print(",");
-        p.client.print(p.roomY);
-        p.client.print(",");
-        p.client.print(p.roomZ);
-        p.client.println(")");
-    }
+    // Send voxel coords to mapper, then describe the room (after any quest dialog)
+    queueAction(p, [](Player &pl) {
+        if (pl.sendVoxel) {
+            pl.client.print("(");
+            pl.client.print(pl.roomX);
+            pl.client.print(",");
+            pl.client.print(pl.roomY);
+            pl.client.print(",");
+            pl.client.print(pl.roomZ);
+            pl.client.println(")");
+        }
 
-    cmdLook(p);
+        cmdLook(pl);
+    });
 
-    // Check for mail when entering post office
+    // Deliver any filed mail when entering the post office (local mailboxes only)
     if (getPostOfficeForRoom(p) != nullptr) {
-        checkAndSpawnMailLetters(p);
+        checkAndSpawnMailLetters(p, false);
     }
 
-    checkNPCAggro(p);
+    checkNPCAggro(p, index);
 }
 
 // =============================================================
@@ -5167,26 +7194,17 @@ String getDisplayName(WorldItem &wi) {
 void showRoomNPCs(Player &p) {
     bool anyNPCs = false;
 
-    for (int i = 0; i < npcInstances.size(); i++) {
-        NpcInstance &n = npcInstances[i];
+    for (NpcInstance *np : getNPCsAt(p.roomX, p.roomY, p.roomZ)) {
+        NpcInstance &n = *np;
 
-        // Skip dead NPCs
-        if (!n.alive) continue;
+        // Skip dying NPCs
         if (n.hp <= 0) continue;
 
-        // Must be in same room
-        if (n.x != p.roomX || n.y != p.roomY || n.z != p.roomZ) continue;
-
-        // Look up definition for display name (String -> std::string)
-        std::string key = std::string(n.npcId.c_str());
-        auto it = npcDefs.find(key);
-        if (it == npcDefs.end()) continue;
-
-        NpcDefinition &def = it->second;
+        const NpcTemplate *tpl = npcTemplateOf(n);
+        if (!tpl) continue;
 
         anyNPCs = true;
-        String npcName = def.attributes.at("name").c_str();
-        p.client.println(addArticle(npcName) + " is here.");
+        p.client.println(addArticle(tpl->name) + " is here.");
     }
 
     if (anyNPCs) {
@@ -5231,8 +7249,8 @@ void cmdLook(Player &p) {
         p.client.println("");  // blank line between map and room description
     }
     
-    // Use the player's currentRoom, not a global rooms[][][]
-    Room &r = p.currentRoom;
+    // The player's room from the room cache, not a global rooms[][][]
+    Room &r = playerRoom(p);
 
     // Room name
     p.client.println(String(r.name));
@@ -5284,7 +7302,7 @@ void cmdLook(Player &p) {
     p.client.println("");  // blank line
 
     // Other players in the room
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &other = players[i];
         
         // Skip self, inactive, not logged in, or invisible
@@ -5347,7 +7365,7 @@ void cmdLookAt(Player &p, const String &input) {
     searchLower.toLowerCase();
 
     // CHECK FOR PLAYER FIRST
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &other = players[i];
         
         // Skip self, inactive, not logged in, or invisible
@@ -5374,24 +7392,18 @@ void cmdLookAt(Player &p, const String &input) {
     }
 
     // CHECK FOR NPCS
-    for (int i = 0; i < (int)npcInstances.size(); i++) {
-        NpcInstance &npc = npcInstances[i];
+    for (NpcInstance *np : getNPCsAt(p.roomX, p.roomY, p.roomZ)) {
+        NpcInstance &npc = *np;
         
         // Must be alive
-        if (!npc.alive || npc.hp <= 0) continue;
-        
-        // Must be in this room
-        if (npc.x != p.roomX || npc.y != p.roomY || npc.z != p.roomZ)
-            continue;
+        if (npc.hp <= 0) continue;
         
         // Look up NPC definition
-        std::string key = std::string(npc.npcId.c_str());
-        auto it = npcDefs.find(key);
-        if (it == npcDefs.end()) continue;
+        const NpcTemplate *tpl = npcTemplateOf(npc);
+        if (!tpl) continue;
         
-        NpcDefinition &def = it->second;
-        String npcName = def.attributes.at("name").c_str();
-        String npcDesc = def.attributes.count("desc") ? def.attributes.at("desc").c_str() : "";
+        const String &npcName = tpl->name;
+        const String &npcDesc = tpl->desc;
         
         // Check if name matches (with word-based partial matching)
         String npcNameLower = npcName;
@@ -5761,7 +7773,7 @@ void debugDumpSinglePlayer(Player &p, const String &name) {
 
     for (int q = 0; q < 10; q++) {
         int questId = q + 1;
-        bool completed = p.questCompleted[q];
+        bool completed = p.quests.completed(q);
 
         String line = "Quest " + String(questId) + ": ";
         line += completed ? "COMPLETED" : "in progress";
@@ -5771,7 +7783,7 @@ void debugDumpSinglePlayer(Player &p, const String &name) {
         bool any = false;
 
         for (int s = 0; s < 10; s++) {
-            if (p.questStepDone[q][s]) {
+            if (p.quests.stepDone(q, s)) {
                 debugPrintNoNL(p, String(s + 1) + " ");
                 any = true;
             }
@@ -5906,12 +7918,17 @@ void debugDumpNPCs(Player &p) {
         debugPrint(p, "");
     }
 
+    debugPrint(p, "NPC pool: " + String(npcInstances.size()) + " of " + String(npcInstances.capacity()) + " slots used");
+    debugPrint(p, "Room graph: " + String(roomNodes.size()) + " rooms, " + String(roomPortals.size()) +
+                  " portals (" + String(roomNodes.size() * sizeof(RoomNode)) + " bytes)");
+
     for (int i = 0; i < (int)npcInstances.size(); i++) {
         auto &npc = npcInstances[i];
 
         String line = "#" + String(i) +
                       "  npcId=" + npc.npcId +
                       "  alive=" + String(npc.alive ? "yes" : "no") +
+                      "  mobile=" + String(npc.mobile ? "yes" : "no") +
                       "  hp=" + String(npc.hp) +
                       "  gold=" + String(npc.gold) +
                       "  xyz=(" + String(npc.x) + "," + String(npc.y) + "," + String(npc.z) + ")";
@@ -6576,7 +8593,7 @@ void cmdDrink(Player &p, const String &arg) {
 
         // If not in inventory, search room
         if (idx == -1) {
-            Room &r = p.currentRoom;
+            Room &r = playerRoom(p);
             for (int i = 0; i < (int)worldItems.size(); i++) {
                 WorldItem &wi = worldItems[i];
                 if (wi.x != r.x || wi.y != r.y || wi.z != r.z)
@@ -6776,120 +8793,15 @@ String getWeatherDescription(int code) {
     }
 }
 
-// Helper function to extract temperature from current object specifically
-String extractCurrentTemperature(const String &json) {
-    // Look specifically for "current":{...} and find temperature_2m within it
-    int currentIdx = json.indexOf("\"current\":");
-    if (currentIdx < 0) {
-        return "unknown";
-    }
-    
-    // Find "temperature_2m": after the "current" object starts
-    int tempIdx = json.indexOf("\"temperature_2m\":", currentIdx);
-    if (tempIdx < 0) {
-        return "unknown";
-    }
-    
-    // Move past the key and colon
-    tempIdx += 17;
-    
-    // Skip whitespace
-    while (tempIdx < json.length() && (json[tempIdx] == ' ' || json[tempIdx] == '\t' || json[tempIdx] == '\n')) {
-        tempIdx++;
-    }
-    
-    // Extract the number (could be negative, have decimals)
-    String temp = "";
-    while (tempIdx < json.length()) {
-        char c = json[tempIdx];
-        if ((c >= '0' && c <= '9') || c == '.' || c == '-') {
-            temp += c;
-            tempIdx++;
-        } else {
-            break;
-        }
-    }
-    
-    return temp.length() > 0 ? temp : "unknown";
-}
-
-// Helper function to extract weather code from current object
-int extractWeatherCode(const String &json) {
-    // Look specifically for "current":{...} and find weather_code within it
-    int currentIdx = json.indexOf("\"current\":");
-    if (currentIdx < 0) {
-        return -1;
-    }
-    
-    // Find "weather_code": after the "current" object starts
-    int codeIdx = json.indexOf("\"weather_code\":", currentIdx);
-    if (codeIdx < 0) {
-        return -1;
-    }
-    
-    // Move past the key and colon
-    codeIdx += 15;
-    
-    // Skip whitespace
-    while (codeIdx < json.length() && (json[codeIdx] == ' ' || json[codeIdx] == '\t' || json[codeIdx] == '\n')) {
-        codeIdx++;
-    }
-    
-    // Extract the number
-    String code = "";
-    while (codeIdx < json.length()) {
-        char c = json[codeIdx];
-        if ((c >= '0' && c <= '9') || c == '-') {
-            code += c;
-            codeIdx++;
-        } else {
-            break;
-        }
-    }
-    
-    return code.length() > 0 ? code.toInt() : -1;
-}
-
-// Convert Celsius to Fahrenheit
-String celsiusToFahrenheit(const String &celsius) {
-    if (celsius == "unknown") return "unknown";
-    float c = celsius.toFloat();
-    float f = (c * 9.0 / 5.0) + 32.0;
-    // Format to 1 decimal place
-    char buffer[10];
-    sprintf(buffer, "%.1f", f);
-    return String(buffer);
-}
-
-// Helper function to extract temperature from JSON response (for geocoding)
-String extractTemperature(const String &json) {
-    // Look for "temperature_2m": followed by a number
-    int idx = json.indexOf("\"temperature_2m\":");
-    if (idx < 0) {
-        return "unknown";
-    }
-    
-    // Move past the key and colon
-    idx += 17;
-    
-    // Skip whitespace
-    while (idx < json.length() && (json[idx] == ' ' || json[idx] == '\t' || json[idx] == '\n')) {
-        idx++;
-    }
-    
-    // Extract the number (could be negative, have decimals)
-    String temp = "";
-    while (idx < json.length()) {
-        char c = json[idx];
-        if ((c >= '0' && c <= '9') || c == '.' || c == '-') {
-            temp += c;
-            idx++;
-        } else {
-            break;
-        }
-    }
-    
-    return temp.length() > 0 ? temp : "unknown";
+// Convert Celsius to Fahrenheit
+String celsiusToFahrenheit(const String &celsius) {
+    if (celsius == "unknown") return "unknown";
+    float c = celsius.toFloat();
+    float f = (c * 9.0 / 5.0) + 32.0;
+    // Format to 1 decimal place
+    char buffer[10];
+    sprintf(buffer, "%.1f", f);
+    return String(buffer);
 }
 
 String getPlayerIPAddress(Player &p) {
@@ -6904,7 +8816,7 @@ void broadcastWeather(const String &data) {
     message += data;
     message += "\n==========================================\n";
     
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         // Split message into lines to avoid buffer issues
         int lineStart = 0;
@@ -6931,271 +8843,338 @@ void broadcastWeather(const String &data) {
     }
 }
 
-void updateWeatherRequests() {
-    if (!currentWeatherRequest.pending) {
-        return;
+// Announce a successful weather result to everyone
+void announceWeather(const WeatherData &data) {
+    // Capitalize city name
+    String cityName = data.location;
+    if (cityName.length() > 0) {
+        cityName[0] = toupper(cityName[0]);
     }
+    String output = cityName + "\n";
+    output += data.current + "\n";
+    output += data.forecast;
+    broadcastWeather(output);
+}
+
+// =============================
+// WEATHER CACHE (LRU, keyed by normalised city)
+// =============================
+
+// "  Detroit , MI " -> "detroit,mi" so equivalent spellings share cache entries
+String normalizeWeatherCity(const String &city) {
+    String in = city;
+    in.trim();
+    in.toLowerCase();
     
+    String out = "";
+    bool pendingSpace = false;
+    for (unsigned int i = 0; i < in.length(); i++) {
+        char c = in[i];
+        if (c == ' ' || c == '\t') {
+            pendingSpace = true;
+            continue;
+        }
+        if (c == ',') {
+            pendingSpace = false;
+            out += c;
+            continue;
+        }
+        if (pendingSpace && out.length() > 0 && out[out.length() - 1] != ',') {
+            out += ' ';
+        }
+        pendingSpace = false;
+        out += c;
+    }
+    return out;
+}
+
+bool lookupGeoCache(const String &city, String &latitude, String &longitude) {
+    for (GeoCacheEntry &e : geoCache) {
+        if (e.city == city) {
+            e.lastUsed = millis();
+            latitude = e.latitude;
+            longitude = e.longitude;
+            return true;
+        }
+    }
+    return false;
+}
+
+void storeGeoCache(const String &city, const String &latitude, const String &longitude) {
+    GeoCacheEntry *slot = nullptr;
+    for (GeoCacheEntry &e : geoCache) {
+        if (e.city == city) {
+            slot = &e;
+            break;
+        }
+    }
+    if (!slot) {
+        if ((int)geoCache.size() < GEO_CACHE_SIZE) {
+            geoCache.push_back(GeoCacheEntry());
+            slot = &geoCache.back();
+        } else {
+            // Evict least recently used
+            slot = &geoCache[0];
+            for (GeoCacheEntry &e : geoCache) {
+                if (e.lastUsed < slot->lastUsed) slot = &e;
+            }
+        }
+    }
+    slot->city = city;
+    slot->latitude = latitude;
+    slot->longitude = longitude;
+    slot->lastUsed = millis();
+}
+
+// Returns a cached result younger than weatherCacheTtlMs, or nullptr
+const WeatherData *lookupWeatherCache(const String &key) {
     unsigned long now = millis();
-    unsigned long elapsed = now - currentWeatherRequest.startTime;
-    
-    // Check for timeout
-    if (elapsed > WEATHER_REQUEST_TIMEOUT) {
-        currentWeatherRequest.pending = false;
-        broadcastWeather("The Weather Mage says: Unable to contact the\nweather spirits at this time.");
-        return;
+    for (WeatherCacheEntry &e : weatherCache) {
+        if (e.key == key) {
+            if (now - e.data.timestamp > weatherCacheTtlMs) {
+                return nullptr;  // Stale - caller refetches and overwrites
+            }
+            e.lastUsed = now;
+            return &e.data;
+        }
+    }
+    return nullptr;
+}
+
+void storeWeatherCache(const String &key, const WeatherData &data) {
+    WeatherCacheEntry *slot = nullptr;
+    for (WeatherCacheEntry &e : weatherCache) {
+        if (e.key == key) {
+            slot = &e;
+            break;
+        }
+    }
+    if (!slot) {
+        if ((int)weatherCache.size() < WEATHER_CACHE_SIZE) {
+            weatherCache.push_back(WeatherCacheEntry());
+            slot = &weatherCache.back();
+        } else {
+            // Evict least recently used
+            slot = &weatherCache[0];
+            for (WeatherCacheEntry &e : weatherCache) {
+                if (e.lastUsed < slot->lastUsed) slot = &e;
+            }
+        }
     }
+    slot->key = key;
+    slot->data = data;
+    slot->lastUsed = millis();
+}
+
+// Extract latitude/longitude from an open-meteo geocoding response
+bool extractGeocodeLatLon(const JsonPathExtractor &json, String &latitude, String &longitude) {
+    latitude = json.get("results[0].latitude");
+    longitude = json.get("results[0].longitude");
+    return latitude.length() > 0 && longitude.length() > 0;
+}
+
+// Parse an open-meteo forecast response into out
+bool parseWeatherPayload(const JsonPathExtractor &json, bool isForecast, const String &query, WeatherData &out) {
+    bool success = false;
     
-    // Check if we have a WiFi connection
-    if (WiFi.status() != WL_CONNECTED) {
-        if (elapsed > 1000) {
-            currentWeatherRequest.pending = false;
-            broadcastWeather("The Weather Mage says: The spirits are not\nresponding. Check your network connection.");
+    if (isForecast) {
+        // 3 days of daily max/min temps and conditions
+        if (json.find("daily.temperature_2m_max[0]") || json.find("daily.weather_code[0]")) {
+            // Build forecast output with High/Low
+            String forecastStr = "";
+            for (int day = 0; day < 3; day++) {
+                String idx = "[" + String(day) + "]";
+                String maxF = celsiusToFahrenheit(json.get("daily.temperature_2m_max" + idx, "unknown"));
+                String minF = celsiusToFahrenheit(json.get("daily.temperature_2m_min" + idx, "unknown"));
+                String weatherDesc = getWeatherDescription(json.get("daily.weather_code" + idx, "-1").toInt());
+                forecastStr += "Day " + String(day + 1) + ": High " + maxF + " / Low " + minF + " degrees Fahrenheit - " + weatherDesc;
+                if (day < 2) forecastStr += "\n";
+            }
+            
+            out.location = query;
+            out.current = "3-Day Forecast";
+            out.forecast = forecastStr;
+            success = true;
+        }
+    } else {
+        // Current weather - current temp and conditions, plus today's high/low
+        String tempF = celsiusToFahrenheit(json.get("current.temperature_2m", "unknown"));
+        int code = json.get("current.weather_code", "-1").toInt();
+        String highF = celsiusToFahrenheit(json.get("daily.temperature_2m_max[0]", "unknown"));
+        String lowF = celsiusToFahrenheit(json.get("daily.temperature_2m_min[0]", "unknown"));
+        
+        if (tempF != "unknown" && code >= 0) {
+            out.location = query;
+            out.current = "Current Temperature: " + tempF + " degrees Fahrenheit\nToday's High: " + highF + " / Low: " + lowF + " degrees Fahrenheit";
+            out.forecast = getWeatherDescription(code);
+            success = true;
+        }
+    }
+    out.timestamp = millis();
+    return success;
+}
+
+// Paths parseWeatherPayload reads
+void wantWeatherPaths(JsonPathExtractor &json) {
+    json.want("current.temperature_2m");
+    json.want("current.weather_code");
+    json.want("daily.temperature_2m_max[]");
+    json.want("daily.temperature_2m_min[]");
+    json.want("daily.weather_code[]");
+}
+
+// Clear the request and announce the result
+void finishWeatherRequest(const String &key, bool success) {
+    for (size_t i = 0; i < weatherRequests.size(); i++) {
+        if (weatherRequests[i].query == key) {
+            weatherRequests.erase(weatherRequests.begin() + i);
+            break;
         }
-        return;
     }
     
-    // Non-blocking check - if we've just started, wait a moment before attempting
-    if (elapsed < 100) {
-        return;
+    if (success) {
+        announceWeather(lastWeatherData);
+    } else {
+        broadcastWeather("The Weather Mage says: The spirits are\nunable to divine the weather at this time.");
     }
+}
+
+// Queue the forecast fetch for known coordinates
+uint32_t submitWeatherForecastJob(const String &key, bool isForecast, const String &city,
+                                  const String &latitude, const String &longitude) {
+    String forecastType = isForecast ? 
+        "&daily=weather_code,temperature_2m_max,temperature_2m_min" : 
+        "&current=temperature_2m,weather_code&daily=temperature_2m_max,temperature_2m_min";
+    
+    HttpJob *weatherJob = new HttpJob();
+    weatherJob->url = String(WEATHER_FORECAST_URL) + "?latitude=" + latitude + 
+                      "&longitude=" + longitude + forecastType + "&timezone=auto";
+    wantWeatherPaths(weatherJob->json);
+    weatherJob->connectTimeoutMs = WEATHER_REQUEST_TIMEOUT;
+    weatherJob->timeoutMs = WEATHER_REQUEST_TIMEOUT;
+    weatherJob->onComplete = [key, isForecast, city](HttpJob &weather) {
+        WeatherData data;
+        bool success = weather.ok() && parseWeatherPayload(weather.json, isForecast, city, data);
+        if (success) {
+            lastWeatherData = data;
+            storeWeatherCache(key, data);
+        }
+        finishWeatherRequest(key, success);
+    };
     
-    bool success = false;
+    return httpJobSubmit(weatherJob);
+}
+
+// Start the HTTP side of a weather request (geocode unless memoised, then forecast)
+void startWeatherFetch(WeatherRequest &req) {
+    String key = req.query;
+    bool isForecast = req.isForecast;
+    String city = key.substring(2);
     
-    // Always use geocoding for specified location, then fetch weather
-    String geoUrl = "http://geocoding-api.open-meteo.com/v1/search?name=" + currentWeatherRequest.query + "&count=1&language=en&format=json";
+    String latitude, longitude;
+    if (lookupGeoCache(city, latitude, longitude)) {
+        weatherCacheStats.geoHits++;
+        req.jobId = submitWeatherForecastJob(key, isForecast, city, latitude, longitude);
+        if (req.jobId == 0) {
+            finishWeatherRequest(key, false);
+        }
+        return;
+    }
+    weatherCacheStats.geoMisses++;
     
-    HTTPClient http;
-    http.setConnectTimeout(WEATHER_REQUEST_TIMEOUT);
-    http.setTimeout(WEATHER_REQUEST_TIMEOUT);
+    HttpJob *geoJob = new HttpJob();
+    String cityParam = city;
+    cityParam.replace(" ", "%20");
+    geoJob->url = String(WEATHER_GEOCODE_URL) + "?name=" + cityParam + "&count=1&language=en&format=json";
+    geoJob->json.want("results[0].latitude");
+    geoJob->json.want("results[0].longitude");
+    geoJob->connectTimeoutMs = WEATHER_REQUEST_TIMEOUT;
+    geoJob->timeoutMs = WEATHER_REQUEST_TIMEOUT;
+    geoJob->onComplete = [key, isForecast, city](HttpJob &geo) {
+        String latitude, longitude;
+        if (!geo.ok() || !extractGeocodeLatLon(geo.json, latitude, longitude)) {
+            finishWeatherRequest(key, false);
+            return;
+        }
+        storeGeoCache(city, latitude, longitude);
+        
+        if (submitWeatherForecastJob(key, isForecast, city, latitude, longitude) == 0) {
+            finishWeatherRequest(key, false);
+        }
+    };
     
-    if (http.begin(geoUrl)) {
-        int httpCode = http.GET();
-        String payload = http.getString();
-        http.end();
+    req.jobId = httpJobSubmit(geoJob);
+    if (req.jobId == 0) {
+        finishWeatherRequest(key, false);
+    }
+}
+
+void updateWeatherRequests() {
+    unsigned long now = millis();
+    
+    for (size_t i = 0; i < weatherRequests.size(); ) {
+        WeatherRequest &req = weatherRequests[i];
+        if (req.jobId != 0) {
+            i++;
+            continue;  // Already handed to the HTTP job queue
+        }
         
-        if (httpCode == 200) {
-            // Extract latitude and longitude
-            int latIdx = payload.indexOf("\"latitude\":");
-            int lonIdx = payload.indexOf("\"longitude\":");
-            
-            if (latIdx >= 0 && lonIdx >= 0) {
-                // Extract latitude properly
-                int latStart = latIdx + 11; // length of "latitude":
-                String latitude = "";
-                while (latStart < payload.length() && (payload[latStart] == ' ' || payload[latStart] == '\t')) latStart++;
-                while (latStart < payload.length()) {
-                    char c = payload[latStart];
-                    if ((c >= '0' && c <= '9') || c == '.' || c == '-') {
-                        latitude += c;
-                        latStart++;
-                    } else {
-                        break;
-                    }
-                }
-                
-                // Extract longitude properly
-                int lonStart = lonIdx + 12; // length of "longitude":
-                String longitude = "";
-                while (lonStart < payload.length() && (payload[lonStart] == ' ' || payload[lonStart] == '\t')) lonStart++;
-                while (lonStart < payload.length()) {
-                    char c = payload[lonStart];
-                    if ((c >= '0' && c <= '9') || c == '.' || c == '-') {
-                        longitude += c;
-                        lonStart++;
-                    } else {
-                        break;
-                    }
-                }
-                
-                if (latitude.length() > 0 && longitude.length() > 0) {
-                    String forecastType = currentWeatherRequest.isForecast ? 
-                        "&daily=weather_code,temperature_2m_max,temperature_2m_min" : 
-                        "&current=temperature_2m,weather_code&daily=temperature_2m_max,temperature_2m_min";
-                    
-                    String weatherUrl = "http://api.open-meteo.com/v1/forecast?latitude=" + latitude + 
-                                      "&longitude=" + longitude + forecastType + "&timezone=auto";
-                    
-                    HTTPClient http2;
-                    http2.setConnectTimeout(WEATHER_REQUEST_TIMEOUT);
-                    http2.setTimeout(WEATHER_REQUEST_TIMEOUT);
-                    
-                    if (http2.begin(weatherUrl)) {
-                        int weatherCode = http2.GET();
-                        String weatherPayload = http2.getString();
-                        http2.end();
-                        
-                        if (weatherCode == 200) {
-                            if (currentWeatherRequest.isForecast) {
-                                // Extract from daily array - get temps and conditions for 3 days
-                                int dailyIdx = weatherPayload.indexOf("\"daily\":");
-                                if (dailyIdx >= 0) {
-                                    String dailyData = weatherPayload.substring(dailyIdx);
-                                    
-                                    // Extract max temps
-                                    int maxTempIdx = dailyData.indexOf("\"temperature_2m_max\":");
-                                    String maxTemps[3] = {"unknown", "unknown", "unknown"};
-                                    
-                                    if (maxTempIdx >= 0) {
-                                        int idx = maxTempIdx + 20;
-                                        while (idx < dailyData.length() && dailyData[idx] != '[') idx++;
-                                        if (idx < dailyData.length()) idx++;
-                                        
-                                        for (int day = 0; day < 3; day++) {
-                                            while (idx < dailyData.length() && (dailyData[idx] == ' ' || dailyData[idx] == '\t' || dailyData[idx] == '\n' || dailyData[idx] == '\r' || dailyData[idx] == ',')) idx++;
-                                            if (idx >= dailyData.length() || dailyData[idx] == ']') break;
-                                            
-                                            String tempStr = "";
-                                            while (idx < dailyData.length() && ((dailyData[idx] >= '0' && dailyData[idx] <= '9') || dailyData[idx] == '.' || dailyData[idx] == '-')) {
-                                                tempStr += dailyData[idx];
-                                                idx++;
-                                            }
-                                            if (tempStr.length() > 0) maxTemps[day] = tempStr;
-                                        }
-                                    }
-                                    
-                                    // Extract min temps
-                                    int minTempIdx = dailyData.indexOf("\"temperature_2m_min\":");
-                                    String minTemps[3] = {"unknown", "unknown", "unknown"};
-                                    
-                                    if (minTempIdx >= 0) {
-                                        int idx = minTempIdx + 20;
-                                        while (idx < dailyData.length() && dailyData[idx] != '[') idx++;
-                                        if (idx < dailyData.length()) idx++;
-                                        
-                                        for (int day = 0; day < 3; day++) {
-                                            while (idx < dailyData.length() && (dailyData[idx] == ' ' || dailyData[idx] == '\t' || dailyData[idx] == '\n' || dailyData[idx] == '\r' || dailyData[idx] == ',')) idx++;
-                                            if (idx >= dailyData.length() || dailyData[idx] == ']') break;
-                                            
-                                            String tempStr = "";
-                                            while (idx < dailyData.length() && ((dailyData[idx] >= '0' && dailyData[idx] <= '9') || dailyData[idx] == '.' || dailyData[idx] == '-')) {
-                                                tempStr += dailyData[idx];
-                                                idx++;
-                                            }
-                                            if (tempStr.length() > 0) minTemps[day] = tempStr;
-                                        }
-                                    }
-                                    
-                                    // Extract weather codes
-                                    int wCodeIdx = dailyData.indexOf("\"weather_code\":");
-                                    int codes[3] = {-1, -1, -1};
-                                    
-                                    if (wCodeIdx >= 0) {
-                                        // Search for [ starting from wCodeIdx
-                                        int idx = wCodeIdx;
-                                        while (idx < dailyData.length() && dailyData[idx] != '[') idx++;
-                                        if (idx < dailyData.length()) idx++;  // skip the [
-                                        
-                                        for (int day = 0; day < 3; day++) {
-                                            // Skip whitespace and commas
-                                            while (idx < dailyData.length() && (dailyData[idx] == ' ' || dailyData[idx] == '\t' || dailyData[idx] == '\n' || dailyData[idx] == '\r' || dailyData[idx] == ',')) idx++;
-                                            if (idx >= dailyData.length() || dailyData[idx] == ']') break;
-                                            
-                                            String codeStr = "";
-                                            while (idx < dailyData.length() && ((dailyData[idx] >= '0' && dailyData[idx] <= '9') || dailyData[idx] == '-')) {
-                                                codeStr += dailyData[idx];
-                                                idx++;
-                                            }
-                                            if (codeStr.length() > 0) codes[day] = codeStr.toInt();
-                                        }
-                                    }
-                                    
-                                    // Build forecast output with High/Low
-                                    String forecastStr = "";
-                                    for (int day = 0; day < 3; day++) {
-                                        String maxF = celsiusToFahrenheit(maxTemps[day]);
-                                        String minF = celsiusToFahrenheit(minTemps[day]);
-                                        String weatherDesc = getWeatherDescription(codes[day]);
-                                        forecastStr += "Day " + String(day + 1) + ": High " + maxF + " / Low " + minF + " degrees Fahrenheit - " + weatherDesc;
-                                        if (day < 2) forecastStr += "\n";
-                                    }
-                                    
-                                    if (forecastStr.length() > 0) {
-                                        lastWeatherData.location = currentWeatherRequest.query;
-                                        lastWeatherData.current = "3-Day Forecast";
-                                        lastWeatherData.forecast = forecastStr;
-                                        success = true;
-                                    }
-                                }
-                            } else {
-                                // Current weather - extract current temp and conditions, plus today's high/low
-                                String tempC = extractCurrentTemperature(weatherPayload);
-                                String tempF = celsiusToFahrenheit(tempC);
-                                int code = extractWeatherCode(weatherPayload);
-                                
-                                // Also extract today's high/low from daily data
-                                String highF = "unknown";
-                                String lowF = "unknown";
-                                
-                                int dailyIdx = weatherPayload.indexOf("\"daily\":");
-                                if (dailyIdx >= 0) {
-                                    String dailyData = weatherPayload.substring(dailyIdx);
-                                    
-                                    // Extract first day's max temp
-                                    int maxTempIdx = dailyData.indexOf("\"temperature_2m_max\":");
-                                    if (maxTempIdx >= 0) {
-                                        int idx = maxTempIdx + 20;
-                                        while (idx < dailyData.length() && dailyData[idx] != '[') idx++;
-                                        if (idx < dailyData.length()) idx++;
-                                        
-                                        while (idx < dailyData.length() && (dailyData[idx] == ' ' || dailyData[idx] == '\t' || dailyData[idx] == '\n' || dailyData[idx] == '\r' || dailyData[idx] == ',')) idx++;
-                                        
-                                        String tempStr = "";
-                                        while (idx < dailyData.length() && ((dailyData[idx] >= '0' && dailyData[idx] <= '9') || dailyData[idx] == '.' || dailyData[idx] == '-')) {
-                                            tempStr += dailyData[idx];
-                                            idx++;
-                                        }
-                                        if (tempStr.length() > 0) highF = celsiusToFahrenheit(tempStr);
-                                    }
-                                    
-                                    // Extract first day's min temp
-                                    int minTempIdx = dailyData.indexOf("\"temperature_2m_min\":");
-                                    if (minTempIdx >= 0) {
-                                        int idx = minTempIdx + 20;
-                                        while (idx < dailyData.length() && dailyData[idx] != '[') idx++;
-                                        if (idx < dailyData.length()) idx++;
-                                        
-                                        while (idx < dailyData.length() && (dailyData[idx] == ' ' || dailyData[idx] == '\t' || dailyData[idx] == '\n' || dailyData[idx] == '\r' || dailyData[idx] == ',')) idx++;
-                                        
-                                        String tempStr = "";
-                                        while (idx < dailyData.length() && ((dailyData[idx] >= '0' && dailyData[idx] <= '9') || dailyData[idx] == '.' || dailyData[idx] == '-')) {
-                                            tempStr += dailyData[idx];
-                                            idx++;
-                                        }
-                                        if (tempStr.length() > 0) lowF = celsiusToFahrenheit(tempStr);
-                                    }
-                                }
-                                
-                                if (tempF != "unknown" && code >= 0) {
-                                    lastWeatherData.location = currentWeatherRequest.query;
-                                    lastWeatherData.current = "Current Temperature: " + tempF + " degrees Fahrenheit\nToday's High: " + highF + " / Low: " + lowF + " degrees Fahrenheit";
-                                    lastWeatherData.forecast = getWeatherDescription(code);
-                                    success = true;
-                                }
-                            }
-                            lastWeatherData.timestamp = now;
-                        }
-                    }
-                }
+        unsigned long elapsed = now - req.startTime;
+        
+        // Check for timeout
+        if (elapsed > WEATHER_REQUEST_TIMEOUT) {
+            weatherRequests.erase(weatherRequests.begin() + i);
+            broadcastWeather("The Weather Mage says: Unable to contact the\nweather spirits at this time.");
+            continue;
+        }
+        
+        // Check if we have a WiFi connection
+        if (WiFi.status() != WL_CONNECTED) {
+            if (elapsed > 1000) {
+                weatherRequests.erase(weatherRequests.begin() + i);
+                broadcastWeather("The Weather Mage says: The spirits are not\nresponding. Check your network connection.");
+                continue;
             }
+            i++;
+            continue;
         }
+        
+        // startWeatherFetch may erase the request on failure, so restart the scan
+        startWeatherFetch(req);
+        i = 0;
     }
+}
+
+// Serve a weather/forecast request from cache, join an identical one in
+// flight, or queue a new fetch
+void requestWeather(const String &location, bool isForecast) {
+    String city = normalizeWeatherCity(location);
+    String key = (isForecast ? "f:" : "c:") + city;
     
-    currentWeatherRequest.pending = false;
+    const WeatherData *cached = lookupWeatherCache(key);
+    if (cached) {
+        weatherCacheStats.weatherHits++;
+        lastWeatherData = *cached;
+        announceWeather(lastWeatherData);
+        return;
+    }
     
-    if (success) {
-        // Capitalize city name
-        String cityName = lastWeatherData.location;
-        if (cityName.length() > 0) {
-            cityName[0] = toupper(cityName[0]);
-        }
-        String output = cityName + "\n";
-        output += lastWeatherData.current + "\n";
-        output += lastWeatherData.forecast;
-        broadcastWeather(output);
-    } else {
-        broadcastWeather("The Weather Mage says: The spirits are\nunable to divine the weather at this time.");
+    for (const WeatherRequest &req : weatherRequests) {
+        if (req.query == key) {
+            weatherCacheStats.coalesced++;
+            return;  // Someone already asked - they will all hear the answer
+        }
     }
+    weatherCacheStats.weatherMisses++;
+    
+    WeatherRequest req;
+    req.pending = true;
+    req.isForecast = isForecast;
+    req.isLocalQuery = false;
+    req.query = key;
+    req.startTime = millis();
+    req.jobId = 0;
+    weatherRequests.push_back(req);
 }
 
 void cmdWeather(Player &p, const String &arg) {
@@ -7225,11 +9204,7 @@ void cmdWeather(Player &p, const String &arg) {
     
     // Initiate weather request for the city
     p.client.println("The Weather Mage begins to consult the spirits for " + location + "...");
-    currentWeatherRequest.pending = true;
-    currentWeatherRequest.isForecast = false;
-    currentWeatherRequest.isLocalQuery = false;
-    currentWeatherRequest.query = location;
-    currentWeatherRequest.startTime = millis();
+    requestWeather(location, false);
 }
 
 void cmdForecast(Player &p, const String &arg) {
@@ -7259,11 +9234,7 @@ void cmdForecast(Player &p, const String &arg) {
     
     // Initiate forecast request for the city
     p.client.println("The Weather Mage begins consulting the spirits for a forecast...");
-    currentWeatherRequest.pending = true;
-    currentWeatherRequest.isForecast = true;
-    currentWeatherRequest.isLocalQuery = false;
-    currentWeatherRequest.query = location;
-    currentWeatherRequest.startTime = millis();
+    requestWeather(location, true);
 }
 
 void cmdWho(Player &p) {
@@ -7272,7 +9243,7 @@ void cmdWho(Player &p) {
     
     p.client.println("\n======== Players Online ========");
     
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (players[i].active && players[i].loggedIn) {
             String name = String(players[i].name);
             if (name.length() > 0) {
@@ -7298,330 +9269,363 @@ void cmdWho(Player &p) {
 // DOWNLOAD COMMAND: HTTP FILE DOWNLOADER
 // =============================
 
-void cmdDownload(Player &p, const String &filename) {
-    String fname = filename;
-    fname.trim();
-    
-    // LIST mode: no filename provided
-    if (fname.length() == 0) {
-        p.client.println("Fetching file list from server...");
-        
-        HTTPClient http;
-        http.begin("http://www.storyboardacs.com/download.php");
-        http.setConnectTimeout(10000);
-        http.setTimeout(15000);
+// Resolve the player an async HTTP job was started for; nullptr if they
+// have since disconnected (or the slot now belongs to someone else)
+Player *findHttpJobOwner(int slot, const String &name) {
+    if (slot < 0 || slot >= maxPlayers) return nullptr;
+    Player &p = players[slot];
+    if (!p.active || !p.loggedIn || !name.equalsIgnoreCase(p.name)) return nullptr;
+    return &p;
+}
+
+int findPlayerSlot(Player &p) {
+    for (int i = 0; i < maxPlayers; i++) {
+        if (&players[i] == &p) return i;
+    }
+    return -1;
+}
+
+// State for a "download all" run (one at a time)
+struct DownloadAllProgress {
+    bool active = false;
+    int slot = -1;
+    String ownerName;
+    std::vector<String> largeFiles;   // streamed individually after the batch
+    size_t nextLarge = 0;
+    int filesDownloaded = 0;
+    unsigned long totalBytes = 0;
+    unsigned long startTime = 0;
+};
+
+DownloadAllProgress downloadAll;
+
+// Paths of the download.php file list: [{"name":..,"size":..,"modified":..}, ...]
+void wantDownloadListPaths(JsonPathExtractor &json) {
+    json.want("[].name");
+    json.want("[].size");
+    json.want("[].modified");
+}
+
+void printDownloadList(Player &p, const JsonPathExtractor &json) {
+    p.client.println("");
+    p.client.println("Filename              Size(KB)      Modified");
+    p.client.println("---------------------------------------------");
+    
+    // One row per array element; fields arrive in document order
+    for (int i = 0; ; i++) {
+        String prefix = "[" + String(i) + "].";
+        const JsonValue *name = json.find(prefix + "name");
+        if (!name) break;
         
-        int httpCode = http.GET();
+        float sizeKB = json.get(prefix + "size", "0").toInt() / 1024.0;
+        String modified = json.get(prefix + "modified");
         
-        Serial.println("[DOWNLOAD] List request HTTP code: " + String(httpCode));
+        // Format and print line
+        String line = name->value;
+        while (line.length() < 22) line += " ";
+        line += String(sizeKB, 1);
+        while (line.length() < 38) line += " ";
+        line += modified;
+        p.client.println(line);
+    }
+    p.client.println("");
+}
+
+// Final summary for "download all"
+void finishDownloadAll() {
+    Player *owner = findHttpJobOwner(downloadAll.slot, downloadAll.ownerName);
+    unsigned long elapsed = millis() - downloadAll.startTime;
+    float speed = (downloadAll.totalBytes / 1024.0) / (elapsed / 1000.0);
+    
+    Serial.println("[DOWNLOAD ALL] " + String(downloadAll.filesDownloaded) + " files, " + String(downloadAll.totalBytes) + " bytes");
+    
+    if (owner) {
+        owner->client.println("");
+        owner->client.println("Download complete: " + String(downloadAll.filesDownloaded) + " files synced");
+        owner->client.println("Total: " + String(downloadAll.totalBytes) + " bytes in " + String(elapsed) + "ms");
+        owner->client.println("Speed: " + String(speed, 1) + " KB/s");
         
-        if (httpCode != 200) {
-            p.client.println("Error: HTTP " + String(httpCode));
-            http.end();
-            return;
+        // Force rebuild of room indexes after download all
+        owner->client.println("");
+        owner->client.println("Rebuilding room indexes...");
+    }
+    buildRoomIndexesIfNeeded(true);  // Force rebuild
+    loadRoomGraph();
+    if (owner) {
+        owner->client.println("Room indexes rebuilt.");
+        owner->client.print("> ");
+    }
+    
+    downloadAll.active = false;
+    downloadAll.largeFiles.clear();
+}
+
+// Stream the next large file of a "download all" run, or finish
+void downloadAllNextLargeFile() {
+    if (downloadAll.nextLarge >= downloadAll.largeFiles.size()) {
+        finishDownloadAll();
+        return;
+    }
+    
+    String largeFile = downloadAll.largeFiles[downloadAll.nextLarge++];
+    Player *owner = findHttpJobOwner(downloadAll.slot, downloadAll.ownerName);
+    if (owner) owner->client.println("Downloading " + largeFile + " (streaming)...");
+    
+    HttpJob *job = new HttpJob();
+    job->url = "http://www.storyboardacs.com/download.php?file=" + largeFile;
+    job->saveToPath = "/" + largeFile;
+    job->connectTimeoutMs = 10000;
+    job->timeoutMs = 30000;
+    job->deadlineMs = 60000;  // 60 second timeout for large files
+    job->onComplete = [](HttpJob &done) {
+        Player *owner = findHttpJobOwner(downloadAll.slot, downloadAll.ownerName);
+        if (done.ok()) {
+            if (owner) owner->client.println("  Downloaded " + String((int)done.bytesWritten) + " bytes");
+            downloadAll.filesDownloaded++;
+            downloadAll.totalBytes += done.bytesWritten;
+        } else if (owner) {
+            if (done.timedOut) {
+                owner->client.println("  Error: Download timeout");
+            } else if (done.httpCode == HTTP_JOB_ERROR_FILE) {
+                owner->client.println("  Error: Could not create file");
+            } else if (done.httpCode == HTTP_JOB_ERROR_INCOMPLETE) {
+                owner->client.println("  Error: Incomplete download (" + String((int)done.bytesWritten) + "/" + String(done.contentLength) + " bytes)");
+            } else {
+                owner->client.println("  Error: HTTP " + String(done.httpCode));
+            }
         }
+        downloadAllNextLargeFile();
+    };
+    
+    if (httpJobSubmit(job) == 0) {
+        if (owner) owner->client.println("  Error: download queue is full");
+        downloadAllNextLargeFile();
+    }
+}
+
+// Unpack the base64 batch from download.php?all=1 (skipping large files)
+void writeDownloadBatch(const String &response) {
+    Player *owner = findHttpJobOwner(downloadAll.slot, downloadAll.ownerName);
+    std::vector<String> &largeFiles = downloadAll.largeFiles;
+    int fileCount = 0;
+    
+    // Count small files in response (exclude large files)
+    int pos2 = 0;
+    while ((pos2 = response.indexOf("\"name\":", pos2)) != -1) {
+        int nameStartPos = response.indexOf("\"", pos2 + 7);
+        int nameEndPos = response.indexOf("\"", nameStartPos + 1);
+        String filename = response.substring(nameStartPos + 1, nameEndPos);
         
-        String response = http.getString();
-        http.end();
-        
-        // Parse JSON and format for display
-        p.client.println("");
-        p.client.println("Filename              Size(KB)      Modified");
-        p.client.println("---------------------------------------------");
-        
-        // Simple JSON parsing for array of objects
-        int pos = 0;
-        while (true) {
-            // Find next "name" field
-            int namePos = response.indexOf("\"name\":", pos);
-            if (namePos == -1) break;
-            
-            // Extract filename
-            int nameStartPos = response.indexOf("\"", namePos + 7);
-            int nameEndPos = response.indexOf("\"", nameStartPos + 1);
-            String filename = response.substring(nameStartPos + 1, nameEndPos);
-            
-            // Find size field after this name
-            int sizePos = response.indexOf("\"size\":", nameEndPos);
-            int sizeStartPos = response.indexOf(":", sizePos) + 1;
-            while (response[sizeStartPos] == ' ') sizeStartPos++;
-            int sizeEndPos = sizeStartPos;
-            while (sizeEndPos < response.length() && isdigit(response[sizeEndPos])) sizeEndPos++;
-            int sizeBytes = response.substring(sizeStartPos, sizeEndPos).toInt();
-            float sizeKB = sizeBytes / 1024.0;
-            
-            // Find modified field
-            int modPos = response.indexOf("\"modified\":", sizeEndPos);
-            int modStartPos = response.indexOf("\"", modPos + 11);
-            int modEndPos = response.indexOf("\"", modStartPos + 1);
-            String modified = response.substring(modStartPos + 1, modEndPos);
-            
-            // Format and print line
-            String line = filename;
-            while (line.length() < 22) line += " ";
-            line += String(sizeKB, 1);
-            while (line.length() < 38) line += " ";
-            line += modified;
-            p.client.println(line);
-            
-            pos = modEndPos;
+        bool isLarge = false;
+        for (const String &lf : largeFiles) {
+            if (filename == lf) {
+                isLarge = true;
+                break;
+            }
         }
-        p.client.println("");
+        
+        if (!isLarge) fileCount++;
+        pos2 += 7;
+    }
+    
+    if (fileCount == 0 && largeFiles.size() == 0) {
+        if (owner) owner->client.println("Error: No files in response or invalid JSON");
         return;
     }
     
-    // DOWNLOAD ALL FILES mode: check if "all" was specified
-    if (fname.equalsIgnoreCase("all")) {
-        p.client.println("Downloading all files from server...");
-        
-        // First, get the list to check file sizes
-        HTTPClient httpList;
-        httpList.begin("http://www.storyboardacs.com/download.php");
-        httpList.setConnectTimeout(10000);
-        httpList.setTimeout(15000);
-        
-        int httpCode = httpList.GET();
-        if (httpCode != 200) {
-            p.client.println("Error: Could not get file list (HTTP " + String(httpCode) + ")");
-            httpList.end();
-            return;
-        }
+    // Download small files from batch
+    pos2 = 0;
+    int currentFile = 1;
+    
+    while (true) {
+        int namePos = response.indexOf("\"name\":", pos2);
+        if (namePos == -1) break;
         
-        String listResponse = httpList.getString();
-        httpList.end();
+        int nameStartPos = response.indexOf("\"", namePos + 7);
+        int nameEndPos = response.indexOf("\"", nameStartPos + 1);
+        String remoteFilename = response.substring(nameStartPos + 1, nameEndPos);
         
-        // Parse list to find large files (> 100KB) that should be downloaded individually
-        std::vector<String> largeFiles;
-        int pos = 0;
-        while (true) {
-            int namePos = listResponse.indexOf("\"name\":", pos);
-            if (namePos == -1) break;
-            
-            int nameStartPos = listResponse.indexOf("\"", namePos + 7);
-            int nameEndPos = listResponse.indexOf("\"", nameStartPos + 1);
-            String filename = listResponse.substring(nameStartPos + 1, nameEndPos);
-            
-            int sizePos = listResponse.indexOf("\"size\":", nameEndPos);
-            int sizeStartPos = listResponse.indexOf(":", sizePos) + 1;
-            while (sizeStartPos < listResponse.length() && listResponse[sizeStartPos] == ' ') sizeStartPos++;
-            int sizeEndPos = sizeStartPos;
-            while (sizeEndPos < listResponse.length() && isdigit(listResponse[sizeEndPos])) sizeEndPos++;
-            int sizeBytes = listResponse.substring(sizeStartPos, sizeEndPos).toInt();
-            
-            // Files > 100KB will be downloaded individually (to avoid RAM overflow)
-            if (sizeBytes > 100 * 1024) {
-                largeFiles.push_back(filename);
-                p.client.println("Note: " + filename + " (" + String(sizeBytes/1024) + "KB) will be downloaded separately...");
+        // Skip large files (download them individually later)
+        bool isLarge = false;
+        for (const String &lf : largeFiles) {
+            if (remoteFilename == lf) {
+                isLarge = true;
+                break;
             }
-            
-            pos = sizeEndPos;
         }
         
-        // Download small files via batch mode (download.php?all=1)
-        HTTPClient http;
-        http.begin("http://www.storyboardacs.com/download.php?all=1");
-        http.setConnectTimeout(10000);
-        http.setTimeout(30000);
+        if (isLarge) {
+            pos2 = nameEndPos;
+            continue;
+        }
         
-        httpCode = http.GET();
+        // Find content field
+        int contentPos = response.indexOf("\"content\":", nameEndPos);
+        if (contentPos == -1) {
+            pos2 = nameEndPos;
+            continue;
+        }
         
-        Serial.println("[DOWNLOAD ALL] HTTP code: " + String(httpCode));
+        int contentStartPos = response.indexOf("\"", contentPos + 10);
+        int contentEndPos = response.indexOf("\"", contentStartPos + 1);
+        String base64Content = response.substring(contentStartPos + 1, contentEndPos);
         
-        if (httpCode != 200) {
-            p.client.println("Error: HTTP " + String(httpCode));
-            http.end();
-            return;
-        }
+        // Decode base64 content
+        String progress = "[" + String(currentFile) + "/" + String(fileCount) + "] Downloading " + remoteFilename + "... ";
         
-        String response = http.getString();
-        http.end();
+        int decodedSize = (base64Content.length() * 3) / 4;
+        uint8_t *decodedData = new uint8_t[decodedSize];
         
-        int fileCount = 0;
-        int filesDownloaded = 0;
-        unsigned long totalBytes = 0;
-        unsigned long startTime = millis();
+        int actualSize = base64_decode(decodedData, decodedSize, (const char*)base64Content.c_str());
         
-        // Count small files in response (exclude large files)
-        int pos2 = 0;
-        while ((pos2 = response.indexOf("\"name\":", pos2)) != -1) {
-            int nameStartPos = response.indexOf("\"", pos2 + 7);
-            int nameEndPos = response.indexOf("\"", nameStartPos + 1);
-            String filename = response.substring(nameStartPos + 1, nameEndPos);
-            
-            bool isLarge = false;
-            for (const String &lf : largeFiles) {
-                if (filename == lf) {
-                    isLarge = true;
-                    break;
-                }
-            }
-            
-            if (!isLarge) fileCount++;
-            pos2 += 7;
+        if (actualSize <= 0) {
+            if (owner) owner->client.println(progress + "(base64 decode error)");
+            delete[] decodedData;
+            pos2 = contentEndPos;
+            currentFile++;
+            continue;
         }
         
-        if (fileCount == 0 && largeFiles.size() == 0) {
-            p.client.println("Error: No files in response or invalid JSON");
-            return;
+        File file = LittleFS.open("/" + remoteFilename, "w");
+        if (!file) {
+            if (owner) owner->client.println(progress + "(file create error)");
+            delete[] decodedData;
+            pos2 = contentEndPos;
+            currentFile++;
+            continue;
         }
         
-        // Download small files from batch
-        pos2 = 0;
-        int currentFile = 1;
+        int written = file.write(decodedData, actualSize);
+        file.close();
         
-        while (true) {
-            int namePos = response.indexOf("\"name\":", pos2);
-            if (namePos == -1) break;
-            
-            int nameStartPos = response.indexOf("\"", namePos + 7);
-            int nameEndPos = response.indexOf("\"", nameStartPos + 1);
-            String remoteFilename = response.substring(nameStartPos + 1, nameEndPos);
-            
-            // Skip large files (download them individually later)
-            bool isLarge = false;
-            for (const String &lf : largeFiles) {
-                if (remoteFilename == lf) {
-                    isLarge = true;
-                    break;
-                }
-            }
-            
-            if (isLarge) {
-                pos2 = nameEndPos;
-                continue;
-            }
-            
-            // Find content field
-            int contentPos = response.indexOf("\"content\":", nameEndPos);
-            if (contentPos == -1) {
-                pos2 = nameEndPos;
-                continue;
-            }
-            
-            int contentStartPos = response.indexOf("\"", contentPos + 10);
-            int contentEndPos = response.indexOf("\"", contentStartPos + 1);
-            String base64Content = response.substring(contentStartPos + 1, contentEndPos);
-            
-            // Decode base64 content
-            p.client.print("[" + String(currentFile) + "/" + String(fileCount) + "] Downloading " + remoteFilename + "... ");
-            
-            int decodedSize = (base64Content.length() * 3) / 4;
-            uint8_t *decodedData = new uint8_t[decodedSize];
-            
-            int actualSize = base64_decode(decodedData, decodedSize, (const char*)base64Content.c_str());
-            
-            if (actualSize <= 0) {
-                p.client.println("(base64 decode error)");
-                delete[] decodedData;
-                pos2 = contentEndPos;
-                currentFile++;
-                continue;
-            }
-            
-            File file = LittleFS.open("/" + remoteFilename, "w");
-            if (!file) {
-                p.client.println("(file create error)");
-                delete[] decodedData;
-                pos2 = contentEndPos;
-                currentFile++;
-                continue;
-            }
-            
-            int written = file.write(decodedData, actualSize);
-            file.close();
+        if (written == actualSize) {
+            if (owner) owner->client.println(progress + String(actualSize) + " bytes");
+            downloadAll.filesDownloaded++;
+            downloadAll.totalBytes += actualSize;
+        } else {
+            if (owner) owner->client.println(progress + "(write error)");
+        }
+        
+        delete[] decodedData;
+        pos2 = contentEndPos;
+        currentFile++;
+    }
+}
+
+void cmdDownload(Player &p, const String &filename) {
+    String fname = filename;
+    fname.trim();
+    
+    int slot = findPlayerSlot(p);
+    String ownerName = String(p.name);
+    
+    // LIST mode: no filename provided
+    if (fname.length() == 0) {
+        p.client.println("Fetching file list from server...");
+        
+        HttpJob *job = new HttpJob();
+        job->url = "http://www.storyboardacs.com/download.php";
+        wantDownloadListPaths(job->json);
+        job->connectTimeoutMs = 10000;
+        job->timeoutMs = 15000;
+        job->onComplete = [slot, ownerName](HttpJob &done) {
+            Serial.println("[DOWNLOAD] List request HTTP code: " + String(done.httpCode));
+            Player *owner = findHttpJobOwner(slot, ownerName);
+            if (!owner) return;
             
-            if (written == actualSize) {
-                p.client.println(String(actualSize) + " bytes");
-                filesDownloaded++;
-                totalBytes += actualSize;
+            if (!done.ok()) {
+                owner->client.println("Error: HTTP " + String(done.httpCode));
             } else {
-                p.client.println("(write error)");
+                printDownloadList(*owner, done.json);
             }
-            
-            delete[] decodedData;
-            pos2 = contentEndPos;
-            currentFile++;
+            owner->client.print("> ");
+        };
+        
+        if (httpJobSubmit(job) == 0) {
+            p.client.println("Error: download queue is full, try again shortly.");
+        }
+        return;
+    }
+    
+    // DOWNLOAD ALL FILES mode: check if "all" was specified
+    if (fname.equalsIgnoreCase("all")) {
+        if (downloadAll.active) {
+            p.client.println("A full download is already in progress.");
+            return;
         }
+        p.client.println("Downloading all files from server...");
         
-        // Download large files individually with streaming
-        for (const String &largeFile : largeFiles) {
-            p.client.println("Downloading " + largeFile + " (streaming)...");
-            
-            HTTPClient streamHttp;
-            String downloadUrl = "http://www.storyboardacs.com/download.php?file=" + largeFile;
-            
-            streamHttp.begin(downloadUrl);
-            streamHttp.setConnectTimeout(10000);
-            streamHttp.setTimeout(30000);
-            
-            int streamCode = streamHttp.GET();
-            
-            if (streamCode != 200) {
-                p.client.println("  Error: HTTP " + String(streamCode));
-                streamHttp.end();
-                continue;
-            }
-            
-            int fileSize = streamHttp.getSize();
-            if (fileSize <= 0) {
-                p.client.println("  Error: Could not determine file size");
-                streamHttp.end();
-                continue;
-            }
-            
-            File file = LittleFS.open("/" + largeFile, "w");
-            if (!file) {
-                p.client.println("  Error: Could not create file");
-                streamHttp.end();
-                continue;
+        downloadAll = DownloadAllProgress();
+        downloadAll.active = true;
+        downloadAll.slot = slot;
+        downloadAll.ownerName = ownerName;
+        downloadAll.startTime = millis();
+        
+        // First, get the list to check file sizes
+        HttpJob *listJob = new HttpJob();
+        listJob->url = "http://www.storyboardacs.com/download.php";
+        wantDownloadListPaths(listJob->json);
+        listJob->connectTimeoutMs = 10000;
+        listJob->timeoutMs = 15000;
+        listJob->onComplete = [](HttpJob &listDone) {
+            Player *owner = findHttpJobOwner(downloadAll.slot, downloadAll.ownerName);
+            if (!listDone.ok()) {
+                if (owner) {
+                    owner->client.println("Error: Could not get file list (HTTP " + String(listDone.httpCode) + ")");
+                    owner->client.print("> ");
+                }
+                downloadAll.active = false;
+                return;
             }
             
-            WiFiClient *stream = streamHttp.getStreamPtr();
-            int bytesWritten = 0;
-            uint8_t buffer[4096];
-            int bytesRead = 0;
-            unsigned long fileStartTime = millis();
-            const unsigned long TIMEOUT = 60000;  // 60 second timeout for large files
-            
-            while (streamHttp.connected() && (bytesRead = stream->readBytes(buffer, sizeof(buffer))) > 0) {
-                file.write(buffer, bytesRead);
-                bytesWritten += bytesRead;
+            // Parse list to find large files (> 100KB) that should be downloaded individually
+            for (int i = 0; ; i++) {
+                String prefix = "[" + String(i) + "].";
+                const JsonValue *name = listDone.json.find(prefix + "name");
+                if (!name) break;
                 
-                if (millis() - fileStartTime > TIMEOUT) {
-                    p.client.println("  Error: Download timeout");
-                    file.close();
-                    LittleFS.remove("/" + largeFile);
-                    streamHttp.end();
-                    break;
+                String filename = name->value;
+                int sizeBytes = listDone.json.get(prefix + "size", "0").toInt();
+                
+                // Files > 100KB will be downloaded individually (to avoid RAM overflow)
+                if (sizeBytes > 100 * 1024) {
+                    downloadAll.largeFiles.push_back(filename);
+                    if (owner) owner->client.println("Note: " + filename + " (" + String(sizeBytes/1024) + "KB) will be downloaded separately...");
                 }
             }
             
-            file.close();
-            streamHttp.end();
+            // Download small files via batch mode (download.php?all=1)
+            HttpJob *batchJob = new HttpJob();
+            batchJob->url = "http://www.storyboardacs.com/download.php?all=1";
+            batchJob->connectTimeoutMs = 10000;
+            batchJob->timeoutMs = 30000;
+            batchJob->onComplete = [](HttpJob &batchDone) {
+                Serial.println("[DOWNLOAD ALL] HTTP code: " + String(batchDone.httpCode));
+                if (!batchDone.ok()) {
+                    Player *owner = findHttpJobOwner(downloadAll.slot, downloadAll.ownerName);
+                    if (owner) {
+                        owner->client.println("Error: HTTP " + String(batchDone.httpCode));
+                        owner->client.print("> ");
+                    }
+                    downloadAll.active = false;
+                    return;
+                }
+                writeDownloadBatch(batchDone.response);
+                
+                // Download large files individually with streaming
+                downloadAllNextLargeFile();
+            };
             
-            if (bytesWritten == fileSize) {
-                p.client.println("  Downloaded " + String(bytesWritten) + " bytes");
-                filesDownloaded++;
-                totalBytes += bytesWritten;
-            } else {
-                p.client.println("  Error: Incomplete download (" + String(bytesWritten) + "/" + String(fileSize) + " bytes)");
+            if (httpJobSubmit(batchJob) == 0) {
+                if (owner) owner->client.println("Error: download queue is full, try again shortly.");
+                downloadAll.active = false;
             }
-        }
-        
-        unsigned long elapsed = millis() - startTime;
-        float speed = (totalBytes / 1024.0) / (elapsed / 1000.0);
-        
-        p.client.println("");
-        p.client.println("Download complete: " + String(filesDownloaded) + " files synced");
-        p.client.println("Total: " + String(totalBytes) + " bytes in " + String(elapsed) + "ms");
-        p.client.println("Speed: " + String(speed, 1) + " KB/s");
-        
-        // Force rebuild of room indexes after download all
-        p.client.println("");
-        p.client.println("Rebuilding room indexes...");
-        buildRoomIndexesIfNeeded(true);  // Force rebuild
-        p.client.println("Room indexes rebuilt.");
+        };
         
+        if (httpJobSubmit(listJob) == 0) {
+            p.client.println("Error: download queue is full, try again shortly.");
+            downloadAll.active = false;
+        }
         return;
     }
 
@@ -7633,66 +9637,43 @@ void cmdDownload(Player &p, const String &filename) {
     
     p.client.println("Downloading " + fname + "...");
     
-    HTTPClient http;
-    String downloadUrl = "http://www.storyboardacs.com/download.php?file=" + fname;
-    
-    http.begin(downloadUrl);
-    http.setConnectTimeout(10000);
-    http.setTimeout(15000);
-    
-    int httpCode = http.GET();
-    
-    if (httpCode != 200) {
-        p.client.println("Error: HTTP " + String(httpCode));
-        Serial.println("[DOWNLOAD] HTTP Error: " + String(httpCode));
-        http.end();
-        return;
-    }
-    
-    int fileSize = http.getSize();
-    if (fileSize <= 0) {
-        p.client.println("Error: Could not determine file size.");
-        http.end();
-        return;
-    }
-    
-    // Create/open file in LittleFS
-    File file = LittleFS.open("/" + fname, "w");
-    if (!file) {
-        p.client.println("Error: Could not create file on device.");
-        http.end();
-        return;
-    }
-    
-    // Stream data to file with larger buffer for better performance
-    WiFiClient *stream = http.getStreamPtr();
-    int bytesWritten = 0;
-    uint8_t buffer[4096];  // Increased from 256 to 4096 bytes for better throughput
-    int bytesRead = 0;
-    unsigned long startTime = millis();
-    const unsigned long TIMEOUT = 30000;
-    
-    while (http.connected() && (bytesRead = stream->readBytes(buffer, sizeof(buffer))) > 0) {
-        file.write(buffer, bytesRead);
-        bytesWritten += bytesRead;
-        
-        if (millis() - startTime > TIMEOUT) {
-            p.client.println("Error: Download timeout.");
-            file.close();
-            LittleFS.remove("/" + fname);
-            http.end();
+    // Stream data straight to LittleFS from the HTTP worker
+    HttpJob *job = new HttpJob();
+    job->url = "http://www.storyboardacs.com/download.php?file=" + fname;
+    job->saveToPath = "/" + fname;
+    job->connectTimeoutMs = 10000;
+    job->timeoutMs = 15000;
+    job->deadlineMs = 30000;
+    job->onComplete = [slot, ownerName, fname](HttpJob &done) {
+        Player *owner = findHttpJobOwner(slot, ownerName);
+        if (!done.ok()) {
+            Serial.println("[DOWNLOAD] HTTP Error: " + String(done.httpCode));
+            if (!owner) return;
+            if (done.timedOut) {
+                owner->client.println("Error: Download timeout.");
+            } else if (done.httpCode == HTTP_JOB_ERROR_FILE) {
+                owner->client.println("Error: Could not create file on device.");
+            } else if (done.httpCode == HTTP_JOB_ERROR_INCOMPLETE) {
+                owner->client.println("Error: Incomplete download (" + String((int)done.bytesWritten) + "/" + String(done.contentLength) + " bytes)");
+            } else {
+                owner->client.println("Error: HTTP " + String(done.httpCode));
+            }
+            owner->client.print("> ");
             return;
         }
-    }
-    
-    file.close();
-    http.end();
-    
-    unsigned long elapsed = millis() - startTime;
-    float speed = (bytesWritten / 1024.0) / (elapsed / 1000.0);  // KB/s
+        if (!owner) return;
+        
+        unsigned long elapsed = done.finishedAt - done.startedAt;
+        float speed = (done.bytesWritten / 1024.0) / (elapsed / 1000.0);  // KB/s
+        
+        owner->client.println("Downloaded " + String((int)done.bytesWritten) + " bytes in " + String(elapsed) + "ms");
+        owner->client.println("Speed: " + String(speed, 1) + " KB/s to /" + fname);
+        owner->client.print("> ");
+    };
     
-    p.client.println("Downloaded " + String(bytesWritten) + " bytes in " + String(elapsed) + "ms");
-    p.client.println("Speed: " + String(speed, 1) + " KB/s to /" + fname);
+    if (httpJobSubmit(job) == 0) {
+        p.client.println("Error: download queue is full, try again shortly.");
+    }
 }
 
 // =============================
@@ -7944,7 +9925,6 @@ void initializeHighLowSession(int playerIndex) {
     // Note: pot is now global (globalHighLowPot), not per-player
     session.gameActive = false;
     session.awaitingAceDeclaration = false;
-    session.awaitingContinue = false;
     session.betWasPot = false;
     
     // Create 104-card deck (double deck)
@@ -8024,8 +10004,7 @@ void dealHighLowHand(Player &p, int playerIndex) {
     if (session.card1.isAce) {
         printCard(p, session.card1);
         p.client.println("");
-        session.awaitingAceDeclaration = true;
-        p.client.println("High or Low?  Enter '1' for Low and '2' for High");
+        promptHighLowAce(p, playerIndex);
         return;
     }
     
@@ -8033,9 +10012,8 @@ void dealHighLowHand(Player &p, int playerIndex) {
     if (session.card2.isAce) {
         printTwoCardsSideBySide(p, session.card1, session.card2);
         p.client.println("");
-        session.awaitingAceDeclaration = true;
         p.client.println("The second card is an Ace!");
-        p.client.println("High or Low?  Enter '1' for Low and '2' for High");
+        promptHighLowAce(p, playerIndex);
         return;
     }
     
@@ -8282,12 +10260,57 @@ void declareAceValue(Player &p, int playerIndex, int aceValue) {
     p.client.println("Enter bet amount, 'pot' or 'end':");
 }
 
-void promptHighLowContinue(Player &p, int playerIndex) {
-    HighLowSession &session = highLowSessions[playerIndex];
+// Answer to "High or Low?" - anything else is handled as a normal command
+PromptResult handleHighLowAce(Player &p, int playerIndex, const String &line) {
+    String choice = cleanInput(line);
+    choice.toLowerCase();
+    
+    if (choice == "1") {
+        declareAceValue(p, playerIndex, 1);  // Low
+        return PROMPT_DONE;
+    } else if (choice == "2") {
+        declareAceValue(p, playerIndex, 2);  // High
+        return PROMPT_DONE;
+    } else if (choice == "end" || choice == "quit") {
+        endHighLowGame(p, playerIndex);
+        return PROMPT_DONE;
+    }
+    return PROMPT_PASS;
+}
+
+void promptHighLowAce(Player &p, int playerIndex) {
+    highLowSessions[playerIndex].awaitingAceDeclaration = true;
+    setPrompt(p, playerIndex, "High or Low?  Enter '1' for Low and '2' for High", PROMPT_TEXT, handleHighLowAce);
+}
+
+// Answer to "Press [Enter] to continue" after a hand
+PromptResult handleHighLowContinue(Player &p, int playerIndex, const String &line) {
+    String choice = line;
+    choice.trim();
+    choice.toLowerCase();
     
-    // Mark that we're waiting for continue/end decision
-    session.awaitingContinue = true;
+    if (choice.length() == 0) {
+        // Empty input - start next hand
+        p.client.println("");
+        dealHighLowHand(p, playerIndex);
+        return PROMPT_DONE;
+    } else if (choice == "end" || choice == "quit") {
+        // End the game
+        endHighLowGame(p, playerIndex);
+        return PROMPT_DONE;
+    } else if (choice == "n" || choice == "s" || choice == "e" || choice == "w" || choice.startsWith("go ")) {
+        // Allow movement - leaving the room ends the game
+        return PROMPT_ABANDON;
+    }
+    
+    // Invalid input during continue prompt
     p.client.println("Press [Enter] to continue or type 'end'");
+    return PROMPT_RETRY;
+}
+
+void promptHighLowContinue(Player &p, int playerIndex) {
+    // Wait for continue/end decision
+    setPrompt(p, playerIndex, "Press [Enter] to continue or type 'end'", PROMPT_ANY, handleHighLowContinue);
 }
 
 void endHighLowGame(Player &p, int playerIndex) {
@@ -8295,7 +10318,7 @@ void endHighLowGame(Player &p, int playerIndex) {
     
     session.gameActive = false;
     session.awaitingAceDeclaration = false;
-    session.awaitingContinue = false;
+    clearPrompt(playerIndex);
     p.client.println("");
     p.client.println("Game ended.");
     p.client.println("");
@@ -9368,18 +11391,70 @@ void processChessMove(Player &p, int playerIndex, ChessSession &session, String
         return;
     }
     
+    // A pawn reaching the last rank: ask what it becomes before playing the move
+    unsigned char movingPiece = session.board[fromRow * 8 + fromCol];
+    if ((movingPiece == 1 && toRow == 7) || (movingPiece == 7 && toRow == 0)) {
+        auto promote = [fromRow, fromCol, toRow, toCol, moveStr](Player &pl, int idx, unsigned char baseType) {
+            ChessSession &s = chessSessions[idx];
+            if (!s.gameActive || s.gameEnded) return;
+            playPlayerChessMove(pl, idx, s, fromRow, fromCol, toRow, toCol, moveStr, baseType);
+        };
+        setPrompt(p, playerIndex, "Promote to (q)ueen, (r)ook, (b)ishop or k(n)ight?", PROMPT_TEXT,
+            [promote](Player &pl, int idx, const String &line) {
+                String choice = cleanInput(line);
+                choice.toLowerCase();
+                if (choice == "resign" || choice == "end" || choice == "quit") return PROMPT_ABANDON;
+                unsigned char baseType = 0;
+                if (choice == "q" || choice == "queen") baseType = 5;
+                else if (choice == "r" || choice == "rook") baseType = 4;
+                else if (choice == "b" || choice == "bishop") baseType = 3;
+                else if (choice == "n" || choice == "knight") baseType = 2;
+                if (baseType == 0) {
+                    pl.client.println("Enter q, r, b or n.");
+                    return PROMPT_RETRY;
+                }
+                promote(pl, idx, baseType);
+                return PROMPT_DONE;
+            },
+            CHESS_PROMOTION_TIMEOUT,
+            [promote](Player &pl, int idx) {
+                pl.client.println("");
+                pl.client.println("No answer - your pawn becomes a Queen.");
+                promote(pl, idx, 5);
+                pl.client.print("> ");
+            });
+        return;
+    }
+    
+    playPlayerChessMove(p, playerIndex, session, fromRow, fromCol, toRow, toCol, moveStr, 0);
+}
+
+// Play a validated player move (promoteTo = piece type 2-5 for a promoting
+// pawn, 0 otherwise), show it, then let the engine answer
+void playPlayerChessMove(Player &p, int playerIndex, ChessSession &session,
+                         int fromRow, int fromCol, int toRow, int toCol,
+                         const String &moveStr, unsigned char promoteTo) {
+    bool isPlayerWhite = session.playerIsWhite;
+    
     // Save info about the move before applying it
     unsigned char movedPiece = session.board[fromRow * 8 + fromCol];
     unsigned char capturedPiece = session.board[toRow * 8 + toCol];
     
     // Move is valid - apply it
     applyMove(session.board, fromRow, fromCol, toRow, toCol);
+    if (promoteTo != 0) {
+        session.board[toRow * 8 + toCol] = promoteTo + (movedPiece > 6 ? 6 : 0);
+    }
     session.lastPlayerMove = moveStr;
     session.isBlackToMove = !session.isBlackToMove;
     session.moveCount++;
     
     // Display formatted move (use movedPiece and capturedPiece saved before the move)
     String moveNotation = formatChessMoveWithPieces(fromRow, fromCol, toRow, toCol, movedPiece, capturedPiece);
+    if (promoteTo != 0) {
+        const char *promotedNames[] = { "", "", "Knight", "Bishop", "Rook", "Queen" };
+        moveNotation += String(" and promotes to ") + promotedNames[promoteTo];
+    }
     
     // Check for checkmate or check against engine
     bool playerIsCheckmate = false;
@@ -9567,11 +11642,26 @@ void processChessMove(Player &p, int playerIndex, ChessSession &session, String
         }
     }
     
-    // Play instantly from opening book, add think delay otherwise
+    // Play instantly from opening book, add think time otherwise.  The pause
+    // is queued for this player only so the rest of the MUD keeps running.
     if (!moveFromOpeningBook && foundEngineMove) {
-        delay(getEngineThinkingTimeMs());  // Dynamic think time based on activity
+        queuePause(p, getEngineThinkingTimeMs());  // Dynamic think time based on activity
+        queueAction(p, [playerIndex, bestFromR, bestFromC, bestToR, bestToC](Player &pl) {
+            playEngineMove(pl, chessSessions[playerIndex], true, bestFromR, bestFromC, bestToR, bestToC);
+        });
+        return;
     }
     
+    playEngineMove(p, session, foundEngineMove, bestFromR, bestFromC, bestToR, bestToC);
+}
+
+// Apply the engine's chosen move (or report that it found none) and show the result
+void playEngineMove(Player &p, ChessSession &session, bool foundEngineMove,
+                    int bestFromR, int bestFromC, int bestToR, int bestToC) {
+    bool isPlayerWhite = session.playerIsWhite;
+    String engineMove = "";
+    String endReason = "";
+    
     // Apply the move found
     if (foundEngineMove) {
         // Save move info before applying
@@ -9618,6 +11708,11 @@ void processChessMove(Player &p, int playerIndex, ChessSession &session, String
         }
         
         applyMove(session.board, bestFromR, bestFromC, bestToR, bestToC);
+        // The engine always promotes to a Queen
+        if ((enginePiece == 1 && bestToR == 7) || (enginePiece == 7 && bestToR == 0)) {
+            session.board[bestToR * 8 + bestToC] = (enginePiece == 1) ? 5 : 11;
+            engineMoveNotation += " and promotes to Queen";
+        }
         
         char fromColChar = 'a' + bestFromC;
         char fromRowChar = '1' + bestFromR;
@@ -9906,6 +12001,8 @@ void cmdHelp(Player &p) {
     // --- World navigation ---
     p.client.println("map                    - Toggle the Mapper Utility on or off");
     p.client.println("townmap                - Town Map of Espertheru");
+    p.client.println("where [place]          - How far the bank, post office and church are");
+    p.client.println("path <place>           - Directions to the bank, post office or church");
 
     // --- Account / system ---
     p.client.println("password               - Change your password");
@@ -9952,7 +12049,7 @@ void cmdQrCode(Player &p, const String &input) {
     // Try to find player with firstWord as name
     Player* targetPlayer = nullptr;
     if (firstWord.length() > 0) {
-        for (int i = 0; i < MAX_PLAYERS; i++) {
+        for (int i = 0; i < maxPlayers; i++) {
             if (players[i].active && players[i].loggedIn &&
                 strcasecmp(players[i].name, firstWord.c_str()) == 0) {
                 targetPlayer = &players[i];
@@ -10122,6 +12219,15 @@ String getMapBlock(int exit_n, int exit_s, int exit_e, int exit_w,
     return result;
 }
 
+// Map block for a room of the room graph
+String getRoomMapBlock(int room, bool isPlayerHere = false, char locationCode = 0) {
+    uint16_t exits = roomNodes[room].exits;
+    auto has = [exits](int d) { return (int)((exits >> d) & 1); };
+    return getMapBlock(has(DIR_NORTH), has(DIR_SOUTH), has(DIR_EAST), has(DIR_WEST),
+                       has(DIR_NE), has(DIR_NW), has(DIR_SE), has(DIR_SW),
+                       has(DIR_UP), has(DIR_DOWN), isPlayerHere, locationCode);
+}
+
 char getLocationCode(int x, int y) {
     // Map coordinates to location codes
     if (x == 250 && y == 250) return 'C';  // Church
@@ -10148,87 +12254,10 @@ void drawPlayerMap(Player &p) {
     const int GRID_RADIUS = 10;  // 10 voxels in each direction from player
     int TARGET_Z = p.roomZ;       // Use player's current Z level
 
-    // Read all rooms on this Z level
-    File f = LittleFS.open("/rooms.txt", "r");
-    if (!f) {
-        return;
-    }
-
-    std::map<uint64_t, String> roomMap;  // key = packVoxelKey(x,y,z), value = room line
-
-    if (f.available()) f.readStringUntil('\n');  // Skip header
-
-    while (f.available()) {
-        String line = f.readStringUntil('\n');
-        line.trim();
-        if (line.length() == 0) continue;
-
-        // Parse CSV: x,y,z,...
-        int c1 = line.indexOf(',');
-        int c2 = line.indexOf(',', c1 + 1);
-        int c3 = line.indexOf(',', c2 + 1);
-
-        if (c1 < 0 || c2 < 0 || c3 < 0) continue;
-
-        int x = line.substring(0, c1).toInt();
-        int y = line.substring(c1 + 1, c2).toInt();
-        int z = line.substring(c2 + 1, c3).toInt();
-
-        if (z == TARGET_Z) {
-            uint64_t key = packVoxelKey(x, y, z);
-            roomMap[key] = line;
-        }
-    }
-    f.close();
-
-    // Create a helper to parse room data from a line
-    auto parseRoomData = [](const String &line) -> std::pair<bool, std::array<int, 10>> {
-        int c1 = line.indexOf(',');
-        int c2 = line.indexOf(',', c1 + 1);
-        int c3 = line.indexOf(',', c2 + 1);
-        
-        if (c1 < 0 || c2 < 0 || c3 < 0) {
-            return {false, {}};
-        }
-
-        auto getField = [&](int fieldIndex) -> int {
-            int count = 0;
-            int start = 0;
-            for (int i = 0; i <= line.length(); i++) {
-                if (i == line.length() || line[i] == ',') {
-                    if (count == fieldIndex) {
-                        return line.substring(start, i).toInt();
-                    }
-                    start = i + 1;
-                    count++;
-                }
-            }
-            return 0;
-        };
-
-        std::array<int, 10> exits = {
-            getField(5),   // exit_n
-            getField(6),   // exit_s
-            getField(7),   // exit_e
-            getField(8),   // exit_w
-            getField(9),   // exit_ne
-            getField(10),  // exit_nw
-            getField(11),  // exit_se
-            getField(12),  // exit_sw
-            getField(13),  // exit_u
-            getField(14)   // exit_d
-        };
-        
-        return {true, exits};
-    };
+    // Exits come from the room graph, so nothing is read from flash
+    if (roomNodes.empty()) return;
 
     // Build the 20x20 grid centered on player
-    // Create a set of visited voxels for fast lookup
-    std::set<uint64_t> visitedSet;
-    for (const auto &voxel : p.visitedVoxels) {
-        visitedSet.insert(packVoxelKey(voxel.x, voxel.y, voxel.z));
-    }
-
     // Display the map without header/footer (just the grid)
     for (int dy = -GRID_RADIUS; dy <= GRID_RADIUS; dy++) {
         // Build 3 output lines for this row of voxels
@@ -10237,26 +12266,15 @@ void drawPlayerMap(Player &p) {
         for (int dx = -GRID_RADIUS; dx <= GRID_RADIUS; dx++) {
             int worldX = p.roomX + dx;
             int worldY = p.roomY + dy;
-            uint64_t key = packVoxelKey(worldX, worldY, TARGET_Z);
+            int room = roomOrdinal(worldX, worldY, TARGET_Z);
             
             String block;
             
             // Check if this voxel has been visited
-            if (visitedSet.count(key)) {
+            if (hasVisitedRoom(p, room)) {
                 // Voxel visited - show its exits
-                const String &roomLine = roomMap[key];
-                auto result = parseRoomData(roomLine);
-                bool exists = result.first;
-                std::array<int, 10> exits = result.second;
-                
-                if (exists) {
-                    bool isPlayerHere = (dx == 0 && dy == 0);
-                    block = getMapBlock(exits[0], exits[1], exits[2], exits[3],
-                                       exits[4], exits[5], exits[6], exits[7],
-                                       exits[8], exits[9], isPlayerHere);
-                } else {
-                    block = "   \n   \n   ";
-                }
+                bool isPlayerHere = (dx == 0 && dy == 0);
+                block = getRoomMapBlock(room, isPlayerHere);
             } else {
                 // Unvisited voxel - show empty space
                 block = "   \n   \n   ";
@@ -10322,107 +12340,21 @@ void cmdTownMap(Player &p) {
     const int TOWN_MAX_X = 254;
     const int TOWN_MAX_Y = 251;
     
-    // Scan all rooms to find those in the town area
-    File f = LittleFS.open("/rooms.txt", "r");
-    if (!f) {
-        p.client.println("Cannot open rooms file.");
+    if (roomNodes.empty()) {
+        p.client.println("No town rooms found.");
         return;
     }
 
-    std::vector<String> townLines;
+    // Calculate grid dimensions (town is fixed: 9x10)
+    int gridWidth = TOWN_MAX_X - TOWN_MIN_X + 1;   // 9 voxels
+    int gridHeight = TOWN_MAX_Y - TOWN_MIN_Y + 1;  // 10 voxels
 
-    if (f.available()) f.readStringUntil('\n');  // Skip header
-
-    while (f.available()) {
-        String line = f.readStringUntil('\n');
-        line.trim();
-        if (line.length() == 0) continue;
-
-        // Parse CSV: x,y,z,...
-        int c1 = line.indexOf(',');
-        int c2 = line.indexOf(',', c1 + 1);
-        int c3 = line.indexOf(',', c2 + 1);
-
-        if (c1 < 0 || c2 < 0 || c3 < 0) continue;
-
-        int x = line.substring(0, c1).toInt();
-        int y = line.substring(c1 + 1, c2).toInt();
-        int z = line.substring(c2 + 1, c3).toInt();
-
-        // Filter for town area at Z=50
-        if (z == TARGET_Z && x >= TOWN_MIN_X && x <= TOWN_MAX_X &&
-            y >= TOWN_MIN_Y && y <= TOWN_MAX_Y) {
-            townLines.push_back(line);
-        }
-    }
-    f.close();
-
-    if (townLines.empty()) {
-        p.client.println("No town rooms found.");
-        return;
-    }
-
-    // Calculate grid dimensions (town is fixed: 9x10)
-    int gridWidth = TOWN_MAX_X - TOWN_MIN_X + 1;   // 9 voxels
-    int gridHeight = TOWN_MAX_Y - TOWN_MIN_Y + 1;  // 10 voxels
-
-    // Create a 2D grid to store room data
-    struct RoomData {
-        bool exists = false;
-        int exit_n = 0, exit_s = 0, exit_e = 0, exit_w = 0;
-        int exit_ne = 0, exit_nw = 0, exit_se = 0, exit_sw = 0;
-        int exit_u = 0, exit_d = 0;
-    };
-
-    std::vector<std::vector<RoomData>> grid(gridHeight, std::vector<RoomData>(gridWidth));
-
-    // Populate grid with room exit data
-    for (const String &line : townLines) {
-        int c1 = line.indexOf(',');
-        int c2 = line.indexOf(',', c1 + 1);
-        int c3 = line.indexOf(',', c2 + 1);
-
-        int x = line.substring(0, c1).toInt();
-        int y = line.substring(c1 + 1, c2).toInt();
-
-        int gridX = x - TOWN_MIN_X;
-        int gridY = y - TOWN_MIN_Y;
-
-        auto getField = [&](int fieldIndex) -> int {
-            int count = 0;
-            int start = 0;
-            for (int i = 0; i <= line.length(); i++) {
-                if (i == line.length() || line[i] == ',') {
-                    if (count == fieldIndex) {
-                        return line.substring(start, i).toInt();
-                    }
-                    start = i + 1;
-                    count++;
-                }
-            }
-            return 0;
-        };
-
-        RoomData &room = grid[gridY][gridX];
-        room.exists = true;
-        room.exit_n = getField(5);
-        room.exit_s = getField(6);
-        room.exit_e = getField(7);
-        room.exit_w = getField(8);
-        room.exit_ne = getField(9);
-        room.exit_nw = getField(10);
-        room.exit_se = getField(11);
-        room.exit_sw = getField(12);
-        room.exit_u = getField(13);
-        room.exit_d = getField(14);
-    }
-
-    // Display the town map
-    p.client.println("");
-    p.client.println("═══════════════════════════════════════════════════════════════════");
-    p.client.println("                     The Town of Espertheru");
-    p.client.println("═══════════════════════════════════════════════════════════════════");
-    p.client.println("");
+    // Display the town map
+    p.client.println("");
+    p.client.println("═══════════════════════════════════════════════════════════════════");
+    p.client.println("                     The Town of Espertheru");
+    p.client.println("═══════════════════════════════════════════════════════════════════");
+    p.client.println("");
 
     // Legend data - 16 items total (15 locations + YOU ARE HERE)
     const char* legendCodes[] = {"C", "E", "G", "D", "L", "W", "A", "R", "P", "B", "$", "O", "M", "p", "S", "X"};
@@ -10461,16 +12393,14 @@ void cmdTownMap(Player &p) {
             int worldX = TOWN_MIN_X + x;
             int worldY = TOWN_MIN_Y + y;
             
-            const RoomData &room = grid[y][x];
+            int room = roomOrdinal(worldX, worldY, TARGET_Z);
             String block;
             
-            if (room.exists) {
+            if (room >= 0) {
                 // Check if player is at this location
                 bool isPlayerHere = (p.roomX == worldX && p.roomY == worldY && p.roomZ == TARGET_Z);
                 char locCode = getLocationCode(worldX, worldY);
-                block = getMapBlock(room.exit_n, room.exit_s, room.exit_e, room.exit_w,
-                                   room.exit_ne, room.exit_nw, room.exit_se, room.exit_sw,
-                                   room.exit_u, room.exit_d, isPlayerHere, locCode);
+                block = getRoomMapBlock(room, isPlayerHere, locCode);
             } else {
                 block = "   \n   \n   ";
             }
@@ -10555,6 +12485,149 @@ void cmdTownMap(Player &p) {
 }
 
 
+// =============================
+// Where / path (room distance fields)
+// =============================
+
+// Landmark named by arg ("bank", "post", "church", ...), or -1
+int findRoomLandmark(const String &arg) {
+    String a = arg;
+    a.trim();
+    a.toLowerCase();
+    if (a.startsWith("the ")) a = a.substring(4);
+    if (a.length() == 0) return -1;
+
+    for (int i = 0; i < ROOM_LANDMARK_COUNT; i++) {
+        if (String(roomLandmarks[i].name).startsWith(a)) return i;
+    }
+    if (a == "spawn" || a == "start") return 2;   // the church
+    return -1;
+}
+
+// How to take one step of a route: "north", or the portal's command
+String roomStepName(int room, int dir) {
+    if (dir >= 0 && dir < 10) return dirNames[dir];
+    const RoomPortal *portal = roomPortalFrom(room);
+    if (portal && portal->command.length() > 0) return "'" + portal->command + "'";
+    return "the portal";
+}
+
+String describeRouteTo(const String &placeName, const RoomField &field, int here) {
+    if (!field.reaches(here)) return "You can't see a way to " + placeName + " from here.";
+
+    int steps = field.steps(here);
+    if (steps == 0) return "You are at " + placeName + ".";
+
+    return capFirst(placeName.c_str()) + " is " + String(steps) + (steps == 1 ? " step" : " steps") +
+           " away; head " + roomStepName(here, field.nextDir(here)) + ".";
+}
+
+void cmdWhere(Player &p, const String &args) {
+    int here = roomOrdinal(p.roomX, p.roomY, p.roomZ);
+    if (here < 0) {
+        p.client.println("You have no idea where you are.");
+        return;
+    }
+
+    String a = args;
+    a.trim();
+
+    if (a.length() > 0) {
+        int landmark = findRoomLandmark(a);
+        if (landmark < 0) {
+            p.client.println("Usage: where [bank|post office|church]");
+            return;
+        }
+        const RoomLandmark &lm = roomLandmarks[landmark];
+        const RoomField *field = roomFieldTo(roomOrdinal(lm.x, lm.y, lm.z));
+        if (!field) {
+            p.client.println("Nobody seems to know where the " + String(lm.name) + " is.");
+            return;
+        }
+        p.client.println(describeRouteTo("the " + String(lm.name), *field, here));
+        return;
+    }
+
+    for (int i = 0; i < ROOM_LANDMARK_COUNT; i++) {
+        const RoomLandmark &lm = roomLandmarks[i];
+        const RoomField *field = roomFieldTo(roomOrdinal(lm.x, lm.y, lm.z));
+        if (!field) continue;
+        p.client.println(describeRouteTo("the " + String(lm.name), *field, here));
+    }
+}
+
+void cmdPath(Player &p, const String &args) {
+    String a = args;
+    a.trim();
+
+    int here = roomOrdinal(p.roomX, p.roomY, p.roomZ);
+    if (here < 0) {
+        p.client.println("You have no idea where you are.");
+        return;
+    }
+
+    // A landmark, or (wizards) any room as x,y,z
+    int target = -1;
+    String placeName;
+    int landmark = findRoomLandmark(a);
+    if (landmark >= 0) {
+        const RoomLandmark &lm = roomLandmarks[landmark];
+        target = roomOrdinal(lm.x, lm.y, lm.z);
+        placeName = "the " + String(lm.name);
+    } else if (p.IsWizard) {
+        String norm = a;
+        norm.replace(",", " ");
+        int x, y, z;
+        if (sscanf(norm.c_str(), "%d %d %d", &x, &y, &z) == 3) {
+            target = roomOrdinal(x, y, z);
+            placeName = "(" + String(x) + "," + String(y) + "," + String(z) + ")";
+            if (target < 0) {
+                p.client.println("There is no room at " + placeName + ".");
+                return;
+            }
+        }
+    }
+
+    if (placeName.length() == 0) {
+        p.client.println(p.IsWizard ? "Usage: path <bank|post office|church|x,y,z>"
+                                    : "Usage: path <bank|post office|church>");
+        return;
+    }
+
+    const RoomField *field = roomFieldTo(target);
+    if (!field || !field->reaches(here)) {
+        p.client.println("You can't see a way to " + placeName + " from here.");
+        return;
+    }
+
+    int steps = field->steps(here);
+    if (steps == 0) {
+        p.client.println("You are at " + placeName + ".");
+        return;
+    }
+
+    // Follow the next hops, folding repeats: "3 east, north, 'enter gate'"
+    String route;
+    int room = here;
+    while (room >= 0 && field->steps(room) > 0) {
+        int dir = field->nextDir(room);
+        String stepName = roomStepName(room, dir);
+        int run = 0;
+        do {
+            room = roomNeighbor(room, dir);
+            run++;
+        } while (dir != ROOM_EXIT_PORTAL && room >= 0 &&
+                 field->steps(room) > 0 && field->nextDir(room) == dir);
+
+        if (route.length() > 0) route += ", ";
+        route += (run > 1) ? String(run) + " " + stepName : stepName;
+    }
+
+    printWrappedLines(p.client, "Path to " + placeName + " (" + String(steps) +
+                      (steps == 1 ? " step): " : " steps): ") + route + ".");
+}
+
+
 void cmdWizHelp(Player &p) {
     if (!p.IsWizard) {
         p.client.println("What?");
@@ -10566,6 +12639,8 @@ void cmdWizHelp(Player &p) {
     // ---------------------------------------------------------
     // DEBUG SYSTEM (alphabetical)
     // ---------------------------------------------------------
+    p.client.println("debug boot              - Boot timing/heap report");
+    p.client.println("debug commands [reset]  - Per-verb command timing and output size");
     p.client.println("debug delete <file>     - Delete a LittleFS file");
     p.client.println("debug destination       - Toggle debug output");
     p.client.println("debug extract <file>    - Backup a single file");
@@ -10573,12 +12648,18 @@ void cmdWizHelp(Player &p) {
     p.client.println("debug files             - Dump core data files");
     p.client.println("debug flashspace        - Show LittleFS usage");
     p.client.println("debug items             - Dump all world items");
+    p.client.println("debug journal [on|off]  - Replay journal recording");
+    p.client.println("debug latency [reset]   - Loop/subsystem latency histograms");
     p.client.println("debug list              - List LittleFS files");
     p.client.println("debug npcs              - Dump NPC definitions");
     p.client.println("debug online            - List connected players with stats");
     p.client.println("debug players           - Dump all player saves");
     p.client.println("debug questflags        - Show quest flags");
     p.client.println("debug sessions          - Show last 50 session log records");
+    p.client.println("debug slots             - Player slot pool and memory per session");
+    p.client.println("debug slow              - Slowest recent commands (kept across reboot)");
+    p.client.println("debug snapshot          - Warm-restart snapshot status");
+    p.client.println("debug ticks             - Game tick task timings");
     p.client.println("debug ymodem            - YMODEM transfer log");
     p.client.println("debug <player>          - Dump a single player");
 
@@ -10602,6 +12683,7 @@ void cmdWizHelp(Player &p) {
     p.client.println("clone                   - Clone an item or NPC to your room");
     p.client.println("clonegold <amount>      - Spawn gold coins to your room");
     p.client.println("goto <x,y,z|player>     - Teleport instantly");
+    p.client.println("path <x,y,z>            - Directions to any room");
     p.client.println("summon <player>         - Bring a player to your location");
     p.client.println("heal <player>           - Fully heal a player");
     p.client.println("invis                   - Toggle invisibility");
@@ -10672,7 +12754,7 @@ void executeEmote(Player &p, int index, const String &cmd, const String &args) {
 
     // --- FIND TARGET PLAYER IN ROOM ---
     int targetIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         if (players[i].roomX != p.roomX ||
             players[i].roomY != p.roomY ||
@@ -10745,7 +12827,7 @@ void cmdSay(Player &p, const char *message) {
     p.client.print("You say: ");
     p.client.println(message);
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active) continue;
         if (&players[i] == &p) continue;
         if (players[i].roomX == p.roomX &&
@@ -10769,7 +12851,7 @@ void cmdShout(Player &p, const char *message) {
     return;
   }
 
-  for (int i = 0; i < MAX_PLAYERS; i++) {
+  for (int i = 0; i < maxPlayers; i++) {
     if (!players[i].active) continue;
     players[i].client.print(capFirst(p.name));
     players[i].client.print(" shouts: ");
@@ -10793,7 +12875,7 @@ void cmdTell(Player &p, const String &targetName, const String &message) {
 
     // Find the target player
     Player *target = nullptr;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         if (players[i].name[0] == '\0') continue;
         if (strcasecmp(players[i].name, targetName.c_str()) == 0) {
@@ -10877,43 +12959,24 @@ void cmdTell(Player &p, const String &targetName, const String &message) {
 }
 
 
-void cmdPassword(Player &p, int index) {
-    // 1) Ask for old password
-    p.client.println("Enter your current password:");
-    while (!p.client.available()) delay(1);
-    String oldpw = cleanInput(p.client.readStringUntil('\n'));
-
-    // Case-insensitive password comparison
-    String lowerOldpw = oldpw;
-    lowerOldpw.toLowerCase();
-    if (lowerOldpw != String(p.storedPassword)) {
-        p.client.println("Incorrect password. Cancelled.");
-        return;
-    }
-
-    // 2) Ask for new password
-    p.client.println("Enter new password:");
-    while (!p.client.available()) delay(1);
-    String newpw = cleanInput(p.client.readStringUntil('\n'));
+// Password change: three chained prompts, cancelled if left unanswered
+const unsigned long PASSWORD_PROMPT_TIMEOUT = 60000UL;
 
-    if (!isValidPassword(newpw)) {
-        p.client.println("Invalid password format. Cancelled.");
-        return;
-    }
+void passwordPromptTimedOut(Player &p, int) {
+    p.client.println("");
+    p.client.println("Password change timed out. Cancelled.");
+    p.client.print("> ");
+}
 
-    // 3) Confirm new password
-    p.client.println("Confirm new password:");
-    while (!p.client.available()) delay(1);
-    String confirm = cleanInput(p.client.readStringUntil('\n'));
+PromptResult passwordConfirm(Player &p, int, const String &line, const String &lowerNewpw) {
+    String confirm = cleanInput(line);
 
     // Case-insensitive password comparison for confirmation
-    String lowerNewpw = newpw;
-    lowerNewpw.toLowerCase();
     String lowerConfirm = confirm;
     lowerConfirm.toLowerCase();
     if (lowerConfirm != lowerNewpw) {
         p.client.println("Passwords do not match. Cancelled.");
-        return;
+        return PROMPT_DONE;
     }
 
     // 4) Save (convert to lowercase before storing)
@@ -10921,11 +12984,54 @@ void cmdPassword(Player &p, int index) {
     savePlayerToFS(p);
 
     p.client.println("Password updated successfully.");
+    return PROMPT_DONE;
+}
+
+PromptResult passwordEnterNew(Player &p, int index, const String &line) {
+    String newpw = cleanInput(line);
+
+    if (!isValidPassword(newpw)) {
+        p.client.println("Invalid password format. Cancelled.");
+        return PROMPT_DONE;
+    }
+
+    // 3) Confirm new password
+    String lowerNewpw = newpw;
+    lowerNewpw.toLowerCase();
+    setPrompt(p, index, "Confirm new password:", PROMPT_SECRET,
+              [lowerNewpw](Player &pl, int idx, const String &answer) {
+                  return passwordConfirm(pl, idx, answer, lowerNewpw);
+              },
+              PASSWORD_PROMPT_TIMEOUT, passwordPromptTimedOut);
+    return PROMPT_DONE;
+}
+
+PromptResult passwordCheckOld(Player &p, int index, const String &line) {
+    String oldpw = cleanInput(line);
+
+    // Case-insensitive password comparison
+    String lowerOldpw = oldpw;
+    lowerOldpw.toLowerCase();
+    if (!passwordMatches(lowerOldpw, p.storedPassword)) {
+        p.client.println("Incorrect password. Cancelled.");
+        return PROMPT_DONE;
+    }
+
+    // 2) Ask for new password
+    setPrompt(p, index, "Enter new password:", PROMPT_SECRET, passwordEnterNew,
+              PASSWORD_PROMPT_TIMEOUT, passwordPromptTimedOut);
+    return PROMPT_DONE;
+}
+
+void cmdPassword(Player &p, int index) {
+    // 1) Ask for old password
+    setPrompt(p, index, "Enter your current password:", PROMPT_SECRET, passwordCheckOld,
+              PASSWORD_PROMPT_TIMEOUT, passwordPromptTimedOut);
 }
 
 
 
-void cmdKill(Player &p, const char* arg) {
+void cmdKill(Player &p, int playerIndex, const char* arg) {
     String t = arg;
     t.trim();
 
@@ -10940,34 +13046,21 @@ void cmdKill(Player &p, const char* arg) {
         return;
     }
 
-    // String -> std::string for npcDefs key
-    std::string key = std::string(npc->npcId.c_str());
-    auto it = npcDefs.find(key);
-    if (it == npcDefs.end()) {
+    const NpcTemplate *tpl = npcTemplateOf(*npc);
+    if (!tpl) {
         p.client.println("That creature seems undefined in the world.");
         return;
     }
 
-    NpcDefinition &def = it->second;
-    String npcName = def.attributes.at("name").c_str();
-
-    // Resolve playerIndex
-    int playerIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (&players[i] == &p) {
-            playerIndex = i;
-            break;
-        }
-    }
-    if (playerIndex == -1) return;
+    const String &npcName = tpl->name;
 
-    // Mark hostility and target
-    npc->hostileTo[playerIndex] = true;
-    npc->targetPlayer = playerIndex;
+    // Mark hostility; it turns on whoever here has hurt it most
+    npcAddThreat(*npc, playerIndex, 1);
+    npcRetarget(*npc);
 
     // Start combat
     p.inCombat = true;
-    p.combatTarget = npc;
+    p.combatTarget = npcInstances.handle(*npc);
     p.nextCombatTime = millis() + 1000;  // 1 second delay before first hit
 
     p.client.println("You engage the " + npcName + " in combat!");
@@ -10975,19 +13068,9 @@ void cmdKill(Player &p, const char* arg) {
 }
 
 
-void autoWimpFlee(Player &p) {
-
-    // Find player's index in players[]
-    int index = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (&players[i] == &p) {
-            index = i;
-            break;
-        }
-    }
-    if (index < 0) return; // should never happen
+void autoWimpFlee(Player &p, int index) {
 
-    Room &r = p.currentRoom;
+    Room &r = playerRoom(p);
 
     // Collect valid exits
     std::vector<String> exits;
@@ -11015,7 +13098,7 @@ void autoWimpFlee(Player &p) {
 
     // End combat
     p.inCombat = false;
-    p.combatTarget = nullptr;
+    p.combatTarget = NpcHandle();
 }
 
 
@@ -11024,74 +13107,178 @@ void autoWimpFlee(Player &p) {
 
 // ***************THE ACTUAL COMBAT ENGINE********************
 
-void doCombatRound(Player &p) {
+static bool rollToHit(int atk, int defv) {
+    int roll = random(1, 21);
+    return (roll + atk) >= defv;
+}
 
-    int playerIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        if (&players[i] == &p) {
-            playerIndex = i;
-            break;
+// The NPC fights back against victimIndex, the player here with the most
+// threat.  True if that player died or fled.
+static bool npcStrike(NpcInstance &npc, const NpcTemplate &tpl, int victimIndex) {
+    Player &v = players[victimIndex];
+    const String &npcName = tpl.name;
+    int npcBaseDmg = tpl.attack;
+
+    int playerDefense = v.baseDefense + v.armorBonus;
+
+    // Players have 2x chance to be hit: roll twice, hit if either succeeds
+    bool npcHits = rollToHit(npcBaseDmg, playerDefense) || rollToHit(npcBaseDmg, playerDefense);
+
+    if (npcHits) {
+
+        int npcRollDmg = random(1, npcBaseDmg + 1);
+
+        int absorb = (v.armorBonus > 0)
+                     ? random(0, v.armorBonus + 1)
+                     : 0;
+
+        int finalNpcDmg = npcRollDmg - absorb;
+        if (finalNpcDmg < 1) finalNpcDmg = 1;
+
+        v.hp -= finalNpcDmg;
+
+        if (v.IsWizard && v.hp <= 0) {
+            v.hp = 1;
+            v.client.println("Your immortality protects you from death!");
+            goto SKIP_DEATH_CHECK;
+        }
+
+        if (v.hp < 0) v.hp = 0;
+
+        String nverb = combatVerbs[random(7)];
+
+        v.client.println(npcName + " hits you.");
+
+        if (v.IsWizard && v.showStats) {
+            int playerArmorTotal = v.baseDefense + v.armorBonus;
+            int playerDmgTotal   = v.attack + v.weaponBonus;
+
+            v.client.println("  (damage=" + String(finalNpcDmg) + ")");
+            v.client.println("    npcDamageRoll: " + String(npcRollDmg));
+            v.client.println("    yourArmorAbsorb: " + String(absorb));
+            v.client.println("    yourArmor: base(" + String(v.baseDefense) +
+                             ") + bonus(" + String(v.armorBonus) +
+                             ") = " + String(playerArmorTotal));
+            v.client.println("    yourDamage: base(" + String(v.attack) +
+                             ") + bonus(" + String(v.weaponBonus) +
+                             ") = " + String(playerDmgTotal));
+        }
+
+        broadcastRoomExcept(
+            v,
+            "The " + npcName + " " + nverb + "s " +
+            capFirst(v.name) + "!",
+            v
+        );
+
+    } else {
+        v.client.println(npcName + " misses you.");
+
+        if (v.IsWizard && v.showStats) {
+            int playerArmorTotal = v.baseDefense + v.armorBonus;
+            int playerDmgTotal   = v.attack + v.weaponBonus;
+
+            v.client.println("  (damage=0)");
+            v.client.println("    yourArmor: base(" + String(v.baseDefense) +
+                             ") + bonus(" + String(v.armorBonus) +
+                             ") = " + String(playerArmorTotal));
+            v.client.println("    yourDamage: base(" + String(v.attack) +
+                             ") + bonus(" + String(v.weaponBonus) +
+                             ") = " + String(playerDmgTotal));
+        }
+
+        broadcastRoomExcept(
+            v,
+            "The " + npcName + " misses " + capFirst(v.name) + "!",
+            v
+        );
+    }
+
+    // ---------------------------------------------------------
+    // COMBAT INJURY CHECK (1 in 1000 chance if no existing injuries)
+    // ---------------------------------------------------------
+    if (!v.IsHeadInjured && !v.IsShoulderInjured && !v.IsLegInjured) {
+        int injuryRoll = random(1, 1001);
+        if (injuryRoll == 1) {
+            // Injury occurred! Determine which one
+            int injuryType = random(1, 4);  // 1 = head, 2 = shoulder, 3 = leg
+            
+            if (injuryType == 1) {
+                v.IsHeadInjured = true;
+                v.client.println("You suffer a blow to the head! You've been BLINDED!");
+                broadcastRoomExcept(v, capFirst(v.name) + " staggers, blinded!", v);
+            } else if (injuryType == 2) {
+                v.IsShoulderInjured = true;
+                v.client.println("Your shoulder is badly injured!");
+                broadcastRoomExcept(v, capFirst(v.name) + "'s shoulder is badly injured!", v);
+            } else if (injuryType == 3) {
+                v.IsLegInjured = true;
+                v.client.println("Your leg has been hobbled!");
+                broadcastRoomExcept(v, capFirst(v.name) + " is now hobbling!", v);
+            }
+            
+            savePlayerToFS(v);
         }
     }
-    if (playerIndex == -1) return;
 
-    if (!p.inCombat || p.combatTarget == nullptr) return;
+SKIP_DEATH_CHECK:
+
+    // Player death
+    if (!v.IsWizard && v.hp == 0) {
+        npcDropAggro(npc, victimIndex);
+        npcRetarget(npc);
+        handlePlayerDeath(v);
+        return true;
+    }
+
+    // Wimp flee
+    if (v.wimpMode && v.hp <= 5) {
+        autoWimpFlee(v, victimIndex);
+        return true;
+    }
+
+    return false;
+}
+
+
+// One round for the player in slot playerIndex against their combatTarget
+void doCombatRound(Player &p, int playerIndex) {
 
-    NpcInstance* npc = p.combatTarget;
+    if (!p.inCombat) return;
 
-    // NPC already dead or gone
-    if (!npc->alive || npc->hp <= 0) {
+    NpcInstance* npc = npcInstances.get(p.combatTarget);
+
+    // NPC already dead, respawned or gone
+    if (!npc || !npc->alive || npc->hp <= 0) {
         p.inCombat = false;
-        p.combatTarget = nullptr;
+        p.combatTarget = NpcHandle();
         return;
     }
 
     // NPC left the room
     if (npc->x != p.roomX || npc->y != p.roomY || npc->z != p.roomZ) {
         p.inCombat = false;
-        p.combatTarget = nullptr;
+        p.combatTarget = NpcHandle();
         return;
     }
 
     // Hostility check (end AFTER round)
-    bool lostHostility = !npc->hostileTo[playerIndex];
+    bool lostHostility = !npcHostileTo(*npc, playerIndex);
 
-    // SAFE lookup
-    std::string npcKey = std::string(npc->npcId.c_str());
-    auto it = npcDefs.find(npcKey);
-    if (it == npcDefs.end()) {
+    const NpcTemplate *tpl = npcTemplateOf(*npc);
+    if (!tpl) {
         p.client.println("Internal error: NPC definition missing.");
         p.inCombat = false;
-        p.combatTarget = nullptr;
+        p.combatTarget = NpcHandle();
         return;
     }
 
-    NpcDefinition &def = it->second;
-
-    // NPC name
-    String npcName = def.attributes.count("name")
-                     ? String(def.attributes.at("name").c_str())
-                     : String("creature");
+    const String &npcName = tpl->name;
 
     Serial.print("DEBUG: NPC HP = ");
     Serial.println(npc->hp);
 
-    auto rollToHit = [&](int atk, int defv) {
-        int roll = random(1, 21);
-        return (roll + atk) >= defv;
-    };
-
-    // Defense
-    int npcDefense = 5;
-    auto defIt = def.attributes.find("defense");
-    if (defIt != def.attributes.end())
-        npcDefense = atoi(defIt->second.c_str());
-
-    // Attack
-    int npcBaseDmg = 1;
-    auto atkIt = def.attributes.find("attack");
-    if (atkIt != def.attributes.end())
-        npcBaseDmg = atoi(atkIt->second.c_str());
+    int npcDefense = tpl->defense;
 
     int playerTotalAtk = p.attack + p.weaponBonus;
     int playerToHitBonus = (p.level - 1) * 2;
@@ -11119,6 +13306,8 @@ void doCombatRound(Player &p) {
 
         int playerDmg = random(1, playerTotalAtk + 1);
         npc->hp -= playerDmg;
+        npcAddThreat(*npc, playerIndex, playerDmg);
+        npcRetarget(*npc);
 
         String verb = combatVerbs[random(7)];
 
@@ -11160,18 +13349,12 @@ void doCombatRound(Player &p) {
             );
 
             // XP
-            int xpReward = 5;
-            auto xpIt = def.attributes.find("xp");
-            if (xpIt != def.attributes.end())
-                xpReward = atoi(xpIt->second.c_str());
-
-            p.xp += xpReward;
+            p.xp += tpl->xp;
 
             // Gold drop
             int dropGold = npc->gold;
-            auto goldIt = def.attributes.find("gold");
-            if (dropGold <= 0 && goldIt != def.attributes.end())
-                dropGold = atoi(goldIt->second.c_str());
+            if (dropGold <= 0)
+                dropGold = tpl->gold;
 
             if (dropGold > 0)
                 spawnGoldAt(p.roomX, p.roomY, p.roomZ, dropGold);
@@ -11180,15 +13363,12 @@ void doCombatRound(Player &p) {
 
             npc->respawnTime = millis() + (30UL * 60UL * 1000UL);
 
-            for (int i = 0; i < MAX_PLAYERS; i++)
-                npc->hostileTo[i] = false;
-
-            npc->targetPlayer = -1;
+            npcClearAggro(*npc);
 
             onQuestEvent(p, "kill", "", npc->npcId, "", 0,0,0);
 
             p.inCombat = false;
-            p.combatTarget = nullptr;
+            p.combatTarget = NpcHandle();
             return;
         }
 
@@ -11216,112 +13396,25 @@ void doCombatRound(Player &p) {
     }
 
     // ---------------------------------------------------------
-    // NPC COUNTERATTACK
+    // AGGRESSIVE NPC DIALOG
     // ---------------------------------------------------------
-    if (npc->targetPlayer == playerIndex) {
-
-        int playerDefense = p.baseDefense + p.armorBonus;
-
-        // Players have 2x chance to be hit: roll twice, hit if either succeeds
-        bool npcHits = rollToHit(npcBaseDmg, playerDefense) || rollToHit(npcBaseDmg, playerDefense);
-
-        if (npcHits) {
-
-            int npcRollDmg = random(1, npcBaseDmg + 1);
+    {
+        if (npc->hp > 0 && tpl->aggressive)
+        {
+            npc->combatDialogCounter++;
 
-            int absorb = (p.armorBonus > 0)
-                         ? random(0, p.armorBonus + 1)
-                         : 0;
+            if (npc->combatDialogCounter >= 3) {
+                npc->combatDialogCounter = 0;
 
-            int finalNpcDmg = npcRollDmg - absorb;
-            if (finalNpcDmg < 1) finalNpcDmg = 1;
+                int idx = npc->dialogOrder[npc->dialogIndex];
+                if (idx >= 0 && idx < NPC_DIALOG_LINES && tpl->dialog[idx].length() > 0) {
 
-            p.hp -= finalNpcDmg;
+                    String line = tpl->dialog[idx];
 
-            if (p.IsWizard && p.hp <= 0) {
-                p.hp = 1;
-                p.client.println("Your immortality protects you from death!");
-                goto SKIP_DEATH_CHECK;
-            }
-
-            if (p.hp < 0) p.hp = 0;
-
-            String nverb = combatVerbs[random(7)];
-
-            p.client.println(npcName + " hits you.");
-
-            if (p.IsWizard && p.showStats) {
-                int playerArmorTotal = p.baseDefense + p.armorBonus;
-                int playerDmgTotal   = p.attack + p.weaponBonus;
-
-                p.client.println("  (damage=" + String(finalNpcDmg) + ")");
-                p.client.println("    npcDamageRoll: " + String(npcRollDmg));
-                p.client.println("    yourArmorAbsorb: " + String(absorb));
-                p.client.println("    yourArmor: base(" + String(p.baseDefense) +
-                                 ") + bonus(" + String(p.armorBonus) +
-                                 ") = " + String(playerArmorTotal));
-                p.client.println("    yourDamage: base(" + String(p.attack) +
-                                 ") + bonus(" + String(p.weaponBonus) +
-                                 ") = " + String(playerDmgTotal));
-            }
-
-            broadcastRoomExcept(
-                p,
-                "The " + npcName + " " + nverb + "s " +
-                capFirst(p.name) + "!",
-                p
-            );
-
-        } else {
-            p.client.println(npcName + " misses you.");
-
-            if (p.IsWizard && p.showStats) {
-                int playerArmorTotal = p.baseDefense + p.armorBonus;
-                int playerDmgTotal   = p.attack + p.weaponBonus;
-
-                p.client.println("  (damage=0)");
-                p.client.println("    yourArmor: base(" + String(p.baseDefense) +
-                                 ") + bonus(" + String(p.armorBonus) +
-                                 ") = " + String(playerArmorTotal));
-                p.client.println("    yourDamage: base(" + String(p.attack) +
-                                 ") + bonus(" + String(p.weaponBonus) +
-                                 ") = " + String(playerDmgTotal));
-            }
-
-            broadcastRoomExcept(
-                p,
-                "The " + npcName + " misses " + capFirst(p.name) + "!",
-                p
-            );
-        }
-    }
-
-    // ---------------------------------------------------------
-    // AGGRESSIVE NPC DIALOG
-    // ---------------------------------------------------------
-    {
-        auto agIt = def.attributes.find("aggressive");
-        if (npc->hp > 0 &&
-            agIt != def.attributes.end() &&
-            atoi(agIt->second.c_str()) == 1)
-        {
-            npc->combatDialogCounter++;
-
-            if (npc->combatDialogCounter >= 3) {
-                npc->combatDialogCounter = 0;
-
-                int idx = npc->dialogOrder[npc->dialogIndex];
-                String key = "dialog_" + String(idx + 1);
-
-                auto dlgIt = def.attributes.find(std::string(key.c_str()));
-                if (dlgIt != def.attributes.end()) {
-
-                    String line = String(dlgIt->second.c_str());
-
-                    if (line.endsWith(".")) {
-                        line.remove(line.length() - 1);
-                        line += "!";
-                    }
+                    if (line.endsWith(".")) {
+                        line.remove(line.length() - 1);
+                        line += "!";
+                    }
 
                     announceDialogToRoom(
                         npc->x, npc->y, npc->z,
@@ -11347,56 +13440,22 @@ void doCombatRound(Player &p) {
     }
 
     // ---------------------------------------------------------
-    // COMBAT INJURY CHECK (1 in 1000 chance if no existing injuries)
+    // NPC COUNTERATTACK (on whoever present has the most threat)
     // ---------------------------------------------------------
-    if (npc->targetPlayer == playerIndex && !p.IsHeadInjured && !p.IsShoulderInjured && !p.IsLegInjured) {
-        int injuryRoll = random(1, 1001);
-        if (injuryRoll == 1) {
-            // Injury occurred! Determine which one
-            int injuryType = random(1, 4);  // 1 = head, 2 = shoulder, 3 = leg
-            
-            if (injuryType == 1) {
-                p.IsHeadInjured = true;
-                p.client.println("You suffer a blow to the head! You've been BLINDED!");
-                broadcastRoomExcept(p, capFirst(p.name) + " staggers, blinded!", p);
-            } else if (injuryType == 2) {
-                p.IsShoulderInjured = true;
-                p.client.println("Your shoulder is badly injured!");
-                broadcastRoomExcept(p, capFirst(p.name) + "'s shoulder is badly injured!", p);
-            } else if (injuryType == 3) {
-                p.IsLegInjured = true;
-                p.client.println("Your leg has been hobbled!");
-                broadcastRoomExcept(p, capFirst(p.name) + " is now hobbling!", p);
-            }
-            
-            savePlayerToFS(p);
-        }
-    }
-
-SKIP_DEATH_CHECK:
-
-    // Player death
-    if (!p.IsWizard && p.hp == 0) {
-        npc->hostileTo[playerIndex] = false;
-        if (npc->targetPlayer == playerIndex)
-            npc->targetPlayer = -1;
-        handlePlayerDeath(p);
-        return;
-    }
-
-    // Wimp flee
-    if (p.wimpMode && p.hp <= 5) {
-        autoWimpFlee(p);
-        return;
+    npcDecayThreat(*npc);
+    int victimIndex = npcRetarget(*npc);
+    if (victimIndex >= 0 && (long)(millis() - npc->nextStrikeTime) >= 0) {
+        npc->nextStrikeTime = millis() + COMBAT_ROUND_MS;
+        if (npcStrike(*npc, *tpl, victimIndex) && victimIndex == playerIndex) return;
     }
 
     // End combat if hostility lost
     if (lostHostility) {
         p.inCombat = false;
-        p.combatTarget = nullptr;
+        p.combatTarget = NpcHandle();
     }
 
-    p.nextCombatTime = millis() + 3000;
+    p.nextCombatTime = millis() + COMBAT_ROUND_MS;
 }
 
 // =============================
@@ -11460,7 +13519,7 @@ void cmdHeal(Player &p, const String &input) {
 
     // Find target player by name (case-insensitive)
     Player* target = nullptr;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
 
         if (!strcasecmp(players[i].name, arg.c_str())) {
@@ -11501,7 +13560,7 @@ void cmdBlind(Player &p, const String &input) {
     // Find target player by name (case-insensitive)
     Player* target = nullptr;
     int targetIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
 
         if (!strcasecmp(players[i].name, arg.c_str())) {
@@ -11550,7 +13609,7 @@ void cmdHobble(Player &p, const String &input) {
     // Find target player by name (case-insensitive)
     Player* target = nullptr;
     int targetIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
 
         if (!strcasecmp(players[i].name, arg.c_str())) {
@@ -11601,7 +13660,7 @@ void cmdLame(Player &p, const String &input) {
     // Find target player by name (case-insensitive)
     Player* target = nullptr;
     int targetIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
 
         if (!strcasecmp(players[i].name, arg.c_str())) {
@@ -11835,7 +13894,7 @@ void cmdGoto(Player &p, const String &args) {
 
     // Resolve playerIndex
     int playerIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (&players[i] == &p) {
             playerIndex = i;
             break;
@@ -11908,7 +13967,7 @@ void cmdGoto(Player &p, const String &args) {
     String target = a;
     target.trim();
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &other = players[i];
         if (!other.active) continue;
         if (&other == &p) continue;
@@ -11963,7 +14022,7 @@ void cmdSummon(Player &p, const String &args) {
 
     // Resolve wizard playerIndex
     int wizardIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (&players[i] == &p) {
             wizardIndex = i;
             break;
@@ -11980,7 +14039,7 @@ void cmdSummon(Player &p, const String &args) {
     }
 
     // Find target player
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &other = players[i];
         if (!other.active) continue;
         if (&other == &p) continue;
@@ -12090,7 +14149,7 @@ void cmdEat(Player &p, const char* arg) {
         
         // If still not found, search room
         if (idx == -1) {
-            Room &r = p.currentRoom;
+            Room &r = playerRoom(p);
             for (int i = 0; i < (int)worldItems.size(); i++) {
                 WorldItem &wi = worldItems[i];
                 if (wi.x != r.x || wi.y != r.y || wi.z != r.z)
@@ -12292,7 +14351,7 @@ void cmdQuestList(Player &p) {
             continue;
 
         // Determine completion status
-        bool completed = p.questCompleted[qd.questId - 1];
+        bool completed = p.quests.completed(qd.questId - 1);
         String status = completed ? " (completed)" : " (in progress)";
 
         // Print quest header with status
@@ -12600,9 +14659,9 @@ void Shop::addOrUpdateItem(const String &itemId, const String &displayName, int
 
 Shop* getShopForRoom(Player &p) {
     for (auto &shop : shops) {
-        if (shop.x == p.currentRoom.x && 
-            shop.y == p.currentRoom.y && 
-            shop.z == p.currentRoom.z) {
+        if (shop.x == p.roomX && 
+            shop.y == p.roomY && 
+            shop.z == p.roomZ) {
             return &shop;
         }
     }
@@ -12692,7 +14751,7 @@ void initializeShops() {
 }
 
 WorldItem* findShopSign(Player &p) {
-    Room &r = p.currentRoom;
+    Room &r = playerRoom(p);
 
     for (auto &wi : worldItems) {
         // Must be in this room, top-level, not owned
@@ -12857,11 +14916,9 @@ void initializePostOffices() {
 void initializeWeatherStations() {
     // Weather Station initialized - uses hardcoded voxel (248,242,50)
     // No persistent data needed, just ready for async HTTP requests
-    currentWeatherRequest.pending = false;
-    currentWeatherRequest.isForecast = false;
-    currentWeatherRequest.query = "";
-    currentWeatherRequest.startTime = 0;
-    currentWeatherRequest.ipAddress = "";
+    weatherRequests.clear();
+    geoCache.clear();
+    weatherCache.clear();
     
     lastWeatherData.location = "";
     lastWeatherData.current = "";
@@ -12902,277 +14959,375 @@ String extractPlayerNameFromEmail(const String &emailBody) {
 }
 
 /**
- * Fetch mail from the web server via HTTP API
+ * Parse the retrieveESP32mail.php JSON response
  * Returns true if successful, populates letters vector
  */
-bool fetchMailFromServer(const String &playerName, std::vector<Letter> &letters) {
-    if (!playerName || playerName.length() == 0) {
-        Serial.println("[MAIL] ERROR: Empty player name");
+bool parseMailResponse(const JsonPathExtractor &json, std::vector<Letter> &letters) {
+    // Format: {"success": true, "emails": [...], "count": N, "errors": [...]}
+    if (json.get("success") != "true") {
+        Serial.println("[MAIL] ERROR: Server returned error or success=false");
+        Serial.println("========== MAIL FETCH END (ERROR) ==========\n");
         return false;
     }
     
-    HTTPClient http;
-    // Don't pass player name - get ALL unread emails and filter by body content
-    String url = "https://www.storyboardacs.com/retrieveESP32mail.php";
-    
-    Serial.println("");
-    Serial.println("========== MAIL FETCH START ==========");
-    Serial.print("[MAIL] Player: ");
-    Serial.println(playerName);
-    Serial.print("[MAIL] URL: ");
-    Serial.println(url);
+    Serial.println("[MAIL] Response success=true");
     
-    http.setConnectTimeout(5000);   // 5 second connection timeout
-    http.setTimeout(10000);          // 10 second total timeout
+    if (json.get("count") == "0") {
+        Serial.println("[MAIL] No new mail (count=0)");
+        Serial.println("========== MAIL FETCH END (SUCCESS, NO MAIL) ==========\n");
+        return true;  // Success, just no mail
+    }
     
-    Serial.println("[MAIL] Attempting HTTP connection...");
+    // Values arrive in document order; a new "emails[n]" prefix starts the next letter
+    String currentPrefix = "";
+    Letter letter;
+    bool haveLetter = false;
     
-    if (!http.begin(url)) {
-        Serial.println("[MAIL] ERROR: Failed to begin HTTP request");
-        return false;
+    for (size_t i = 0; i <= json.values.size(); i++) {
+        String prefix = "";
+        if (i < json.values.size()) {
+            const String &path = json.values[i].path;
+            if (!path.startsWith("emails[")) continue;
+            prefix = path.substring(0, path.indexOf(']') + 1);
+        }
+        
+        // Finish the previous email object
+        if (haveLetter && prefix != currentPrefix) {
+            if (letter.body.length() > 0) {
+                letters.push_back(letter);
+                Serial.print("[MAIL] SUCCESS: Parsed email from: ");
+                Serial.println(letter.from);
+                Serial.print("[MAIL] Email subject: ");
+                Serial.println(letter.subject);
+            } else {
+                Serial.println("[MAIL] WARNING: Email has empty body, skipping");
+            }
+            letter = Letter();
+            haveLetter = false;
+        }
+        if (i == json.values.size()) break;
+        
+        currentPrefix = prefix;
+        haveLetter = true;
+        
+        const JsonValue &v = json.values[i];
+        String field = v.path.substring(prefix.length() + 1);
+        if (field == "to") letter.to = v.value;
+        else if (field == "from") letter.from = v.value;
+        else if (field == "subject") letter.subject = v.value;
+        else if (field == "body") letter.body = v.value;
+        else if (field == "messageId") letter.messageId = v.value;
+        else if (field == "displayName") letter.displayName = v.value;  // preferred playername or sender email part
+        else if (field == "recipient") letter.recipient = v.value;
     }
     
-    Serial.println("[MAIL] HTTP connection started, sending GET request...");
-    http.addHeader("Content-Type", "application/json");
-    
-    int httpCode = http.GET();
-    Serial.print("[MAIL] HTTP Response Code: ");
-    Serial.println(httpCode);
+    Serial.print("[MAIL] Successfully parsed ");
+    Serial.print(letters.size());
+    Serial.println(" emails");
+    Serial.println("========== MAIL FETCH END (SUCCESS) ==========\n");
+    return true;
+}
+
+// Paths parseMailResponse reads
+void wantMailPaths(JsonPathExtractor &json) {
+    json.want("success");
+    json.want("count");
+    json.want("emails[].to");
+    json.want("emails[].from");
+    json.want("emails[].subject");
+    json.want("emails[].body");
+    json.want("emails[].messageId");
+    json.want("emails[].displayName");
+    json.want("emails[].recipient");
+}
+
+String mailboxPath(const String &box) {
+    return "/mail_" + box + ".txt";
+}
+
+int mailWaiting(const String &box) {
+    auto it = mailIndex.find(box);
+    return it == mailIndex.end() ? 0 : it->second;
+}
+
+// Percent-encode a query parameter value
+String urlEncode(const String &s) {
+    const char *hex = "0123456789ABCDEF";
+    String out;
+    for (unsigned int i = 0; i < s.length(); i++) {
+        char c = s[i];
+        if (isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += c;
+        } else {
+            out += '%';
+            out += hex[((uint8_t)c) >> 4];
+            out += hex[((uint8_t)c) & 0x0F];
+        }
+    }
+    return out;
+}
+
+// Which mailbox a letter belongs in: the named player if they exist, else unclaimed
+String mailboxForLetter(const Letter &letter) {
+    String name = letter.recipient;
+    if (name.length() == 0) {
+        name = extractPlayerNameFromEmail(letter.body);
+    }
+    int space = name.indexOf(' ');
+    if (space > 0) name = name.substring(0, space);
+    name.toLowerCase();
     
-    if (httpCode != HTTP_CODE_OK) {
-        Serial.print("[MAIL] ERROR: HTTP error code ");
-        Serial.println(httpCode);
-        http.end();
-        Serial.println("========== MAIL FETCH END (ERROR) ==========\n");
+    if (name.length() > 0 && LittleFS.exists("/user_" + name + ".txt")) {
+        return name;
+    }
+    return MAIL_UNCLAIMED;
+}
+
+// Mailbox record: one "X|value" line per field, newlines stored as \n
+String escapeMailField(const String &s) {
+    String out = s;
+    out.replace("\\", "\\\\");
+    out.replace("\r", "");
+    out.replace("\n", "\\n");
+    return out;
+}
+
+bool fileMailLetter(const String &box, const Letter &letter) {
+    File f = LittleFS.open(mailboxPath(box), "a");
+    if (!f) {
+        Serial.println("[MAIL] ERROR: Cannot open mailbox " + box);
         return false;
     }
+    f.println("F|" + escapeMailField(letter.from));
+    f.println("S|" + escapeMailField(letter.subject));
+    f.println("I|" + escapeMailField(letter.messageId));
+    f.println("B|" + escapeMailField(letter.body));
+    f.close();
+    mailIndex[box]++;
+    return true;
+}
+
+int readMailbox(const String &box, std::vector<Letter> &letters) {
+    File f = LittleFS.open(mailboxPath(box), "r");
+    if (!f) return 0;
     
-    String response = http.getString();
-    http.end();
+    int count = 0;
+    while (f.available()) {
+        String line = f.readStringUntil('\n');
+        if (line.endsWith("\r")) line.remove(line.length() - 1);
+        if (line.length() < 2 || line[1] != '|') continue;
+        
+        String value = unescapeNewlines(line.substring(2));
+        if (line[0] == 'F') {
+            letters.push_back(Letter());
+            letters.back().from = value;
+            count++;
+        } else if (count > 0) {
+            Letter &letter = letters.back();
+            if (line[0] == 'S') letter.subject = value;
+            else if (line[0] == 'I') letter.messageId = value;
+            else if (line[0] == 'B') letter.body = value;
+        }
+    }
+    f.close();
+    return count;
+}
+
+// Take every letter out of a mailbox (the file is removed)
+int emptyMailbox(const String &box, std::vector<Letter> &letters) {
+    if (mailWaiting(box) == 0) return 0;
+    int count = readMailbox(box, letters);
+    LittleFS.remove(mailboxPath(box));
+    mailIndex.erase(box);
+    return count;
+}
+
+void saveMailCursor() {
+    File f = LittleFS.open(MAIL_CURSOR_PATH, "w");
+    if (!f) {
+        Serial.println("[MAIL] Failed to save mail cursor");
+        return;
+    }
+    f.println(mailPoll.etag);
+    f.println(mailPoll.lastMessageId);
+    f.close();
+}
+
+// Restore the poll cursor and count the letters waiting in each mailbox
+void loadMailState() {
+    File f = LittleFS.open(MAIL_CURSOR_PATH, "r");
+    if (f) {
+        mailPoll.etag = f.readStringUntil('\n');
+        mailPoll.etag.trim();
+        mailPoll.lastMessageId = f.readStringUntil('\n');
+        mailPoll.lastMessageId.trim();
+        f.close();
+    }
     
-    Serial.print("[MAIL] Response length: ");
-    Serial.print(response.length());
-    Serial.println(" bytes");
+    mailIndex.clear();
+    File root = LittleFS.open("/");
+    if (!root || !root.isDirectory()) return;
     
-    if (response.length() > 500) {
-        Serial.print("[MAIL] Response (first 500 chars): ");
-        Serial.println(response.substring(0, 500));
-    } else {
-        Serial.print("[MAIL] Full Response: ");
-        Serial.println(response);
+    File file = root.openNextFile();
+    while (file) {
+        String fname = file.name();
+        if (fname.startsWith("/")) fname = fname.substring(1);
+        
+        if (fname.startsWith("mail_") && fname.endsWith(".txt")) {
+            String box = fname.substring(5, fname.length() - 4);
+            int count = 0;
+            while (file.available()) {
+                String line = file.readStringUntil('\n');
+                if (line.startsWith("F|")) count++;
+            }
+            if (count > 0) mailIndex[box] = count;
+        }
+        file = root.openNextFile();
     }
     
-    // Parse JSON response
-    // Format: {"success": true, "emails": [...], "count": N, "errors": [...]}
-    
-    // Simple JSON parsing (no external library)
-    // Check for success - handle both "success": true and "success":true (no spaces)
-    if (response.indexOf("\"success\":true") == -1 && response.indexOf("\"success\": true") == -1) {
-        Serial.println("[MAIL] ERROR: Server returned error or success=false");
-        Serial.println("[MAIL] Looking for success flag in response...");
-        Serial.println(response);
-        Serial.println("========== MAIL FETCH END (ERROR) ==========\n");
+    int total = 0;
+    for (auto &entry : mailIndex) total += entry.second;
+    Serial.printf("[MAIL] %d letters waiting in %d mailboxes, cursor '%s'\n",
+                  total, (int)mailIndex.size(), mailPoll.lastMessageId.c_str());
+}
+
+/**
+ * Deliver waiting mail to a player standing in the post office
+ * Called when player enters the post office or uses "check mail" command.
+ * Only the local mailboxes are read - the inbox itself is polled in the
+ * background.  Letters addressed to this player come first, then any
+ * unclaimed ones.  Returns true if letters were delivered.
+ */
+bool checkAndSpawnMailLetters(Player &p, bool reportNoMail) {
+    if (strlen(p.name) == 0) {
+        Serial.println("[MAIL] ERROR: Empty player name");
         return false;
     }
     
-    Serial.println("[MAIL] Response success=true");
-    
-    if (response.indexOf("\"count\":0") != -1 || response.indexOf("\"count\": 0") != -1) {
-        Serial.println("[MAIL] No new mail (count=0)");
-        Serial.println("========== MAIL FETCH END (SUCCESS, NO MAIL) ==========\n");
-        return true;  // Success, just no mail
-    }
+    String box = String(p.name);
+    box.toLowerCase();
     
-    Serial.println("[MAIL] Response contains emails, parsing...");
+    std::vector<Letter> letters;
+    emptyMailbox(box, letters);
+    emptyMailbox(MAIL_UNCLAIMED, letters);
     
-    // Extract email array
-    // Look for "emails": [...]
-    int emailsStart = response.indexOf("\"emails\": [");
-    if (emailsStart == -1) {
-        emailsStart = response.indexOf("\"emails\":[");  // Also try without space
-    }
-    if (emailsStart == -1) {
-        Serial.println("[MAIL] ERROR: Could not find emails array in response");
-        Serial.println("========== MAIL FETCH END (ERROR) ==========\n");
+    if (letters.size() == 0) {
+        if (reportNoMail) {
+            p.client.println("No mail today, sorry.");
+        }
         return false;
     }
     
-    Serial.println("[MAIL] Found emails array, parsing individual emails...");
+    Serial.println("");
+    Serial.println("========== POST OFFICE MAIL CHECK ==========");
+    Serial.print("[MAIL] Delivering mail to player: ");
+    Serial.println(p.name);
     
-    // Parse each email object in the array
-    // Very basic parsing - assumes well-formed JSON
-    int pos = emailsStart;
-    if (response.indexOf("\"emails\": [") != -1) {
-        pos += 11;  // Move past "emails": [
-    } else {
-        pos += 10;  // Move past "emails":[
+    spawnMailLetters(&p, String(p.name), p.roomX, p.roomY, p.roomZ, letters);
+    return true;
+}
+
+// Hand freshly filed letters to anyone already waiting in a post office
+void deliverMailToWaitingPlayers() {
+    for (int i = 0; i < maxPlayers; i++) {
+        Player &p = players[i];
+        if (!p.active || !p.loggedIn) continue;
+        if (getPostOfficeForRoom(p) == nullptr) continue;
+        if (checkAndSpawnMailLetters(p, false)) {
+            p.client.print("> ");
+        }
+    }
+}
+
+// Queue a background poll of the post office inbox (non-blocking)
+void startMailPoll() {
+    if (mailPoll.jobId != 0) {
+        return; // Already polling
     }
     
-    int emailCount = 0;
+    HttpJob *job = new HttpJob();
+    job->url = MAIL_POLL_URL;
+    if (mailPoll.lastMessageId.length() > 0) {
+        // Tells the server what we have filed; it deletes those and sends only newer mail
+        job->url += "?since=" + urlEncode(mailPoll.lastMessageId);
+    }
+    job->ifNoneMatch = mailPoll.etag;
+    wantMailPaths(job->json);
+    job->connectTimeoutMs = 5000;   // 5 second connection timeout
+    job->timeoutMs = 10000;          // 10 second total timeout
     
-    while (pos < response.length()) {
-        // Look for opening brace of email object
-        int objStart = response.indexOf('{', pos);
-        if (objStart == -1) break;
-        
-        // Find closing brace
-        int objEnd = response.indexOf('}', objStart);
-        if (objEnd == -1) break;
-        
-        String emailObj = response.substring(objStart, objEnd + 1);
-        
-        Serial.print("[MAIL] Parsing email object ");
-        Serial.print(emailCount + 1);
-        Serial.print(": ");
-        Serial.println(emailObj.substring(0, 100));
-        
-        // Parse fields
-        Letter letter;
+    job->onComplete = [](HttpJob &done) {
+        mailPoll.jobId = 0;
+        mailPoll.lastPollTime = millis();
+        mailPoll.polls++;
         
-        // Extract "to"
-        int toStart = emailObj.indexOf("\"to\": \"");
-        if (toStart == -1) toStart = emailObj.indexOf("\"to\":\"");
-        if (toStart != -1) {
-            toStart = emailObj.indexOf("\"", toStart + 4) + 1;
-            int toEnd = emailObj.indexOf("\"", toStart);
-            if (toEnd != -1) {
-                letter.to = emailObj.substring(toStart, toEnd);
-            }
-        }
-        
-        // Extract "from"
-        int fromStart = emailObj.indexOf("\"from\": \"");
-        if (fromStart == -1) fromStart = emailObj.indexOf("\"from\":\"");
-        if (fromStart != -1) {
-            fromStart = emailObj.indexOf("\"", fromStart + 5) + 1;
-            int fromEnd = emailObj.indexOf("\"", fromStart);
-            if (fromEnd != -1) {
-                letter.from = emailObj.substring(fromStart, fromEnd);
-            }
-        }
-        
-        // Extract "subject"
-        int subjStart = emailObj.indexOf("\"subject\": \"");
-        if (subjStart == -1) subjStart = emailObj.indexOf("\"subject\":\"");
-        if (subjStart != -1) {
-            subjStart = emailObj.indexOf("\"", subjStart + 8) + 1;
-            int subjEnd = emailObj.indexOf("\"", subjStart);
-            if (subjEnd != -1) {
-                letter.subject = emailObj.substring(subjStart, subjEnd);
-            }
+        if (done.httpCode == HTTP_CODE_NOT_MODIFIED) {
+            mailPoll.notModified++;
+            return;
         }
         
-        // Extract "body" (note: body may contain escaped newlines and special chars)
-        // This is more robust - find "body": then skip to the opening quote, then extract until closing quote
-        int bodyStart = emailObj.indexOf("\"body\":");
-        if (bodyStart != -1) {
-            // Find the opening quote for the body value
-            bodyStart = emailObj.indexOf("\"", bodyStart + 7);
-            if (bodyStart != -1) {
-                bodyStart++;  // Move past the opening quote
-                
-                // Find the closing quote - must handle escaped characters
-                int bodyEnd = bodyStart;
-                while (bodyEnd < emailObj.length()) {
-                    char c = emailObj[bodyEnd];
-                    if (c == '\\' && (bodyEnd + 1) < emailObj.length()) {
-                        // Skip escaped character
-                        bodyEnd += 2;
-                    } else if (c == '"') {
-                        // Found unescaped closing quote
-                        break;
-                    } else {
-                        bodyEnd++;
-                    }
-                }
-                
-                if (bodyEnd <= emailObj.length()) {
-                    letter.body = emailObj.substring(bodyStart, bodyEnd);
-                    // Unescape JSON sequences
-                    letter.body.replace("\\r\\n", "\r\n");
-                    letter.body.replace("\\n", "\n");
-                    letter.body.replace("\\\"", "\"");
-                    letter.body.replace("\\\\", "\\");
-                }
-            }
+        std::vector<Letter> letters;
+        if (!done.ok() || !parseMailResponse(done.json, letters)) {
+            mailPoll.failures++;
+            Serial.println("[MAIL] Poll failed (code " + String(done.httpCode) + ")");
+            return;
         }
         
-        // Extract "messageId"
-        int msgIdStart = emailObj.indexOf("\"messageId\": \"");
-        if (msgIdStart == -1) msgIdStart = emailObj.indexOf("\"messageId\":\"");
-        if (msgIdStart != -1) {
-            msgIdStart = emailObj.indexOf("\"", msgIdStart + 10) + 1;
-            int msgIdEnd = emailObj.indexOf("\"", msgIdStart);
-            if (msgIdEnd != -1) {
-                letter.messageId = emailObj.substring(msgIdStart, msgIdEnd);
+        // The cursor only moves past letters that are safely filed: the next
+        // "since=" poll makes the server delete everything up to it
+        int filed = 0;
+        bool saveFailed = false;
+        for (Letter &letter : letters) {
+            String box = mailboxForLetter(letter);
+            if (!fileMailLetter(box, letter)) {
+                saveFailed = true;
+                break;  // fetched again on the next poll
             }
-        }
-        
-        // Extract "displayName" (preferred playername or sender email part)
-        int displayNameStart = emailObj.indexOf("\"displayName\": \"");
-        if (displayNameStart == -1) displayNameStart = emailObj.indexOf("\"displayName\":\"");
-        if (displayNameStart != -1) {
-            displayNameStart = emailObj.indexOf("\"", displayNameStart + 13) + 1;
-            int displayNameEnd = emailObj.indexOf("\"", displayNameStart);
-            if (displayNameEnd != -1) {
-                letter.displayName = emailObj.substring(displayNameStart, displayNameEnd);
+            filed++;
+            Serial.println("[MAIL] Filed letter " + letter.messageId + " from " + letter.from + " -> " + box);
+            if (letter.messageId.length() > 0) {
+                mailPoll.lastMessageId = letter.messageId;
             }
         }
-        
-        if (letter.body.length() > 0) {
-            letters.push_back(letter);
-            Serial.print("[MAIL] SUCCESS: Parsed email from: ");
-            Serial.println(letter.from);
-            Serial.print("[MAIL] Email subject: ");
-            Serial.println(letter.subject);
-            emailCount++;
+        mailPoll.filed += filed;
+        if (saveFailed) {
+            mailPoll.failures++;
+            mailPoll.etag = "";     // no 304 until the rest are filed
+            Serial.println("[MAIL] Could not file a letter; it stays on the server for the next poll");
         } else {
-            Serial.println("[MAIL] WARNING: Email has empty body, skipping");
+            mailPoll.etag = done.etag;
         }
+        saveMailCursor();
         
-        pos = objEnd + 1;
-    }
+        if (filed > 0) {
+            deliverMailToWaitingPlayers();
+        }
+    };
     
-    Serial.print("[MAIL] Successfully parsed ");
-    Serial.print(letters.size());
-    Serial.println(" emails");
-    Serial.println("========== MAIL FETCH END (SUCCESS) ==========\n");
-    return true;
+    mailPoll.jobId = httpJobSubmit(job);
+}
+
+// Poll the inbox on a timer; call from the HTTP tick
+void updateMailPoll(unsigned long now) {
+    if (mailPoll.jobId == 0 && (long)(now - mailPoll.nextPollTime) >= 0 && WiFi.status() == WL_CONNECTED) {
+        startMailPoll();
+        mailPoll.nextPollTime = now + MAIL_POLL_INTERVAL;
+    }
+}
+
+// Poll on the next loop instead of waiting for the timer
+void requestMailPoll() {
+    mailPoll.nextPollTime = millis();
 }
 
 /**
- * Check for mail and spawn letter items in the post office
- * Called when player enters the post office
- */
-/**
- * Check for mail and spawn letter items in the post office
- * Called when player enters the post office or uses "check mail" command
- * Returns true if mail was found and letters were spawned
+ * Drop delivered letters on the post office floor
+ * owner may be nullptr if nobody is there to be told
  */
-bool checkAndSpawnMailLetters(Player &p) {
-    Serial.println("");
-    Serial.println("========== POST OFFICE MAIL CHECK ==========");
-    Serial.print("[MAIL] Checking mail for player: ");
-    Serial.println(p.name);
-    
-    std::vector<Letter> letters;
-    
-    // Fetch ALL unread emails (not filtered by player)
-    if (!fetchMailFromServer(String(p.name), letters)) {
-        Serial.println("[MAIL] RESULT: Failed to fetch mail from server");
-        Serial.println("========== POST OFFICE MAIL CHECK END ==========\n");
-        return false;
-    }
-    
-    if (letters.size() == 0) {
-        Serial.println("[MAIL] RESULT: No mail found");
-        Serial.println("========== POST OFFICE MAIL CHECK END ==========\n");
-        return false;  // No mail found
-    }
-    
+void spawnMailLetters(Player *owner, const String &ownerName, int x, int y, int z, std::vector<Letter> &letters) {
     Serial.print("[MAIL] Found ");
     Serial.print(letters.size());
-    Serial.println(" unread letters from server, spawning as items...");
+    Serial.println(" letters in the mailbox, spawning as items...");
     
     // Use all letters directly - no recipient filtering
     // Each letter will be displayed with the sender's email address part
@@ -13181,8 +15336,10 @@ bool checkAndSpawnMailLetters(Player &p) {
     Serial.print(letters.size());
     Serial.println(" letters - announcing to player and spawning items");
     
-    // Mail found - announce it
-    p.client.println("\nThe Postal Clerk says: \"You've got mail!\" and drops the mail on the floor.");
+    // Mail found - announce it (only if the player is still here to see it)
+    if (owner && owner->roomX == x && owner->roomY == y && owner->roomZ == z) {
+        owner->client.println("\nThe Postal Clerk says: \"You've got mail!\" and drops the mail on the floor.");
+    }
     
     // Create letter items in the room
     for (int i = 0; i < (int)letters.size(); i++) {
@@ -13194,10 +15351,10 @@ bool checkAndSpawnMailLetters(Player &p) {
         Serial.println(letters.size());
         
         // Use player's name for the letter (not the sender)
-        String letterName = "Letter for " + String(capFirst(p.name));
+        String letterName = "Letter for " + String(capFirst(ownerName.c_str()));
         
         Serial.print("[MAIL] Letter for player: ");
-        Serial.println(p.name);
+        Serial.println(ownerName);
         
         // Create world item for the letter
         WorldItem letter_item;
@@ -13206,9 +15363,9 @@ bool checkAndSpawnMailLetters(Player &p) {
         letter_item.ownerName = "";  // Not owned - in room
         
         // Position at post office
-        letter_item.x = p.roomX;
-        letter_item.y = p.roomY;
-        letter_item.z = p.roomZ;
+        letter_item.x = x;
+        letter_item.y = y;
+        letter_item.z = z;
         
         Serial.print("[MAIL] Position: (");
         Serial.print(letter_item.x);
@@ -13235,7 +15392,6 @@ bool checkAndSpawnMailLetters(Player &p) {
     }
     
     Serial.println("========== POST OFFICE MAIL CHECK END ==========\n");
-    return true;  // Mail was found and spawned
 }
 
 void updateDrunkennessRecovery(Player &p) {
@@ -13505,7 +15661,7 @@ bool giveItemToPlayer(Player &p, int worldIndex) {
 
 
 Player* findPlayerInRoom(Player &p, const String &targetName) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active) continue;
         if (&players[i] == &p) continue;
 
@@ -13578,7 +15734,7 @@ void cmdGive(Player &p, const String &args) {
     NpcInstance* tn = nullptr;
 
     // Players first
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &other = players[i];
         if (!other.active) continue;
         if (&other == &p) continue;
@@ -13596,21 +15752,15 @@ void cmdGive(Player &p, const String &args) {
 
     // NPCs second
     if (!tp) {
-        for (auto &n : npcInstances) {
-            if (!n.alive || n.hp <= 0) continue;
+        for (NpcInstance *np : getNPCsAt(p.roomX, p.roomY, p.roomZ)) {
+            if (np->hp <= 0) continue;
 
-            if (n.x == p.roomX && n.y == p.roomY && n.z == p.roomZ) {
-                std::string key = n.npcId.c_str();
-                auto it = npcDefs.find(key);
-                if (it == npcDefs.end()) continue;
+            const NpcTemplate *tpl = npcTemplateOf(*np);
+            if (!tpl) continue;
 
-                auto &def = it->second;
-                String npcName = def.attributes.at("name").c_str();
-
-                if (npcNameMatches(npcName, targetName)) {
-                    tn = &n;
-                    break;
-                }
+            if (npcNameMatches(tpl->name, targetName)) {
+                tn = np;
+                break;
             }
         }
     }
@@ -13820,7 +15970,7 @@ int findContainer(Player &p, const char* containerStr, bool &isInInventory) {
     // -----------------------------------------
     // 2. SEARCH ROOM (top-level only)
     // -----------------------------------------
-    Room &r = p.currentRoom;
+    Room &r = playerRoom(p);
 
     for (int i = 0; i < (int)worldItems.size(); i++) {
         WorldItem &wi = worldItems[i];
@@ -14475,7 +16625,7 @@ void cmdDrop(Player &p, const String &input) {
     WorldItem &wi = worldItems[worldIndex];
     
     // Check if we're in a special room (RECYCLING CENTER)
-    if (isRecyclingCenter(p.currentRoom)) {
+    if (isRecyclingCenter(playerRoom(p))) {
         // Remove from inventory
         p.invIndices[invSlot] = p.invIndices[p.invCount - 1];
         p.invCount--;
@@ -14511,7 +16661,7 @@ void cmdDropAll(Player &p, const char *unused) {
 void cmdDropAll(Player &p) {
     bool droppedAny = false;
     int totalCoins = 0;
-    bool inRecyclingCenter = isRecyclingCenter(p.currentRoom);
+    bool inRecyclingCenter = isRecyclingCenter(playerRoom(p));
 
     // ---------------------------------------------------------
     // 1. Iterate inventory safely
@@ -14963,7 +17113,7 @@ void cmdUnwield(Player &p) {
 // =============================
 
 void broadcastToRoom(int x, int y, int z, const String &msg, Player *exclude) {
-  for (int i = 0; i < MAX_PLAYERS; i++) {
+  for (int i = 0; i < maxPlayers; i++) {
     if (!players[i].active) continue;
     if (&players[i] == exclude) continue;
     if (players[i].roomX == x && players[i].roomY == y && players[i].roomZ == z) {
@@ -14985,8 +17135,7 @@ void handlePlayerDeath(Player &p) {
 
     // Dramatic death line
     String msg = deathMsgs[random(5)];
-    p.client.println(msg);
-    delay(500);
+    queueOutput(p, msg, 500);
 
     broadcastRoomExcept(
         p,
@@ -14999,22 +17148,20 @@ void handlePlayerDeath(Player &p) {
     p.xp -= lostXP;
     if (p.xp < 0) p.xp = 0;
 
-    p.client.println("You lose " + String(lostXP) + " experience points!");
-    delay(500);
+    queueOutput(p, "You lose " + String(lostXP) + " experience points!", 500);
 
     // Prevent negative HP
     p.hp = 0;
 
     // End combat
     p.inCombat = false;
-    p.combatTarget = nullptr;
+    p.combatTarget = NpcHandle();
 
     // Drop all coins in inventory at death location
     if (p.coins > 0) {
         spawnGoldAt(p.roomX, p.roomY, p.roomZ, p.coins);
-        p.client.println("Your " + String(p.coins) + " gold coins scatter on the ground!");
+        queueOutput(p, "Your " + String(p.coins) + " gold coins scatter on the ground!", 1000);
         p.coins = 0;
-        delay(1000);
     }
 
     // Drop all inventory items
@@ -15045,12 +17192,10 @@ void handlePlayerDeath(Player &p) {
         p.level = newLevel;
         applyLevelBonuses(p);
 
-        p.client.println("You have dropped to level " + String(p.level) + ".");
-        delay(500);
+        queueOutput(p, "You have dropped to level " + String(p.level) + ".", 500);
 
-        p.client.println("You are now known as: " +
-            String(titles[p.raceId][p.level - 1]));
-        delay(500);
+        queueOutput(p, "You are now known as: " +
+            String(titles[p.raceId][p.level - 1]), 500);
     }
 
     // ----------------------------------------------------
@@ -15063,19 +17208,17 @@ void handlePlayerDeath(Player &p) {
     int spawnY = 250;
     int spawnZ = 50;
 
-    p.client.println("Your spirit drifts back toward the mortal world...");
-    delay(500);
+    queueOutput(p, "Your spirit drifts back toward the mortal world...", 500);
 
     loadRoomForPlayer(p, spawnX, spawnY, spawnZ);
 
-    p.client.println("You awaken back at the spawn point...");
-    delay(500);
+    queueOutput(p, "You awaken back at the spawn point...", 500);
 
-    cmdLook(p);
+    queueAction(p, [](Player &pl) { cmdLook(pl); });
 }
 
 void broadcastRoomExcept(Player &p, const String &msg, Player &exclude) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (!players[i].active || !players[i].loggedIn) continue;
         if (&players[i] == &exclude) continue;
 
@@ -15133,6 +17276,11 @@ bool isValidPassword(const String &s) {
   return true;
 }
 
+// Stored passwords are lowercase; a replay's masked password always matches
+bool passwordMatches(const String &lowerTyped, const char *stored) {
+  return lowerTyped == String(stored) || journalSecret(lowerTyped);
+}
+
 
 void parseKeyValuePairs(const String &line, std::map<String, String> &out) {
     out.clear();
@@ -15474,14 +17622,14 @@ void savePlayerToFS(Player &p) {
     // QUEST COMPLETION FLAGS
     // -----------------------------
     for (int q = 0; q < 10; q++)
-        f.println(p.questCompleted[q] ? "1" : "0");
+        f.println(p.quests.completed(q) ? "1" : "0");
 
     // -----------------------------
     // QUEST STEP FLAGS
     // -----------------------------
     for (int q = 0; q < 10; q++)
         for (int s = 0; s < 10; s++)
-            f.println(p.questStepDone[q][s] ? "1" : "0");
+            f.println(p.quests.stepDone(q, s) ? "1" : "0");
 
     // Healthcare plan flag
     f.println(p.hasHealthcarePlan ? "1" : "0");
@@ -15776,7 +17924,7 @@ bool loadPlayerFromFS(Player &p, const String &name) {
     // -----------------------------
     for (int q = 0; q < 10; q++) {
         safeRead(tmp);
-        p.questCompleted[q] = (tmp == "1");
+        p.quests.setCompleted(q, tmp == "1");
     }
 
     // -----------------------------
@@ -15785,7 +17933,7 @@ bool loadPlayerFromFS(Player &p, const String &name) {
     for (int q = 0; q < 10; q++) {
         for (int s = 0; s < 10; s++) {
             safeRead(tmp);
-            p.questStepDone[q][s] = (tmp == "1");
+            p.quests.setStep(q, s, tmp == "1");
         }
     }
 
@@ -15836,22 +17984,243 @@ struct LoginState {
 
   String tempName;
   String tempPassword;
+
+  uint32_t heapAtAccept = 0;  // free heap when the connection came in
 };
 
-LoginState loginState[MAX_PLAYERS];
+LoginState *loginState = nullptr;                // maxPlayers of them
+const unsigned long LOGIN_TIMEOUT_MS = 30000UL;
+
+// The slot's next line is a password (login or "password" command); the
+// replay journal records a stand-in instead
+bool inputIsSecret(int index) {
+  if (!players[index].loggedIn &&
+      (loginState[index].stage == LOGIN_PASSWORD || loginState[index].stage == LOGIN_NEW_PASSWORD)) {
+    return true;
+  }
+  return pendingPrompts[index].active && pendingPrompts[index].input == PROMPT_SECRET;
+}
+
+// =============================
+// Session pool
+// =============================
+//
+// Everything kept per connection - Player, LoginState, PendingPrompt,
+// DeferredOutput, the High-Low and chess games and a room cache slot - is
+// an array of maxPlayers slots, allocated once by setup() after the world is loaded
+// and before the MUD port opens.  The count is what the heap left at that
+// point can carry: each slot costs its structs plus
+// SESSION_HEAP_PER_CONNECTION for what a connected player allocates as it
+// plays (socket buffers, strings, visited rooms, queued output), and
+// SESSION_HEAP_RESERVE stays back for the rest (HTTP workers and their TLS
+// sessions, uploads, the world growing).  MAX_PLAYERS caps it, and so does
+// the socket count lwIP was built with: the stock Arduino core has 16 in
+// all, which leaves about 10 for players; 30 and up needs a core built
+// with a larger CONFIG_LWIP_MAX_SOCKETS.
+//
+// What a session really costs is measured too - free heap when the
+// connection is accepted against free heap once it has logged in - and
+// shown by "debug sessions" next to the estimate.
+
+#ifndef SESSION_HEAP_RESERVE
+#define SESSION_HEAP_RESERVE (64UL * 1024UL)    // build with -D SESSION_HEAP_RESERVE=bytes to change
+#endif
+
+#ifndef SESSION_HEAP_PER_CONNECTION
+#define SESSION_HEAP_PER_CONNECTION 3072UL      // dynamic heap a connected player is budgeted
+#endif
+
+#ifndef SESSION_SOCKETS_RESERVED
+#define SESSION_SOCKETS_RESERVED 6              // MUD and file listeners, an upload, 2 HTTP workers, NTP
+#endif
+
+struct SessionPoolStats {
+    uint32_t slotBytes = 0;         // the per-slot structs, all arrays together
+    uint32_t heapAtSizing = 0;      // free heap when the pool was sized
+    uint32_t heapAfter = 0;         // free heap once it was allocated
+    const char *limitedBy = "";     // what kept it from growing
+    uint32_t measured = 0;          // logins whose heap cost was measured
+    uint32_t measuredTotal = 0;
+    uint32_t measuredMax = 0;
+};
+
+SessionPoolStats sessionPool;
+
+// The one slot left when the heap cannot give even that
+struct SessionFallbackSlot {
+    Player player;
+    LoginState login;
+    PendingPrompt prompt;
+    DeferredOutput output;
+    HighLowSession highLow;
+    ChessSession chess;
+};
+
+static SessionFallbackSlot sessionFallback;
+
+static void freeSessionPool() {
+    if (players != &sessionFallback.player) {
+        delete[] players;
+        delete[] loginState;
+        delete[] pendingPrompts;
+        delete[] deferredOutput;
+        delete[] highLowSessions;
+        delete[] chessSessions;
+    }
+    players = nullptr;
+    loginState = nullptr;
+    pendingPrompts = nullptr;
+    deferredOutput = nullptr;
+    highLowSessions = nullptr;
+    chessSessions = nullptr;
+    if (roomCache != &roomCacheBootSlot) delete[] roomCache;
+    roomCache = &roomCacheBootSlot;
+    roomCacheSlots = 1;
+    maxPlayers = 0;
+}
+
+// Size the pool from the free heap and allocate it; every slot starts
+// zeroed, as the fixed arrays used to
+void allocateSessionPool() {
+    sessionPool.slotBytes = sizeof(Player) + sizeof(LoginState) + sizeof(PendingPrompt) +
+                            sizeof(DeferredOutput) + sizeof(HighLowSession) + sizeof(ChessSession) +
+                            sizeof(RoomCacheSlot);
+    sessionPool.heapAtSizing = ESP.getFreeHeap();
+
+    uint32_t perSlot = sessionPool.slotBytes + SESSION_HEAP_PER_CONNECTION;
+    uint32_t roomSpare = ROOM_CACHE_SLOTS * sizeof(RoomCacheSlot);
+    uint32_t spare = sessionPool.heapAtSizing > SESSION_HEAP_RESERVE + roomSpare ?
+                     sessionPool.heapAtSizing - SESSION_HEAP_RESERVE - roomSpare : 0;
+
+    int n = MAX_PLAYERS;
+    sessionPool.limitedBy = "MAX_PLAYERS";
+    if ((int)(spare / perSlot) < n) {
+        n = spare / perSlot;
+        sessionPool.limitedBy = "heap";
+    }
+#ifdef CONFIG_LWIP_MAX_SOCKETS
+    if (CONFIG_LWIP_MAX_SOCKETS - SESSION_SOCKETS_RESERVED < n) {
+        n = CONFIG_LWIP_MAX_SOCKETS - SESSION_SOCKETS_RESERVED;
+        sessionPool.limitedBy = "lwIP sockets";
+    }
+#endif
+    if (n < 1) n = 1;   // always room for one (a wizard, to find out why), see below
+
+    // Each array is one block, so a fragmented heap can still refuse it
+    for (; n >= 1; n--) {
+        players         = new (std::nothrow) Player[n]();
+        loginState      = new (std::nothrow) LoginState[n]();
+        pendingPrompts  = new (std::nothrow) PendingPrompt[n]();
+        deferredOutput  = new (std::nothrow) DeferredOutput[n]();
+        highLowSessions = new (std::nothrow) HighLowSession[n]();
+        chessSessions   = new (std::nothrow) ChessSession[n]();
+        RoomCacheSlot *rooms = new (std::nothrow) RoomCacheSlot[n + ROOM_CACHE_SLOTS]();
+        if (rooms) {
+            roomCache = rooms;
+            roomCacheSlots = n + ROOM_CACHE_SLOTS;
+        }
+        if (players && loginState && pendingPrompts && deferredOutput && highLowSessions && chessSessions &&
+            rooms) break;
+        freeSessionPool();
+        sessionPool.limitedBy = "largest free block";
+    }
+
+    // Not even one slot: run on the static one rather than with none
+    if (n < 1) {
+        players = &sessionFallback.player;
+        loginState = &sessionFallback.login;
+        pendingPrompts = &sessionFallback.prompt;
+        deferredOutput = &sessionFallback.output;
+        highLowSessions = &sessionFallback.highLow;
+        chessSessions = &sessionFallback.chess;
+        n = 1;
+        sessionPool.limitedBy = "no heap, static slot";
+        Serial.println("[SESSIONS] [ERROR] No heap for even one player slot; using the static fallback slot");
+    }
+    maxPlayers = n;
+    sessionPool.heapAfter = ESP.getFreeHeap();
+
+    Serial.printf("[SESSIONS] %d player slots of %d (%s), %u bytes each + %lu budgeted, %d rooms cached, %u heap free\n",
+                  maxPlayers, MAX_PLAYERS, sessionPool.limitedBy, (unsigned)sessionPool.slotBytes,
+                  (unsigned long)SESSION_HEAP_PER_CONNECTION, roomCacheSlots, (unsigned)sessionPool.heapAfter);
+}
+
+// A login finished: what the session has cost since it was accepted
+void noteSessionHeap(int index) {
+    int32_t used = (int32_t)(loginState[index].heapAtAccept - ESP.getFreeHeap());
+    if (loginState[index].heapAtAccept == 0 || used <= 0) return;   // something else freed memory meanwhile
+    sessionPool.measured++;
+    sessionPool.measuredTotal += used;
+    if ((uint32_t)used > sessionPool.measuredMax) sessionPool.measuredMax = used;
+}
+
+void printSessionPool(Print &out) {
+    int active = 0, loggedIn = 0;
+    for (int i = 0; i < maxPlayers; i++) {
+        if (!players[i].active) continue;
+        active++;
+        if (players[i].loggedIn) loggedIn++;
+    }
+
+    char line[120];
+    out.println("=== SESSIONS ===");
+    snprintf(line, sizeof(line), "Slots:      %d of MAX_PLAYERS %d (limited by %s)",
+             maxPlayers, MAX_PLAYERS, sessionPool.limitedBy);
+    out.println(line);
+    snprintf(line, sizeof(line), "In use:     %d connected, %d logged in", active, loggedIn);
+    out.println(line);
+    snprintf(line, sizeof(line), "Per slot:   %u bytes (Player %u, login %u, prompt %u, output %u, high-low %u, chess %u, room %u)",
+             (unsigned)sessionPool.slotBytes, (unsigned)sizeof(Player), (unsigned)sizeof(LoginState),
+             (unsigned)sizeof(PendingPrompt), (unsigned)sizeof(DeferredOutput),
+             (unsigned)sizeof(HighLowSession), (unsigned)sizeof(ChessSession), (unsigned)sizeof(RoomCacheSlot));
+    out.println(line);
+    snprintf(line, sizeof(line), "Budget:     %lu bytes per connection, %lu held in reserve",
+             (unsigned long)SESSION_HEAP_PER_CONNECTION, (unsigned long)SESSION_HEAP_RESERVE);
+    out.println(line);
+    if (sessionPool.measured > 0) {
+        snprintf(line, sizeof(line), "Measured:   %u bytes average, %u max, accept to login (%u logins)",
+                 (unsigned)(sessionPool.measuredTotal / sessionPool.measured),
+                 (unsigned)sessionPool.measuredMax, (unsigned)sessionPool.measured);
+    } else {
+        snprintf(line, sizeof(line), "Measured:   no logins yet");
+    }
+    out.println(line);
+    snprintf(line, sizeof(line), "Heap:       %u free when sized, %u after, %u now",
+             (unsigned)sessionPool.heapAtSizing, (unsigned)sessionPool.heapAfter,
+             (unsigned)ESP.getFreeHeap());
+    out.println(line);
+    snprintf(line, sizeof(line), "Room cache: %d slots, %u hits, %u misses",
+             roomCacheSlots, (unsigned)roomCacheHits, (unsigned)roomCacheMisses);
+    out.println(line);
+}
 
 // =============================
 // Begin login for a new connection
 // =============================
 
+void handleLogin(Player &p, int index, const String &rawLine);
+
 void startLogin(Player &p, int index) {
   loginState[index] = LoginState();
   loginState[index].startTime = millis();
+  loginState[index].heapAtAccept = ESP.getFreeHeap();
 
   p.client.println(GLOBAL_MUD);
   p.client.println(); // blank line
 
-  p.client.println("Enter your name:");
+  // Every login answer goes to handleLogin until the player is in (or gone);
+  // the whole exchange must finish within LOGIN_TIMEOUT_MS, idle or not
+  setPrompt(p, index, "Enter your name:", PROMPT_TEXT,
+      [](Player &pl, int idx, const String &line) {
+          handleLogin(pl, idx, line);
+          return (pl.loggedIn || !pl.active) ? PROMPT_DONE : PROMPT_RETRY;
+      },
+      LOGIN_TIMEOUT_MS,
+      [](Player &pl, int) {
+          pl.client.println("Login timed out.");
+          pl.client.stop();
+          pl.active = false;
+      });
 }
 
 
@@ -15895,7 +18264,7 @@ void initPlayer(Player &p) {
     p.armorBonus = 0;
 
     p.inCombat = false;
-    p.combatTarget = nullptr;
+    p.combatTarget = NpcHandle();
     p.nextCombatTime = 0;
 }
 
@@ -15907,14 +18276,6 @@ void handleLogin(Player &p, int index, const String &rawLine) {
     LoginState &st = loginState[index];
     String line = cleanInput(rawLine);
 
-    // Timeout check
-    if (millis() - st.startTime > 30000UL) {
-        p.client.println("Login timed out.");
-        p.client.stop();
-        p.active = false;
-        return;
-    }
-
     switch (st.stage) {
 
         // -------------------------
@@ -15968,7 +18329,7 @@ void handleLogin(Player &p, int index, const String &rawLine) {
             // Case-insensitive password comparison
             String lowerInputPassword = line;
             lowerInputPassword.toLowerCase();
-            if (lowerInputPassword != String(p.storedPassword)) {
+            if (!passwordMatches(lowerInputPassword, p.storedPassword)) {
                 st.passwordAttempts++;
                 if (st.passwordAttempts >= 3) {
                     p.client.println("Too many failed attempts. Disconnecting.");
@@ -15981,7 +18342,7 @@ void handleLogin(Player &p, int index, const String &rawLine) {
             }
 
             // Check if player is already logged in elsewhere
-            for (int i = 0; i < MAX_PLAYERS; i++) {
+            for (int i = 0; i < maxPlayers; i++) {
                 if (players[i].active && players[i].loggedIn && 
                     strcasecmp(players[i].name, p.name) == 0) {
                     // Found existing session with same name - disconnect it
@@ -16000,6 +18361,7 @@ void handleLogin(Player &p, int index, const String &rawLine) {
             // Successful login
             st.stage = LOGIN_DONE;
             p.loggedIn = true;
+            noteSessionHeap(index);
             
             // Log session login (with distinction for new vs existing players)
             if (st.isNewPlayer) {
@@ -16066,7 +18428,7 @@ void handleLogin(Player &p, int index, const String &rawLine) {
 
             // Determine this player's index in players[]
             int pIndex = -1;
-            for (int i = 0; i < MAX_PLAYERS; i++) {
+            for (int i = 0; i < maxPlayers; i++) {
                 if (&players[i] == &p) {
                     pIndex = i;
                     break;
@@ -16115,6 +18477,9 @@ void handleLogin(Player &p, int index, const String &rawLine) {
                 cmdLook(p);
             }
 
+            // Pick up a chess / High-Low game interrupted by the scheduled reboot
+            restoreSnapshotSessions(p, pIndex);
+
             return;
         }
 
@@ -16179,18 +18544,14 @@ void handleLogin(Player &p, int index, const String &rawLine) {
 
 
             // Initialize quest progress (10 quests × 10 steps)
-            for (int q = 0; q < 10; q++) {
-                p.questCompleted[q] = false;
-                for (int s = 0; s < 10; s++) {
-                    p.questStepDone[q][s] = false;
-                }
-            }
+            p.quests = QuestFlags();
 
             // Save new character
             savePlayerToFS(p);
 
             st.stage = LOGIN_DONE;
             p.loggedIn = true;
+            noteSessionHeap(index);
             
             // Log new character login
             logSessionNewLogin(p.name);
@@ -16247,7 +18608,7 @@ void sendVoxel(Player &p) {
 }
 
 void broadcastToAll(const String &msg) {
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &p = players[i];
         if (!p.active || !p.loggedIn) continue;
         p.client.println(msg);
@@ -16406,7 +18767,7 @@ int resolveItem(Player &p, const String &raw) {
     }
 
     // 3. Room items (direct world index)
-    Room &r = p.currentRoom;
+    Room &r = playerRoom(p);
     for (int i = 0; i < (int)worldItems.size(); i++) {
         WorldItem &wi = worldItems[i];
 
@@ -16531,11 +18892,13 @@ void debugPrint(Player &p, const String &msg) {
 // CORE INTERACTION COMMANDS
 // =============================
 void handleCommand(Player &p, int index, const String &rawLine) {
+    LATENCY_SCOPE(latency[LAT_COMMAND]);
+
     // -----------------------------------------
     // Check if player left a game room (end games if so)
     // -----------------------------------------
     // Check High-Low game room
-    if (index >= 0 && index < MAX_PLAYERS && highLowSessions[index].gameActive) {
+    if (index >= 0 && index < maxPlayers && highLowSessions[index].gameActive) {
         if (p.roomX != highLowSessions[index].gameRoomX || 
             p.roomY != highLowSessions[index].gameRoomY || 
             p.roomZ != highLowSessions[index].gameRoomZ) {
@@ -16547,7 +18910,7 @@ void handleCommand(Player &p, int index, const String &rawLine) {
     }
     
     // Check Chess game room
-    if (index >= 0 && index < MAX_PLAYERS && chessSessions[index].gameActive) {
+    if (index >= 0 && index < maxPlayers && chessSessions[index].gameActive) {
         if (p.roomX != 247 || p.roomY != 248 || p.roomZ != 50) {
             // Player moved out of Game Parlor - end chess game
             endChessGame(p, index);
@@ -16556,44 +18919,6 @@ void handleCommand(Player &p, int index, const String &rawLine) {
         }
     }
 
-    // -----------------------------------------
-    // Handle High-Low continue prompt FIRST (before empty check)
-    // -----------------------------------------
-    if (index >= 0 && index < MAX_PLAYERS && highLowSessions[index].gameActive) {
-        HighLowSession &session = highLowSessions[index];
-        
-        if (session.awaitingContinue) {
-            String trimmed = rawLine;
-            trimmed.trim();
-            String lowerTrimmed = trimmed;
-            lowerTrimmed.toLowerCase();
-            
-            p.client.println("[DEBUG CONTINUE] trimmed='" + trimmed + "' length=" + String(trimmed.length()));
-            
-            if (trimmed.length() == 0) {
-                // Empty input - start next hand
-                p.client.println("[DEBUG] Empty input detected - dealing next hand");
-                session.awaitingContinue = false;
-                p.client.println("");
-                dealHighLowHand(p, index);
-                return;
-            } else if (lowerTrimmed == "end" || lowerTrimmed == "quit") {
-                // End the game
-                endHighLowGame(p, index);
-                return;
-            } else if (lowerTrimmed == "n" || lowerTrimmed == "s" || lowerTrimmed == "e" || lowerTrimmed == "w" || 
-                       lowerTrimmed.startsWith("go ")) {
-                // Allow movement commands
-                session.awaitingContinue = false;
-                // Fall through to normal command processing
-            } else {
-                // Invalid input during continue prompt
-                p.client.println("Press [Enter] to continue or type 'end'");
-                return;
-            }
-        }
-    }
-
     // -----------------------------------------
     // Clean and split input
     // -----------------------------------------
@@ -16607,12 +18932,14 @@ void handleCommand(Player &p, int index, const String &rawLine) {
     cmd.toLowerCase();
     args.trim();
 
+    COMMAND_PROBE(p, cmd, args);
+
     // -----------------------------------------
     // ACTIVITY MONITORING: Reset timer for non-chess commands
     // (Chess moves in Game Parlor don't reset the timer)
     // -----------------------------------------
     bool isChessMove = false;
-    if (index >= 0 && index < MAX_PLAYERS && chessSessions[index].gameActive) {
+    if (index >= 0 && index < maxPlayers && chessSessions[index].gameActive) {
         // Check if this looks like a chess move (e.g., "e4", "e2e4", "Nf3")
         // or chess-related command
         if (cmd == "board" || cmd == "help" || cmd == "status" || cmd == "end" || cmd == "quit") {
@@ -16717,8 +19044,9 @@ void handleCommand(Player &p, int index, const String &rawLine) {
     // -----------------------------------------
     // Portal activation  intercept the movement and teleport to using portal command eg.  Church 'enter', etc
     // -----------------------------------------
-    if (p.currentRoom.hasPortal) {
-        String pcmd = String(p.currentRoom.portalCommand);
+    Room &here = playerRoom(p);
+    if (here.hasPortal) {
+        String pcmd = String(here.portalCommand);
         pcmd.trim();
         pcmd.toLowerCase();
 
@@ -17033,12 +19361,9 @@ void handleCommand(Player &p, int index, const String &rawLine) {
     }
 
     if (cmd == "checkmail" || cmd == "check mail" || cmd == "mail") {
-        // Check for mail and spawn letters
-        bool hasMailResult = checkAndSpawnMailLetters(p);
-        
-        // Provide feedback
-        if (!hasMailResult) {
-            p.client.println("No mail today, sorry.");
+        // Deliver anything already filed; poll the inbox now in case more just arrived
+        if (!checkAndSpawnMailLetters(p, true)) {
+            requestMailPoll();
         }
         return;
     }
@@ -17085,7 +19410,7 @@ void handleCommand(Player &p, int index, const String &rawLine) {
         
         // Find the player index
         int playerIndex = -1;
-        for (int i = 0; i < MAX_PLAYERS; i++) {
+        for (int i = 0; i < maxPlayers; i++) {
             if (&players[i] == &p) {
                 playerIndex = i;
                 break;
@@ -17272,7 +19597,7 @@ void handleCommand(Player &p, int index, const String &rawLine) {
             p.client.println("Attack what?");
             return;
         }
-        cmdKill(p, args.c_str());
+        cmdKill(p, index, args.c_str());
         return;
     }
 
@@ -17351,6 +19676,16 @@ void handleCommand(Player &p, int index, const String &rawLine) {
         return;
     }
 
+    if (cmd == "where") {
+        cmdWhere(p, args);
+        return;
+    }
+
+    if (cmd == "path") {
+        cmdPath(p, args);
+        return;
+    }
+
 // -----------------------------------------
 // SAVE / WIMP / QUIT
 // -----------------------------------------
@@ -17367,14 +19702,14 @@ void handleCommand(Player &p, int index, const String &rawLine) {
 
     if (cmd == "q" || cmd == "quit") {
         // End any active High-Low game
-        if (index >= 0 && index < MAX_PLAYERS && highLowSessions[index].gameActive) {
+        if (index >= 0 && index < maxPlayers && highLowSessions[index].gameActive) {
             highLowSessions[index].gameActive = false;
             highLowSessions[index].awaitingAceDeclaration = false;
-            highLowSessions[index].awaitingContinue = false;
+            clearPrompt(index);
         }
         
         // End any active Chess game
-        if (index >= 0 && index < MAX_PLAYERS && chessSessions[index].gameActive) {
+        if (index >= 0 && index < maxPlayers && chessSessions[index].gameActive) {
             chessSessions[index].gameActive = false;
         }
         
@@ -17742,6 +20077,7 @@ void handleCommand(Player &p, int index, const String &rawLine) {
 
             // Create NPC instance from definition
             NpcInstance clonedNPC;
+            clonedNPC.templateIndex = findNpcTemplate(npcId);
             clonedNPC.x = p.roomX;
             clonedNPC.y = p.roomY;
             clonedNPC.z = p.roomZ;
@@ -17764,7 +20100,13 @@ void handleCommand(Player &p, int index, const String &rawLine) {
             clonedNPC.gold = (goldIt != it->second.attributes.end()) ? 
                 atoi(goldIt->second.c_str()) : 0;
             
-            npcInstances.push_back(clonedNPC);
+            npcClearAggro(clonedNPC);
+
+            if (!npcInstances.add(clonedNPC)) {
+                Serial.println("[WARN] NPC pool full (MAX_NPCS=" + String(MAX_NPCS) + "), clone refused: " + allNpcNames[npcIdx]);
+                p.client.println("The world cannot hold another creature (" + String(MAX_NPCS) + " NPCs).");
+                return;
+            }
             
             p.client.println("Cloned: " + allNpcNames[npcIdx]);
             announceToRoom(
@@ -17812,6 +20154,7 @@ void handleCommand(Player &p, int index, const String &rawLine) {
 
         savePlayerToFS(p);
         saveWorldItems();  // Save world state before reboot
+        if (innKeeperJokes.dirty) saveJokePool();
         
         // Reset world to fresh state before reboot
         cmdResetWorldItems(p, "");
@@ -17850,6 +20193,8 @@ if (cmd == "debug") {
     // -----------------------------------------
     if (a.length() == 0) {
         p.client.println("Debug commands:");
+        p.client.println("  debug boot               - Last boot's per-stage timing and heap report");
+        p.client.println("  debug commands [reset]   - Per-verb calls, p50/p99/max time and bytes sent, or clear them");
         p.client.println("  debug delete <file>      - Delete a LittleFS file");
         p.client.println("  debug destination        - Toggle debug output between SERIAL and TELNET");
         p.client.println("  debug extract <file>     - Backup a single file (for pre-partition save)");
@@ -17857,12 +20202,20 @@ if (cmd == "debug") {
         p.client.println("  debug files              - Dump core data files");
         p.client.println("  debug flashspace         - Show LittleFS total/used/free space");
         p.client.println("  debug items              - Dump world items");
+        p.client.println("  debug journal [on|off]   - Replay journal status, or record from the next boot / stop");
+        p.client.println("  debug latency [reset]    - Loop and subsystem latency percentiles, or clear them");
         p.client.println("  debug list               - List all files in LittleFS root");
+        p.client.println("  debug mail               - Mail poll cursor/stats and waiting mailboxes");
         p.client.println("  debug npcs               - Dump NPC definitions and instances");
         p.client.println("  debug online             - Show currently logged-in players with stats");
         p.client.println("  debug players            - Dump all player save files");
         p.client.println("  debug questflags         - Show quest flags");
         p.client.println("  debug sessions           - Show last 50 session log records");
+        p.client.println("  debug slots              - Player slots allocated at boot, bytes per session, room cache");
+        p.client.println("  debug slow               - Last commands that took 50 ms or more (kept across the reboot)");
+        p.client.println("  debug snapshot           - How this boot loaded the world; games awaiting their players");
+        p.client.println("  debug ticks              - Game tick tasks: period, runs, avg/max time, lateness");
+        p.client.println("  debug weather [ttl <m>]  - Weather cache/HTTP stats, or set cache TTL (minutes)");
         p.client.println("  debug ymodem             - Print YMODEM transfer debug log");
         p.client.println("  debug <player>           - Dump a single player save file");
         return;
@@ -17983,6 +20336,204 @@ if (cmd == "debug") {
         return;
     }
 
+    // -----------------------------------------
+    // debug slots (session pool and what a session costs)
+    // -----------------------------------------
+    if (a == "slots") {
+        if (p.debugDest == DEBUG_TO_SERIAL) printSessionPool(Serial);
+        else printSessionPool(p.client);
+        return;
+    }
+
+    // -----------------------------------------
+    // debug latency
+    // -----------------------------------------
+    if (a == "latency" || a == "latency reset") {
+        if (a == "latency reset") {
+            resetLatency();
+            debugPrint(p, "Latency histograms cleared.");
+            return;
+        }
+        if (p.debugDest == DEBUG_TO_SERIAL) printLatencyReport(Serial);
+        else printLatencyReport(p.client);
+        return;
+    }
+
+    // -----------------------------------------
+    // debug commands / debug slow
+    // -----------------------------------------
+    if (a == "commands" || a == "commands reset") {
+        if (a == "commands reset") {
+            resetCommandStats();
+            debugPrint(p, "Command statistics cleared.");
+            return;
+        }
+        if (p.debugDest == DEBUG_TO_SERIAL) printCommandReport(Serial);
+        else printCommandReport(p.client);
+        return;
+    }
+
+    if (a == "slow") {
+        if (p.debugDest == DEBUG_TO_SERIAL) printSlowCommands(Serial);
+        else printSlowCommands(p.client);
+        return;
+    }
+
+    // -----------------------------------------
+    // debug ticks
+    // -----------------------------------------
+    if (a == "ticks") {
+        debugPrint(p, "=== GAME TICKS (" + String(TICK_MS) + " ms tick, " +
+                      String(TICK_BUDGET_US / 1000) + " ms budget per loop) ===");
+        char line[96];
+        snprintf(line, sizeof(line), "%-18s %8s %8s %7s %7s %7s %6s",
+                 "task", "period", "runs", "avg us", "max us", "late ms", "skip");
+        debugPrint(p, line);
+        for (int id = 0; id < gameTicks.capacity(); id++) {
+            const TickTask &t = gameTicks.task(id);
+            if (!t.active) continue;
+            String period = t.periodTicks ? String(t.periodTicks * TICK_MS) + "ms" : String("once");
+            snprintf(line, sizeof(line), "%-18s %8s %8lu %7lu %7lu %7lu %6lu",
+                     t.name, period.c_str(), (unsigned long)t.runs,
+                     (unsigned long)(t.runs ? t.totalUs / t.runs : 0),
+                     (unsigned long)t.maxUs, (unsigned long)t.maxLateMs,
+                     (unsigned long)t.skipped);
+            debugPrint(p, line);
+        }
+        debugPrint(p, "Loops over budget: " + String(gameTicks.overruns()) +
+                      ", runs deferred to next loop: " + String(gameTicks.deferred()));
+        return;
+    }
+
+    // -----------------------------------------
+    // debug journal (replay recording, see ReplayJournal.h)
+    // -----------------------------------------
+    if (a == "journal" || a == "journal on" || a == "journal off") {
+        if (a == "journal on") {
+            File f = LittleFS.open(JOURNAL_FLAG_PATH, "w");
+            if (f) f.close();
+            debugPrint(p, journal.recording ? "Already recording; the journal restarts at every boot while on."
+                                            : "Journal on: recording starts at the next boot.");
+            return;
+        }
+        if (a == "journal off") {
+            LittleFS.remove(JOURNAL_FLAG_PATH);
+            journalEnd();
+            debugPrint(p, "Journal off.");
+            return;
+        }
+        debugPrint(p, "=== REPLAY JOURNAL ===");
+        if (journal.recording) {
+            debugPrint(p, "Recording to " + String(JOURNAL_PATH) + ": " +
+                          String(journal.bytes + journal.used) + " bytes, " +
+                          String(journal.passes) + " passes, " + String(journal.events) + " events");
+        } else if (*journal.stopReason) {
+            debugPrint(p, String("Not recording (") + journal.stopReason + ").");
+        } else {
+            debugPrint(p, "Not recording.");
+        }
+        debugPrint(p, "Random seed this boot: " + String(journal.seed));
+        debugPrint(p, String("Record at boot: ") + (LittleFS.exists(JOURNAL_FLAG_PATH) ? "yes" : "no"));
+        const char *paths[] = {JOURNAL_PATH, JOURNAL_PREV_PATH};
+        for (const char *path : paths) {
+            File f = LittleFS.open(path, "r");
+            if (!f) continue;
+            debugPrint(p, String(path) + ": " + String((unsigned long)f.size()) + " bytes");
+            f.close();
+        }
+        return;
+    }
+
+    // -----------------------------------------
+    // debug boot
+    // -----------------------------------------
+    if (a == "boot") {
+        File f = LittleFS.open(BOOT_REPORT_PATH, "r");
+        if (!f) {
+            debugPrint(p, "No boot report found.");
+            return;
+        }
+        debugPrint(p, "=== BOOT REPORT ===");
+        while (f.available()) {
+            String line = f.readStringUntil('\n');
+            debugPrint(p, line);
+        }
+        f.close();
+        return;
+    }
+
+    // -----------------------------------------
+    // debug snapshot
+    // -----------------------------------------
+    if (a == "snapshot") {
+        debugPrint(p, "=== WORLD SNAPSHOT ===");
+        debugPrint(p, worldSnapshotStatus);
+        if (snapshotSessions.empty() || (long)(millis() - snapshotSessionsExpireAt) >= 0) {
+            debugPrint(p, "No restored games waiting.");
+        } else {
+            for (auto &g : snapshotSessions) {
+                debugPrint(p, "  " + g.playerName + ": " + (g.isChess ? "chess" : "high-low"));
+            }
+            debugPrint(p, "Held for another " + formatTime(snapshotSessionsExpireAt - millis()) + ".");
+        }
+        debugPrint(p, "Next scheduled reboot writes " + String(WORLD_SNAPSHOT_PATH) + " in " +
+                   formatTime(nextGlobalRespawn - millis()) + ".");
+        return;
+    }
+
+    // -----------------------------------------
+    // debug mail
+    // -----------------------------------------
+    if (a == "mail") {
+        debugPrint(p, "=== MAIL POLL ===");
+        debugPrint(p, "Polls: " + String(mailPoll.polls) + ", not modified: " + String(mailPoll.notModified) +
+                   ", failed: " + String(mailPoll.failures) + ", letters filed: " + String(mailPoll.filed));
+        debugPrint(p, "Cursor: '" + mailPoll.lastMessageId + "'  ETag: " + mailPoll.etag);
+        String last = mailPoll.lastPollTime ? formatTime(millis() - mailPoll.lastPollTime) + " ago" : String("never");
+        debugPrint(p, "Last poll: " + last + (mailPoll.jobId ? " (poll in flight)" : ""));
+        if (mailIndex.empty()) {
+            debugPrint(p, "No letters waiting.");
+        }
+        for (auto &entry : mailIndex) {
+            debugPrint(p, "  " + entry.first + ": " + String(entry.second) + " letter(s)");
+        }
+        debugPrint(p, "=================");
+        return;
+    }
+
+    // -----------------------------------------
+    // debug weather [ttl <minutes>]
+    // -----------------------------------------
+    if (a == "weather" || a.startsWith("weather ")) {
+        String sub = a.substring(7);
+        sub.trim();
+        if (sub.startsWith("ttl")) {
+            long minutes = sub.substring(3).toInt();
+            if (minutes <= 0) {
+                p.client.println("Usage: debug weather ttl <minutes>");
+                return;
+            }
+            weatherCacheTtlMs = (unsigned long)minutes * 60UL * 1000UL;
+            p.client.println("Weather cache TTL set to " + String(minutes) + " minutes.");
+            return;
+        }
+        
+        uint32_t geoTotal = weatherCacheStats.geoHits + weatherCacheStats.geoMisses;
+        uint32_t wxTotal = weatherCacheStats.weatherHits + weatherCacheStats.weatherMisses + weatherCacheStats.coalesced;
+        debugPrint(p, "=== WEATHER CACHE ===");
+        debugPrint(p, "Geocode: " + String(geoCache.size()) + "/" + String(GEO_CACHE_SIZE) + " entries, " +
+                   String(weatherCacheStats.geoHits) + " hits / " + String(geoTotal) + " lookups");
+        debugPrint(p, "Weather: " + String(weatherCache.size()) + "/" + String(WEATHER_CACHE_SIZE) + " entries, " +
+                   String(weatherCacheStats.weatherHits) + " hits, " + String(weatherCacheStats.coalesced) +
+                   " coalesced / " + String(wxTotal) + " requests");
+        debugPrint(p, "TTL: " + String(weatherCacheTtlMs / 60000UL) + " min, in flight: " + String(weatherRequests.size()));
+        debugPrint(p, "HTTP jobs: " + String(httpJobStats.submitted) + " submitted, " + String(httpJobStats.completed) +
+                   " ok, " + String(httpJobStats.failed) + " failed, " + String(httpJobStats.timedOut) + " timed out, " +
+                   String(httpJobStats.rejected) + " rejected");
+        debugPrint(p, "=====================");
+        return;
+    }
+
     // -----------------------------------------
     // debug ymodem
     // -----------------------------------------
@@ -18038,6 +20589,11 @@ if (cmd == "debug") {
         if (!fname.startsWith("/"))
             fname = "/" + fname;
 
+        if (isJournalFile(fname)) {
+            debugPrint(p, "The replay journal is not served over the network; read it off the flash over USB.");
+            return;
+        }
+
         if (!LittleFS.exists(fname)) {
             debugPrint(p, "File not found: " + fname);
             return;
@@ -18093,6 +20649,11 @@ if (cmd == "debug") {
         while (file) {
             String fileName = file.name();
             size_t fileSize = file.size();
+
+            if (isJournalFile(fileName)) {
+                file = root.openNextFile();
+                continue;
+            }
             
             debugPrint(p, "");
             debugPrint(p, "=== FILE: " + fileName + " (" + String(fileSize) + " bytes) ===");
@@ -18139,7 +20700,7 @@ if (cmd == "debug") {
     if (a == "online") {
         debugPrint(p, "=== CURRENTLY LOGGED-IN PLAYERS ===");
         int onlineCount = 0;
-        for (int i = 0; i < MAX_PLAYERS; i++) {
+        for (int i = 0; i < maxPlayers; i++) {
             if (players[i].active && players[i].loggedIn) {
                 onlineCount++;
                 String status = "";
@@ -18215,7 +20776,7 @@ if (cmd == "debug") {
 // -----------------------------------------
     // Check if player is in an active High-Low game session
     int playerIndex = -1;
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         if (&players[i] == &p) {
             playerIndex = i;
             break;
@@ -18225,37 +20786,9 @@ if (cmd == "debug") {
     if (playerIndex >= 0 && highLowSessions[playerIndex].gameActive) {
         HighLowSession &session = highLowSessions[playerIndex];
         
-        // Check if awaiting continuation after hand
-        if (session.awaitingContinue) {
-            if (cmd == "" || cmd.length() == 0) {
-                // Empty input - start next hand
-                session.awaitingContinue = false;
-                p.client.println("");
-                dealHighLowHand(p, playerIndex);
-                return;
-            } else if (cmd == "end" || cmd == "quit") {
-                // End the game
-                endHighLowGame(p, playerIndex);
-                return;
-            } else {
-                // Invalid input during continue prompt
-                p.client.println("Press [Enter] to continue or type 'end'");
-                return;
-            }
-        }
-        // Check if awaiting Ace declaration
-        else if (session.awaitingAceDeclaration) {
-            if (cmd == "1") {
-                declareAceValue(p, playerIndex, 1);  // Low
-                return;
-            } else if (cmd == "2") {
-                declareAceValue(p, playerIndex, 2);  // High
-                return;
-            } else if (cmd == "end" || cmd == "quit") {
-                endHighLowGame(p, playerIndex);
-                return;
-            }
-        } else {
+        // The continue and Ace questions are answered through the pending prompt;
+        // while an Ace is undeclared other input is just a normal command
+        if (!session.awaitingAceDeclaration) {
             // Process betting input
             if (cmd == "end" || cmd == "quit") {
                 endHighLowGame(p, playerIndex);
@@ -18380,6 +20913,571 @@ String readClientLine(WiFiClient &c) {
 
 
 
+ // ============================
+// BOOT PROFILER
+// =============================
+//
+// setup() marks each stage with bootStage(); a stage runs until the next
+// mark.  Things that happen in the background are noted with bootEvent() -
+// WiFi association is checked at every stage boundary, so the report shows
+// which stage it completed during.  writeBootReport() saves the timings and
+// heap figures to BOOT_REPORT_PATH, shown by "debug boot".
+
+static void bootCloseStage() {
+    if (bootOpenStage < 0) return;
+    BootStage &st = bootStages[bootOpenStage];
+    st.durationMs = millis() - st.startMs;
+    st.freeHeapAfter = ESP.getFreeHeap();
+    bootOpenStage = -1;
+}
+
+void bootStage(const char *name) {
+    bootCloseStage();
+    if (!bootWifiNoted && WiFi.status() == WL_CONNECTED) {
+        bootWifiNoted = true;
+        bootEvent("wifi associated");
+    }
+    if (bootStageCount >= MAX_BOOT_STAGES) return;
+    BootStage &st = bootStages[bootStageCount];
+    st.name = name;
+    st.startMs = millis();
+    st.durationMs = 0;
+    st.freeHeapAfter = 0;
+    st.isEvent = false;
+    bootOpenStage = bootStageCount++;
+}
+
+void bootEvent(const char *name) {
+    if (bootStageCount >= MAX_BOOT_STAGES) return;
+    BootStage &st = bootStages[bootStageCount++];
+    st.name = name;
+    st.startMs = millis();
+    st.durationMs = 0;
+    st.freeHeapAfter = ESP.getFreeHeap();
+    st.isEvent = true;
+}
+
+void writeBootReport() {
+    bootCloseStage();
+    if (!bootWifiNoted && WiFi.status() == WL_CONNECTED) {
+        bootWifiNoted = true;
+        bootEvent("wifi associated");
+    }
+
+    File f = LittleFS.open(BOOT_REPORT_PATH, "w");
+    if (!f) return;
+
+    f.printf("Boot report - firmware %s, ready at %lu ms\n", ESP32MUD_VERSION, millis());
+    f.printf("Heap free %u, min free %u, largest block %u\n",
+             (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMinFreeHeap(), (unsigned)ESP.getMaxAllocHeap());
+    f.printf("Player slots %d of %d (limited by %s), %u bytes each\n",
+             maxPlayers, MAX_PLAYERS, sessionPool.limitedBy, (unsigned)sessionPool.slotBytes);
+    f.println("");
+    f.printf("%-24s %8s %8s %10s\n", "stage", "start", "ms", "heap after");
+    for (int i = 0; i < bootStageCount; i++) {
+        const BootStage &st = bootStages[i];
+        if (st.isEvent) {
+            f.printf("  @ %-20s %8lu %8s %10u\n", st.name, st.startMs, "", (unsigned)st.freeHeapAfter);
+        } else {
+            f.printf("%-24s %8lu %8lu %10u\n", st.name, st.startMs, st.durationMs, (unsigned)st.freeHeapAfter);
+        }
+    }
+    f.close();
+    Serial.printf("[BOOT] Ready in %lu ms (report in %s)\n", millis(), BOOT_REPORT_PATH);
+}
+
+// =====================================================
+// GAME TICK TASKS
+// =====================================================
+//
+// Everything loop() used to re-check on every pass.  Each runs from
+// gameTicks at the period given in registerGameTicks(); per-task timings
+// are shown by "debug ticks".
+
+// 6-hour reboot warnings and the reboot itself
+void tickRebootCountdown(unsigned long now) {
+    checkGlobalRebootCountdown(now);
+}
+
+void tickCombat(unsigned long now) {
+    for (int i = 0; i < maxPlayers; i++) {
+        Player &p = players[i];
+        if (!p.active || !p.loggedIn) continue;
+        if (p.inCombat && now >= p.nextCombatTime) doCombatRound(p, i);
+    }
+}
+
+void tickNpcRespawn(unsigned long now) {
+    for (auto &npc : npcInstances) {
+        if (!npc.alive && npc.respawnTime > 0 && now >= npc.respawnTime) {
+
+            npcInstances.renew(npc);
+            npc.alive = true;
+            npc.suppressDeathMessage = false;
+
+            const NpcTemplate *tpl = npcTemplateOf(npc);
+            if (!tpl) continue;
+
+            npc.hp = tpl->hp;
+            npc.gold = tpl->gold;
+
+            npcInstances.moveTo(npc, npc.spawnX, npc.spawnY, npc.spawnZ);
+            npc.respawnTime = 0;
+            npc.nextMoveTime = 0;
+
+            npc.dialogIndex = 0;
+            npc.dialogOrder[0] = 0;
+            npc.dialogOrder[1] = 1;
+            npc.dialogOrder[2] = 2;
+
+            for (int i = 0; i < 3; i++) {
+                int r = random(0, 3);
+                int tmp = npc.dialogOrder[i];
+                npc.dialogOrder[i] = npc.dialogOrder[r];
+                npc.dialogOrder[r] = tmp;
+            }
+
+            npc.nextDialogTime = now + random(3000, 30001);
+        }
+    }
+}
+
+// Budgeted, see updateNpcMovement
+void tickNpcMovement(unsigned long now) {
+    updateNpcMovement(now);
+}
+
+void tickNpcDialog(unsigned long now) {
+    for (auto &npc : npcInstances) {
+        if (!npc.alive) continue;
+
+        if (now >= npc.nextDialogTime) {
+
+            const NpcTemplate *tpl = npcTemplateOf(npc);
+            if (!tpl) continue;
+
+            int idx = npc.dialogOrder[npc.dialogIndex];
+
+            if (idx >= 0 && idx < NPC_DIALOG_LINES && tpl->dialog[idx].length() > 0) {
+                // Use announceDialogToRoom for proper formatting
+                announceDialogToRoom(
+                    npc.x, npc.y, npc.z,
+                    tpl->name,
+                    tpl->dialog[idx],
+                    -1
+                );
+            }
+
+            npc.dialogIndex++;
+            if (npc.dialogIndex >= 3) {
+                npc.dialogIndex = 0;
+
+                for (int i = 0; i < 3; i++) {
+                    int r = random(0, 3);
+                    int tmp = npc.dialogOrder[i];
+                    npc.dialogOrder[i] = npc.dialogOrder[r];
+                    npc.dialogOrder[r] = tmp;
+                }
+            }
+
+            // Increase minimum dialog time in post office to reduce dialog spam
+            int minDialogTime = (npc.x == 252 && npc.y == 248 && npc.z == 50) ? 30000 : 8000;
+            int maxDialogTime = (npc.x == 252 && npc.y == 248 && npc.z == 50) ? 120001 : 30001;
+            npc.nextDialogTime = now + random(minDialogTime, maxDialogTime);
+        }
+    }
+}
+
+void tickItemDialog(unsigned long now) {
+    for (size_t i = 0; i < worldItems.size(); i++) {
+        WorldItem &item = worldItems[i];
+        
+        // Only process world items (not in inventory)
+        if (item.ownerName.length() > 0) continue;
+        
+        // Check if item has any dialog attributes (using dialog_1, dialog_2, dialog_3 format)
+        // Use getAttr() to fetch from itemDefs template
+        String dialog1 = item.getAttr("dialog_1", itemDefs);
+        String dialog2 = item.getAttr("dialog_2", itemDefs);
+        String dialog3 = item.getAttr("dialog_3", itemDefs);
+        
+        if (dialog1.length() == 0 && dialog2.length() == 0 && dialog3.length() == 0) {
+            continue;  // No dialogs for this item
+        }
+        
+        // Count how many dialogs this item has
+        int dialogCount = 0;
+        if (dialog1.length() > 0) dialogCount++;
+        if (dialog2.length() > 0) dialogCount++;
+        if (dialog3.length() > 0) dialogCount++;
+        
+        // Initialize dialog timer if needed
+        if (item.attributes.find("nextDialogTime") == item.attributes.end()) {
+            // Increase minimum dialog time in post office to reduce dialog spam
+            int minDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 30000 : 8000;
+            int maxDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 120001 : 30001;
+            item.attributes["nextDialogTime"] = std::to_string(now + random(minDialogTime, maxDialogTime));
+        }
+        
+        unsigned long nextTime = (unsigned long)strtoull(item.attributes["nextDialogTime"].c_str(), NULL, 10);
+        
+        if (now >= nextTime) {
+            // Pick dialog based on cycle order - only cycle through actual dialogs
+            int dialogNum = item.dialogOrder[item.dialogIndex] + 1;  // Convert 0-2 to 1-3
+            String dialogKey = "dialog_" + String(dialogNum);
+            
+            // Use getAttr() to fetch from itemDefs template
+            String line = item.getAttr(dialogKey, itemDefs);
+            
+            if (line.length() > 0) {
+                // Get display name from itemDefs
+                String itemName = item.getAttr("name", itemDefs);
+                if (itemName.length() == 0) {
+                    itemName = item.name;
+                }
+                
+                announceDialogToRoom(item.x, item.y, item.z, "The " + itemName, line, -1);
+            }
+            
+            // Move to next dialog - only cycle through the dialogs that exist
+            if (dialogCount == 1) {
+                // Single dialog: only repeat if it's the ONLY one
+                // Don't cycle, just repeat the same dialog
+            } else {
+                // Multiple dialogs: cycle through without repeating
+                item.dialogIndex++;
+                if (item.dialogIndex >= dialogCount) {
+                    item.dialogIndex = 0;
+                    
+                    // Shuffle order for next cycle
+                    for (int j = 0; j < dialogCount; j++) {
+                        int r = random(0, dialogCount);
+                        int tmp = item.dialogOrder[j];
+                        item.dialogOrder[j] = item.dialogOrder[r];
+                        item.dialogOrder[r] = tmp;
+                    }
+                }
+            }
+            
+            // Schedule next dialog
+            // Increase minimum dialog time in post office to reduce dialog spam
+            int minDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 30000 : 8000;
+            int maxDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 120001 : 30001;
+            item.attributes["nextDialogTime"] = std::to_string(now + random(minDialogTime, maxDialogTime));
+        }
+    }
+}
+
+// Inn Keeper jokes (room 249, 248, 50), told from the prefetched pool
+void tickInnKeeperJokes(unsigned long now) {
+    const int JOKE_ROOM_X = 249;
+    const int JOKE_ROOM_Y = 248;
+    const int JOKE_ROOM_Z = 50;
+    
+    int playersInRoom = countPlayersInRoom(JOKE_ROOM_X, JOKE_ROOM_Y, JOKE_ROOM_Z);
+    
+    if (playersInRoom > 0) {
+        // Players are in the Inn Keeper room - activate joke system
+        innKeeperJokes.active = true;
+        
+        // Tell the next joke straight from the prefetched pool
+        if ((long)(now - innKeeperJokes.nextJokeTime) >= 0) {
+            if (popPooledJoke(innKeeperJokes.currentJoke)) {
+                innKeeperJokes.dirty = true;
+                broadcastToRoom(JOKE_ROOM_X, JOKE_ROOM_Y, JOKE_ROOM_Z, "");
+                
+                // Wrap joke text like room descriptions (80 chars max)
+                String wrappedJoke = wordWrap(innKeeperJokes.currentJoke, MAX_OUTPUT_WIDTH);
+                String jokeMsg = "The Inn Keeper Says: \"" + wrappedJoke + ".\"";
+                
+                // Send wrapped joke to all players in room
+                announceToRoom(JOKE_ROOM_X, JOKE_ROOM_Y, JOKE_ROOM_Z, jokeMsg, -1);
+                
+                // Send prompt to all players in room on new line
+                for (int i = 0; i < maxPlayers; i++) {
+                    if (players[i].active && players[i].loggedIn &&
+                        players[i].roomX == JOKE_ROOM_X && players[i].roomY == JOKE_ROOM_Y && players[i].roomZ == JOKE_ROOM_Z) {
+                        players[i].client.println("");  // Blank line
+                        players[i].client.print("> ");
+                    }
+                }
+                
+                // Schedule next joke (15-20 seconds from now)
+                innKeeperJokes.nextJokeTime = now + random(15000, 20001);
+            } else {
+                // Pool ran dry - check again shortly (refill runs at the busy pace)
+                innKeeperJokes.nextJokeTime = now + 3000;
+            }
+        }
+    } else {
+        // No players in room - deactivate joke system (pool keeps filling slowly)
+        innKeeperJokes.active = false;
+    }
+    
+    updateJokePool(now);
+}
+
+// Natural healing, drunkenness and fullness recovery
+void tickHealing(unsigned long) {
+    for (int i = 0; i < maxPlayers; i++) {
+        Player &p = players[i];
+        if (!p.active || !p.loggedIn) continue;
+        if (p.hp < p.maxHp) {
+            p.hp += 1;
+            if (p.hp > p.maxHp) p.hp = p.maxHp;
+        }
+        // Drunkenness recovery
+        updateDrunkennessRecovery(p);
+        // Fullness recovery
+        updateFullnessRecovery(p);
+    }
+}
+
+// Deliver finished HTTP jobs, then start any new weather request
+void tickHttpJobs(unsigned long now) {
+    httpJobPump();
+    updateWeatherRequests();
+    updateMailPoll(now);
+}
+
+void tickShopRestock(unsigned long) {
+    restockAllShops();
+}
+
+#if LATENCY_PROFILING
+// Tick task run times go to that task's histogram
+void recordTickLatency(int id, uint32_t us) {
+    if (id < LATENCY_TICK_TASKS) latency[LAT_TICK_FIRST + id].record(us);
+}
+#endif
+
+// Periods are chosen so nothing is noticeably later than when loop()
+// checked it on every pass: combat rounds are 1-3 s apart, dialog and
+// respawn times are whole seconds, HTTP results are not time critical.
+void registerGameTicks() {
+    gameTicks.reset(millis());
+    gameTicks.every("reboot countdown", 250, tickRebootCountdown);
+    gameTicks.every("combat",           50,  tickCombat);
+    gameTicks.every("npc respawn",      500, tickNpcRespawn);
+    gameTicks.every("npc movement",     TICK_MS, tickNpcMovement);
+    gameTicks.every("npc dialog",       250, tickNpcDialog);
+    gameTicks.every("item dialog",      1000, tickItemDialog);
+    gameTicks.every("inn keeper jokes", 250, tickInnKeeperJokes);
+    gameTicks.every("healing",          60000UL, tickHealing);
+    gameTicks.every("http jobs",        50,  tickHttpJobs);
+    gameTicks.every("shop restock",     60UL * 60UL * 1000UL, tickShopRestock);
+#if LATENCY_PROFILING
+    gameTicks.setObserver(recordTickLatency);
+#endif
+}
+
+// =====================================================
+// LATENCY REPORT ("debug latency", serial LATENCY_Request)
+// =====================================================
+
+void printLatencyReport(Print &out) {
+#if LATENCY_PROFILING
+    char line[100];
+    out.println("=== LATENCY (us, since boot or last reset) ===");
+    snprintf(line, sizeof(line), "%-18s %9s %7s %7s %7s %7s %8s %8s",
+             "section", "count", "avg", "p50", "p90", "p99", "p99.9", "max");
+    out.println(line);
+
+    for (int slot = 0; slot < LAT_SLOTS; slot++) {
+        const char *name;
+        if (slot < LAT_TICK_FIRST) {
+            name = latencySlotNames[slot];
+        } else {
+            const TickTask &t = gameTicks.task(slot - LAT_TICK_FIRST);
+            if (!t.active) continue;
+            name = t.name;
+        }
+        const LatencyHistogram &h = latency[slot];
+        snprintf(line, sizeof(line), "%-18s %9lu %7lu %7lu %7lu %7lu %8lu %8lu",
+                 name, (unsigned long)h.count, (unsigned long)h.averageUs(),
+                 (unsigned long)h.percentile(50), (unsigned long)h.percentile(90),
+                 (unsigned long)h.percentile(99), (unsigned long)h.percentile(99.9f),
+                 (unsigned long)h.maxUs);
+        out.println(line);
+    }
+#else
+    out.println("Latency profiling is compiled out (LATENCY_PROFILING=0).");
+#endif
+}
+
+void resetLatency() {
+#if LATENCY_PROFILING
+    for (int slot = 0; slot < LAT_SLOTS; slot++) latency[slot].reset();
+#endif
+}
+
+// =====================================================
+// COMMAND PROFILING ("debug commands", "debug slow")
+// =====================================================
+
+static void copyField(char *dst, size_t size, const String &src) {
+    strncpy(dst, src.c_str(), size - 1);
+    dst[size - 1] = '\0';
+    for (char *c = dst; *c; c++) {
+        if (*c == '|' || *c == '\n' || *c == '\r') *c = ' ';   // keeps the log file one record per line
+    }
+}
+
+void recordCommand(Player &p, const String &verb, const String &args, uint32_t us, uint32_t bytes) {
+#if LATENCY_PROFILING
+    CommandStats *stats = nullptr;
+    for (auto &cs : commandStats) {
+        if (strncmp(cs.verb, verb.c_str(), sizeof(cs.verb) - 1) == 0) {
+            stats = &cs;
+            break;
+        }
+    }
+    if (!stats) {
+        // The last slot is kept for everything past the limit
+        bool full = (int)commandStats.size() >= COMMAND_STATS_MAX_VERBS - 1;
+        const char *name = full ? "(other)" : verb.c_str();
+        if (full) {
+            for (auto &cs : commandStats) {
+                if (strcmp(cs.verb, name) == 0) stats = &cs;
+            }
+        }
+        if (!stats) {
+            commandStats.emplace_back();
+            stats = &commandStats.back();
+            copyField(stats->verb, sizeof(stats->verb), name);
+        }
+    }
+
+    stats->hist.record(us);
+    stats->bytesOut += bytes;
+    if (bytes > stats->maxBytes) stats->maxBytes = bytes;
+
+    if (us < SLOW_COMMAND_US) return;
+
+    SlowCommand &slow = slowCommands[slowCommandCount % SLOW_COMMAND_LOG_SIZE];
+    slowCommandCount++;
+    time_t now = time(nullptr);
+    slow.when = (now > 1000000000) ? (uint32_t)now : 0;
+    slow.us = us;
+    slow.bytes = bytes;
+    copyField(slow.player, sizeof(slow.player), p.name);
+    copyField(slow.verb, sizeof(slow.verb), verb);
+    copyField(slow.args, sizeof(slow.args), args);
+#endif
+}
+
+// One line per entry, oldest first: when|us|bytes|player|verb|args
+void saveSlowCommands() {
+#if LATENCY_PROFILING
+    int kept = slowCommandCount < SLOW_COMMAND_LOG_SIZE ? slowCommandCount : SLOW_COMMAND_LOG_SIZE;
+    if (kept == 0) {
+        LittleFS.remove(SLOW_COMMAND_LOG_PATH);
+        return;
+    }
+
+    File f = LittleFS.open(SLOW_COMMAND_LOG_PATH, "w");
+    if (!f) return;
+    for (int i = slowCommandCount - kept; i < slowCommandCount; i++) {
+        const SlowCommand &slow = slowCommands[i % SLOW_COMMAND_LOG_SIZE];
+        f.printf("%lu|%lu|%lu|%s|%s|%s\n", (unsigned long)slow.when, (unsigned long)slow.us,
+                 (unsigned long)slow.bytes, slow.player, slow.verb, slow.args);
+    }
+    f.close();
+#endif
+}
+
+void loadSlowCommands() {
+#if LATENCY_PROFILING
+    File f = LittleFS.open(SLOW_COMMAND_LOG_PATH, "r");
+    if (!f) return;
+
+    slowCommandCount = 0;
+    while (f.available()) {
+        String line = f.readStringUntil('\n');
+        int sep[5];
+        int from = 0;
+        bool ok = true;
+        for (int k = 0; k < 5 && ok; k++) {
+            sep[k] = line.indexOf('|', from);
+            ok = sep[k] >= 0;
+            from = sep[k] + 1;
+        }
+        if (!ok) continue;
+
+        SlowCommand &slow = slowCommands[slowCommandCount % SLOW_COMMAND_LOG_SIZE];
+        slowCommandCount++;
+        slow.when = strtoul(line.substring(0, sep[0]).c_str(), NULL, 10);
+        slow.us = strtoul(line.substring(sep[0] + 1, sep[1]).c_str(), NULL, 10);
+        slow.bytes = strtoul(line.substring(sep[1] + 1, sep[2]).c_str(), NULL, 10);
+        copyField(slow.player, sizeof(slow.player), line.substring(sep[2] + 1, sep[3]));
+        copyField(slow.verb, sizeof(slow.verb), line.substring(sep[3] + 1, sep[4]));
+        copyField(slow.args, sizeof(slow.args), line.substring(sep[4] + 1));
+    }
+    f.close();
+#endif
+}
+
+// Verbs by total time spent, the costliest first
+void printCommandReport(Print &out) {
+#if LATENCY_PROFILING
+    std::vector<int> order;
+    for (int i = 0; i < (int)commandStats.size(); i++) order.push_back(i);
+    std::sort(order.begin(), order.end(), [](int a, int b) {
+        return commandStats[a].hist.totalUs > commandStats[b].hist.totalUs;
+    });
+
+    char line[100];
+    out.println("=== COMMANDS (us, since boot or last reset) ===");
+    snprintf(line, sizeof(line), "%-11s %7s %8s %7s %7s %8s %7s %7s",
+             "verb", "calls", "total ms", "p50", "p99", "max", "avg B", "max B");
+    out.println(line);
+    for (int i : order) {
+        const CommandStats &cs = commandStats[i];
+        snprintf(line, sizeof(line), "%-11s %7lu %8lu %7lu %7lu %8lu %7lu %7lu",
+                 cs.verb, (unsigned long)cs.hist.count, (unsigned long)(cs.hist.totalUs / 1000),
+                 (unsigned long)cs.hist.percentile(50), (unsigned long)cs.hist.percentile(99),
+                 (unsigned long)cs.hist.maxUs,
+                 (unsigned long)(cs.hist.count ? cs.bytesOut / cs.hist.count : 0),
+                 (unsigned long)cs.maxBytes);
+        out.println(line);
+    }
+    if (order.empty()) out.println("No commands yet.");
+#else
+    out.println("Command profiling is compiled out (LATENCY_PROFILING=0).");
+#endif
+}
+
+// Slow command log, newest first
+void printSlowCommands(Print &out) {
+#if LATENCY_PROFILING
+    out.println("=== SLOW COMMANDS (>= " + String(SLOW_COMMAND_US / 1000) + " ms, newest first) ===");
+    int kept = slowCommandCount < SLOW_COMMAND_LOG_SIZE ? slowCommandCount : SLOW_COMMAND_LOG_SIZE;
+    if (kept == 0) out.println("None logged.");
+
+    char line[120];
+    for (int i = slowCommandCount - 1; i >= slowCommandCount - kept; i--) {
+        const SlowCommand &slow = slowCommands[i % SLOW_COMMAND_LOG_SIZE];
+        char when[20] = "--";
+        if (slow.when) {
+            time_t local = (time_t)slow.when + timezoneOffsetSeconds;
+            strftime(when, sizeof(when), "%m-%d %H:%M:%S", gmtime(&local));
+        }
+        snprintf(line, sizeof(line), "%-14s %7lu ms %6lu B  %-12s %s %s",
+                 when, (unsigned long)(slow.us / 1000), (unsigned long)slow.bytes,
+                 slow.player, slow.verb, slow.args);
+        out.println(line);
+    }
+#else
+    out.println("Command profiling is compiled out (LATENCY_PROFILING=0).");
+#endif
+}
+
+void resetCommandStats() {
+#if LATENCY_PROFILING
+    commandStats.clear();
+#endif
+}
+
  // ============================
 // setup()
 // =============================
@@ -18387,6 +21485,8 @@ String readClientLine(WiFiClient &c) {
 
 void setup() {
     Serial.begin(115200);
+    latencyBegin();
+    bootStage("usb serial");
     
     // Wait for USB CDC to be ready (up to 5 seconds)
     unsigned long startTime = millis();
@@ -18406,8 +21506,16 @@ void setup() {
     // -------------------------------
     // Mount FS silently
     // -------------------------------
+    bootStage("mount fs");
     LittleFS.begin(true);
 
+    // A reset during the last upload's file swap is finished before anything reads the world
+    ymodem_recoverCommit();
+    if (LittleFS.exists(UPLOAD_COMMIT_JOURNAL)) {
+        Serial.println("[FILE UPLOAD] Completing interrupted upload commit");
+        stagedApplyJournal(UPLOAD_COMMIT_JOURNAL, UPLOAD_PART_SUFFIX);
+    }
+
     // Always start with a clean YMODEM log
     LittleFS.remove("/ymodem_debug.txt");
 
@@ -18418,31 +21526,16 @@ void setup() {
     }
 
     // =====================================================
-    // YMODEM UPLOAD WINDOW (SKIPPED IF NO SERIAL)
-    // =====================================================
-    if (!NoSerial) {
-        g_inYmodem = true;
-        bool gotTransfer = ymodem_receiveSession(5000);
-        g_inYmodem = false;
-
-        if (gotTransfer) {
-            Serial.println("[YMODEM] Session complete. Rebooting into MUD...");
-            delay(500);
-            safeReboot();
-        }
-    } else {
-        Serial.println("NoSerial detected — skipping YMODEM window.");
-    }
-
-    Serial.println("5 second window reached: Booting MUD");
-
-    // =====================================================
-    // WIFI PROVISIONING + FALLBACK LOGIC
+    // START WIFI ASSOCIATION
     // =====================================================
+    // WiFi.begin() returns at once and the driver associates in the
+    // background, so the YMODEM window and the world load below overlap it
+    // instead of waiting on it afterwards.
     const char* credPath = "/credentials.txt";
 
     bool credsExist = LittleFS.exists(credPath);
     bool wifiConnected = false;
+    unsigned long wifiStartedAt = millis();
 
     String ssid, pass, portStr;
 
@@ -18451,22 +21544,93 @@ void setup() {
         ssid = f.readStringUntil('\n'); ssid.trim();
         pass = f.readStringUntil('\n'); pass.trim();
         portStr = f.readStringUntil('\n'); portStr.trim();
+        fileUploadKey = f.readStringUntil('\n'); fileUploadKey.trim();
         f.close();
 
         WiFi.mode(WIFI_STA);
         WiFi.begin(ssid.c_str(), pass.c_str());
+        wifiStartedAt = millis();
+    }
+
+    // random() is seeded once per boot and the seed journaled, so a replay
+    // of this boot draws the same numbers
+#ifdef ESP32
+    uint32_t bootSeed = esp_random();
+#else
+    uint32_t bootSeed = (uint32_t)time(nullptr) ^ (uint32_t)micros();
+#endif
+    if (bootSeed == 0) bootSeed = 1;
+    randomSeed(bootSeed);
+    journalBegin(bootSeed, (uint16_t)portStr.toInt());
+
+    // =====================================================
+    // YMODEM UPLOAD WINDOW (SKIPPED IF NO SERIAL)
+    // =====================================================
+    bootStage("ymodem window");
+    if (YMODEM_BOOT_WINDOW_MS == 0) {
+        Serial.println("YMODEM window disabled at build time.");
+    } else if (!NoSerial) {
+        g_inYmodem = true;
+        bool gotTransfer = ymodem_receiveSession(YMODEM_BOOT_WINDOW_MS);
+        g_inYmodem = false;
+
+        if (gotTransfer) {
+            Serial.println("[YMODEM] Session complete. Rebooting into MUD...");
+            delay(500);
+            safeReboot();
+        }
+    } else {
+        Serial.println("NoSerial detected — skipping YMODEM window.");
+    }
 
-        unsigned long start = millis();
-        while (WiFi.status() != WL_CONNECTED && millis() - start < 8000) {
+    Serial.println("5 second window reached: Booting MUD");
+
+    if (credsExist) {
+        // =====================================================
+        // LOAD THE WORLD WHILE WIFI FINISHES ASSOCIATING
+        // =====================================================
+        // Nothing below reboots any more (YMODEM is done), so the world can
+        // be parsed now rather than after the WiFi and NTP waits.
+        bootStage("reset world");
+        resetWorldState();              // wipe world
+        bootStage("item definitions");
+        loadAllItemDefinitions();       // load item templates
+        bootStage("npc definitions");
+        loadAllNPCDefinitions();        // load NPC templates
+        bootStage("quests");
+        loadQuests();                   // load quests
+        bootStage("room indexes");
+        buildRoomIndexesIfNeeded();     // build room lookup tables
+        bootStage("room graph");
+        loadRoomGraph();                // exits in RAM for NPCs, paths and maps
+        bootStage("shops/taverns/etc");
+        initializeShops();              // initialize room-based shops
+        initializeTaverns();            // initialize taverns with drinks
+        initializePostOffices();        // initialize post offices
+        initializeWeatherStations();    // initialize weather station
+        bootStage("persisted state");
+        loadHighLowPot();               // load high-low pot from persistent storage
+        loadJokePool();                 // load prefetched jokes + seen hashes
+        loadMailState();                // mail poll cursor + mailbox index
+        loadSlowCommands();             // slow command log from before the last reboot
+
+        // After the scheduled reboot the world comes back from its snapshot
+        // (items, NPCs, shop stock, pot, games); otherwise parse the text files
+        bootStage("world snapshot");
+        if (!loadWorldSnapshot()) {
+            bootStage("world items");
+            loadAllWorldItems();        // load items.vxi
+            bootStage("npc instances");
+            loadAllNPCInstances();      // load NPC spawns
+        }
+
+        // Whatever is left of the 8 second association budget
+        bootStage("wifi wait");
+        while (WiFi.status() != WL_CONNECTED && millis() - wifiStartedAt < 8000) {
             delay(200);
         }
 
         wifiConnected = (WiFi.status() == WL_CONNECTED);
-        
-        // If WiFi connected, sync time from NTP
-        if (wifiConnected) {
-            syncTimeFromNTP();
-        }
     }
 
     if (!credsExist) {
@@ -18492,6 +21656,7 @@ void setup() {
     Serial.println(portStr);
 
     if (WiFi.status() != WL_CONNECTED) {
+        bootStage("wifi retry");
         WiFi.mode(WIFI_STA);
         WiFi.begin(ssid.c_str(), pass.c_str());
 
@@ -18507,15 +21672,14 @@ void setup() {
     Serial.println(WiFi.localIP());
 
     // =====================================================
-    // INITIALIZE TIMEZONE FROM TIME SERVER
-    // =====================================================
-    initializeTimezone();
-
-    // =====================================================
-    // AUTO-SYNC FILES FROM SERVER (optional, non-blocking)
+    // OPEN THE MUD PORT
     // =====================================================
-    //autoSyncFilesAtBoot();
+    // The world is already loaded, so connections are accepted (and wait in
+    // the listen backlog) from here on rather than after the clock syncs.
+    bootStage("session pool");
+    allocateSessionPool();          // as many player slots as the heap left can carry
 
+    bootStage("servers");
     {
         int mudPort = portStr.toInt();
         server = new WiFiServer(mudPort);
@@ -18525,8 +21689,39 @@ void setup() {
         Serial.println(mudPort);
     }
 
+#if FILE_UPLOAD_SERVER
+    // Uploads and backups are serviced a slice per loop(), so the port can
+    // stay open without stalling the game.  Every request must carry the
+    // key, so without one the port stays closed.
+    if (fileUploadKey.length() > 0) {
+        fileUploadServer = new WiFiServer(FILE_UPLOAD_PORT);
+        fileUploadServer->begin();
+        Serial.printf("File server started on port %d\n", FILE_UPLOAD_PORT);
+    } else {
+        Serial.println("File server not started: no upload key (line 4 of credentials.txt)");
+    }
+#endif
+
+    // =====================================================
+    // SYNC CLOCK + TIMEZONE FROM TIME SERVERS
+    // =====================================================
+    bootStage("ntp sync");
+    syncTimeFromNTP();
+    bootStage("timezone");
+    initializeTimezone();
+
+    // =====================================================
+    // AUTO-SYNC FILES FROM SERVER (optional, non-blocking)
+    // =====================================================
+    //autoSyncFilesAtBoot();
+
+    // =====================================================
+    // OUTBOUND HTTP WORKERS (weather, jokes, mail, downloads)
+    // =====================================================
+    httpJobQueueBegin();
+
     // Initialize players
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         players[i].active = false;
         players[i].loggedIn = false;
         players[i].invCount = 0;
@@ -18535,23 +21730,6 @@ void setup() {
             players[i].wornItemIndices[s] = -1;
     }
 
-    // =====================================================
-    // ⭐ NOW LOAD THE WORLD — AFTER ALL REBOOTS ARE DONE ⭐
-    // =====================================================
-
-    resetWorldState();              // wipe world
-    loadAllItemDefinitions();       // load item templates
-    loadAllWorldItems();            // load items.vxi
-    loadAllNPCDefinitions();        // load NPC templates
-    loadAllNPCInstances();          // load NPC spawns
-    loadQuests();                   // load quests
-    buildRoomIndexesIfNeeded();     // build room lookup tables
-    initializeShops();              // initialize room-based shops
-    initializeTaverns();            // initialize taverns with drinks
-    initializePostOffices();        // initialize post offices
-    initializeWeatherStations();    // initialize weather station
-    loadHighLowPot();               // load high-low pot from persistent storage
-
     // Initialize 6-hour reboot timer
     nextGlobalRespawn = millis() + GLOBAL_RESPAWN_INTERVAL;
     warned5min  = false;
@@ -18560,6 +21738,11 @@ void setup() {
     warned30sec = false;
     warned5sec  = false;
 
+    // Periodic world work from here on runs off loop() via gameTicks
+    journalReady();
+    registerGameTicks();
+
+    writeBootReport();
     return;
 
     // =====================================================
@@ -18595,6 +21778,8 @@ PROVISIONING_MODE:
 
 //MAIN LOOP
 void loop() {
+    LATENCY_SCOPE(latency[LAT_LOOP]);
+    journalPass(millis());
 
     // ============================================================
     // BINARY TRANSFER MODE ALWAYS TAKES PRIORITY (legacy removed)
@@ -18608,6 +21793,7 @@ void loop() {
 
         String cmd = Serial.readStringUntil('\n');
         cmd.trim();
+        journalSerial(cmd);
 
         // ============================================================
         // NEW: ESP32 RESET COMMAND (from VB.NET)
@@ -18628,6 +21814,11 @@ void loop() {
             Serial.println(" 4000");
             return;
         }
+
+        if (cmd == "LATENCY_Request") {
+            printLatencyReport(Serial);
+            return;
+        }
     }
 
     // ============================================================
@@ -18635,58 +21826,57 @@ void loop() {
     // ============================================================
 
     // Accept new players
+    LATENCY_BEGIN(inputTimer);
     WiFiClient newClient = server->available();
     if (newClient) {
 
-        for (int i = 0; i < MAX_PLAYERS; i++) {
+        bool placed = false;
+        for (int i = 0; i < maxPlayers; i++) {
             if (!players[i].active) {
                 players[i].client = newClient;
                 players[i].active = true;
                 players[i].loggedIn = false;
+                journalAccept(i);
+                clearDeferredOutput(i);
+                clearPrompt(i);
+                npcForgetPlayer(i);
                 startLogin(players[i], i);
+                placed = true;
                 break;
             }
         }
+        if (!placed) {
+            newClient.println("The realm is full (" + String(maxPlayers) + " players). Please try again later.");
+            newClient.stop();
+        }
     }
 
     // Process player input
-    for (int i = 0; i < MAX_PLAYERS; i++) {
+    for (int i = 0; i < maxPlayers; i++) {
         Player &p = players[i];
         if (!p.active) continue;
 
         if (!p.client.connected()) {
+            journalClose(i);
             p.active = false;
+            clearDeferredOutput(i);
+            clearPrompt(i);
+            npcForgetPlayer(i);
             continue;
         }
 
+        // Still pacing out a death/quest/chess sequence - leave input in the socket
+        if (hasDeferredOutput(i)) continue;
+
         if (p.client.available()) {
             String line = readClientLine(p.client);
+            journalLine(i, line, inputIsSecret(i));
 
-            // Check for High-Low continue prompt BEFORE empty line rejection
-            if (i >= 0 && i < MAX_PLAYERS && highLowSessions[i].gameActive && highLowSessions[i].awaitingContinue) {
-                // Player is waiting to continue a game - allow empty input
-                if (line.length() == 0) {
-                    // Empty input continues the game
-                    highLowSessions[i].awaitingContinue = false;
-                    p.client.println("");
-                    dealHighLowHand(players[i], i);
-                    p.client.print("> ");
-                    continue;
-                } else if (line == "end" || line == "quit") {
-                    // End the game
-                    endHighLowGame(players[i], i);
-                    p.client.print("> ");
-                    continue;
-                } else if (line == "n" || line == "s" || line == "e" || line == "w" || line.startsWith("go ")) {
-                    // Allow movement - will be processed by handleCommand
-                    highLowSessions[i].awaitingContinue = false;
-                    // Fall through to normal command processing
-                } else {
-                    // Invalid input
-                    p.client.println("Press [Enter] to continue or type 'end'");
-                    p.client.print("> ");
-                    continue;
-                }
+            // A pending question (login, password change, game prompts) gets
+            // first look, before empty line rejection
+            if (dispatchPrompt(p, i, line)) {
+                p.client.print("> ");
+                continue;
             }
 
             if (line.length() == 0) {
@@ -18694,459 +21884,509 @@ void loop() {
                 continue;
             }
 
-            if (!p.loggedIn) handleLogin(p, i, line);
-            else handleCommand(players[i], i, line);
+            if (!p.loggedIn) continue;   // login answers all go through its prompt
+            handleCommand(players[i], i, line);
             p.client.print("> ");
 
         }
     }
+    LATENCY_END(inputTimer, latency[LAT_INPUT]);
 
-    // Combat tick
+    journalNow(millis());
     unsigned long now = millis();
 
-    // ============================================================
-    // ⭐ TIMED REBOOT COUNTDOWN (6-hour cycle)
-    // ============================================================
-    checkGlobalRebootCountdown(now);
+    // Release paced output whose time has come
+    {
+        LATENCY_SCOPE(latency[LAT_OUTPUT]);
+        pumpDeferredOutput(now);
+        updatePromptTimeouts(now);
+    }
 
-    for (int i = 0; i < MAX_PLAYERS; i++) {
-        Player &p = players[i];
-        if (!p.active || !p.loggedIn) continue;
-        if (p.inCombat && now >= p.nextCombatTime) doCombatRound(p);
+    // Periodic world work (combat, NPCs, dialog, healing, restock, ...)
+    // runs from the tick scheduler; anything left over after the budget
+    // waits for the next pass so input above is never starved
+    {
+        LATENCY_SCOPE(latency[LAT_TICKS]);
+        int fired = gameTicks.run(now, TICK_BUDGET_US, journalTickLimit());
+        if (gameTicks.pending()) journalTickCut(fired);
     }
 
+    // =====================================================
+    // HANDLE FILE UPLOADS VIA HTTP (Port 8080)
+    // =====================================================
+    {
+        LATENCY_SCOPE(latency[LAT_UPLOAD]);
+        updateUploadServer(now);
+    }
+}
 
+// =====================================================
+// FILE UPLOAD SERVER - HTTP on port 8080
+// =====================================================
+//
+// Each connection is a small state machine that loop() advances by at most
+// UPLOAD_SLICE_BYTES per call, so an upload (or a browser poking the port)
+// never holds up the game:
+//
+//   GET  /               usage
+//   POST /upload         multipart/form-data upload, streamed to LittleFS
+//   GET  /files          list of world files (name and size)
+//   GET  /files/<name>   download a world file, e.g. for backups
+//
+// Every request must carry "X-Upload-Key: <key>" (line 4 of
+// credentials.txt) or it gets a 401.  Only the world data files in
+// UPLOAD_WORLD_FILES can be listed, fetched or replaced: player saves,
+// credentials, the replay journal and the rest of LittleFS are never
+// reachable from here.
+//
+// At most UPLOAD_MAX_CONNECTIONS are served at once; further connections
+// get a 503.
 
-    // NPC respawn tick
-for (auto &npc : npcInstances) {
-    if (!npc.alive && npc.respawnTime > 0 && now >= npc.respawnTime) {
+static const char *const UPLOAD_WORLD_FILES[] = {
+    "rooms.txt", "items.vxd", "items.vxi", "npcs.vxd", "npcs.vxi", "quests.txt", "shops.txt"
+};
 
-        npc.alive = true;
-        npc.suppressDeathMessage = false;
+enum UploadConnState {
+    UPLOAD_FREE,
+    UPLOAD_HEADERS,     // reading the request line and headers
+    UPLOAD_BODY,        // streaming a POST body through the multipart parser
+    UPLOAD_SENDING,     // streaming a file back out
+    UPLOAD_CLOSING      // response written; lingering before stop()
+};
 
-        // SAFE lookup: convert npcId (String) → std::string
-        std::string npcKey = std::string(npc.npcId.c_str());
-        auto it = npcDefs.find(npcKey);
-        if (it == npcDefs.end()) continue;
+struct UploadConnection {
+    UploadConnState state = UPLOAD_FREE;
+    WiFiClient client;
+    String request;                 // request line + headers
+    unsigned long lastActivity = 0;
+
+    // POST /upload
+    MultipartParser multipart;
+    long contentLen = 0;
+    long bodyRead = 0;
+    File upload;
+    String fileName;
+    String tempPath;                // part being written, "" when none
+    size_t fileSize = 0;
+    bool writeFailed = false;
+    bool commitFailed = false;          // written, but could not be swapped in
+    bool roomsReplaced = false;
+    std::vector<String> savedFiles;
+    std::vector<String> refusedFiles;   // parts naming a file outside the allowlist
+    std::vector<String> busyFiles;      // parts naming a file another connection is writing
+
+    // GET /files/<name>
+    File download;
+};
 
-        NpcDefinition &def = it->second;
+UploadConnection uploadConns[UPLOAD_MAX_CONNECTIONS];
 
-        // HP
-        int hp = 1;
-        auto hpIt = def.attributes.find("hp");
-        if (hpIt != def.attributes.end()) {
-            hp = strToInt(hpIt->second);
+// Lower-case the uploaded name and keep only [a-z0-9._-]
+String sanitizeUploadFileName(const String &name) {
+    String fileName = name;
+    int slash = fileName.lastIndexOf('/');
+    if (slash < 0) slash = fileName.lastIndexOf('\\');
+    if (slash >= 0) fileName = fileName.substring(slash + 1);
+    fileName.trim();
+    fileName.toLowerCase();
+    for (int i = 0; i < fileName.length(); i++) {
+        char c = fileName[i];
+        if (!isalnum(c) && c != '.' && c != '_' && c != '-') {
+            fileName[i] = '_';
         }
-        npc.hp = hp;
+    }
+    if (fileName.length() == 0) fileName = "unknown.txt";
+    return fileName;
+}
+
+// World data the file server may list, send and replace (sanitized names)
+bool isUploadWorldFile(const String &fileName) {
+    for (const char *allowed : UPLOAD_WORLD_FILES) {
+        if (fileName == allowed) return true;
+    }
+    return false;
+}
 
-        // GOLD
-        int gold = 0;
-        auto goldIt = def.attributes.find("gold");
-        if (goldIt != def.attributes.end()) {
-            gold = strToInt(goldIt->second);
+// Check the X-Upload-Key header against the configured key.  Every byte is
+// compared so the time taken doesn't reveal how much of a guess matched.
+bool uploadAuthorized(const String &request) {
+    if (fileUploadKey.length() == 0) return false;
+    String lowerRequest = request;
+    lowerRequest.toLowerCase();
+    static const char pattern[] = "\r\nx-upload-key:";
+    int at = lowerRequest.indexOf(pattern);
+    if (at < 0) return false;
+    int start = at + strlen(pattern);
+    int eol = request.indexOf("\r\n", start);
+    String given = request.substring(start, eol < 0 ? request.length() : eol);
+    given.trim();
+
+    uint8_t diff = given.length() == fileUploadKey.length() ? 0 : 1;
+    for (unsigned int i = 0; i < fileUploadKey.length(); i++) {
+        diff |= (uint8_t)fileUploadKey[i] ^ (uint8_t)(i < given.length() ? given[i] : 0);
+    }
+    return diff == 0;
+}
+
+// Send a complete short response and start closing the connection
+void uploadRespond(UploadConnection &conn, const String &status, const String &contentType, const String &body) {
+    String response = "HTTP/1.1 " + status + "\r\n"
+                      "Content-Type: " + contentType + "\r\n"
+                      "Content-Length: " + String(body.length()) + "\r\n"
+                      "Connection: close\r\n"
+                      "\r\n" + body;
+    conn.client.print(response);
+    conn.state = UPLOAD_CLOSING;
+    conn.lastActivity = millis();
+}
+
+void uploadReset(UploadConnection &conn) {
+    if (conn.upload) conn.upload.close();
+    if (conn.tempPath.length() > 0) LittleFS.remove(conn.tempPath);
+    if (conn.download) conn.download.close();
+    conn.client.stop();
+    conn.state = UPLOAD_FREE;
+    conn.request = "";
+    conn.tempPath = "";
+    conn.fileName = "";
+    conn.savedFiles.clear();
+    conn.refusedFiles.clear();
+    conn.busyFiles.clear();
+}
+
+// POST /upload: check headers and set up the multipart parser
+void uploadBeginPost(UploadConnection &conn) {
+    // Header names are case-insensitive; values are taken from the original
+    String lowerRequest = conn.request;
+    lowerRequest.toLowerCase();
+
+    // Extract Content-Length
+    int contentLenIdx = lowerRequest.indexOf("content-length:");
+    conn.contentLen = -1;
+    if (contentLenIdx >= 0) {
+        int eol = conn.request.indexOf("\r\n", contentLenIdx);
+        String lenStr = conn.request.substring(contentLenIdx + 15, eol);
+        lenStr.trim();
+        conn.contentLen = lenStr.toInt();
+    }
+
+    // Find boundary (for multipart/form-data)
+    int boundaryIdx = lowerRequest.indexOf("boundary=");
+    String boundary = "";
+    if (boundaryIdx >= 0) {
+        int end = conn.request.indexOf("\r\n", boundaryIdx);
+        boundary = conn.request.substring(boundaryIdx + 9, end);
+        boundary.trim();
+        if (boundary.startsWith("\"") && boundary.endsWith("\"")) {
+            boundary = boundary.substring(1, boundary.length() - 1);
+        }
+    }
+
+    if (conn.contentLen <= 0 || boundary.length() == 0) {
+        uploadRespond(conn, "400 Bad Request", "text/plain",
+                      "Expected a multipart/form-data body with Content-Length\n");
+        return;
+    }
+
+    // Each file part is written to /<name>.upload in fixed chunks and
+    // swapped in through a commit journal (as YMODEM uploads are) only once
+    // its closing boundary has been seen.  A name another connection is
+    // still writing is refused, so the two never share a staged file.
+    UploadConnection *c = &conn;
+    conn.multipart.begin(boundary);
+    conn.bodyRead = 0;
+    conn.writeFailed = false;
+    conn.commitFailed = false;
+    conn.roomsReplaced = false;
+    conn.savedFiles.clear();
+    conn.refusedFiles.clear();
+    conn.busyFiles.clear();
+
+    conn.multipart.onPartBegin = [c](const String &, const String &filename) {
+        if (filename.length() == 0) return false;   // ordinary form field
+        String fileName = sanitizeUploadFileName(filename);
+        if (!isUploadWorldFile(fileName)) {
+            c->refusedFiles.push_back(fileName);
+            return false;
+        }
+        for (const UploadConnection &other : uploadConns) {
+            if (&other != c && other.tempPath.length() > 0 && other.fileName == fileName) {
+                c->busyFiles.push_back(fileName);
+                return false;
+            }
+        }
+        c->fileName = fileName;
+        c->tempPath = "/" + c->fileName + UPLOAD_PART_SUFFIX;
+        c->fileSize = 0;
+        c->upload = LittleFS.open(c->tempPath, "w");
+        if (!c->upload) {
+            c->writeFailed = true;
+            c->tempPath = "";
+            return false;
+        }
+        return true;
+    };
+    conn.multipart.onData = [c](const uint8_t *data, size_t len) {
+        if (c->upload.write(data, len) != len) {
+            c->writeFailed = true;
+            return false;
+        }
+        c->fileSize += len;
+        return true;
+    };
+    conn.multipart.onPartEnd = [c]() {
+        c->upload.close();
+        // Left to the journal from here: a failed swap is retried at boot
+        c->tempPath = "";
+        if (!stagedCommit(UPLOAD_COMMIT_JOURNAL, UPLOAD_PART_SUFFIX, {c->fileName})) {
+            c->commitFailed = true;
+            Serial.println("[FILE UPLOAD] Could not swap in /" + c->fileName);
+            return;
         }
-        npc.gold = gold;
+        if (c->fileName == "rooms.txt") c->roomsReplaced = true;
+        c->savedFiles.push_back(c->fileName + " (" + String((unsigned long)c->fileSize) + " bytes)");
+        Serial.println("[FILE UPLOAD] Received: /" + c->fileName + " (" + String((unsigned long)c->fileSize) + " bytes)");
+    };
 
-        npc.x = npc.spawnX;
-        npc.y = npc.spawnY;
-        npc.z = npc.spawnZ;
-        npc.respawnTime = 0;
+    conn.state = UPLOAD_BODY;
+    conn.request = "";
+}
 
-        npc.dialogIndex = 0;
-        npc.dialogOrder[0] = 0;
-        npc.dialogOrder[1] = 1;
-        npc.dialogOrder[2] = 2;
+// POST /upload finished (or gave up): report what was saved
+void uploadFinishPost(UploadConnection &conn) {
+    // A part left open by a short or malformed body is discarded
+    if (conn.tempPath.length() > 0) {
+        conn.upload.close();
+        LittleFS.remove(conn.tempPath);
+        conn.tempPath = "";
+    }
 
-        for (int i = 0; i < 3; i++) {
-            int r = random(0, 3);
-            int tmp = npc.dialogOrder[i];
-            npc.dialogOrder[i] = npc.dialogOrder[r];
-            npc.dialogOrder[r] = tmp;
+    // The room lookup tables and the room graph are built from rooms.txt
+    if (conn.roomsReplaced) {
+        buildRoomIndexesIfNeeded(true);
+        loadRoomGraph();
+    }
+
+    bool clean = !conn.writeFailed && !conn.commitFailed && conn.refusedFiles.empty() && conn.busyFiles.empty();
+    if (conn.multipart.finished() && clean && !conn.savedFiles.empty()) {
+        String body = "File uploaded successfully!\n";
+        for (const String &saved : conn.savedFiles) {
+            body += "File: " + saved + "\n";
         }
+        if (conn.roomsReplaced) body += "Room indexes rebuilt.\n";
+        body += "\nTo check the file, use: DEBUG FILES\n";
+        uploadRespond(conn, "200 OK", "text/plain", body);
+        return;
+    }
 
-        npc.nextDialogTime = now + random(3000, 30001);
+    String body;
+    if (conn.commitFailed) {
+        body = "Received, but the file could not be swapped in; it is retried at the next boot\n";
+        uploadRespond(conn, "500 Internal Server Error", "text/plain", body);
+        return;
+    } else if (conn.writeFailed) {
+        body = "Failed to write file\n";
+    } else if (!conn.busyFiles.empty()) {
+        for (const String &busy : conn.busyFiles) {
+            body += "Already being uploaded on another connection: " + busy + "\n";
+        }
+        uploadRespond(conn, "409 Conflict", "text/plain", body);
+        return;
+    } else if (!conn.refusedFiles.empty()) {
+        for (const String &refused : conn.refusedFiles) {
+            body += "Not an uploadable world file: " + refused + "\n";
+        }
+        Serial.println("[FILE UPLOAD] Refused an upload outside the world files");
+        uploadRespond(conn, "403 Forbidden", "text/plain", body);
+        return;
+    } else if (conn.savedFiles.empty() && conn.multipart.finished()) {
+        body = "No file in upload\n";
+    } else {
+        body = "Upload incomplete (" + String(conn.bodyRead) + " of " + String(conn.contentLen) + " bytes)\n";
     }
+    Serial.println("[FILE UPLOAD] Failed after " + String(conn.bodyRead) + " of " + String(conn.contentLen) + " bytes");
+    uploadRespond(conn, conn.writeFailed ? "500 Internal Server Error" : "400 Bad Request", "text/plain", body);
 }
 
-    // NPC dialog tick
-    for (auto &npc : npcInstances) {
-        if (!npc.alive) continue;
-
-        if (now >= npc.nextDialogTime) {
-
-            // SAFE lookup
-            std::string npcKey = std::string(npc.npcId.c_str());
-            auto it = npcDefs.find(npcKey);
-            if (it == npcDefs.end()) continue;
+// GET /files: one "name size" line per world file present
+void uploadSendListing(UploadConnection &conn) {
+    String body = "";
+    for (const char *name : UPLOAD_WORLD_FILES) {
+        File file = LittleFS.open("/" + String(name), "r");
+        if (file && !file.isDirectory()) {
+            body += String(name) + " " + String((unsigned long)file.size()) + "\n";
+        }
+        if (file) file.close();
+    }
+    uploadRespond(conn, "200 OK", "text/plain", body);
+}
 
-            NpcDefinition &def = it->second;
+// GET /files/<name>: send headers, then stream the file a slice per loop
+void uploadBeginDownload(UploadConnection &conn, const String &requested) {
+    String fileName = sanitizeUploadFileName(requested);
+    if (!isUploadWorldFile(fileName)) {
+        uploadRespond(conn, "403 Forbidden", "text/plain", "Not available\n");
+        return;
+    }
 
-            int idx = npc.dialogOrder[npc.dialogIndex];
-            String key = "dialog_" + String(idx + 1);
+    conn.download = LittleFS.open("/" + fileName, "r");
+    if (!conn.download || conn.download.isDirectory()) {
+        if (conn.download) conn.download.close();
+        uploadRespond(conn, "404 Not Found", "text/plain", "No such file: " + fileName + "\n");
+        return;
+    }
 
-            // Convert key → std::string
-            std::string skey = std::string(key.c_str());
+    conn.client.print("HTTP/1.1 200 OK\r\n"
+                      "Content-Type: application/octet-stream\r\n"
+                      "Content-Disposition: attachment; filename=\"" + fileName + "\"\r\n"
+                      "Content-Length: " + String((unsigned long)conn.download.size()) + "\r\n"
+                      "Connection: close\r\n"
+                      "\r\n");
+    conn.state = UPLOAD_SENDING;
+    Serial.println("[FILE UPLOAD] Sending /" + fileName + " (" + String((unsigned long)conn.download.size()) + " bytes)");
+}
 
-            if (def.attributes.count(skey)) {
+// Headers complete: pick the endpoint
+void uploadRoute(UploadConnection &conn) {
+    int firstLine = conn.request.indexOf("\r\n");
+    String requestLine = conn.request.substring(0, firstLine);
+    int pathStart = requestLine.indexOf(' ') + 1;
+    int pathEnd = requestLine.indexOf(' ', pathStart);
+    String method = requestLine.substring(0, pathStart - 1);
+    String path = (pathEnd > pathStart) ? requestLine.substring(pathStart, pathEnd) : "";
 
-                // Convert stored std::string → Arduino String
-                String line = String(def.attributes.at(skey).c_str());
+    if (!uploadAuthorized(conn.request)) {
+        Serial.println("[FILE UPLOAD] Refused " + method + " " + path + " without a valid key");
+        uploadRespond(conn, "401 Unauthorized", "text/plain", "X-Upload-Key required\n");
+        return;
+    }
 
-                // Convert NPC name (std::string) → Arduino String
-                String npcName = String(def.attributes.at("name").c_str());
+    if (method == "POST" && path == "/upload") {
+        uploadBeginPost(conn);
+    } else if (method == "GET" && path == "/files") {
+        uploadSendListing(conn);
+    } else if (method == "GET" && path.startsWith("/files/")) {
+        uploadBeginDownload(conn, path.substring(7));
+    } else if (method == "GET" && path == "/") {
+        // A browser form can't send the key header, so this is just usage
+        String body = "ESP32 MUD file server (send X-Upload-Key with every request)\n"
+                      "  POST /upload        multipart/form-data, field \"file\"\n"
+                      "  GET  /files         list\n"
+                      "  GET  /files/<name>  download\n"
+                      "World files:";
+        for (const char *name : UPLOAD_WORLD_FILES) body += " " + String(name);
+        uploadRespond(conn, "200 OK", "text/plain", body + "\n");
+    } else {
+        uploadRespond(conn, "404 Not Found", "text/plain", "Not found\n");
+    }
+}
 
-                // Use announceDialogToRoom for proper formatting
-                announceDialogToRoom(
-                    npc.x, npc.y, npc.z,
-                    npcName,
-                    line,
-                    -1
-                );
-            }
+// Advance one connection by at most one slice of work
+void serviceUploadConnection(UploadConnection &conn, unsigned long now) {
+    uint8_t buffer[UPLOAD_SLICE_BYTES];
 
-            npc.dialogIndex++;
-            if (npc.dialogIndex >= 3) {
-                npc.dialogIndex = 0;
+    switch (conn.state) {
+        case UPLOAD_FREE:
+            return;
 
-                for (int i = 0; i < 3; i++) {
-                    int r = random(0, 3);
-                    int tmp = npc.dialogOrder[i];
-                    npc.dialogOrder[i] = npc.dialogOrder[r];
-                    npc.dialogOrder[r] = tmp;
+        case UPLOAD_HEADERS: {
+            // Byte at a time so the body stays in the socket for the parser
+            if (conn.client.available() <= 0) {
+                if (!conn.client.connected() || now - conn.lastActivity > UPLOAD_IDLE_TIMEOUT) {
+                    uploadReset(conn);
                 }
+                return;
             }
-
-            // Increase minimum dialog time in post office to reduce dialog spam
-            int minDialogTime = (npc.x == 252 && npc.y == 248 && npc.z == 50) ? 30000 : 8000;
-            int maxDialogTime = (npc.x == 252 && npc.y == 248 && npc.z == 50) ? 120001 : 30001;
-            npc.nextDialogTime = now + random(minDialogTime, maxDialogTime);
-        }
-    }
-
-    // Item dialog tick
-    for (size_t i = 0; i < worldItems.size(); i++) {
-        WorldItem &item = worldItems[i];
-        
-        // Only process world items (not in inventory)
-        if (item.ownerName.length() > 0) continue;
-        
-        // Check if item has any dialog attributes (using dialog_1, dialog_2, dialog_3 format)
-        // Use getAttr() to fetch from itemDefs template
-        String dialog1 = item.getAttr("dialog_1", itemDefs);
-        String dialog2 = item.getAttr("dialog_2", itemDefs);
-        String dialog3 = item.getAttr("dialog_3", itemDefs);
-        
-        if (dialog1.length() == 0 && dialog2.length() == 0 && dialog3.length() == 0) {
-            continue;  // No dialogs for this item
-        }
-        
-        // Count how many dialogs this item has
-        int dialogCount = 0;
-        if (dialog1.length() > 0) dialogCount++;
-        if (dialog2.length() > 0) dialogCount++;
-        if (dialog3.length() > 0) dialogCount++;
-        
-        // Initialize dialog timer if needed
-        if (item.attributes.find("nextDialogTime") == item.attributes.end()) {
-            // Increase minimum dialog time in post office to reduce dialog spam
-            int minDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 30000 : 8000;
-            int maxDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 120001 : 30001;
-            item.attributes["nextDialogTime"] = std::to_string(now + random(minDialogTime, maxDialogTime));
-        }
-        
-        unsigned long nextTime = (unsigned long)strtoull(item.attributes["nextDialogTime"].c_str(), NULL, 10);
-        
-        if (now >= nextTime) {
-            // Pick dialog based on cycle order - only cycle through actual dialogs
-            int dialogNum = item.dialogOrder[item.dialogIndex] + 1;  // Convert 0-2 to 1-3
-            String dialogKey = "dialog_" + String(dialogNum);
-            
-            // Use getAttr() to fetch from itemDefs template
-            String line = item.getAttr(dialogKey, itemDefs);
-            
-            if (line.length() > 0) {
-                // Get display name from itemDefs
-                String itemName = item.getAttr("name", itemDefs);
-                if (itemName.length() == 0) {
-                    itemName = item.name;
+            conn.lastActivity = now;
+            for (size_t budget = UPLOAD_SLICE_BYTES; budget > 0 && conn.client.available() > 0; budget--) {
+                conn.request += (char)conn.client.read();
+                if (conn.request.endsWith("\r\n\r\n")) {
+                    uploadRoute(conn);
+                    return;
                 }
-                
-                announceDialogToRoom(item.x, item.y, item.z, "The " + itemName, line, -1);
-            }
-            
-            // Move to next dialog - only cycle through the dialogs that exist
-            if (dialogCount == 1) {
-                // Single dialog: only repeat if it's the ONLY one
-                // Don't cycle, just repeat the same dialog
-            } else {
-                // Multiple dialogs: cycle through without repeating
-                item.dialogIndex++;
-                if (item.dialogIndex >= dialogCount) {
-                    item.dialogIndex = 0;
-                    
-                    // Shuffle order for next cycle
-                    for (int j = 0; j < dialogCount; j++) {
-                        int r = random(0, dialogCount);
-                        int tmp = item.dialogOrder[j];
-                        item.dialogOrder[j] = item.dialogOrder[r];
-                        item.dialogOrder[r] = tmp;
-                    }
+                if (conn.request.length() > UPLOAD_MAX_HEADER_BYTES) {
+                    uploadRespond(conn, "431 Request Header Fields Too Large", "text/plain", "Headers too large\n");
+                    return;
                 }
             }
-            
-            // Schedule next dialog
-            // Increase minimum dialog time in post office to reduce dialog spam
-            int minDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 30000 : 8000;
-            int maxDialogTime = (item.x == 252 && item.y == 248 && item.z == 50) ? 120001 : 30001;
-            item.attributes["nextDialogTime"] = std::to_string(now + random(minDialogTime, maxDialogTime));
+            return;
         }
-    }
-
-
-
 
-    // =============================
-    // INN KEEPER JOKE SYSTEM (Room 249, 248, 50) - NON-BLOCKING ASYNC
-    // =============================
-    {
-        const int JOKE_ROOM_X = 249;
-        const int JOKE_ROOM_Y = 248;
-        const int JOKE_ROOM_Z = 50;
-        
-        int playersInRoom = countPlayersInRoom(JOKE_ROOM_X, JOKE_ROOM_Y, JOKE_ROOM_Z);
-        
-        if (playersInRoom > 0) {
-            // Players are in the Inn Keeper room - activate joke system
-            innKeeperJokes.active = true;
-            
-            // Check if async fetch completed (non-blocking check)
-            if (innKeeperJokes.requestPending) {
-                if (checkJokeFetchComplete()) {
-                    Serial.println("[JOKE SUCCESS] Fetch completed!");
-                    // Successfully received and parsed joke - broadcast it to the room
-                    broadcastToRoom(JOKE_ROOM_X, JOKE_ROOM_Y, JOKE_ROOM_Z, "");
-                    
-                    // Wrap joke text like room descriptions (80 chars max)
-                    String wrappedJoke = wordWrap(innKeeperJokes.currentJoke, MAX_OUTPUT_WIDTH);
-                    String jokeMsg = "The Inn Keeper Says: \"" + wrappedJoke + ".\"";
-                    
-                    // Send wrapped joke to all players in room
-                    announceToRoom(JOKE_ROOM_X, JOKE_ROOM_Y, JOKE_ROOM_Z, jokeMsg, -1);
-                    
-                    // Send prompt to all players in room on new line
-                    for (int i = 0; i < MAX_PLAYERS; i++) {
-                        if (players[i].active && players[i].loggedIn &&
-                            players[i].roomX == JOKE_ROOM_X && players[i].roomY == JOKE_ROOM_Y && players[i].roomZ == JOKE_ROOM_Z) {
-                            players[i].client.println("");  // Blank line
-                            players[i].client.print("> ");
-                        }
-                    }
-                    
-                    // Schedule next joke (15-20 seconds from now)
-                    innKeeperJokes.nextJokeTime = now + random(15000, 20001);
-                    Serial.println("[JOKE] Next joke scheduled in 15-20 seconds");
+        case UPLOAD_BODY: {
+            bool done = conn.bodyRead >= conn.contentLen || conn.multipart.hasError() || conn.multipart.finished();
+            int avail = done ? 0 : conn.client.available();
+            if (avail > 0) {
+                long want = conn.contentLen - conn.bodyRead;
+                if (want > (long)sizeof(buffer)) want = sizeof(buffer);
+                if (want > avail) want = avail;
+                int n = conn.client.read(buffer, want);
+                if (n > 0) {
+                    conn.multipart.feed(buffer, n);
+                    conn.bodyRead += n;
+                    conn.lastActivity = now;
                 }
+            } else if (done || !conn.client.connected() || now - conn.lastActivity > UPLOAD_IDLE_TIMEOUT) {
+                uploadFinishPost(conn);
             }
-            
-            // Check if it's time to initiate a new joke fetch (non-blocking start)
-            if (now >= innKeeperJokes.nextJokeTime && !innKeeperJokes.requestPending) {
-                Serial.println("[JOKE] Timer expired, initiating fetch");
-                startJokeFetch();  // Just initiate, doesn't block
-                // Schedule timeout fallback (try again in 3 seconds if request fails)
-                innKeeperJokes.nextJokeTime = now + 3000;
-            }
-        } else {
-            // No players in room - deactivate joke system
-            innKeeperJokes.active = false;
-            // Cancel any pending request
-            if (innKeeperJokes.requestPending && innKeeperJokes.httpClient) {
-                innKeeperJokes.httpClient->end();
-                delete innKeeperJokes.httpClient;
-                innKeeperJokes.httpClient = nullptr;
-                innKeeperJokes.requestPending = false;
-                Serial.println("[JOKE] Request cancelled, no players in room");
-            }
-            // Clear used joke IDs when room empties
-            if (innKeeperJokes.usedJokeIds.size() > 0) {
-                Serial.printf("[JOKE] Clearing %d used joke IDs\n", innKeeperJokes.usedJokeIds.size());
-                innKeeperJokes.usedJokeIds.clear();
-            }
+            return;
         }
-    }
 
-    // Natural healing
-    static unsigned long lastHealTick = 0;
-    if (now - lastHealTick >= 60000UL) {
-        lastHealTick = now;
-        for (int i = 0; i < MAX_PLAYERS; i++) {
-            Player &p = players[i];
-            if (!p.active || !p.loggedIn) continue;
-            if (p.hp < p.maxHp) {
-                p.hp += 1;
-                if (p.hp > p.maxHp) p.hp = p.maxHp;
+        case UPLOAD_SENDING: {
+            int n = conn.download.read(buffer, sizeof(buffer));
+            if (n > 0 && conn.client.connected() && now - conn.lastActivity <= UPLOAD_IDLE_TIMEOUT) {
+                // A full send buffer takes part of a slice: step the file
+                // back so the rest goes out on the next one
+                size_t sent = conn.client.write(buffer, n);
+                if (sent < (size_t)n) conn.download.seek(conn.download.position() - (n - sent));
+                if (sent > 0) conn.lastActivity = now;
+            } else {
+                conn.download.close();
+                conn.state = UPLOAD_CLOSING;
+                conn.lastActivity = now;
             }
-            // Drunkenness recovery
-            updateDrunkennessRecovery(p);
-            // Fullness recovery
-            updateFullnessRecovery(p);
+            return;
         }
-    }
-
-    // Update weather requests (non-blocking HTTP)
-    updateWeatherRequests();
-
-    // Shop restock
-    if (now - lastShopRestock >= 60UL * 60UL * 1000UL) {
-        restockAllShops();
-        lastShopRestock = now;
-    }
 
-    // =====================================================
-    // HANDLE FILE UPLOADS VIA HTTP (Port 8080)
-    // =====================================================
-    if (fileUploadServer) {
-        WiFiClient uploadClient = fileUploadServer->available();
-        if (uploadClient) {
-            handleFileUploadRequest(uploadClient);
-        }
+        case UPLOAD_CLOSING:
+            // Give the last segment time to leave before closing the socket
+            if (now - conn.lastActivity >= UPLOAD_CLOSE_LINGER) {
+                uploadReset(conn);
+            }
+            return;
     }
 }
 
-// =====================================================
-// FILE UPLOAD HANDLER - HTTP POST endpoint
-// =====================================================
-void handleFileUploadRequest(WiFiClient &client) {
-    String request = "";
-    unsigned long timeout = millis() + 2000;  // 2-second timeout
-    
-    // Read HTTP request headers
-    while (client.available() && millis() < timeout) {
-        char c = client.read();
-        request += c;
-        if (request.endsWith("\r\n\r\n")) break;
-    }
-
-    // Parse request line
-    int firstLine = request.indexOf("\r\n");
-    String requestLine = request.substring(0, firstLine);
-
-    if (requestLine.indexOf("POST /upload") >= 0) {
-        // Extract Content-Length
-        int contentLenIdx = request.indexOf("Content-Length: ");
-        int contentLen = 0;
-        if (contentLenIdx >= 0) {
-            int eol = request.indexOf("\r\n", contentLenIdx);
-            String lenStr = request.substring(contentLenIdx + 16, eol);
-            contentLen = lenStr.toInt();
-        }
-
-        // Find boundary (for multipart/form-data)
-        int boundaryIdx = request.indexOf("boundary=");
-        String boundary = "";
-        if (boundaryIdx >= 0) {
-            int end = request.indexOf("\r\n", boundaryIdx);
-            boundary = request.substring(boundaryIdx + 9, end);
-        }
-
-        // Read file data
-        String fileName = "unknown.txt";
-
-        // Read remaining body until boundary
-        String fileContent = "";
-        while (client.available() && fileContent.length() < contentLen * 2) {
-            fileContent += (char)client.read();
-        }
-
-        // Parse filename from the multipart Content-Disposition header (in the body)
-        // Look for: Content-Disposition: form-data; name="file"; filename="shops.txt"
-        int dispIdx = fileContent.indexOf("filename=");
-        if (dispIdx >= 0) {
-            int start = dispIdx + 9;
-            // Skip quote if present
-            if (fileContent[start] == '"') start++;
-            
-            int end = start;
-            while (end < fileContent.length()) {
-                char c = fileContent[end];
-                if (c == '"' || c == ';' || c == '\r' || c == '\n') break;
-                end++;
-            }
-            
-            if (end > start) {
-                fileName = fileContent.substring(start, end);
-                fileName.trim();
-                
-                // Sanitize filename
-                fileName.toLowerCase();
-                for (int i = 0; i < fileName.length(); i++) {
-                    char c = fileName[i];
-                    if (!isalnum(c) && c != '.' && c != '_' && c != '-') {
-                        fileName[i] = '_';
-                    }
-                }
-            }
-        }
-
-        // Extract actual file data (between boundaries)
-        int dataStart = fileContent.indexOf("\r\n\r\n");
-        if (dataStart >= 0) {
-            dataStart += 4;
-            int dataEnd = fileContent.lastIndexOf("\r\n--");
-            if (dataEnd > dataStart) {
-                String actualData = fileContent.substring(dataStart, dataEnd);
+// Accept new connections and give every open one a slice.  Called from loop().
+void updateUploadServer(unsigned long now) {
+    if (!fileUploadServer) return;
 
-                // Write to LittleFS
-                String filePath = "/" + fileName;
-                File f = LittleFS.open(filePath, "w");
-                if (f) {
-                    f.print(actualData);
-                    f.close();
-                    
-                    // Send success response
-                    client.println("HTTP/1.1 200 OK");
-                    client.println("Content-Type: text/plain");
-                    client.println("Connection: close");
-                    client.println();
-                    client.println("File uploaded successfully!");
-                    client.println("File: " + fileName);
-                    client.println("Size: " + String(actualData.length()) + " bytes");
-                    client.println();
-                    client.println("To check the file, use: DEBUG FILES");
-                    
-                    Serial.println("[FILE UPLOAD] Received: " + filePath + " (" + String(actualData.length()) + " bytes)");
-                } else {
-                    // Send error
-                    client.println("HTTP/1.1 500 Internal Server Error");
-                    client.println("Content-Type: text/plain");
-                    client.println("Connection: close");
-                    client.println();
-                    client.println("Failed to write file");
-                    Serial.println("[FILE UPLOAD] Failed to open: " + filePath);
-                }
+    WiFiClient incoming = fileUploadServer->available();
+    if (incoming) {
+        UploadConnection *slot = nullptr;
+        for (int i = 0; i < UPLOAD_MAX_CONNECTIONS; i++) {
+            if (uploadConns[i].state == UPLOAD_FREE) {
+                slot = &uploadConns[i];
+                break;
             }
         }
-    } else if (requestLine.indexOf("GET /") >= 0) {
-        // Serve simple upload HTML form
-        String html = 
-            "HTTP/1.1 200 OK\r\n"
-            "Content-Type: text/html\r\n"
-            "Connection: close\r\n"
-            "\r\n"
-            "<!DOCTYPE html><html><body>"
-            "<h1>ESP32 MUD - File Upload</h1>"
-            "<form method='POST' action='/upload' enctype='multipart/form-data'>"
-            "<input type='file' name='file' required>"
-            "<button type='submit'>Upload</button>"
-            "</form>"
-            "<p>Supported files: shops.txt, items.vxd, items.vxi, npcs.vxd, npcs.vxi, quests.txt, rooms.txt</p>"
-            "</body></html>";
-        client.print(html);
-    } else {
-        client.println("HTTP/1.1 404 Not Found");
-        client.println("Connection: close");
-        client.println();
+        if (slot) {
+            slot->client = incoming;
+            slot->state = UPLOAD_HEADERS;
+            slot->request = "";
+            slot->lastActivity = now;
+        } else {
+            incoming.print("HTTP/1.1 503 Service Unavailable\r\n"
+                           "Content-Type: text/plain\r\n"
+                           "Retry-After: 5\r\n"
+                           "Connection: close\r\n"
+                           "\r\n"
+                           "Too many transfers in progress, try again shortly\n");
+            incoming.stop();
+            Serial.println("[FILE UPLOAD] Busy, refused a connection");
+        }
     }
 
-    delay(100);
-    client.stop();
-}
\ No newline at end of file
+    for (int i = 0; i < UPLOAD_MAX_CONNECTIONS; i++) {
+        serviceUploadConnection(uploadConns[i], now);
+    }
+}
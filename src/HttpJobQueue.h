@@ -0,0 +1,336 @@
+#pragma once
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <LittleFS.h>
+#include <atomic>
+#include <functional>
+#include "JsonPull.h"
+#if !defined(ESP32)
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+#if defined(NATIVE_BUILD)
+#include <NativeReplay.h>                   // a replay runs jobs inline
+#endif
+
+// ============================================================
+// ASYNC HTTP JOB QUEUE
+// ============================================================
+//
+// All outbound HTTP (weather, jokes, mail, downloads) goes through here so
+// that a slow server never stalls loop().  Callers fill in an HttpJob and
+// hand it to httpJobSubmit(); a small pool of worker tasks performs the
+// blocking HTTPClient work and the finished job is handed back to the game
+// loop by httpJobPump(), which runs the job's onComplete callback on the
+// main task.  Callbacks may therefore touch players/world state freely.
+//
+// On the native build std::thread workers stand in for the tasks, so the
+// pump never waits for a server there either.  A --replay run executes one
+// queued job per pump call instead, inline, so it repeats exactly.
+
+static const int           HTTP_MAX_CONCURRENT     = 2;    // worker tasks (each may hold a TLS session)
+static const int           HTTP_JOB_QUEUE_DEPTH    = 8;    // pending jobs before submit() refuses
+static const uint32_t      HTTP_WORKER_STACK       = 8192;
+static const unsigned long HTTP_JOB_DEFAULT_TIMEOUT = 10000;
+
+struct HttpJob;
+typedef std::function<void(HttpJob &job)> HttpJobCallback;
+
+struct HttpJob {
+    uint32_t id = 0;                        // assigned by httpJobSubmit()
+    String url;
+    String method = "GET";                  // "GET" or "POST"
+    String payload;                         // request body for POST
+    String contentType;                     // optional Content-Type header
+    String ifNoneMatch;                     // optional If-None-Match header (304 = unchanged)
+    String saveToPath;                      // if set, body is streamed to this LittleFS file instead of response
+    JsonPathExtractor json;                 // if any paths are wanted, body is parsed on the fly instead of kept
+
+    unsigned long connectTimeoutMs = 5000;
+    unsigned long timeoutMs = HTTP_JOB_DEFAULT_TIMEOUT;  // socket read timeout
+    unsigned long deadlineMs = 0;           // total budget from submit (0 = connect + read timeout)
+
+    HttpJobCallback onComplete = nullptr;   // runs on the game loop
+
+    // Filled in by the worker
+    int httpCode = 0;                       // HTTP status, or negative HTTPC_ERROR_* / HTTP_JOB_* code
+    String response;                        // body (empty when saveToPath or json is used)
+    String etag;                            // ETag response header, if the server sent one
+    int contentLength = -1;
+    size_t bytesWritten = 0;                // bytes streamed to saveToPath
+    bool timedOut = false;
+    unsigned long queuedAt = 0;
+    unsigned long startedAt = 0;
+    unsigned long finishedAt = 0;
+
+    bool ok() const { return httpCode == 200 && !timedOut && (!json.wantsAny() || json.ok()); }
+};
+
+// Local error codes (HTTPClient uses -1..-11)
+static const int HTTP_JOB_ERROR_DEADLINE   = -100;
+static const int HTTP_JOB_ERROR_FILE       = -101;
+static const int HTTP_JOB_ERROR_INCOMPLETE = -102;
+
+struct HttpJobStats {
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+    uint32_t failed = 0;
+    uint32_t timedOut = 0;
+    uint32_t rejected = 0;
+    std::atomic<int> inFlight{0};           // changed by the worker tasks
+};
+
+HttpJobStats httpJobStats;
+static uint32_t httpNextJobId = 1;
+
+// ============================================================
+// Worker side: perform one job (blocking)
+// ============================================================
+
+void httpJobExecute(HttpJob &job) {
+    job.startedAt = millis();
+    unsigned long deadline = job.deadlineMs ? job.deadlineMs : (job.connectTimeoutMs + job.timeoutMs);
+
+    // Waited in the queue past its budget - don't bother the server
+    if (job.startedAt - job.queuedAt > deadline) {
+        job.timedOut = true;
+        job.httpCode = HTTP_JOB_ERROR_DEADLINE;
+        job.finishedAt = millis();
+        return;
+    }
+
+    HTTPClient http;
+    http.setConnectTimeout(job.connectTimeoutMs);
+    http.setTimeout(job.timeoutMs);
+
+    if (!http.begin(job.url)) {
+        job.httpCode = HTTPC_ERROR_CONNECTION_REFUSED;
+        job.finishedAt = millis();
+        return;
+    }
+    if (job.contentType.length() > 0) {
+        http.addHeader("Content-Type", job.contentType);
+    }
+    if (job.ifNoneMatch.length() > 0) {
+        http.addHeader("If-None-Match", job.ifNoneMatch);
+    }
+    const char *wantedHeaders[] = { "ETag" };
+    http.collectHeaders(wantedHeaders, 1);
+
+    job.httpCode = (job.method == "POST") ? http.POST(job.payload) : http.GET();
+    job.etag = http.header("ETag");
+
+    if (job.httpCode == 200) {
+        job.contentLength = http.getSize();
+
+        if (job.json.wantsAny()) {
+            job.json.reset();
+            int streamed = http.writeToStream(&job.json);
+            job.json.finish();
+            if (streamed < 0) {
+                job.httpCode = streamed;
+                job.timedOut = (streamed == HTTPC_ERROR_READ_TIMEOUT);
+            }
+        } else if (job.saveToPath.length() == 0) {
+            job.response = http.getString();
+        } else {
+            File file = LittleFS.open(job.saveToPath, "w");
+            if (!file) {
+                job.httpCode = HTTP_JOB_ERROR_FILE;
+            } else {
+                WiFiClient *stream = http.getStreamPtr();
+                uint8_t buffer[1024];
+                int bytesRead = 0;
+                while (http.connected() && (bytesRead = stream->readBytes(buffer, sizeof(buffer))) > 0) {
+                    file.write(buffer, bytesRead);
+                    job.bytesWritten += bytesRead;
+                    if (millis() - job.queuedAt > deadline) {
+                        job.timedOut = true;
+                        break;
+                    }
+                }
+                file.close();
+
+                if (job.timedOut) {
+                    job.httpCode = HTTP_JOB_ERROR_DEADLINE;
+                } else if (job.contentLength > 0 && (int)job.bytesWritten != job.contentLength) {
+                    job.httpCode = HTTP_JOB_ERROR_INCOMPLETE;
+                }
+                if (job.httpCode != 200) {
+                    LittleFS.remove(job.saveToPath);
+                }
+            }
+        }
+    } else if (job.httpCode == HTTPC_ERROR_READ_TIMEOUT) {
+        job.timedOut = true;
+    }
+
+    http.end();
+    job.finishedAt = millis();
+}
+
+// ============================================================
+// Queue plumbing
+// ============================================================
+
+#if defined(ESP32)
+
+static QueueHandle_t httpPendingQueue = nullptr;   // HttpJob* waiting for a worker
+static QueueHandle_t httpDoneQueue = nullptr;      // HttpJob* waiting for its callback
+
+void httpWorkerTask(void *) {
+    for (;;) {
+        HttpJob *job = nullptr;
+        if (xQueueReceive(httpPendingQueue, &job, portMAX_DELAY) != pdTRUE || !job) continue;
+        httpJobStats.inFlight++;
+        httpJobExecute(*job);
+        httpJobStats.inFlight--;
+        xQueueSend(httpDoneQueue, &job, portMAX_DELAY);
+    }
+}
+
+void httpJobQueueBegin() {
+    if (httpPendingQueue) return;
+    httpPendingQueue = xQueueCreate(HTTP_JOB_QUEUE_DEPTH, sizeof(HttpJob *));
+    httpDoneQueue = xQueueCreate(HTTP_JOB_QUEUE_DEPTH + HTTP_MAX_CONCURRENT, sizeof(HttpJob *));
+    for (int i = 0; i < HTTP_MAX_CONCURRENT; i++) {
+        String name = "http" + String(i);
+        xTaskCreate(httpWorkerTask, name.c_str(), HTTP_WORKER_STACK, nullptr, 1, nullptr);
+    }
+    Serial.printf("[HTTP] Job queue started (%d workers, depth %d)\n", HTTP_MAX_CONCURRENT, HTTP_JOB_QUEUE_DEPTH);
+}
+
+static bool httpJobEnqueue(HttpJob *job) {
+    return httpPendingQueue && xQueueSend(httpPendingQueue, &job, 0) == pdTRUE;
+}
+
+static HttpJob *httpJobNextDone() {
+    HttpJob *job = nullptr;
+    if (httpDoneQueue && xQueueReceive(httpDoneQueue, &job, 0) == pdTRUE) return job;
+    return nullptr;
+}
+
+#else
+
+struct HttpHostQueues {
+    std::mutex lock;
+    std::condition_variable waiting;        // a job was queued
+    std::deque<HttpJob *> pending;          // waiting for a worker
+    std::deque<HttpJob *> done;             // waiting for its callback
+};
+
+static HttpHostQueues *httpQueues = nullptr;   // never freed: detached workers outlive main()
+static bool httpJobsInline = false;            // replay: run on the pump, one per call
+
+void httpWorkerThread() {
+    for (;;) {
+        HttpJob *job;
+        {
+            std::unique_lock<std::mutex> lock(httpQueues->lock);
+            httpQueues->waiting.wait(lock, [] { return !httpQueues->pending.empty(); });
+            job = httpQueues->pending.front();
+            httpQueues->pending.pop_front();
+        }
+        httpJobStats.inFlight++;
+        httpJobExecute(*job);
+        httpJobStats.inFlight--;
+        std::lock_guard<std::mutex> lock(httpQueues->lock);
+        httpQueues->done.push_back(job);
+    }
+}
+
+void httpJobQueueBegin() {
+    if (httpQueues) return;
+    httpQueues = new HttpHostQueues();
+#if defined(NATIVE_BUILD)
+    httpJobsInline = nativeReplaying();
+#endif
+    if (httpJobsInline) {
+        Serial.println("[HTTP] Job queue started (inline for the replay)");
+        return;
+    }
+    for (int i = 0; i < HTTP_MAX_CONCURRENT; i++) {
+        std::thread(httpWorkerThread).detach();
+    }
+    Serial.printf("[HTTP] Job queue started (%d worker threads, depth %d)\n", HTTP_MAX_CONCURRENT, HTTP_JOB_QUEUE_DEPTH);
+}
+
+static bool httpJobEnqueue(HttpJob *job) {
+    httpJobQueueBegin();                    // unit tests submit without setup()
+    {
+        std::lock_guard<std::mutex> lock(httpQueues->lock);
+        if ((int)httpQueues->pending.size() >= HTTP_JOB_QUEUE_DEPTH) return false;
+        httpQueues->pending.push_back(job);
+    }
+    httpQueues->waiting.notify_one();
+    return true;
+}
+
+static HttpJob *httpJobNextDone() {
+    if (!httpQueues) return nullptr;
+    std::lock_guard<std::mutex> lock(httpQueues->lock);
+    if (httpJobsInline) {
+        if (httpQueues->pending.empty()) return nullptr;
+        HttpJob *job = httpQueues->pending.front();
+        httpQueues->pending.pop_front();
+        httpJobStats.inFlight++;
+        httpJobExecute(*job);
+        httpJobStats.inFlight--;
+        return job;
+    }
+    if (httpQueues->done.empty()) return nullptr;
+    HttpJob *job = httpQueues->done.front();
+    httpQueues->done.pop_front();
+    return job;
+}
+
+#endif
+
+// ============================================================
+// Game-loop API
+// ============================================================
+
+// Queue a job.  Takes ownership of job; returns its id, or 0 if the queue
+// is full (the job is deleted and onComplete is NOT called).
+uint32_t httpJobSubmit(HttpJob *job) {
+    job->id = httpNextJobId++;
+    if (httpNextJobId == 0) httpNextJobId = 1;
+    job->queuedAt = millis();
+
+    if (!httpJobEnqueue(job)) {
+        Serial.println("[HTTP] Queue full, rejected: " + job->url);
+        httpJobStats.rejected++;
+        delete job;
+        return 0;
+    }
+    httpJobStats.submitted++;
+    return job->id;
+}
+
+// Deliver finished jobs to their callbacks.  Call once per loop().
+void httpJobPump() {
+    HttpJob *job;
+    while ((job = httpJobNextDone()) != nullptr) {
+        if (job->ok()) {
+            httpJobStats.completed++;
+        } else if (job->timedOut) {
+            httpJobStats.timedOut++;
+        } else {
+            httpJobStats.failed++;
+        }
+        if (job->onComplete) {
+            job->onComplete(*job);
+        }
+        delete job;
+#if !defined(ESP32)
+        if (httpJobsInline) break;          // ran inline: one job per call
+#endif
+    }
+}
+
+// Number of jobs queued or running
+int httpJobsOutstanding() {
+    return (int)(httpJobStats.submitted - httpJobStats.completed - httpJobStats.failed - httpJobStats.timedOut);
+}
@@ -0,0 +1,399 @@
+#pragma once
+#include <Arduino.h>
+#include <vector>
+
+// ============================================================
+// STREAMING JSON PATH EXTRACTOR
+// ============================================================
+//
+// Single-pass pull parser for HTTP responses.  Register the paths you care
+// about with want(), then push the body through it a byte (or chunk) at a
+// time - it is a Stream, so HTTPClient::writeToStream() can feed it
+// directly and chunked transfer encoding is handled for us.  Only the
+// scalar values whose path matches are kept; everything else is skipped
+// without being buffered, so the full body never sits in RAM.
+//
+// Paths use dots for object keys and [n] for array elements:
+//     current.temperature_2m
+//     daily.temperature_2m_max[0]
+//     results[0].latitude
+// In a pattern, [] matches any index:  emails[].body
+//
+// String values are unescaped (\n, \", \uXXXX -> UTF-8, ...).  A surrogate
+// pair (\ud83d\ude00, as PHP's json_encode writes emoji) becomes one 4-byte
+// character; half a pair becomes U+FFFD.  Numbers, true/false and null are
+// returned as their literal text.
+
+static const int JSON_MAX_DEPTH = 16;
+
+struct JsonValue {
+    String path;     // concrete path, e.g. "emails[2].body"
+    String value;
+    bool isString;
+};
+
+class JsonPathExtractor : public Stream {
+public:
+    std::vector<JsonValue> values;   // matched values, in document order
+
+    void want(const char *pattern) { patterns.push_back(String(pattern)); }
+    bool wantsAny() const { return !patterns.empty(); }
+
+    void reset() {
+        values.clear();
+        depth = 0;
+        state = JS_VALUE;
+        capturing = false;
+        failed = false;
+        done = false;
+        inEscape = false;
+        unicodeDigits = -1;
+        unicodeValue = 0;
+        highSurrogate = 0;      // a body cut inside \uD83D must not pair into the next
+        key = "";
+        buf = "";
+    }
+
+    bool ok() const { return done && !failed; }
+    bool hasError() const { return failed; }
+
+    // First value with this exact path, or nullptr
+    const JsonValue *find(const String &path) const {
+        for (const JsonValue &v : values) {
+            if (v.path == path) return &v;
+        }
+        return nullptr;
+    }
+
+    String get(const String &path, const String &fallback = "") const {
+        const JsonValue *v = find(path);
+        return v ? v->value : fallback;
+    }
+
+    // Feed parser ---------------------------------------------------------
+
+    void feed(char c) {
+        if (failed) return;
+        // A literal ends on the first byte that can't belong to it; that
+        // byte then needs to be handled in the state that follows.
+        if (state == JS_LITERAL) {
+            if (isLiteralChar(c)) {
+                if (capturing) buf += c;
+                return;
+            }
+            endValue(false);
+        }
+        step(c);
+    }
+
+    void feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len; i++) feed((char)data[i]);
+    }
+
+    // Flush a trailing top-level literal (e.g. a bare number body)
+    void finish() {
+        if (state == JS_LITERAL) endValue(false);
+        if (depth != 0 || state == JS_STRING || state == JS_KEY) failed = true;
+    }
+
+    // Stream interface (write side only) so HTTPClient can push into us
+    size_t write(uint8_t c) override { feed((char)c); return 1; }
+    size_t write(const uint8_t *data, size_t len) override { feed(data, len); return len; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() override {}
+
+private:
+    enum State {
+        JS_VALUE,        // expecting a value
+        JS_KEY_OR_END,   // after '{' or ',' in an object
+        JS_KEY,          // inside a key string
+        JS_COLON,        // after a key
+        JS_AFTER_VALUE,  // expecting ',' or a closing bracket
+        JS_STRING,       // inside a string value
+        JS_LITERAL       // number / true / false / null
+    };
+
+    struct Frame {
+        bool isArray;
+        int index;       // current array index
+        String key;      // current object key
+    };
+
+    std::vector<String> patterns;
+    Frame stack[JSON_MAX_DEPTH];
+    int depth = 0;
+    State state = JS_VALUE;
+    bool inEscape = false;
+    int unicodeDigits = -1;          // >= 0 while reading \uXXXX
+    uint16_t unicodeValue = 0;
+    uint16_t highSurrogate = 0;      // \uD800-\uDBFF waiting for its low half
+    bool capturing = false;          // current value's path is wanted
+    bool failed = false;
+    bool done = false;
+    String key;
+    String buf;
+
+    static bool isWhitespace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    static bool isLiteralChar(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+    }
+
+    String currentPath() const {
+        String path = "";
+        for (int i = 0; i < depth; i++) {
+            if (stack[i].isArray) {
+                path += "[";
+                path += String(stack[i].index);
+                path += "]";
+            } else {
+                if (path.length() > 0) path += ".";
+                path += stack[i].key;
+            }
+        }
+        return path;
+    }
+
+    // Does the pattern name the value at the top of the stack?  Walks the
+    // frames instead of building currentPath(), so values nobody wants cost
+    // no allocation.  "[]" in the pattern accepts any "[n]".
+    bool stackMatches(const String &pattern) const {
+        const char *p = pattern.c_str();
+        bool empty = true;             // currentPath() so far is ""
+        for (int i = 0; i < depth; i++) {
+            const Frame &f = stack[i];
+            if (f.isArray) {
+                if (*p++ != '[') return false;
+                if (*p == ']') {
+                    p++;
+                } else {
+                    if (*p < '0' || *p > '9') return false;
+                    int n = 0;
+                    while (*p >= '0' && *p <= '9') n = n * 10 + (*p++ - '0');
+                    if (*p++ != ']' || n != f.index) return false;
+                }
+                empty = false;
+            } else {
+                if (!empty && *p++ != '.') return false;
+                size_t len = f.key.length();
+                if (strncmp(p, f.key.c_str(), len) != 0) return false;
+                p += len;
+                if (len > 0) empty = false;
+            }
+        }
+        return *p == '\0';
+    }
+
+    bool wanted() const {
+        for (const String &p : patterns) {
+            if (stackMatches(p)) return true;
+        }
+        return false;
+    }
+
+    void beginValue(bool isString, char first) {
+        capturing = wanted();
+        buf = "";
+        if (isString) {
+            state = JS_STRING;
+            inEscape = false;
+            unicodeDigits = -1;
+            highSurrogate = 0;
+        } else {
+            state = JS_LITERAL;
+            if (capturing) buf += first;
+        }
+    }
+
+    void endValue(bool isString) {
+        if (capturing) {
+            JsonValue v;
+            v.path = currentPath();
+            v.value = buf;
+            v.isString = isString;
+            values.push_back(v);
+        }
+        capturing = false;
+        buf = "";
+        afterValue();
+    }
+
+    void afterValue() {
+        state = JS_AFTER_VALUE;
+        if (depth == 0) done = true;
+    }
+
+    void push(bool isArray) {
+        if (depth >= JSON_MAX_DEPTH) {
+            failed = true;
+            return;
+        }
+        stack[depth].isArray = isArray;
+        stack[depth].index = 0;
+        stack[depth].key = "";
+        depth++;
+        state = isArray ? JS_VALUE : JS_KEY_OR_END;
+    }
+
+    void pop() {
+        depth--;
+        afterValue();
+    }
+
+    void appendCodepoint(String &out, uint32_t cp) {
+        if (cp < 0x80) {
+            out += (char)cp;
+        } else if (cp < 0x800) {
+            out += (char)(0xC0 | (cp >> 6));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += (char)(0xE0 | (cp >> 12));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        } else {
+            out += (char)(0xF0 | (cp >> 18));
+            out += (char)(0x80 | ((cp >> 12) & 0x3F));
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    // A \uXXXX escape is complete: pair surrogates, replace lone halves
+    void appendEscapedUnit(String &out, uint16_t unit, bool keep) {
+        if (unit >= 0xDC00 && unit <= 0xDFFF && highSurrogate) {
+            if (keep) appendCodepoint(out, 0x10000 + ((uint32_t)(highSurrogate - 0xD800) << 10) + (unit - 0xDC00));
+            highSurrogate = 0;
+            return;
+        }
+        dropHighSurrogate(out, keep);
+        if (unit >= 0xD800 && unit <= 0xDBFF) {
+            highSurrogate = unit;
+        } else if (keep) {
+            appendCodepoint(out, (unit >= 0xDC00 && unit <= 0xDFFF) ? 0xFFFD : unit);
+        }
+    }
+
+    // Anything but a low half after a high one leaves the high one unpaired
+    void dropHighSurrogate(String &out, bool keep) {
+        if (!highSurrogate) return;
+        if (keep) appendCodepoint(out, 0xFFFD);
+        highSurrogate = 0;
+    }
+
+    // Consume one character of a string; returns true at the closing quote
+    bool stringChar(char c, String &out, bool keep) {
+        if (unicodeDigits >= 0) {
+            int v = (c >= '0' && c <= '9') ? c - '0' :
+                    (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                    (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+            if (v < 0) {
+                failed = true;
+                return false;
+            }
+            unicodeValue = (unicodeValue << 4) | v;
+            if (++unicodeDigits == 4) {
+                appendEscapedUnit(out, unicodeValue, keep);
+                unicodeDigits = -1;
+            }
+            return false;
+        }
+        if (inEscape) {
+            inEscape = false;
+            if (c != 'u') dropHighSurrogate(out, keep);
+            char decoded;
+            switch (c) {
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'u': unicodeDigits = 0; unicodeValue = 0; return false;
+                default:  decoded = c; break;   // \" \\ \/
+            }
+            if (keep) out += decoded;
+            return false;
+        }
+        if (c == '\\') {
+            inEscape = true;
+            return false;
+        }
+        dropHighSurrogate(out, keep);
+        if (c == '"') return true;
+        if (keep) out += c;
+        return false;
+    }
+
+    void step(char c) {
+        switch (state) {
+            case JS_VALUE:
+                if (isWhitespace(c)) return;
+                if (c == '{') { push(false); return; }
+                if (c == '[') { push(true); return; }
+                if (c == ']' && depth > 0 && stack[depth - 1].isArray) { pop(); return; }  // empty array
+                if (c == '"') { beginValue(true, c); return; }
+                if (isLiteralChar(c)) { beginValue(false, c); return; }
+                failed = true;
+                return;
+
+            case JS_KEY_OR_END:
+                if (isWhitespace(c)) return;
+                if (c == '}') { pop(); return; }
+                if (c == '"') {
+                    key = "";
+                    inEscape = false;
+                    unicodeDigits = -1;
+                    highSurrogate = 0;
+                    state = JS_KEY;
+                    return;
+                }
+                failed = true;
+                return;
+
+            case JS_KEY:
+                if (stringChar(c, key, true)) {
+                    stack[depth - 1].key = key;
+                    state = JS_COLON;
+                }
+                return;
+
+            case JS_COLON:
+                if (isWhitespace(c)) return;
+                if (c == ':') { state = JS_VALUE; return; }
+                failed = true;
+                return;
+
+            case JS_STRING:
+                if (stringChar(c, buf, capturing)) endValue(true);
+                return;
+
+            case JS_AFTER_VALUE:
+                if (isWhitespace(c)) return;
+                if (depth == 0) { failed = true; return; }   // trailing garbage
+                if (c == ',') {
+                    if (stack[depth - 1].isArray) {
+                        stack[depth - 1].index++;
+                        state = JS_VALUE;
+                    } else {
+                        state = JS_KEY_OR_END;
+                    }
+                    return;
+                }
+                if (c == ']' && stack[depth - 1].isArray) { pop(); return; }
+                if (c == '}' && !stack[depth - 1].isArray) { pop(); return; }
+                failed = true;
+                return;
+
+            case JS_LITERAL:
+                return;   // handled in feed()
+        }
+    }
+};
+
+// Parse a complete in-memory document (e.g. a file read from LittleFS)
+bool jsonExtract(JsonPathExtractor &json, const String &text) {
+    json.reset();
+    json.feed((const uint8_t *)text.c_str(), text.length());
+    json.finish();
+    return json.ok();
+}
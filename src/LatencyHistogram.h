@@ -0,0 +1,146 @@
+#pragma once
+#include <Arduino.h>
+
+// ============================================================
+// LATENCY HISTOGRAMS (loop and subsystem profiling)
+// ============================================================
+//
+// A LatencyHistogram keeps a distribution of durations in microseconds
+// the way HdrHistogram does: buckets are log-linear, 2^SubBits per power
+// of two, so every value is kept to within 1/8 (12.5 %) from a
+// microsecond up to half a minute in a few hundred bytes, and p50, p99
+// etc. can be read back at any time without keeping samples.  Count,
+// total and max are exact.  CoarseLatencyHistogram (4 buckets per power
+// of two, within 25 %) is half the size, for tables of many of them.
+//
+// Timing uses the CPU cycle counter (one instruction on the ESP32-C3), so
+// a probe costs a couple of reads and an add.  The counter wraps every
+// ~26 s at 160 MHz; a span longer than that is folded, which only a
+// stalled loop would ever see.  Put a probe around a block with
+//
+//     LATENCY_SCOPE(latency[LAT_COMBAT]);
+//
+// Building with -D LATENCY_PROFILING=0 turns every LATENCY_SCOPE into
+// nothing; callers keep their histograms inside #if LATENCY_PROFILING.
+
+#ifndef LATENCY_PROFILING
+#define LATENCY_PROFILING 1          // build with -D LATENCY_PROFILING=0 to compile the probes out
+#endif
+
+static const int LATENCY_MAX_BITS = 25;           // 2^25 us = 33 s; longer lands in the last bucket
+
+static uint32_t latencyCyclesPerUs = 1;
+
+// Call once at boot, after the CPU clock is set
+static inline void latencyBegin() {
+#ifdef ESP32
+    latencyCyclesPerUs = ESP.getCpuFreqMHz();
+    if (latencyCyclesPerUs == 0) latencyCyclesPerUs = 1;
+#endif
+}
+
+static inline uint32_t latencyCycles() {
+#ifdef ESP32
+    return ESP.getCycleCount();
+#else
+    return micros();
+#endif
+}
+
+template <int SubBits>
+struct BasicLatencyHistogram {
+    static const int SUB_BUCKETS = 1 << SubBits;                  // buckets per power of two
+    static const int BUCKETS = SUB_BUCKETS * (LATENCY_MAX_BITS - SubBits + 1);
+
+    uint16_t buckets[BUCKETS];           // halved together when one fills up
+    uint32_t count = 0;
+    uint64_t totalUs = 0;
+    uint32_t maxUs = 0;
+
+    BasicLatencyHistogram() { reset(); }
+
+    void reset() {
+        memset(buckets, 0, sizeof(buckets));
+        count = 0;
+        totalUs = 0;
+        maxUs = 0;
+    }
+
+    void record(uint32_t us) {
+        count++;
+        totalUs += us;
+        if (us > maxUs) maxUs = us;
+
+        int idx = bucketOf(us);
+        if (buckets[idx] == 0xFFFF) {
+            // Keep the shape, give recent samples more weight
+            for (int i = 0; i < BUCKETS; i++) buckets[i] >>= 1;
+        }
+        buckets[idx]++;
+    }
+
+    uint32_t averageUs() const { return count ? (uint32_t)(totalUs / count) : 0; }
+
+    // Smallest value that pct percent of samples are at or below (to
+    // bucket precision; never above the true max)
+    uint32_t percentile(float pct) const {
+        uint32_t total = 0;
+        for (int i = 0; i < BUCKETS; i++) total += buckets[i];
+        if (total == 0) return 0;
+
+        uint32_t wanted = (uint32_t)((pct / 100.0f) * total + 0.5f);
+        if (wanted < 1) wanted = 1;
+        uint32_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += buckets[i];
+            if (seen >= wanted) {
+                uint32_t top = bucketTop(i);
+                return top < maxUs ? top : maxUs;
+            }
+        }
+        return maxUs;
+    }
+
+    static int bucketOf(uint32_t us) {
+        if (us < (uint32_t)SUB_BUCKETS) return us;
+        int bits = 31 - __builtin_clz(us);
+        if (bits >= LATENCY_MAX_BITS) return BUCKETS - 1;
+        int shift = bits - SubBits;
+        return (shift + 1) * SUB_BUCKETS + ((us >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    // Largest value that falls in bucket idx
+    static uint32_t bucketTop(int idx) {
+        if (idx < SUB_BUCKETS) return idx;
+        int shift = idx / SUB_BUCKETS - 1;
+        uint32_t low = (uint32_t)(SUB_BUCKETS + idx % SUB_BUCKETS) << shift;
+        return low + (1u << shift) - 1;
+    }
+};
+
+typedef BasicLatencyHistogram<3> LatencyHistogram;
+typedef BasicLatencyHistogram<2> CoarseLatencyHistogram;
+
+// Records the time from construction to end of scope
+struct LatencyScope {
+    LatencyHistogram &hist;
+    uint32_t start;
+
+    explicit LatencyScope(LatencyHistogram &h) : hist(h), start(latencyCycles()) {}
+    ~LatencyScope() { hist.record((latencyCycles() - start) / latencyCyclesPerUs); }
+};
+
+#define LATENCY_CONCAT_(a, b) a##b
+#define LATENCY_CONCAT(a, b) LATENCY_CONCAT_(a, b)
+
+// LATENCY_BEGIN/LATENCY_END do the same for a stretch of code that is
+// not a block of its own
+#if LATENCY_PROFILING
+#define LATENCY_SCOPE(hist) LatencyScope LATENCY_CONCAT(latencyScope_, __LINE__)(hist)
+#define LATENCY_BEGIN(timer) uint32_t timer = latencyCycles()
+#define LATENCY_END(timer, hist) (hist).record((latencyCycles() - (timer)) / latencyCyclesPerUs)
+#else
+#define LATENCY_SCOPE(hist) do {} while (0)
+#define LATENCY_BEGIN(timer) do {} while (0)
+#define LATENCY_END(timer, hist) do {} while (0)
+#endif
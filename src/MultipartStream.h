@@ -0,0 +1,213 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+
+// ============================================================
+// STREAMING MULTIPART/FORM-DATA PARSER
+// ============================================================
+//
+// Push parser for HTTP upload bodies.  Feed it the body as it arrives, in
+// pieces of any size; part headers are parsed as they go by and part data
+// is handed to onData in MULTIPART_CHUNK-sized pieces (plus a final short
+// piece per part), so nothing larger than one chunk is ever held in RAM.
+//
+// The part delimiter is "\r\n--<boundary>".  Bytes that could be the start
+// of a delimiter are held back until the next byte decides it, so a
+// delimiter split across two feed() calls is still found.  Boundaries may
+// not contain CR or LF (RFC 2046), so after a mismatch the only place a
+// new delimiter can start is the current byte.
+//
+//     MultipartParser mp;
+//     mp.begin(boundary);
+//     mp.onPartBegin = [](const String &name, const String &filename) { ...; return true; };
+//     mp.onData      = [](const uint8_t *data, size_t len) { ...; return true; };
+//     mp.onPartEnd   = []() { ... };
+//     while (...) mp.feed(buf, n);
+//     if (!mp.finished()) { ...truncated or malformed... }
+
+static const size_t MULTIPART_CHUNK          = 1024;   // onData piece size
+static const size_t MULTIPART_MAX_HEADER_LINE = 256;
+
+class MultipartParser {
+public:
+    // Return false from onPartBegin to skip that part's data.
+    // Return false from onData to abort the whole parse.
+    std::function<bool(const String &name, const String &filename)> onPartBegin = nullptr;
+    std::function<bool(const uint8_t *data, size_t len)> onData = nullptr;
+    std::function<void()> onPartEnd = nullptr;
+
+    void begin(const String &boundary) {
+        delimiter = "\r\n--" + boundary;
+        // The first boundary may sit at the very start of the body, with
+        // no CRLF in front of it: start as if the CRLF had been seen
+        state = MP_PREAMBLE;
+        matchLen = 2;
+        outLen = 0;
+        line = "";
+        partName = "";
+        partFilename = "";
+        skipping = false;
+        failed = boundary.length() == 0;
+        bytesFed = 0;
+    }
+
+    void feed(const uint8_t *data, size_t len) {
+        for (size_t i = 0; i < len && !failed && state != MP_DONE; i++) {
+            step(data[i]);
+        }
+        bytesFed += len;
+    }
+
+    bool finished() const { return state == MP_DONE && !failed; }
+    bool hasError() const { return failed; }
+    size_t consumed() const { return bytesFed; }
+
+private:
+    enum State {
+        MP_PREAMBLE,      // before the first boundary (ignored)
+        MP_AFTER_DELIM,   // just matched a delimiter: "--" or CRLF follows
+        MP_CLOSE_DASH,    // saw the first '-' of the closing "--"
+        MP_DELIM_LF,      // saw CR after a delimiter
+        MP_HEADERS,       // part header lines
+        MP_DATA,          // part body
+        MP_DONE           // closing boundary seen; epilogue ignored
+    };
+
+    String delimiter;
+    State state = MP_DONE;
+    size_t matchLen = 0;                  // delimiter bytes matched (held back)
+    uint8_t out[MULTIPART_CHUNK];
+    size_t outLen = 0;
+    String line;
+    String partName;
+    String partFilename;
+    bool skipping = false;                // onPartBegin declined this part
+    bool failed = false;
+    size_t bytesFed = 0;
+
+    void emit(uint8_t c) {
+        if (state != MP_DATA || skipping) return;
+        out[outLen++] = c;
+        if (outLen == MULTIPART_CHUNK) flushOut();
+    }
+
+    void flushOut() {
+        if (outLen > 0 && onData && !onData(out, outLen)) failed = true;
+        outLen = 0;
+    }
+
+    // Match c against the delimiter; returns true once it is complete
+    bool matchDelimiter(uint8_t c) {
+        if (c == (uint8_t)delimiter[matchLen]) {
+            if (++matchLen == delimiter.length()) {
+                matchLen = 0;
+                return true;
+            }
+            return false;
+        }
+        // Not a delimiter after all: the held-back bytes were data
+        for (size_t i = 0; i < matchLen; i++) emit((uint8_t)delimiter[i]);
+        matchLen = 0;
+        if (c == (uint8_t)delimiter[0]) {
+            matchLen = 1;
+        } else {
+            emit(c);
+        }
+        return false;
+    }
+
+    // Pull name="..." / filename="..." out of a Content-Disposition line
+    static String headerParam(const String &header, const String &lower, const char *key) {
+        String pattern = String(key) + "=";
+        int at = -1;
+        int from = 0;
+        while ((at = lower.indexOf(pattern, from)) >= 0) {
+            // Skip "filename=" when looking for "name="
+            if (at == 0 || lower[at - 1] == ' ' || lower[at - 1] == ';') break;
+            from = at + 1;
+        }
+        if (at < 0) return "";
+        int start = at + pattern.length();
+        bool quoted = start < (int)header.length() && header[start] == '"';
+        if (quoted) start++;
+        int end = start;
+        while (end < (int)header.length()) {
+            char c = header[end];
+            if (quoted ? c == '"' : (c == ';' || c == ' ')) break;
+            end++;
+        }
+        return header.substring(start, end);
+    }
+
+    void headerLine() {
+        String lower = line;
+        lower.toLowerCase();
+        if (lower.startsWith("content-disposition:")) {
+            partName = headerParam(line, lower, "name");
+            partFilename = headerParam(line, lower, "filename");
+        }
+    }
+
+    void step(uint8_t c) {
+        switch (state) {
+            case MP_PREAMBLE:
+                if (matchDelimiter(c)) state = MP_AFTER_DELIM;
+                return;
+
+            case MP_AFTER_DELIM:
+                if (c == '-') { state = MP_CLOSE_DASH; return; }
+                if (c == '\r') { state = MP_DELIM_LF; return; }
+                if (c == ' ' || c == '\t') return;   // transport padding
+                failed = true;
+                return;
+
+            case MP_CLOSE_DASH:
+                if (c == '-') { state = MP_DONE; return; }
+                failed = true;
+                return;
+
+            case MP_DELIM_LF:
+                if (c != '\n') { failed = true; return; }
+                state = MP_HEADERS;
+                line = "";
+                partName = "";
+                partFilename = "";
+                return;
+
+            case MP_HEADERS:
+                if (c == '\n' && line.endsWith("\r")) {
+                    line.remove(line.length() - 1);
+                    if (line.length() == 0) {
+                        skipping = onPartBegin && !onPartBegin(partName, partFilename);
+                        state = MP_DATA;
+                        matchLen = 0;
+                        outLen = 0;
+                        return;
+                    }
+                    headerLine();
+                    line = "";
+                    return;
+                }
+                if (line.length() >= MULTIPART_MAX_HEADER_LINE) {
+                    failed = true;
+                    return;
+                }
+                line += (char)c;
+                return;
+
+            case MP_DATA:
+                if (matchDelimiter(c)) {
+                    if (!skipping) {
+                        flushOut();
+                        if (onPartEnd) onPartEnd();
+                    }
+                    skipping = false;
+                    state = MP_AFTER_DELIM;
+                }
+                return;
+
+            case MP_DONE:
+                return;
+        }
+    }
+};
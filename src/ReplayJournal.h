@@ -0,0 +1,334 @@
+#pragma once
+#include <Arduino.h>
+#include <LittleFS.h>
+
+// ============================================================
+// REPLAY JOURNAL (deterministic session recorder)
+// ============================================================
+//
+// Stalls that only show up mid-game cannot be chased live: the clock,
+// random() and what the players type are different on every run.  When
+// /journal.on exists at boot ("debug journal on"), everything loop() takes
+// from outside is written to /journal.bin:
+//
+//   - the seed setup() gives random() (it is seeded once per boot)
+//   - the millis() value at the top of each loop() pass, and again where
+//     loop() reads the time for paced output and the game ticks
+//   - each accepted connection, input line, dropped connection and serial
+//     command, in the pass that read it
+//   - how many tick tasks ran when the tick budget cut a pass short
+//
+// The native build replays a journal with --replay (lib/NativeShims):
+// setup() and loop() run again against a copy of the filesystem, with the
+// clock, random() and the clients all driven from the log, so the same
+// workload can be profiled or bisected on a PC.
+//
+// A pass in which the clock did not move and nothing was journaled is not
+// written; the replay folds it into the next one.  Outbound HTTP results
+// are not journaled (a replay sees every request fail).
+//
+// Passwords never reach the file: a line typed at a password prompt is
+// recorded as JOURNAL_SECRET_LINE, and during a replay journalSecret()
+// lets the password checks accept that stand-in.  A wrong password
+// therefore replays as a right one.
+//
+// Encoding: a 15-byte header ("MUDJ", version, seed, MUD port and millis()
+// at the start, little-endian) and then a byte stream.  A byte below 0x80
+// is one pass that many ms after the previous one; the other records are
+// a tag byte followed by base-128 varints.  A run of passes 1 ms apart,
+// which is what an idle server produces, is a single JR_RUN.
+
+#ifndef REPLAY_JOURNAL
+#define REPLAY_JOURNAL 1                    // build with -D REPLAY_JOURNAL=0 to leave the recorder out
+#endif
+
+#ifndef JOURNAL_MAX_BYTES
+#define JOURNAL_MAX_BYTES (512UL * 1024UL)  // recording stops here, to spare the flash
+#endif
+
+#if defined(NATIVE_BUILD)
+#include <NativeReplay.h>                   // the replay driver's clock hooks
+#endif
+
+static const char JOURNAL_PATH[]      = "/journal.bin";
+static const char JOURNAL_PREV_PATH[] = "/journal.old";   // the boot before this one
+static const char JOURNAL_FLAG_PATH[] = "/journal.on";
+
+// Journal files are never served over the network (file server, debug extract)
+inline bool isJournalFile(String name) {
+    if (!name.startsWith("/")) name = "/" + name;
+    return name == JOURNAL_PATH || name == JOURNAL_PREV_PATH || name == JOURNAL_FLAG_PATH;
+}
+static const char JOURNAL_SECRET_LINE[] = "journalmasked";  // recorded in place of a password
+static const uint8_t JOURNAL_VERSION  = 1;
+static const int JOURNAL_BUFFER_BYTES = 512;
+static const unsigned long JOURNAL_FLUSH_MS = 1000;
+
+// Record tags (lib/NativeShims/src/NativeReplay.cpp reads the same list)
+enum JournalRecord : uint8_t {
+    JR_PASS_MAX = 0x7F,     // 0x00-0x7F: one pass, that many ms after the last
+    JR_RUN = 0x80,          // n: n passes, each 1 ms after the last
+    JR_PASS,                // dt: one pass dt ms after the last
+    JR_ACCEPT,              // slot
+    JR_LINE,                // slot, length, text
+    JR_CLOSE,               // slot
+    JR_SERIAL,              // length, text
+    JR_READY,               // millis(), unix time: setup() is done
+    JR_NOW,                 // ms from the top of the pass to loop()'s "now"
+    JR_CUT,                 // tick tasks run before the budget stopped the pass
+    JR_END                  // recording stopped
+};
+
+struct ReplayJournal {
+    File file;
+    bool recording = false;
+    uint8_t *buf = nullptr;             // JOURNAL_BUFFER_BYTES, only while recording
+    int used = 0;
+    uint32_t bytes = 0;                 // flushed to the file so far
+    uint32_t passes = 0;
+    uint32_t events = 0;                // connections, lines and serial commands
+    uint32_t seed = 0;
+    unsigned long passMs = 0;           // top of the current pass
+    unsigned long writtenMs = 0;        // time of the last pass written
+    uint32_t run = 0;                   // passes 1 ms apart not written yet
+    bool passWritten = true;
+    bool keepNextPass = false;          // the tick budget left work for the next pass
+    unsigned long flushedAt = 0;
+    const char *stopReason = "";
+};
+
+static ReplayJournal journal;
+
+#if REPLAY_JOURNAL
+
+static bool journalFlush() {
+    if (journal.used == 0) return true;
+    size_t n = journal.file.write(journal.buf, journal.used);
+    journal.bytes += n;
+    journal.used = 0;
+    return n > 0;
+}
+
+static void journalPut(uint8_t b) {
+    journal.buf[journal.used++] = b;
+    if (journal.used == JOURNAL_BUFFER_BYTES) journalFlush();
+}
+
+static void journalPutVarint(uint32_t v) {
+    while (v >= 0x80) {
+        journalPut((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    journalPut((uint8_t)v);
+}
+
+static void journalPutLE(uint32_t v, int n) {
+    for (int i = 0; i < n; i++) journalPut((uint8_t)(v >> (8 * i)));
+}
+
+static void journalPutText(const String &s) {
+    journalPutVarint(s.length());
+    for (unsigned i = 0; i < s.length(); i++) journalPut((uint8_t)s[i]);
+}
+
+static void journalWriteRun() {
+    if (journal.run == 0) return;
+    if (journal.run == 1) {
+        journalPut(1);
+    } else {
+        journalPut(JR_RUN);
+        journalPutVarint(journal.run);
+    }
+    journal.run = 0;
+}
+
+static void journalWritePass(unsigned long dt) {
+    journal.passes++;
+    journal.writtenMs = journal.passMs;
+    journal.passWritten = true;
+    journal.keepNextPass = false;
+    if (dt == 1) {
+        journal.run++;
+        return;
+    }
+    journalWriteRun();
+    if (dt <= JR_PASS_MAX) {
+        journalPut((uint8_t)dt);
+    } else {
+        journalPut(JR_PASS);
+        journalPutVarint(dt);
+    }
+}
+
+// Start an event record in the current pass
+static void journalRecord(uint8_t tag) {
+    if (!journal.passWritten) journalWritePass(0);
+    journalWriteRun();
+    journalPut(tag);
+}
+
+// Stop recording; the journal stays readable up to here
+void journalEnd(const char *reason = "stopped") {
+    if (!journal.recording) return;
+    journalWriteRun();
+    journalPut(JR_END);
+    journalFlush();
+    journal.file.close();
+    free(journal.buf);
+    journal.buf = nullptr;
+    journal.recording = false;
+    journal.stopReason = reason;
+}
+
+// Called once in setup(), after random() is seeded and before anything
+// else uses it.  Records only when the flag file is present.
+void journalBegin(uint32_t seed, uint16_t port) {
+    journal.seed = seed;
+    if (!LittleFS.exists(JOURNAL_FLAG_PATH)) return;
+#if defined(NATIVE_BUILD)
+    if (nativeReplaying()) return;
+#endif
+
+    // Keep the previous boot's journal: the stall is usually in that one
+    LittleFS.remove(JOURNAL_PREV_PATH);
+    if (LittleFS.exists(JOURNAL_PATH)) LittleFS.rename(JOURNAL_PATH, JOURNAL_PREV_PATH);
+
+    journal.file = LittleFS.open(JOURNAL_PATH, "w");
+    journal.buf = (uint8_t *)malloc(JOURNAL_BUFFER_BYTES);
+    if (!journal.file || !journal.buf) {
+        if (journal.file) journal.file.close();
+        free(journal.buf);
+        journal.buf = nullptr;
+        Serial.println("[JOURNAL] Cannot open " + String(JOURNAL_PATH));
+        return;
+    }
+
+    journal.recording = true;
+    journal.used = 0;
+    journal.bytes = 0;
+    journal.passes = 0;
+    journal.events = 0;
+    journal.run = 0;
+    journal.passMs = journal.writtenMs = journal.flushedAt = millis();
+    journal.passWritten = true;
+    journal.keepNextPass = false;
+
+    journalPut('M'); journalPut('U'); journalPut('D'); journalPut('J');
+    journalPut(JOURNAL_VERSION);
+    journalPutLE(seed, 4);
+    journalPutLE(port, 2);
+    journalPutLE(journal.passMs, 4);
+    Serial.printf("[JOURNAL] Recording to %s (seed %lu)\n", JOURNAL_PATH, (unsigned long)seed);
+}
+
+// End of setup(): a replay jumps its clock to the recorded time here, so the
+// game ticks start in the same phase as they did on the device
+void journalReady() {
+#if defined(NATIVE_BUILD)
+    nativeReplayReady();
+#endif
+    if (!journal.recording) return;
+    journalPut(JR_READY);
+    journalPutVarint(millis());
+    journalPutVarint((uint32_t)time(nullptr));
+}
+
+// Top of every loop() pass
+void journalPass(unsigned long now) {
+    if (!journal.recording) return;
+    journal.passMs = now;
+    journal.passWritten = false;
+    if (now != journal.writtenMs || journal.keepNextPass) journalWritePass(now - journal.writtenMs);
+
+    if (now - journal.flushedAt >= JOURNAL_FLUSH_MS) {
+        journal.flushedAt = now;
+        bool ok = journalFlush();
+        journal.file.flush();
+        if (!ok) journalEnd("filesystem full");
+        else if (journal.bytes >= JOURNAL_MAX_BYTES) journalEnd("size limit reached");
+    }
+}
+
+// Where loop() takes "now" for paced output and the ticks; a replay puts
+// its clock forward to the recorded instant
+void journalNow(unsigned long now) {
+#if defined(NATIVE_BUILD)
+    nativeReplayNow();
+#endif
+    if (!journal.recording || now == journal.passMs) return;
+    journalRecord(JR_NOW);
+    journalPutVarint(now - journal.passMs);
+}
+
+// How many tick tasks the replayed pass may run (-1: up to the budget)
+int journalTickLimit() {
+#if defined(NATIVE_BUILD)
+    return nativeReplayTickLimit();
+#else
+    return -1;
+#endif
+}
+
+// The tick budget stopped this pass after fired tasks
+void journalTickCut(int fired) {
+    if (!journal.recording) return;
+    journalRecord(JR_CUT);
+    journalPutVarint(fired);
+    journal.keepNextPass = true;
+}
+
+void journalAccept(int slot) {
+    if (!journal.recording) return;
+    journalRecord(JR_ACCEPT);
+    journalPutVarint(slot);
+    journal.events++;
+}
+
+// secret: the line answers a password prompt and is masked
+void journalLine(int slot, const String &line, bool secret) {
+    if (!journal.recording) return;
+    journalRecord(JR_LINE);
+    journalPutVarint(slot);
+    journalPutText(secret ? String(JOURNAL_SECRET_LINE) : line);
+    journal.events++;
+}
+
+void journalClose(int slot) {
+    if (!journal.recording) return;
+    journalRecord(JR_CLOSE);
+    journalPutVarint(slot);
+    journal.events++;
+}
+
+void journalSerial(const String &line) {
+    if (!journal.recording) return;
+    journalRecord(JR_SERIAL);
+    journalPutText(line);
+    journal.events++;
+}
+
+#else
+
+inline void journalEnd(const char * = "stopped") {}
+inline void journalBegin(uint32_t seed, uint16_t) { journal.seed = seed; }
+inline void journalReady() {}
+inline void journalPass(unsigned long) {}
+inline void journalNow(unsigned long) {}
+inline int journalTickLimit() { return -1; }
+inline void journalTickCut(int) {}
+inline void journalAccept(int) {}
+inline void journalLine(int, const String &, bool) {}
+inline void journalClose(int) {}
+inline void journalSerial(const String &) {}
+
+#endif
+
+// A replay is feeding back a masked password: treat it as the right one
+inline bool journalSecret(const String &typed) {
+#if defined(NATIVE_BUILD)
+    return nativeReplaying() && typed.equalsIgnoreCase(JOURNAL_SECRET_LINE);
+#else
+    (void)typed;
+    return false;
+#endif
+}
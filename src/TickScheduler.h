@@ -0,0 +1,309 @@
+#pragma once
+#include <Arduino.h>
+
+// ============================================================
+// GAME TICK SCHEDULER (hierarchical timer wheel)
+// ============================================================
+//
+// Periodic game work (combat rounds, NPC respawn and dialog, healing, shop
+// restock, ...) registers here instead of keeping its own millis()
+// comparison in loop().  loop() services input first and then calls
+// run(now, budgetUs), which fires whatever is due and hands control back
+// once the budget is spent; the rest fires on the next call, so input is
+// never held up for longer than about one budget.
+//
+// Time is counted in TICK_MS ticks.  Tasks wait in a 4-level wheel of 64
+// slots per level (0.64 s, 41 s, 44 min and 46 h of range at 10 ms), so
+// registering, firing and re-arming a task costs the same however many
+// tasks there are; only the slot for the current tick is looked at.  A
+// task in an upper level drops down a level ("cascades") when the wheel
+// below it comes round.
+//
+// Periodic tasks are fixed-step: the next run is due one period after the
+// previous due time, not after the run finished, so they do not drift.  A
+// task that fell behind by more than a period skips the missed runs.
+//
+//     TickScheduler ticks;
+//     ticks.every("healing", 60000, tickHealing);
+//     ticks.after("reminder", 5000, tickReminder);   // one-shot
+//     ...
+//     ticks.run(millis(), 20000);                    // in loop()
+
+static const int      TICK_MAX_TASKS   = 24;
+static const uint32_t TICK_MS          = 10;
+static const int      TICK_WHEEL_BITS  = 6;
+static const int      TICK_WHEEL_SLOTS = 1 << TICK_WHEEL_BITS;
+static const int      TICK_WHEEL_LEVELS = 4;
+
+typedef void (*TickFn)(unsigned long now);
+typedef void (*TickObserver)(int id, uint32_t us);   // told how long each run took
+
+struct TickTask {
+    const char *name = nullptr;
+    TickFn fn = nullptr;
+    uint32_t periodTicks = 0;       // 0 = one-shot
+    uint32_t dueTick = 0;
+    bool active = false;
+    bool queued = false;            // in a wheel slot or the ready list
+    int8_t next = -1;               // next task in the same slot / ready list
+
+    // Stats
+    uint32_t runs = 0;
+    uint32_t skipped = 0;           // periodic runs dropped after falling behind
+    uint64_t totalUs = 0;
+    uint32_t maxUs = 0;
+    uint32_t lastUs = 0;
+    uint32_t maxLateMs = 0;         // how long past its due time a run started
+};
+
+class TickScheduler {
+public:
+    TickScheduler() { reset(0); }
+
+    // Forget every task and start counting at now
+    void reset(unsigned long now) {
+        for (int i = 0; i < TICK_MAX_TASKS; i++) tasks[i] = TickTask();
+        for (int l = 0; l < TICK_WHEEL_LEVELS; l++)
+            for (int s = 0; s < TICK_WHEEL_SLOTS; s++) heads[l][s] = -1;
+        readyHead = readyTail = -1;
+        currentTick = 0;
+        lastMs = now;
+        deferredRuns = 0;
+        budgetOverruns = 0;
+    }
+
+    // Run fn every periodMs, first after firstDelayMs (default one period).
+    // Returns the task id, or -1 when every slot is taken.
+    int every(const char *name, unsigned long periodMs, TickFn fn, long firstDelayMs = -1) {
+        uint32_t period = msToTicks(periodMs);
+        if (period == 0) period = 1;
+        return add(name, fn, period, firstDelayMs < 0 ? periodMs : (unsigned long)firstDelayMs);
+    }
+
+    // Run fn once, delayMs from now
+    int after(const char *name, unsigned long delayMs, TickFn fn) {
+        return add(name, fn, 0, delayMs);
+    }
+
+    void cancel(int id) {
+        if (!valid(id)) return;
+        unlink(id);
+        tasks[id].active = false;
+    }
+
+    // Move a task's next run to delayMs from now
+    void reschedule(int id, unsigned long delayMs) {
+        if (!valid(id)) return;
+        unlink(id);
+        tasks[id].dueTick = tickAfter(delayMs);
+        insert(id);
+    }
+
+    // Fire due tasks until budgetUs is spent, or maxRuns have run when
+    // maxRuns > 0 (a replay repeating a recorded budget cut).  At least one
+    // task runs per call, so the ready list always drains even when one task
+    // alone takes longer than the budget.  Returns the number of runs.
+    int run(unsigned long now, uint32_t budgetUs, int maxRuns = -1) {
+        uint32_t started = micros();
+        int fired = 0;
+
+        // Advance the wheel to now; due tasks move to the ready list
+        while ((int32_t)(now - lastMs) >= 0) {
+            advance();
+            lastMs += TICK_MS;
+        }
+
+        bool first = true;
+        while (readyHead >= 0) {
+            if (!first && (maxRuns > 0 ? fired >= maxRuns : (uint32_t)(micros() - started) >= budgetUs)) {
+                budgetOverruns++;
+                for (int id = readyHead; id >= 0; id = tasks[id].next) deferredRuns++;
+                return fired;
+            }
+            first = false;
+
+            int id = readyHead;
+            readyHead = tasks[id].next;
+            if (readyHead < 0) readyTail = -1;
+            tasks[id].next = -1;
+            tasks[id].queued = false;
+            fire(id, now);
+            fired++;
+        }
+        return fired;
+    }
+
+    // Due runs left over by the last run() call
+    bool pending() const { return readyHead >= 0; }
+
+    // Called after every run, e.g. to feed a latency histogram
+    void setObserver(TickObserver fn) { observer = fn; }
+
+    // Stats
+    int capacity() const { return TICK_MAX_TASKS; }
+    const TickTask &task(int id) const { return tasks[id]; }
+    uint32_t deferred() const { return deferredRuns; }
+    uint32_t overruns() const { return budgetOverruns; }
+
+private:
+    TickTask tasks[TICK_MAX_TASKS];
+    int8_t heads[TICK_WHEEL_LEVELS][TICK_WHEEL_SLOTS];
+    int8_t readyHead = -1;
+    int8_t readyTail = -1;
+    uint32_t currentTick = 0;       // next tick to be processed
+    unsigned long lastMs = 0;       // millis() at which currentTick falls due
+    uint32_t deferredRuns = 0;      // due runs pushed to a later call by the budget
+    uint32_t budgetOverruns = 0;
+    TickObserver observer = nullptr;
+
+    static uint32_t msToTicks(unsigned long ms) { return (ms + TICK_MS - 1) / TICK_MS; }
+
+    bool valid(int id) const { return id >= 0 && id < TICK_MAX_TASKS && tasks[id].active; }
+
+    // First tick at or after millis() + delayMs
+    uint32_t tickAfter(unsigned long delayMs) const {
+        int32_t ahead = (int32_t)(millis() + delayMs - lastMs);
+        if (ahead <= 0) return currentTick - 1;
+        return currentTick + msToTicks((unsigned long)ahead);
+    }
+
+    int add(const char *name, TickFn fn, uint32_t periodTicks, unsigned long delayMs) {
+        for (int id = 0; id < TICK_MAX_TASKS; id++) {
+            if (tasks[id].active) continue;
+            tasks[id] = TickTask();
+            tasks[id].name = name;
+            tasks[id].fn = fn;
+            tasks[id].periodTicks = periodTicks;
+            tasks[id].dueTick = tickAfter(delayMs);
+            tasks[id].active = true;
+            insert(id);
+            return id;
+        }
+        return -1;
+    }
+
+    // Level and slot for a task due at dueTick
+    void insert(int id) {
+        TickTask &t = tasks[id];
+        int32_t delta = (int32_t)(t.dueTick - currentTick);
+        if (delta <= 0) {
+            pushReady(id);
+            return;
+        }
+
+        int level = 0;
+        uint32_t due = t.dueTick;
+        while (level < TICK_WHEEL_LEVELS - 1 &&
+               (uint32_t)delta >= (1u << (TICK_WHEEL_BITS * (level + 1)))) {
+            level++;
+        }
+        if (level == TICK_WHEEL_LEVELS - 1 &&
+            (uint32_t)delta >= (1u << (TICK_WHEEL_BITS * TICK_WHEEL_LEVELS))) {
+            // Beyond the top level: park in its last slot and re-check on cascade
+            due = currentTick + (1u << (TICK_WHEEL_BITS * TICK_WHEEL_LEVELS)) - 1;
+        }
+        int slot = (due >> (TICK_WHEEL_BITS * level)) & (TICK_WHEEL_SLOTS - 1);
+        t.next = heads[level][slot];
+        heads[level][slot] = id;
+        t.queued = true;
+    }
+
+    void pushReady(int id) {
+        TickTask &t = tasks[id];
+        t.next = -1;
+        t.queued = true;
+        if (readyTail >= 0) tasks[readyTail].next = id;
+        else readyHead = id;
+        readyTail = id;
+    }
+
+    // Take a task off whichever list holds it
+    void unlink(int id) {
+        if (!tasks[id].queued) return;
+        auto removeFrom = [&](int8_t &head, int8_t *tail) {
+            int8_t prev = -1;
+            for (int8_t *link = &head; *link >= 0; link = &tasks[*link].next) {
+                if (*link == id) {
+                    *link = tasks[id].next;
+                    if (tail && *tail == id) *tail = prev;
+                    return true;
+                }
+                prev = *link;
+            }
+            return false;
+        };
+        bool found = removeFrom(readyHead, &readyTail);
+        for (int l = 0; l < TICK_WHEEL_LEVELS && !found; l++)
+            for (int s = 0; s < TICK_WHEEL_SLOTS && !found; s++)
+                found = removeFrom(heads[l][s], nullptr);
+        tasks[id].next = -1;
+        tasks[id].queued = false;
+    }
+
+    // Process one tick: cascade upper levels when the level below wraps,
+    // then move this tick's slot to the ready list
+    void advance() {
+        for (int level = 1; level < TICK_WHEEL_LEVELS; level++) {
+            uint32_t lowerBits = TICK_WHEEL_BITS * level;
+            if (currentTick & ((1u << lowerBits) - 1)) break;
+            int slot = (currentTick >> lowerBits) & (TICK_WHEEL_SLOTS - 1);
+            int id = heads[level][slot];
+            heads[level][slot] = -1;
+            while (id >= 0) {
+                int next = tasks[id].next;
+                tasks[id].queued = false;
+                insert(id);
+                id = next;
+            }
+        }
+
+        int slot = currentTick & (TICK_WHEEL_SLOTS - 1);
+        int id = heads[0][slot];
+        heads[0][slot] = -1;
+        while (id >= 0) {
+            int next = tasks[id].next;
+            tasks[id].queued = false;
+            if (tasks[id].dueTick == currentTick) pushReady(id);
+            else insert(id);        // due a wheel turn later (parked task)
+            id = next;
+        }
+        currentTick++;
+    }
+
+    void fire(int id, unsigned long now) {
+        TickTask &t = tasks[id];
+        uint32_t dueTick = t.dueTick;
+
+        // lastMs is the time of currentTick, so the due tick was
+        // (currentTick - dueTick) ticks before it
+        int32_t lateMs = (int32_t)(now - lastMs) +
+                         (int32_t)(currentTick - dueTick) * (int32_t)TICK_MS;
+        if (lateMs > (int32_t)t.maxLateMs) t.maxLateMs = lateMs;
+
+        uint32_t start = micros();
+        t.fn(now);
+        uint32_t us = micros() - start;
+
+        t.runs++;
+        t.lastUs = us;
+        t.totalUs += us;
+        if (us > t.maxUs) t.maxUs = us;
+        if (observer) observer(id, us);
+
+        // The callback may have cancelled or rescheduled its own task
+        if (!t.active || t.queued || t.dueTick != dueTick) return;
+
+        if (t.periodTicks == 0) {
+            t.active = false;
+            return;
+        }
+
+        uint32_t nextDue = dueTick + t.periodTicks;
+        while ((int32_t)(nextDue - currentTick) < 0) {
+            nextDue += t.periodTicks;
+            t.skipped++;
+        }
+        t.dueTick = nextDue;
+        insert(id);
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <Arduino.h>
 #include <LittleFS.h>
+#include <vector>
 
 // ============================================================
 // YMODEM CONSTANTS
@@ -16,37 +17,129 @@ static const uint8_t CRC_CHAR = 'C';
 
 static const uint32_t YMODEM_BYTE_TIMEOUT_MS = 3000;
 static const uint8_t  YMODEM_MAX_RETRIES     = 10;
+static const uint16_t YMODEM_WRITE_CHUNK     = 4096;   // file data is written to flash in chunks this size
+
+// Uploads are staged as "/<name>.part" and only swapped in, all together,
+// once the whole batch has arrived and validated
+static const char *YMODEM_PART_SUFFIX    = ".part";
+static const char *YMODEM_COMMIT_JOURNAL = "/ymodem_commit.txt";
+static const char *YMODEM_MANIFEST_NAME  = "manifest.crc";   // optional "name size crc32" list sent with the batch
 
 // ============================================================
 // Logging helper
 // ============================================================
+//
+// Log lines go to a RAM ring during the transfer and are written to
+// /ymodem_debug.txt once, when the session ends.  Opening and appending to
+// the file for every block used to cost more than receiving the block.
+// If the ring wraps, the oldest lines are dropped and the tail is kept.
+
+static const uint16_t YMODEM_LOG_RING_SIZE = 8192;
+
+static char     ymodemLogRing[YMODEM_LOG_RING_SIZE];
+static uint16_t ymodemLogHead = 0;         // next write position
+static bool     ymodemLogWrapped = false;
 
 void ymodemLog(const String &msg) {
-    File f = LittleFS.open("/ymodem_debug.txt", "a");
+    const char *text = msg.c_str();
+    uint16_t len = msg.length();
+    for (uint16_t i = 0; i <= len; i++) {
+        ymodemLogRing[ymodemLogHead++] = (i < len) ? text[i] : '\n';
+        if (ymodemLogHead >= YMODEM_LOG_RING_SIZE) {
+            ymodemLogHead = 0;
+            ymodemLogWrapped = true;
+        }
+    }
+}
+
+// Write the ring to /ymodem_debug.txt (oldest first) and empty it
+void ymodemLogFlush() {
+    File f = LittleFS.open("/ymodem_debug.txt", "w");
     if (f) {
-        f.println(msg);
+        if (ymodemLogWrapped) {
+            // Skip the partial line the write head landed in
+            uint16_t from = ymodemLogHead;
+            while (from < YMODEM_LOG_RING_SIZE && ymodemLogRing[from] != '\n') from++;
+            f.println("... (earlier log lines dropped)");
+            if (from + 1 < YMODEM_LOG_RING_SIZE) {
+                f.write((const uint8_t *)ymodemLogRing + from + 1, YMODEM_LOG_RING_SIZE - from - 1);
+            }
+        }
+        f.write((const uint8_t *)ymodemLogRing, ymodemLogHead);
         f.close();
     }
+    ymodemLogHead = 0;
+    ymodemLogWrapped = false;
 }
 
 // ============================================================
-// CRC16
+// CRC16 (XMODEM/CCITT, poly 0x1021, init 0)
 // ============================================================
 
+static const uint16_t YMODEM_CRC16_TABLE[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
 uint16_t ymodem_crc16(const uint8_t *data, uint16_t len) {
     uint16_t crc = 0;
     while (len--) {
-        crc ^= (uint16_t)(*data++) << 8;
-        for (int i = 0; i < 8; i++) {
-            if (crc & 0x8000) crc = (crc << 1) ^ 0x1021;
-            else              crc = (crc << 1);
-        }
+        crc = (crc << 8) ^ YMODEM_CRC16_TABLE[(uint8_t)(crc >> 8) ^ *data++];
     }
     return crc;
 }
 
 // ============================================================
-// Read byte with timeout
+// CRC32 (IEEE, same as zip / zlib.crc32) for whole staged files
+// ============================================================
+
+static const uint32_t YMODEM_CRC32_NIBBLES[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t ymodem_crc32Update(uint32_t crc, const uint8_t *data, size_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ YMODEM_CRC32_NIBBLES[crc & 0x0F];
+        crc = (crc >> 4) ^ YMODEM_CRC32_NIBBLES[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+// ============================================================
+// Read with timeout
 // ============================================================
 
 bool ymodem_readByte(uint8_t &out, uint32_t timeoutMs) {
@@ -61,6 +154,68 @@ bool ymodem_readByte(uint8_t &out, uint32_t timeoutMs) {
     return false;
 }
 
+// Read exactly len bytes, taking whatever the driver has buffered in one
+// call.  timeoutMs applies to each gap in the stream, not to the whole read.
+bool ymodem_readBytes(uint8_t *buf, uint16_t len, uint32_t timeoutMs) {
+    uint16_t got = 0;
+    uint32_t lastData = millis();
+    while (got < len) {
+        int avail = Serial.available();
+        if (avail > 0) {
+            uint16_t want = len - got;
+            if (avail < (int)want) want = (uint16_t)avail;
+            got += Serial.readBytes(buf + got, want);
+            lastData = millis();
+        } else if (millis() - lastData >= timeoutMs) {
+            return false;
+        } else {
+            delay(1);
+        }
+    }
+    return true;
+}
+
+// Read the rest of an SOH/STX block (block number, complement, data and
+// CRC) once its first byte has been seen, and verify the CRC
+bool ymodem_readBlockBody(uint8_t &blockNum,
+                          uint8_t &blockNumInv,
+                          uint8_t *data,
+                          uint16_t dataLen)
+{
+    uint8_t header[2];
+    if (!ymodem_readBytes(header, 2, YMODEM_BYTE_TIMEOUT_MS)) {
+        ymodemLog("readBlock: timeout reading blockNum");
+        return false;
+    }
+    blockNum = header[0];
+    blockNumInv = header[1];
+
+    ymodemLog(String("readBlock: blkNum=") + String(blockNum) +
+              " blkNumInv=" + String(blockNumInv) +
+              " dataLen=" + String(dataLen));
+
+    if (!ymodem_readBytes(data, dataLen, YMODEM_BYTE_TIMEOUT_MS)) {
+        ymodemLog("readBlock: timeout reading data");
+        return false;
+    }
+
+    uint8_t crcBytes[2];
+    if (!ymodem_readBytes(crcBytes, 2, YMODEM_BYTE_TIMEOUT_MS)) {
+        ymodemLog("readBlock: timeout reading crc");
+        return false;
+    }
+
+    uint16_t crcRecv = ((uint16_t)crcBytes[0] << 8) | crcBytes[1];
+    uint16_t crcCalc = ymodem_crc16(data, dataLen);
+
+    if (crcRecv != crcCalc) {
+        ymodemLog(String("readBlock: CRC mismatch recv=0x") +
+                  String(crcRecv, HEX) + " calc=0x" + String(crcCalc, HEX));
+        return false;
+    }
+    return true;
+}
+
 // ============================================================
 // Read block
 // ============================================================
@@ -108,42 +263,7 @@ bool ymodem_readBlock(uint8_t &blockType,
         return false;
     }
 
-    if (!ymodem_readByte(blockNum, YMODEM_BYTE_TIMEOUT_MS)) {
-        ymodemLog("readBlock: timeout reading blockNum");
-        return false;
-    }
-    if (!ymodem_readByte(blockNumInv, YMODEM_BYTE_TIMEOUT_MS)) {
-        ymodemLog("readBlock: timeout reading blockNumInv");
-        return false;
-    }
-
-    ymodemLog(String("readBlock: blkNum=") + String(blockNum) +
-              " blkNumInv=" + String(blockNumInv) +
-              " dataLen=" + String(dataLen));
-
-    for (uint16_t i = 0; i < dataLen; i++) {
-        if (!ymodem_readByte(data[i], YMODEM_BYTE_TIMEOUT_MS)) {
-            ymodemLog("readBlock: timeout reading data");
-            return false;
-        }
-    }
-
-    uint8_t crcHi, crcLo;
-    if (!ymodem_readByte(crcHi, YMODEM_BYTE_TIMEOUT_MS)) {
-        ymodemLog("readBlock: timeout reading crcHi");
-        return false;
-    }
-    if (!ymodem_readByte(crcLo, YMODEM_BYTE_TIMEOUT_MS)) {
-        ymodemLog("readBlock: timeout reading crcLo");
-        return false;
-    }
-
-    uint16_t crcRecv = ((uint16_t)crcHi << 8) | crcLo;
-    uint16_t crcCalc = ymodem_crc16(data, dataLen);
-
-    if (crcRecv != crcCalc) {
-        ymodemLog(String("readBlock: CRC mismatch recv=0x") +
-                  String(crcRecv, HEX) + " calc=0x" + String(crcCalc, HEX));
+    if (!ymodem_readBlockBody(blockNum, blockNumInv, data, dataLen)) {
         return false;
     }
 
@@ -197,11 +317,101 @@ bool ymodem_parseHeader(const uint8_t *data,
 // Receive file
 // ============================================================
 
+// Received data is collected here and written to flash a whole chunk at a
+// time rather than one 128/1024-byte block per write call
+static uint8_t  ymodemWriteBuf[YMODEM_WRITE_CHUNK];
+static uint16_t ymodemWriteLen = 0;
+static uint8_t  ymodemCompareBuf[1024];
+
+static void ymodem_flushWrites(File &f) {
+    if (ymodemWriteLen > 0) {
+        f.write(ymodemWriteBuf, ymodemWriteLen);
+        ymodemWriteLen = 0;
+    }
+}
+
+static void ymodem_bufferWrite(File &f, const uint8_t *data, uint16_t len) {
+    while (len > 0) {
+        uint16_t room = YMODEM_WRITE_CHUNK - ymodemWriteLen;
+        uint16_t n = (len < room) ? len : room;
+        memcpy(ymodemWriteBuf + ymodemWriteLen, data, n);
+        ymodemWriteLen += n;
+        data += n;
+        len -= n;
+        if (ymodemWriteLen == YMODEM_WRITE_CHUNK) ymodem_flushWrites(f);
+    }
+}
+
+// Store one block at file offset `offset`.  Inside the prefix left by an
+// interrupted upload the block is compared with what is already on flash
+// and only rewritten if it differs; past it, data is appended.
+static void ymodem_stageBlock(File &f, uint32_t offset, uint32_t staged,
+                              const uint8_t *data, uint16_t len, uint32_t &reused)
+{
+    if (offset + len <= staged) {
+        if (f.read(ymodemCompareBuf, len) == len && memcmp(ymodemCompareBuf, data, len) == 0) {
+            reused += len;
+            return;
+        }
+        f.seek(offset);
+        f.write(data, len);
+        return;
+    }
+    if (offset < staged) {
+        f.seek(offset);   // block straddles the end of the staged data
+    }
+    ymodem_bufferWrite(f, data, len);
+}
+
+String ymodem_partPath(const String &filename) {
+    return "/" + filename + YMODEM_PART_SUFFIX;
+}
+
+// Size and CRC32 of a file on LittleFS
+bool ymodem_fileCrc32(const String &path, uint32_t &outSize, uint32_t &outCrc) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return false;
+    outSize = 0;
+    outCrc = 0;
+    int n;
+    while ((n = f.read(ymodemWriteBuf, YMODEM_WRITE_CHUNK)) > 0) {
+        outCrc = ymodem_crc32Update(outCrc, ymodemWriteBuf, n);
+        outSize += n;
+    }
+    f.close();
+    return true;
+}
+
+// Files received and validated in the current session
+struct YmodemStagedFile {
+    String name;
+    uint32_t size;
+    uint32_t crc32;
+};
+
+static std::vector<YmodemStagedFile> ymodemBatch;
+
 bool ymodem_receiveFile(const String &filename, uint32_t expectedSize) {
     ymodemLog("Receiving file: " + filename +
               " expectedSize=" + String(expectedSize));
 
-    File f = LittleFS.open("/" + filename, "w");
+    // A staged copy left by an interrupted upload of the same size is
+    // reopened so the blocks already on flash don't have to be rewritten
+    String partPath = ymodem_partPath(filename);
+    uint32_t staged = 0;
+    File f;
+    if (expectedSize > 0 && LittleFS.exists(partPath)) {
+        f = LittleFS.open(partPath, "r+");
+        if (f && f.size() > 0 && f.size() <= expectedSize) {
+            staged = f.size();
+            ymodemLog("Resuming " + partPath + " staged=" + String(staged));
+        } else if (f) {
+            f.close();
+        }
+    }
+    if (staged == 0) {
+        f = LittleFS.open(partPath, "w");
+    }
     if (!f) {
         ymodemLog("Failed to open file");
         return false;
@@ -209,6 +419,9 @@ bool ymodem_receiveFile(const String &filename, uint32_t expectedSize) {
 
     uint8_t dataBuf[1024];
     uint32_t received = 0;
+    uint32_t reused = 0;
+    uint32_t startedAt = millis();
+    ymodemWriteLen = 0;
     uint8_t expectedBlockNum = 1;
     uint8_t retries = 0;
 
@@ -220,7 +433,8 @@ bool ymodem_receiveFile(const String &filename, uint32_t expectedSize) {
             retries++;
             ymodemLog(String("receiveFile: readBlock failed, retries=") + String(retries));
             if (retries > YMODEM_MAX_RETRIES) {
-                ymodemLog("Too many errors, aborting file");
+                ymodemLog("Too many errors, aborting file (staged copy kept for resume)");
+                ymodem_flushWrites(f);
                 f.close();
                 return false;
             }
@@ -239,6 +453,7 @@ bool ymodem_receiveFile(const String &filename, uint32_t expectedSize) {
 
         if (blockType == CAN) {
             ymodemLog("Cancelled by sender (CAN)");
+            ymodem_flushWrites(f);
             f.close();
             return false;
         }
@@ -255,7 +470,7 @@ bool ymodem_receiveFile(const String &filename, uint32_t expectedSize) {
                 toWrite = expectedSize - received;
             }
             if (toWrite > 0) {
-                f.write(dataBuf, toWrite);
+                ymodem_stageBlock(f, received, staged, dataBuf, toWrite, reused);
                 received += toWrite;
             }
             expectedBlockNum++;
@@ -273,26 +488,196 @@ bool ymodem_receiveFile(const String &filename, uint32_t expectedSize) {
         }
     }
 
+    ymodem_flushWrites(f);
     f.flush();
     f.close();
-    ymodemLog("File complete: " + filename +
-              " finalSize=" + String(received));
+
+    // Validate the staged copy before it can join the batch
+    uint32_t stagedSize = 0, crc = 0;
+    if (!ymodem_fileCrc32(partPath, stagedSize, crc) ||
+        stagedSize != received || (expectedSize > 0 && received != expectedSize)) {
+        ymodemLog("File rejected: " + filename + " received=" + String(received) +
+                  " onFlash=" + String(stagedSize) + " expected=" + String(expectedSize));
+        LittleFS.remove(partPath);
+        return false;
+    }
+
+    YmodemStagedFile entry;
+    entry.name = filename;
+    entry.size = received;
+    entry.crc32 = crc;
+    ymodemBatch.push_back(entry);
+
+    uint32_t elapsed = millis() - startedAt;
+    uint32_t kbPerSec = elapsed ? (uint32_t)((uint64_t)received * 1000 / elapsed / 1024) : 0;
+    ymodemLog("File staged: " + filename +
+              " finalSize=" + String(received) +
+              " crc32=" + String(crc, HEX) +
+              " reused=" + String(reused) +
+              " in " + String(elapsed) + "ms (" +
+              String(kbPerSec) + " KB/s)");
     return true;
 }
 
+// ============================================================
+// Commit staged batch
+// ============================================================
+
+// Check the batch against manifest.crc, if the sender included one.
+// Every listed file must have arrived with the listed size and CRC32.
+static bool ymodem_checkManifest() {
+    bool haveManifest = false;
+    for (const YmodemStagedFile &sf : ymodemBatch) {
+        if (sf.name == YMODEM_MANIFEST_NAME) haveManifest = true;
+    }
+    if (!haveManifest) {
+        ymodemLog("Commit: no manifest, files validated by size only");
+        return true;
+    }
+
+    File m = LittleFS.open(ymodem_partPath(YMODEM_MANIFEST_NAME), "r");
+    if (!m) return false;
+
+    bool ok = true;
+    while (m.available()) {
+        String line = m.readStringUntil('\n');
+        line.trim();
+        if (line.length() == 0 || line.startsWith("#")) continue;
+
+        int s1 = line.indexOf(' ');
+        int s2 = (s1 < 0) ? -1 : line.indexOf(' ', s1 + 1);
+        if (s2 < 0) {
+            ymodemLog("Commit: bad manifest line '" + line + "'");
+            ok = false;
+            continue;
+        }
+        String name = line.substring(0, s1);
+        uint32_t size = (uint32_t)line.substring(s1 + 1, s2).toInt();
+        uint32_t crc = (uint32_t)strtoul(line.substring(s2 + 1).c_str(), nullptr, 16);
+
+        const YmodemStagedFile *found = nullptr;
+        for (const YmodemStagedFile &sf : ymodemBatch) {
+            if (sf.name == name) found = &sf;
+        }
+        if (!found) {
+            ymodemLog("Commit: " + name + " listed in manifest but not received");
+            ok = false;
+        } else if (found->size != size || found->crc32 != crc) {
+            ymodemLog("Commit: " + name + " does not match manifest (size " + String(found->size) +
+                      " crc32 " + String(found->crc32, HEX) + ")");
+            LittleFS.remove(ymodem_partPath(name));   // bad data - don't resume from it
+            ok = false;
+        }
+    }
+    m.close();
+    return ok;
+}
+
+// Swap in every file named in a commit journal ("/<name><suffix>" over
+// "/<name>"), then drop the room indexes if rooms.txt changed.  Safe to
+// repeat after a reset part way.  Returns false if a file could not be
+// moved into place; the journal is then kept so the next boot retries.
+// The port-8080 file server commits its uploads through here as well.
+bool stagedApplyJournal(const char *journalPath, const char *suffix) {
+    File j = LittleFS.open(journalPath, "r");
+    if (!j) return true;
+
+    bool ok = true;
+    bool roomsChanged = false;
+    while (j.available()) {
+        String name = j.readStringUntil('\n');
+        name.trim();
+        if (name.length() == 0) continue;
+
+        String livePath = "/" + name;
+        String stagedPath = livePath + suffix;
+        if (LittleFS.exists(stagedPath)) {
+            // Rename over the live file; where that isn't allowed, remove it
+            // first (the journal covers the gap)
+            if (!LittleFS.rename(stagedPath, livePath)) {
+                LittleFS.remove(livePath);
+                if (!LittleFS.rename(stagedPath, livePath)) {
+                    Serial.println("[COMMIT] Could not move " + stagedPath + " into place");
+                    ok = false;
+                    continue;
+                }
+            }
+        }
+        if (name == "rooms.txt") roomsChanged = true;
+    }
+    j.close();
+
+    if (roomsChanged) {
+        LittleFS.remove("/rooms.idx");
+        LittleFS.remove("/rooms.bin");
+    }
+    if (ok) LittleFS.remove(journalPath);
+    return ok;
+}
+
+// Write the list of staged files to swap in, then swap them.  The journal
+// is written under a temporary name and renamed into place, so a reset can
+// never leave a half-written file list.
+bool stagedCommit(const char *journalPath, const char *suffix, const std::vector<String> &names) {
+    String tmpJournal = String(journalPath) + ".tmp";
+    File j = LittleFS.open(tmpJournal, "w");
+    if (!j) return false;
+    for (const String &name : names) j.println(name);
+    j.close();
+    LittleFS.remove(journalPath);
+    if (!LittleFS.rename(tmpJournal, journalPath)) {
+        LittleFS.remove(tmpJournal);
+        return false;
+    }
+    return stagedApplyJournal(journalPath, suffix);
+}
+
+// All files of the session are staged: validate and swap them in together
+bool ymodem_commitBatch() {
+    if (ymodemBatch.empty()) {
+        ymodemLog("Commit: nothing staged");
+        return true;
+    }
+    if (!ymodem_checkManifest()) {
+        ymodemLog("Commit: batch rejected, live files untouched");
+        return false;
+    }
+
+    std::vector<String> names;
+    for (const YmodemStagedFile &sf : ymodemBatch) {
+        if (sf.name != YMODEM_MANIFEST_NAME) names.push_back(sf.name);
+    }
+    if (!stagedCommit(YMODEM_COMMIT_JOURNAL, YMODEM_PART_SUFFIX, names)) {
+        ymodemLog("Commit: swap did not complete; a journal left behind is finished at the next boot");
+        return false;
+    }
+    LittleFS.remove(ymodem_partPath(YMODEM_MANIFEST_NAME));
+
+    ymodemLog("Commit: " + String(names.size()) + " file(s) swapped in");
+    return true;
+}
+
+// Finish a commit that a reset interrupted.  Call at boot, after
+// LittleFS is mounted and before the world files are read.
+void ymodem_recoverCommit() {
+    if (!LittleFS.exists(YMODEM_COMMIT_JOURNAL)) return;
+    Serial.println("[YMODEM] Completing interrupted upload commit");
+    stagedApplyJournal(YMODEM_COMMIT_JOURNAL, YMODEM_PART_SUFFIX);
+}
+
 // ============================================================
 // Receive session
 // ============================================================
 
-bool ymodem_receiveSession(uint32_t startTimeoutMs) {
+static bool ymodem_runSession(uint32_t startTimeoutMs) {
     // Ensure USB-CDC (Serial) is ready before starting YMODEM
     while (!Serial) {
         delay(10);
     }
     delay(300);
 
-    LittleFS.remove("/ymodem_debug.txt");
     ymodemLog("Session start, timeoutMs=" + String(startTimeoutMs));
+    ymodemBatch.clear();
 
     uint32_t start = millis();
     uint8_t dataBuf[1024];
@@ -316,41 +701,8 @@ bool ymodem_receiveSession(uint32_t startTimeoutMs) {
                           (blockType == SOH ? "SOH" : "STX") +
                           " dataLen=" + String(dataLen));
 
-                if (!ymodem_readByte(blkNum, YMODEM_BYTE_TIMEOUT_MS)) {
-                    ymodemLog("Session: timeout reading header blkNum");
-                    return false;
-                }
-                if (!ymodem_readByte(blkNumInv, YMODEM_BYTE_TIMEOUT_MS)) {
-                    ymodemLog("Session: timeout reading header blkNumInv");
-                    return false;
-                }
-
-                ymodemLog(String("Session: header blkNum=") + String(blkNum) +
-                          " blkNumInv=" + String(blkNumInv));
-
-                for (uint16_t i = 0; i < dataLen; i++) {
-                    if (!ymodem_readByte(dataBuf[i], YMODEM_BYTE_TIMEOUT_MS)) {
-                        ymodemLog("Session: timeout reading header data");
-                        return false;
-                    }
-                }
-
-                uint8_t crcHi, crcLo;
-                if (!ymodem_readByte(crcHi, YMODEM_BYTE_TIMEOUT_MS)) {
-                    ymodemLog("Session: timeout reading header crcHi");
-                    return false;
-                }
-                if (!ymodem_readByte(crcLo, YMODEM_BYTE_TIMEOUT_MS)) {
-                    ymodemLog("Session: timeout reading header crcLo");
-                    return false;
-                }
-
-                uint16_t crcRecv = ((uint16_t)crcHi << 8) | crcLo;
-                uint16_t crcCalc = ymodem_crc16(dataBuf, dataLen);
-
-                if (crcRecv != crcCalc) {
-                    ymodemLog(String("Header CRC mismatch recv=0x") +
-                              String(crcRecv, HEX) + " calc=0x" + String(crcCalc, HEX));
+                if (!ymodem_readBlockBody(blkNum, blkNumInv, dataBuf, dataLen)) {
+                    ymodemLog("Session: bad header block");
                     Serial.write(NAK);
                     return false;
                 }
@@ -366,7 +718,7 @@ bool ymodem_receiveSession(uint32_t startTimeoutMs) {
                 if (filename.length() == 0) {
                     Serial.write(ACK);
                     ymodemLog("End of session header received (empty filename)");
-                    return true;
+                    return ymodem_commitBatch();
                 }
 
                 Serial.write(ACK);
@@ -375,7 +727,7 @@ bool ymodem_receiveSession(uint32_t startTimeoutMs) {
                           "' size=" + String(filesize) + " sent ACK+'C'");
 
                 if (!ymodem_receiveFile(filename, filesize)) {
-                    ymodemLog("File receive failed");
+                    ymodemLog("File receive failed, nothing committed");
                     return false;
                 }
 
@@ -403,4 +755,11 @@ bool ymodem_receiveSession(uint32_t startTimeoutMs) {
 
     ymodemLog("No transfer started (session timeout)");
     return false;
-}
\ No newline at end of file
+}
+
+// Run the upload window, then write the session log to flash once
+bool ymodem_receiveSession(uint32_t startTimeoutMs) {
+    bool ok = ymodem_runSession(startTimeoutMs);
+    ymodemLogFlush();
+    return ok;
+}
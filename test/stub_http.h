@@ -0,0 +1,141 @@
+#pragma once
+
+// ============================================================
+// STUB HTTP SERVER (shared by the native unit tests)
+// ============================================================
+//
+// Listens on an ephemeral port on 127.0.0.1 and answers one connection at
+// a time from a background thread, calling the handler with the parsed
+// request.  The native HTTPClient reaches it because it is local.
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+struct StubRequest {
+    std::string method, path, body, ifNoneMatch, contentType;
+};
+
+typedef std::function<std::string(const StubRequest &req)> StubHandler;
+
+static std::string stubResponse(int code, const std::string &body, const std::string &extraHeaders = "") {
+    return "HTTP/1.1 " + std::to_string(code) + " X\r\nContent-Length: " + std::to_string(body.size()) +
+           "\r\n" + extraHeaders + "Connection: close\r\n\r\n" + body;
+}
+
+// The body as a chunked response, split into the given pieces
+static std::string stubChunked(const std::vector<std::string> &chunks) {
+    std::string out = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n";
+    for (const std::string &chunk : chunks) {
+        char size[16];
+        snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+        out += size + chunk + "\r\n";
+    }
+    return out + "0\r\n\r\n";
+}
+
+class StubHttpServer {
+public:
+    void start(StubHandler handler) {
+        this->handler = handler;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(fd, (sockaddr *)&addr, sizeof(addr));
+        listen(fd, 16);
+        socklen_t len = sizeof(addr);
+        getsockname(fd, (sockaddr *)&addr, &len);
+        port = ntohs(addr.sin_port);
+
+        std::thread([this] {
+            for (;;) {
+                int conn = accept(fd, nullptr, nullptr);
+                if (conn < 0) return;
+                serve(conn);
+                close(conn);
+            }
+        }).detach();
+    }
+
+    std::string url(const std::string &path) const {
+        return "http://127.0.0.1:" + std::to_string(port) + path;
+    }
+
+    size_t count() {
+        std::lock_guard<std::mutex> hold(lock);
+        return requests.size();
+    }
+
+    // Requests whose path starts with prefix
+    size_t count(const std::string &prefix) {
+        std::lock_guard<std::mutex> hold(lock);
+        size_t n = 0;
+        for (const StubRequest &r : requests) n += r.path.compare(0, prefix.size(), prefix) == 0;
+        return n;
+    }
+
+    StubRequest last() {
+        std::lock_guard<std::mutex> hold(lock);
+        return requests.empty() ? StubRequest() : requests.back();
+    }
+
+    uint16_t port = 0;
+
+private:
+    int fd = -1;
+    StubHandler handler;
+    std::mutex lock;
+    std::vector<StubRequest> requests;
+
+    void serve(int conn) {
+        std::string in;
+        char buf[2048];
+        size_t headerEnd;
+        while ((headerEnd = in.find("\r\n\r\n")) == std::string::npos) {
+            ssize_t n = recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0) return;
+            in.append(buf, n);
+        }
+
+        StubRequest req;
+        size_t sp = in.find(' ');
+        req.method = in.substr(0, sp);
+        req.path = in.substr(sp + 1, in.find(' ', sp + 1) - sp - 1);
+        size_t length = 0;
+        size_t lineStart = in.find("\r\n") + 2;
+        while (lineStart < headerEnd) {
+            size_t lineEnd = in.find("\r\n", lineStart);
+            std::string line = in.substr(lineStart, lineEnd - lineStart);
+            size_t colon = line.find(':');
+            std::string name = line.substr(0, colon);
+            std::string value = colon + 2 <= line.size() ? line.substr(colon + 2) : "";
+            if (name == "Content-Length") length = std::stoul(value);
+            if (name == "If-None-Match") req.ifNoneMatch = value;
+            if (name == "Content-Type") req.contentType = value;
+            lineStart = lineEnd + 2;
+        }
+        req.body = in.substr(headerEnd + 4);
+        while (req.body.size() < length) {
+            ssize_t n = recv(conn, buf, sizeof(buf), 0);
+            if (n <= 0) return;
+            req.body.append(buf, n);
+        }
+        {
+            std::lock_guard<std::mutex> hold(lock);
+            requests.push_back(req);
+        }
+
+        std::string reply = handler(req);
+        send(conn, reply.data(), reply.size(), MSG_NOSIGNAL);
+    }
+};
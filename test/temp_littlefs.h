@@ -0,0 +1,42 @@
+#pragma once
+
+// ============================================================
+// TEMPORARY LITTLEFS (shared by the native unit tests)
+// ============================================================
+//
+// Points the native LittleFS at a fresh directory under /tmp, unseeded
+// (data/ is not copied in), and removes it again when the object goes out
+// of scope.  Declare one at the top of main(), before anything touches
+// the filesystem:
+//
+//     int main() {
+//         TempLittleFS fs("rooms");
+//         UNITY_BEGIN();
+//         ...
+//         return UNITY_END();
+//     }
+
+#include <LittleFS.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+class TempLittleFS {
+public:
+    explicit TempLittleFS(const char *name) {
+        root = std::string("/tmp/mud_") + name + "_test_XXXXXX";
+        setenv("MUD_FS_ROOT", mkdtemp(&root[0]), 1);
+        setenv("MUD_FS_SEED", "/nonexistent", 1);
+        LittleFS.begin(false);
+    }
+
+    ~TempLittleFS() { nftw(root.c_str(), removeEntry, 16, FTW_DEPTH | FTW_PHYS); }
+
+    const char *path() const { return root.c_str(); }
+
+private:
+    std::string root;
+
+    static int removeEntry(const char *path, const struct stat *, int, struct FTW *) { return remove(path); }
+};
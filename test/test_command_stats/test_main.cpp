@@ -0,0 +1,146 @@
+// Per-verb command timing and the slow-command log
+//
+//   pio test -e native -f test_command_stats
+//
+// The whole sketch is compiled in.  Verbs past the table limit must share
+// "(other)", the slow-command ring must keep the newest entries in order,
+// and /slowcmds.txt must load back what was saved, with the '|' and
+// newlines that arguments may contain flattened to spaces.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static Player alice;
+
+static CommandStats *statsFor(const char *verb) {
+    for (auto &cs : commandStats) {
+        if (strcmp(cs.verb, verb) == 0) return &cs;
+    }
+    return nullptr;
+}
+
+static void clearSlowLog() {
+    slowCommandCount = 0;
+    memset(slowCommands, 0, sizeof(slowCommands));
+}
+
+void setUp() {
+    resetCommandStats();
+    clearSlowLog();
+}
+
+void tearDown() {}
+
+void test_verbs_past_the_limit_share_other() {
+    for (int i = 0; i < 1000; i++) recordCommand(alice, "look", "", 200 + i % 50, 300);
+    for (int i = 0; i < 60; i++) recordCommand(alice, String("verb") + i, "", 10, 1);
+
+    TEST_ASSERT_EQUAL(COMMAND_STATS_MAX_VERBS, (int)commandStats.size());
+    CommandStats *look = statsFor("look");
+    TEST_ASSERT_NOT_NULL(look);
+    TEST_ASSERT_EQUAL(1000, (int)look->hist.count);
+    TEST_ASSERT_EQUAL(300, (int)(look->bytesOut / look->hist.count));
+    TEST_ASSERT_EQUAL(249, (int)look->hist.maxUs);
+
+    // "look" and verb0..verb37 have their own rows; the other 22 share one
+    CommandStats *other = statsFor("(other)");
+    TEST_ASSERT_NOT_NULL(other);
+    TEST_ASSERT_EQUAL(60 - (COMMAND_STATS_MAX_VERBS - 2), (int)other->hist.count);
+    TEST_ASSERT_NULL(statsFor("verb59"));
+
+    // A verb seen before the table filled keeps its own row
+    recordCommand(alice, "verb0", "", 10, 1);
+    TEST_ASSERT_EQUAL(2, (int)statsFor("verb0")->hist.count);
+    TEST_ASSERT_TRUE(commandStats.back().verb == std::string("(other)"));
+}
+
+void test_slow_log_keeps_the_newest() {
+    recordCommand(alice, "look", "", SLOW_COMMAND_US - 1, 10);          // not slow
+    TEST_ASSERT_EQUAL(0, slowCommandCount);
+
+    for (int i = 0; i < SLOW_COMMAND_LOG_SIZE + 4; i++) {
+        recordCommand(alice, "download", String(i), SLOW_COMMAND_US + i, i);
+    }
+    TEST_ASSERT_EQUAL(SLOW_COMMAND_LOG_SIZE + 4, slowCommandCount);
+
+    // The four oldest were overwritten
+    for (int i = 4; i < SLOW_COMMAND_LOG_SIZE + 4; i++) {
+        const SlowCommand &slow = slowCommands[i % SLOW_COMMAND_LOG_SIZE];
+        TEST_ASSERT_EQUAL(SLOW_COMMAND_US + i, slow.us);
+        TEST_ASSERT_EQUAL_STRING(String(i).c_str(), slow.args);
+    }
+}
+
+void test_slow_log_survives_save_and_load() {
+    for (int i = 0; i < 20; i++) {
+        recordCommand(alice, "download", String("file|") + i + "\nx", 60000 + i, 10 + i);
+    }
+    SlowCommand before[SLOW_COMMAND_LOG_SIZE];
+    memcpy(before, slowCommands, sizeof(before));
+    int countBefore = slowCommandCount;
+
+    saveSlowCommands();
+    clearSlowLog();
+    loadSlowCommands();
+
+    // Loaded oldest first, so the ring holds the same entries from slot 0
+    TEST_ASSERT_EQUAL(SLOW_COMMAND_LOG_SIZE, slowCommandCount);
+    for (int i = 0; i < SLOW_COMMAND_LOG_SIZE; i++) {
+        const SlowCommand &want = before[(countBefore - SLOW_COMMAND_LOG_SIZE + i) % SLOW_COMMAND_LOG_SIZE];
+        const SlowCommand &got = slowCommands[i];
+        TEST_ASSERT_EQUAL(want.us, got.us);
+        TEST_ASSERT_EQUAL(want.bytes, got.bytes);
+        TEST_ASSERT_EQUAL_STRING("Alice", got.player);
+        TEST_ASSERT_EQUAL_STRING("download", got.verb);
+        TEST_ASSERT_EQUAL_STRING(want.args, got.args);
+    }
+    TEST_ASSERT_EQUAL_STRING("file 19 x", slowCommands[SLOW_COMMAND_LOG_SIZE - 1].args);
+
+    // Nothing logged: the file is removed rather than left stale
+    clearSlowLog();
+    saveSlowCommands();
+    TEST_ASSERT_FALSE(LittleFS.exists(SLOW_COMMAND_LOG_PATH));
+}
+
+void test_handle_command_counts_its_output() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    Player &p = players[0];
+    initPlayer(p);
+    p.client = WiFiClient(fds[0]);
+    p.active = p.loggedIn = true;
+    strcpy(p.name, "Alice");
+    handleCommand(p, 0, "who");
+    p.client.stop();
+
+    size_t received = 0;
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) received += n;
+    close(fds[1]);
+
+    CommandStats *who = statsFor("who");
+    TEST_ASSERT_NOT_NULL(who);
+    TEST_ASSERT_EQUAL(1, (int)who->hist.count);
+    TEST_ASSERT_TRUE(received > 0);
+    TEST_ASSERT_EQUAL((int)received, (int)who->bytesOut);
+}
+
+int main() {
+    TempLittleFS fs("cmdstats");
+    allocateSessionPool();
+    strcpy(alice.name, "Alice");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_verbs_past_the_limit_share_other);
+    RUN_TEST(test_slow_log_keeps_the_newest);
+    RUN_TEST(test_slow_log_survives_save_and_load);
+    RUN_TEST(test_handle_command_counts_its_output);
+    return UNITY_END();
+}
@@ -0,0 +1,119 @@
+// A scripted death must not stall loop()
+//
+//   pio test -e native -f test_death_latency
+//
+// The whole sketch is compiled in.  Two players sit on socketpairs; one
+// dies (as tickCombat would make them) while the other keeps typing.  Every
+// loop() pass is timed, the dying player must still see the death lines
+// paced out over seconds, and the bystander's commands must be answered
+// while that happens.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <string>
+#include <sys/socket.h>
+
+static const unsigned long LOOP_BUDGET_US = 50000;   // one pass; the old death slept ~4.5 s in one
+
+static int farEnd[2];                                 // test side of each player's socket
+
+static void seatPlayer(int slot, const char *name) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    Player &p = players[slot];
+    p.client = WiFiClient(fds[0]);
+    farEnd[slot] = fds[1];
+    p.active = true;
+    p.loggedIn = true;
+    strncpy(p.name, name, sizeof(p.name) - 1);
+    p.raceId = 0;
+    p.xp = 30;
+    p.level = getLevelFromXp(p.xp);
+    p.hp = p.maxHp = 20;
+    p.roomX = 250;
+    p.roomY = 250;
+    p.roomZ = 50;
+    p.wieldedItemIndex = -1;
+    for (int s = 0; s < SLOT_COUNT; s++) p.wornItemIndices[s] = -1;
+    clearDeferredOutput(slot);
+}
+
+// Everything the player has been sent so far
+static std::string drain(int slot) {
+    std::string out;
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(farEnd[slot], buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+    return out;
+}
+
+static uint32_t timedLoop() {
+    unsigned long start = micros();
+    loop();
+    return micros() - start;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_death_is_paced_without_blocking_loop() {
+    seatPlayer(0, "victim");
+    seatPlayer(1, "bystander");
+    drain(0);
+    drain(1);
+
+    unsigned long start = millis();
+    handlePlayerDeath(players[0]);
+    TEST_ASSERT_LESS_THAN(start + 100, millis());      // queued, not slept
+
+    uint32_t worstUs = 0;
+    int passes = 0, answered = 0;
+    std::string victimSaw;
+    unsigned long lastLineAt = start;
+    while (millis() - start < 6000) {
+        // The bystander types a command every 100 ms
+        if (passes % 20 == 0) send(farEnd[1], "score\n", 6, MSG_NOSIGNAL);
+
+        uint32_t us = timedLoop();
+        if (us > worstUs) worstUs = us;
+        passes++;
+
+        std::string got = drain(0);
+        if (!got.empty()) {
+            victimSaw += got;
+            lastLineAt = millis();
+        }
+        if (drain(1).find("> ") != std::string::npos) answered++;
+        delay(5);
+    }
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "worst loop() pass %u us over %d passes", worstUs, passes);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_LESS_THAN(LOOP_BUDGET_US, worstUs);
+
+    // The dying player still gets the whole sequence, spread over seconds
+    TEST_ASSERT_TRUE(victimSaw.find("experience points") != std::string::npos);
+    TEST_ASSERT_TRUE(victimSaw.find("You awaken back at the spawn point") != std::string::npos);
+    TEST_ASSERT_TRUE(lastLineAt - start >= 2000);
+
+    // ...and the bystander was answered throughout
+    TEST_ASSERT_TRUE(answered >= 40);
+}
+
+int main() {
+    TempLittleFS fs("death");
+
+    allocateSessionPool();
+    server = new WiFiServer(0);         // any free port; nobody connects
+    server->begin();
+    nextGlobalRespawn = millis() + GLOBAL_RESPAWN_INTERVAL;
+    registerGameTicks();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_death_is_paced_without_blocking_loop);
+    return UNITY_END();
+}
@@ -0,0 +1,232 @@
+// Port 8080 file server: key check, world-file allowlist and commit
+//
+//   pio test -e native -f test_file_server
+//
+// The whole sketch is compiled in.  Each request is written to one end of
+// a socketpair whose other end is handed to an upload connection, and
+// serviceUploadConnection() is run until the response is complete.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char *KEY = "s3cret-upload-key";
+
+static std::string request(const std::string &raw) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    UploadConnection &conn = uploadConns[0];
+    conn.client = WiFiClient(fds[0]);
+    conn.state = UPLOAD_HEADERS;
+    conn.request = "";
+    conn.lastActivity = millis();
+    send(fds[1], raw.data(), raw.size(), MSG_NOSIGNAL);
+
+    std::string response;
+    char buf[2048];
+    for (int i = 0; i < 2000 && conn.state != UPLOAD_FREE; i++) {
+        serviceUploadConnection(conn, millis());
+        ssize_t n;
+        while ((n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) response.append(buf, n);
+        delay(1);
+    }
+    ssize_t n;
+    while ((n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) response.append(buf, n);
+    close(fds[1]);
+    return response;
+}
+
+static std::string get(const std::string &path, const char *key = KEY) {
+    std::string raw = "GET " + path + " HTTP/1.1\r\nHost: mud\r\n";
+    if (key) raw += std::string("X-Upload-Key: ") + key + "\r\n";
+    return request(raw + "\r\n");
+}
+
+static std::string post(const std::string &filename, const std::string &content, const char *key = KEY) {
+    std::string boundary = "XyZzY";
+    std::string body = "--" + boundary + "\r\nContent-Disposition: form-data; name=\"file\"; filename=\"" +
+                       filename + "\"\r\n\r\n" + content + "\r\n--" + boundary + "--\r\n";
+    std::string raw = "POST /upload HTTP/1.1\r\nHost: mud\r\n";
+    if (key) raw += std::string("X-Upload-Key: ") + key + "\r\n";
+    raw += "Content-Type: multipart/form-data; boundary=" + boundary + "\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\n\r\n" + body;
+    return request(raw);
+}
+
+static int status(const std::string &response) {
+    return response.size() > 12 ? atoi(response.c_str() + 9) : 0;
+}
+
+static std::string body(const std::string &response) {
+    size_t at = response.find("\r\n\r\n");
+    return at == std::string::npos ? "" : response.substr(at + 4);
+}
+
+static void writeFile(const char *path, const char *text) {
+    File f = LittleFS.open(path, "w");
+    f.print(text);
+    f.close();
+}
+
+static std::string readFile(const char *path) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return "<missing>";
+    String s = f.readString();
+    f.close();
+    return s.c_str();
+}
+
+static const char *PRIVATE_FILES[] = {"user_alice.txt", "credentials.txt", "journal.bin", "journal.old",
+                                      "journal.on", "slowcmds.txt", "mail_alice.txt"};
+
+void setUp() {
+    fileUploadKey = KEY;
+    writeFile("/rooms.txt", "1|Town Square|old\n");
+    writeFile("/user_alice.txt", "secretpw\n1\n");
+    writeFile("/credentials.txt", "ssid\nwifipass\n4000\ns3cret-upload-key\n");
+    writeFile("/journal.bin", "alice\nsecretpw\n");
+    writeFile("/journal.old", "x");
+    writeFile("/journal.on", "");
+    writeFile("/slowcmds.txt", "look 20ms\n");
+    writeFile("/mail_alice.txt", "F|bob\n");
+}
+
+void tearDown() {}
+
+void test_every_route_needs_the_key() {
+    const char *paths[] = {"/", "/files", "/files/rooms.txt", "/nothing"};
+    for (const char *path : paths) {
+        TEST_ASSERT_EQUAL(401, status(get(path, nullptr)));
+        TEST_ASSERT_EQUAL(401, status(get(path, "wrong")));
+        TEST_ASSERT_EQUAL(401, status(get(path, "s3cret-upload-ke")));
+    }
+    TEST_ASSERT_EQUAL(401, status(post("rooms.txt", "hacked", nullptr)));
+    TEST_ASSERT_EQUAL(401, status(post("rooms.txt", "hacked", "wrong")));
+    TEST_ASSERT_EQUAL_STRING("1|Town Square|old\n", readFile("/rooms.txt").c_str());
+
+    TEST_ASSERT_EQUAL(200, status(get("/")));
+    TEST_ASSERT_EQUAL(200, status(get("/files/rooms.txt")));
+}
+
+void test_no_configured_key_refuses_everything() {
+    fileUploadKey = "";
+    TEST_ASSERT_EQUAL(401, status(get("/files", "")));
+    TEST_ASSERT_EQUAL(401, status(get("/files", KEY)));
+}
+
+void test_listing_shows_only_world_files() {
+    std::string response = get("/files");
+    TEST_ASSERT_EQUAL(200, status(response));
+    TEST_ASSERT_EQUAL_STRING("rooms.txt 18\n", body(response).c_str());
+}
+
+void test_private_files_cannot_be_read() {
+    for (const char *name : PRIVATE_FILES) {
+        std::string response = get(std::string("/files/") + name);
+        TEST_ASSERT_EQUAL(403, status(response));
+        TEST_ASSERT_TRUE(response.find("secretpw") == std::string::npos);
+    }
+    // Path tricks sanitize to a name that still isn't on the list
+    TEST_ASSERT_EQUAL(403, status(get("/files/../user_alice.txt")));
+    TEST_ASSERT_EQUAL(403, status(get("/files/USER_ALICE.TXT")));
+
+    std::string response = get("/files/rooms.txt");
+    TEST_ASSERT_EQUAL(200, status(response));
+    TEST_ASSERT_EQUAL_STRING("1|Town Square|old\n", body(response).c_str());
+}
+
+void test_private_files_cannot_be_written() {
+    for (const char *name : PRIVATE_FILES) {
+        std::string before = readFile((std::string("/") + name).c_str());
+        TEST_ASSERT_EQUAL(403, status(post(name, "overwritten")));
+        TEST_ASSERT_EQUAL_STRING(before.c_str(), readFile((std::string("/") + name).c_str()).c_str());
+        TEST_ASSERT_FALSE(LittleFS.exists((std::string("/") + name + ".upload").c_str()));
+    }
+}
+
+void test_key_without_a_space_is_accepted() {
+    std::string raw = std::string("GET /files HTTP/1.1\r\nHost: mud\r\nX-Upload-Key:") + KEY + "\r\n\r\n";
+    TEST_ASSERT_EQUAL(200, status(request(raw)));
+    raw = std::string("GET /files HTTP/1.1\r\nHost: mud\r\nx-upload-key:   ") + KEY + "  \r\n\r\n";
+    TEST_ASSERT_EQUAL(200, status(request(raw)));
+}
+
+void test_world_file_upload_replaces_it() {
+    std::string response = post("items.vxd", "torch|new\n");
+    TEST_ASSERT_EQUAL(200, status(response));
+    TEST_ASSERT_EQUAL_STRING("torch|new\n", readFile("/items.vxd").c_str());
+    TEST_ASSERT_FALSE(LittleFS.exists("/items.vxd.upload"));
+    TEST_ASSERT_FALSE(LittleFS.exists(UPLOAD_COMMIT_JOURNAL));
+}
+
+void test_rooms_upload_rebuilds_the_room_graph() {
+    writeFile("/rooms.idx", "stale");
+    writeFile("/rooms.bin", "stale");
+    std::string rooms = "x,y,z,name,long_desc,ex_n,ex_s,ex_e,ex_w,ex_ne,ex_nw,ex_se,ex_sw,ex_u,ex_d\n"
+                        "250,250,50,Church,A church.,0,0,1,0,0,0,0,0,0,0\n"
+                        "251,250,50,Lane,A lane.,0,0,0,1,0,0,0,0,0,0\n";
+    std::string response = post("rooms.txt", rooms);
+    TEST_ASSERT_EQUAL(200, status(response));
+    TEST_ASSERT_TRUE(body(response).find("Room indexes rebuilt.") != std::string::npos);
+    TEST_ASSERT_EQUAL(2, (int)roomNodes.size());
+    TEST_ASSERT_EQUAL(roomOrdinal(251, 250, 50), roomNeighbor(roomOrdinal(250, 250, 50), DIR_EAST));
+    TEST_ASSERT_TRUE(readFile("/rooms.idx") != "stale");
+    TEST_ASSERT_TRUE(readFile("/rooms.bin") != "stale");
+}
+
+void test_failed_swap_keeps_the_upload_for_the_next_boot() {
+    // A directory where the file should go: neither rename nor remove works
+    LittleFS.mkdir("/npcs.vxd");
+    writeFile("/npcs.vxd/keep", "x");
+    std::string response = post("npcs.vxd", "rat|new\n");
+    TEST_ASSERT_EQUAL(500, status(response));
+    TEST_ASSERT_TRUE(body(response).find("could not be swapped in") != std::string::npos);
+    TEST_ASSERT_TRUE(LittleFS.exists(UPLOAD_COMMIT_JOURNAL));
+    TEST_ASSERT_EQUAL_STRING("rat|new\n", readFile("/npcs.vxd.upload").c_str());
+
+    // What setup() does at the next boot
+    LittleFS.remove("/npcs.vxd/keep");
+    LittleFS.rmdir("/npcs.vxd");
+    TEST_ASSERT_TRUE(stagedApplyJournal(UPLOAD_COMMIT_JOURNAL, UPLOAD_PART_SUFFIX));
+    TEST_ASSERT_EQUAL_STRING("rat|new\n", readFile("/npcs.vxd").c_str());
+    TEST_ASSERT_FALSE(LittleFS.exists(UPLOAD_COMMIT_JOURNAL));
+}
+
+void test_name_being_written_elsewhere_is_refused() {
+    UploadConnection &other = uploadConns[1];
+    other.fileName = "quests.txt";
+    other.tempPath = "/quests.txt.upload";
+    writeFile("/quests.txt.upload", "half");
+    writeFile("/quests.txt", "live\n");
+
+    TEST_ASSERT_EQUAL(409, status(post("quests.txt", "mine\n")));
+    TEST_ASSERT_EQUAL_STRING("live\n", readFile("/quests.txt").c_str());
+    TEST_ASSERT_EQUAL_STRING("half", readFile("/quests.txt.upload").c_str());
+
+    other.fileName = "";
+    other.tempPath = "";
+    TEST_ASSERT_EQUAL(200, status(post("quests.txt", "mine\n")));
+    TEST_ASSERT_EQUAL_STRING("mine\n", readFile("/quests.txt").c_str());
+}
+
+int main() {
+    TempLittleFS fs("files");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_every_route_needs_the_key);
+    RUN_TEST(test_no_configured_key_refuses_everything);
+    RUN_TEST(test_listing_shows_only_world_files);
+    RUN_TEST(test_private_files_cannot_be_read);
+    RUN_TEST(test_private_files_cannot_be_written);
+    RUN_TEST(test_key_without_a_space_is_accepted);
+    RUN_TEST(test_world_file_upload_replaces_it);
+    RUN_TEST(test_rooms_upload_rebuilds_the_room_graph);
+    RUN_TEST(test_failed_swap_keeps_the_upload_for_the_next_boot);
+    RUN_TEST(test_name_being_written_elsewhere_is_refused);
+    return UNITY_END();
+}
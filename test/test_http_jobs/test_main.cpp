@@ -0,0 +1,241 @@
+// HTTP job queue against a stub server on 127.0.0.1
+//
+//   pio test -e native -f test_http_jobs
+//
+// The native HTTPClient speaks plain HTTP to local hosts.  Worker threads
+// run the jobs, so httpJobPump() only hands back what has finished and
+// never waits for the server.
+
+#include <unity.h>
+#include <HttpJobQueue.h>
+#include "../temp_littlefs.h"
+
+#include "../stub_http.h"
+
+// ------------------------------------------------------------
+// Stub server: answers by path
+// ------------------------------------------------------------
+
+static StubHttpServer stub;
+
+static std::string stubAnswer(const StubRequest &req) {
+    if (req.path == "/hello") return stubResponse(200, "hello there", "ETag: \"v1\"\r\n");
+    if (req.path == "/echo") return stubResponse(200, req.method + ":" + req.body);
+    if (req.path == "/etag") {
+        if (req.ifNoneMatch == "\"v7\"") return "HTTP/1.1 304 Not Modified\r\nETag: \"v7\"\r\nConnection: close\r\n\r\n";
+        return stubResponse(200, "fresh", "ETag: \"v7\"\r\n");
+    }
+    if (req.path == "/chunked") {
+        // Chunk boundaries fall inside a key, a number and a string
+        return stubChunked({"{\"current\":{\"temp", "erature_2m\":21", ".5},\"name\":\"B", "ob\"}"});
+    }
+    if (req.path == "/file") {
+        std::string body(5000, 'x');
+        for (size_t i = 0; i < body.size(); i++) body[i] = 'a' + i % 26;
+        return stubResponse(200, body);
+    }
+    if (req.path == "/slow") {
+        usleep(600 * 1000);
+        return stubResponse(200, "too late");
+    }
+    return stubResponse(404, "no");
+}
+
+// ------------------------------------------------------------
+// Helpers
+// ------------------------------------------------------------
+
+static int delivered;
+
+static HttpJob *makeJob(const char *path, HttpJobCallback done = nullptr) {
+    HttpJob *job = new HttpJob();
+    job->url = stub.url(path).c_str();
+    job->connectTimeoutMs = 1000;
+    job->timeoutMs = 2000;
+    job->onComplete = done ? done : [](HttpJob &) { delivered++; };
+    return job;
+}
+
+// Pump, as loop() does, until count jobs are delivered (5 s at most)
+static void pumpUntil(int count) {
+    for (int i = 0; i < 500 && delivered < count; i++) {
+        httpJobPump();
+        delay(10);
+    }
+}
+
+void setUp() {
+    delivered = 0;
+}
+
+void tearDown() {
+    while (httpJobsOutstanding() > 0) {
+        httpJobPump();
+        delay(1);
+    }
+}
+
+// ------------------------------------------------------------
+// Tests
+// ------------------------------------------------------------
+
+void test_pump_never_waits_for_the_server() {
+    String first;
+    httpJobSubmit(makeJob("/slow", [&](HttpJob &) { delivered++; if (first == "") first = "slow"; }));
+    HttpJob *quick = makeJob("/", [&](HttpJob &) { delivered++; if (first == "") first = "refused"; });
+    quick->url = "http://127.0.0.1:1/";     // the stub answers one at a time; this needs no server
+    httpJobSubmit(quick);
+    TEST_ASSERT_EQUAL(2, httpJobsOutstanding());
+
+    unsigned long start = millis();
+    httpJobPump();
+    TEST_ASSERT_LESS_THAN(50, millis() - start);
+
+    // The quick job comes back on the other worker while the slow one runs
+    pumpUntil(1);
+    TEST_ASSERT_EQUAL_STRING("refused", first.c_str());
+    TEST_ASSERT_EQUAL(1, httpJobsOutstanding());
+    TEST_ASSERT_EQUAL(1, httpJobStats.inFlight.load());
+
+    pumpUntil(2);
+    TEST_ASSERT_EQUAL(2, delivered);
+    TEST_ASSERT_EQUAL(0, httpJobsOutstanding());
+    TEST_ASSERT_EQUAL(0, httpJobStats.inFlight.load());
+}
+
+void test_get_returns_body_and_etag() {
+    String body, etag;
+    int code = 0;
+    httpJobSubmit(makeJob("/hello", [&](HttpJob &job) {
+        delivered++;
+        code = job.httpCode;
+        body = job.response;
+        etag = job.etag;
+        TEST_ASSERT_TRUE(job.ok());
+    }));
+    pumpUntil(1);
+    TEST_ASSERT_EQUAL(200, code);
+    TEST_ASSERT_EQUAL_STRING("hello there", body.c_str());
+    TEST_ASSERT_EQUAL_STRING("\"v1\"", etag.c_str());
+}
+
+void test_post_sends_payload_and_content_type() {
+    String body;
+    HttpJob *job = makeJob("/echo", [&](HttpJob &j) { delivered++; body = j.response; });
+    job->method = "POST";
+    job->payload = "{\"to\":\"bob\"}";
+    job->contentType = "application/json";
+    httpJobSubmit(job);
+    pumpUntil(1);
+    TEST_ASSERT_EQUAL_STRING("POST:{\"to\":\"bob\"}", body.c_str());
+    StubRequest sent = stub.last();
+    TEST_ASSERT_EQUAL_STRING("application/json", sent.contentType.c_str());
+}
+
+void test_if_none_match_gets_304() {
+    int code = 0;
+    String response = "unset";
+    HttpJob *job = makeJob("/etag", [&](HttpJob &j) { delivered++; code = j.httpCode; response = j.response; });
+    job->ifNoneMatch = "\"v7\"";
+    httpJobSubmit(job);
+    pumpUntil(1);
+    TEST_ASSERT_EQUAL(304, code);
+    TEST_ASSERT_EQUAL_STRING("", response.c_str());
+}
+
+void test_json_paths_from_chunked_body() {
+    String temp, name;
+    bool ok = false;
+    HttpJob *job = makeJob("/chunked", [&](HttpJob &j) {
+        delivered++;
+        ok = j.ok();
+        temp = j.json.get("current.temperature_2m");
+        name = j.json.get("name");
+    });
+    job->json.want("current.temperature_2m");
+    job->json.want("name");
+    httpJobSubmit(job);
+    pumpUntil(1);
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL_STRING("21.5", temp.c_str());
+    TEST_ASSERT_EQUAL_STRING("Bob", name.c_str());
+}
+
+void test_save_to_path_streams_to_file() {
+    size_t written = 0;
+    bool ok = false;
+    HttpJob *job = makeJob("/file", [&](HttpJob &j) { delivered++; ok = j.ok(); written = j.bytesWritten; });
+    job->saveToPath = "/download_test.txt";
+    httpJobSubmit(job);
+    pumpUntil(1);
+    TEST_ASSERT_TRUE(ok);
+    TEST_ASSERT_EQUAL(5000, written);
+
+    File f = LittleFS.open("/download_test.txt", "r");
+    TEST_ASSERT_TRUE((bool)f);
+    TEST_ASSERT_EQUAL(5000, f.size());
+    TEST_ASSERT_EQUAL('a', f.read());
+    f.close();
+}
+
+void test_read_timeout_is_counted() {
+    uint32_t timedOutBefore = httpJobStats.timedOut;
+    bool timedOut = false;
+    HttpJob *job = makeJob("/slow", [&](HttpJob &j) { delivered++; timedOut = j.timedOut; });
+    job->timeoutMs = 200;
+    unsigned long start = millis();
+    httpJobSubmit(job);
+    pumpUntil(1);
+    TEST_ASSERT_TRUE(timedOut);
+    TEST_ASSERT_LESS_THAN(600, millis() - start);
+    TEST_ASSERT_EQUAL(timedOutBefore + 1, httpJobStats.timedOut);
+}
+
+void test_unreachable_and_remote_hosts_fail() {
+    int refusedCode = 0, remoteCode = 0;
+    uint32_t failedBefore = httpJobStats.failed;
+
+    HttpJob *refused = makeJob("/", [&](HttpJob &j) { delivered++; refusedCode = j.httpCode; });
+    refused->url = "http://127.0.0.1:1/";
+    httpJobSubmit(refused);
+    HttpJob *remote = makeJob("/", [&](HttpJob &j) { delivered++; remoteCode = j.httpCode; });
+    remote->url = "https://www.storyboardacs.com/download.php";
+    httpJobSubmit(remote);
+    pumpUntil(2);
+
+    TEST_ASSERT_EQUAL(HTTPC_ERROR_CONNECTION_REFUSED, refusedCode);
+    TEST_ASSERT_EQUAL(HTTPC_ERROR_CONNECTION_REFUSED, remoteCode);
+    TEST_ASSERT_EQUAL(failedBefore + 2, httpJobStats.failed);
+}
+
+void test_full_queue_rejects_without_callback() {
+    // Keep both workers busy so the queue itself fills
+    for (int i = 0; i < HTTP_MAX_CONCURRENT; i++) httpJobSubmit(makeJob("/slow"));
+    for (int i = 0; i < 100 && httpJobStats.inFlight.load() < HTTP_MAX_CONCURRENT; i++) delay(1);
+    TEST_ASSERT_EQUAL(HTTP_MAX_CONCURRENT, httpJobStats.inFlight.load());
+
+    uint32_t rejectedBefore = httpJobStats.rejected;
+    for (int i = 0; i < HTTP_JOB_QUEUE_DEPTH; i++) TEST_ASSERT_NOT_EQUAL(0, httpJobSubmit(makeJob("/hello")));
+    TEST_ASSERT_EQUAL(0, httpJobSubmit(makeJob("/hello")));
+    TEST_ASSERT_EQUAL(rejectedBefore + 1, httpJobStats.rejected);
+
+    pumpUntil(HTTP_MAX_CONCURRENT + HTTP_JOB_QUEUE_DEPTH + 1);
+    TEST_ASSERT_EQUAL(HTTP_MAX_CONCURRENT + HTTP_JOB_QUEUE_DEPTH, delivered);
+}
+
+int main() {
+    TempLittleFS fs("http");
+    stub.start(stubAnswer);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_pump_never_waits_for_the_server);
+    RUN_TEST(test_get_returns_body_and_etag);
+    RUN_TEST(test_post_sends_payload_and_content_type);
+    RUN_TEST(test_if_none_match_gets_304);
+    RUN_TEST(test_json_paths_from_chunked_body);
+    RUN_TEST(test_save_to_path_streams_to_file);
+    RUN_TEST(test_read_timeout_is_counted);
+    RUN_TEST(test_unreachable_and_remote_hosts_fail);
+    RUN_TEST(test_full_queue_rejects_without_callback);
+    return UNITY_END();
+}
@@ -0,0 +1,74 @@
+// Inn Keeper joke pool: seen-marking and the /jokepool.txt round trip
+//
+//   pio test -e native -f test_joke_pool
+//
+// The whole sketch is compiled in; the tests work on innKeeperJokes
+// directly, the way startJokeFetch() and tickInnKeeperJokes() do.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+
+void setUp() {
+    innKeeperJokes = JokeSession();
+}
+
+void tearDown() {}
+
+void test_fetched_joke_is_not_seen_until_told() {
+    uint32_t h = jokeHash("id:11");
+    TEST_ASSERT_TRUE(pushPooledJoke("A SQL query walks into a bar", h));
+    TEST_ASSERT_FALSE(jokeSeen(h));
+    TEST_ASSERT_TRUE(jokePooled(h));
+
+    String told;
+    TEST_ASSERT_TRUE(popPooledJoke(told));
+    TEST_ASSERT_EQUAL_STRING("A SQL query walks into a bar", told.c_str());
+    TEST_ASSERT_TRUE(jokeSeen(h));
+    TEST_ASSERT_FALSE(jokePooled(h));
+}
+
+void test_untold_jokes_survive_a_save() {
+    pushPooledJoke("first joke, never told", 101);
+    pushPooledJoke("second joke, told", 102);
+    String told;
+    popPooledJoke(told);                        // tells the first one
+    saveJokePool();
+
+    innKeeperJokes = JokeSession();
+    loadJokePool();
+    TEST_ASSERT_EQUAL(1, innKeeperJokes.poolCount);
+    TEST_ASSERT_TRUE(jokePooled(102));
+    TEST_ASSERT_FALSE(jokeSeen(102));
+    TEST_ASSERT_TRUE(jokeSeen(101));
+}
+
+void test_pool_file_keeps_escapes() {
+    const char *text = "He said \"hi\"\n\tthen left C:\\inn\\ at 5\r";
+    pushPooledJoke(text, 7);
+    saveJokePool();
+
+    File f = LittleFS.open(JOKE_POOL_PATH, "r");
+    String line = f.readStringUntil('\n');
+    line.trim();                                // println ends lines with CRLF
+    f.close();
+    TEST_ASSERT_EQUAL_STRING("J|7|He said \\\"hi\\\"\\n\\tthen left C:\\\\inn\\\\ at 5\\r", line.c_str());
+
+    innKeeperJokes = JokeSession();
+    loadJokePool();
+    String back;
+    TEST_ASSERT_TRUE(popPooledJoke(back));
+    TEST_ASSERT_EQUAL_STRING(text, back.c_str());
+}
+
+int main() {
+    TempLittleFS fs("joke");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_fetched_joke_is_not_seen_until_told);
+    RUN_TEST(test_untold_jokes_survive_a_save);
+    RUN_TEST(test_pool_file_keeps_escapes);
+    return UNITY_END();
+}
@@ -0,0 +1,170 @@
+// Passwords never reach the replay journal
+//
+//   pio test -e native -f test_journal_secrets
+//
+// The whole sketch is compiled in and the journal is recording.  A player
+// logs in over a socketpair (one wrong password first), changes their
+// password and types a command; /journal.bin must hold the name and the
+// command but none of the passwords.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int farEnd = -1;                               // test side of the player's socket
+
+static void createAlice() {
+    Player &p = players[1];
+    initPlayer(p);
+    strncpy(p.name, "alice", sizeof(p.name) - 1);
+    strncpy(p.storedPassword, "hunter2", sizeof(p.storedPassword) - 1);
+    p.raceId = 0;
+    p.xp = 0;
+    p.level = 1;
+    p.hp = p.maxHp = 20;
+    p.roomX = 250;
+    p.roomY = 250;
+    p.roomZ = 50;
+    savePlayerToFS(p);
+    players[1] = Player();
+}
+
+static void connect() {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    Player &p = players[0];
+    p.client = WiFiClient(fds[0]);
+    farEnd = fds[1];
+    p.active = true;
+    p.loggedIn = false;
+    startLogin(p, 0);
+}
+
+// Send one line and run loop() until the game has read it
+static std::string type(const char *line) {
+    send(farEnd, line, strlen(line), MSG_NOSIGNAL);
+    send(farEnd, "\n", 1, MSG_NOSIGNAL);
+    std::string out;
+    char buf[1024];
+    for (int i = 0; i < 20; i++) {
+        loop();
+        ssize_t n;
+        while ((n = recv(farEnd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+        delay(2);
+    }
+    return out;
+}
+
+static std::string readJournal() {
+    File f = LittleFS.open(JOURNAL_PATH, "r");
+    std::string s(f.size(), '\0');
+    f.read((uint8_t *)&s[0], s.size());
+    f.close();
+    return s;
+}
+
+static int count(const std::string &s, const std::string &what) {
+    int n = 0;
+    for (size_t at = s.find(what); at != std::string::npos; at = s.find(what, at + 1)) n++;
+    return n;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_passwords_are_masked() {
+    connect();
+    type("alice");
+    TEST_ASSERT_TRUE(type("wrongpw").find("Incorrect password") != std::string::npos);
+    type("hunter2");
+    TEST_ASSERT_TRUE(players[0].loggedIn);
+
+    type("password");
+    type("hunter2");
+    type("newpass9");
+    TEST_ASSERT_TRUE(type("newpass9").find("Password updated") != std::string::npos);
+    type("score");
+    journalEnd();
+
+    std::string j = readJournal();
+    TEST_ASSERT_TRUE(j.find("hunter2") == std::string::npos);
+    TEST_ASSERT_TRUE(j.find("wrongpw") == std::string::npos);
+    TEST_ASSERT_TRUE(j.find("newpass9") == std::string::npos);
+    TEST_ASSERT_EQUAL(5, count(j, JOURNAL_SECRET_LINE));
+
+    // What a replay needs besides the passwords is still there
+    TEST_ASSERT_TRUE(j.find("alice") != std::string::npos);
+    TEST_ASSERT_TRUE(j.find("password") != std::string::npos);
+    TEST_ASSERT_TRUE(j.find("score") != std::string::npos);
+}
+
+void test_stand_in_only_matches_in_a_replay() {
+    TEST_ASSERT_FALSE(passwordMatches(JOURNAL_SECRET_LINE, "hunter2"));
+    TEST_ASSERT_TRUE(passwordMatches("hunter2", "hunter2"));
+    TEST_ASSERT_TRUE(isValidPassword(JOURNAL_SECRET_LINE));
+}
+
+void test_debug_extract_refuses_the_journal() {
+    Player &p = players[0];
+    p.IsWizard = true;
+    p.debugDest = DEBUG_TO_TELNET;
+    const char *names[] = {"journal.bin", "/journal.old", "journal.on"};
+    for (const char *name : names) {
+        std::string out = type((std::string("debug extract ") + name).c_str());
+        TEST_ASSERT_TRUE(out.find("not served over the network") != std::string::npos);
+        TEST_ASSERT_TRUE(out.find("BACKUP") == std::string::npos);
+    }
+
+    // extractall prints a line per write, more than a socketpair buffers
+    // while nobody reads it; send it to Serial (stdout) and catch that
+    p.debugDest = DEBUG_TO_SERIAL;
+    char captured[] = "/tmp/mud_journal_extract_XXXXXX";
+    int fd = mkstemp(captured);
+    fflush(stdout);
+    int savedStdout = dup(1);
+    dup2(fd, 1);
+    type("debug extractall");
+    fflush(stdout);
+    dup2(savedStdout, 1);
+    close(savedStdout);
+    close(fd);
+
+    std::string all;
+    FILE *in = fopen(captured, "r");
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) all.append(buf, n);
+    fclose(in);
+    unlink(captured);
+
+    TEST_ASSERT_TRUE(all.find("BACKUP COMPLETE: 3 files") != std::string::npos);
+    TEST_ASSERT_TRUE(all.find("user_alice.txt") != std::string::npos);
+    TEST_ASSERT_TRUE(all.find("journal.") == std::string::npos);
+}
+
+int main() {
+    TempLittleFS fs("journal");
+
+    allocateSessionPool();
+    server = new WiFiServer(0);         // any free port; the player is seated directly
+    server->begin();
+    nextGlobalRespawn = millis() + GLOBAL_RESPAWN_INTERVAL;
+    registerGameTicks();
+    createAlice();
+    LittleFS.open(JOURNAL_FLAG_PATH, "w").close();
+    journalBegin(1, 4000);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_passwords_are_masked);
+    RUN_TEST(test_stand_in_only_matches_in_a_replay);
+    RUN_TEST(test_debug_extract_refuses_the_journal);
+    int failures = UNITY_END();
+
+    close(farEnd);
+    return failures;
+}
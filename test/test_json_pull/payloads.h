@@ -0,0 +1,98 @@
+#pragma once
+
+// Response bodies in the form each endpoint sends them: Open-Meteo
+// (compact, raw UTF-8 units), JokeAPI (pretty-printed, raw UTF-8),
+// retrieveESP32mail.php and download.php (PHP json_encode: "\/" and
+// \uXXXX escapes, emoji as surrogate pairs).
+
+static const char GEOCODE_DETROIT[] =
+    R"({"results":[{"id":4990729,"name":"Detroit","latitude":42.33143,"longitude":-83.04575,)"
+    R"("elevation":192.0,"feature_code":"PPLA2","country_code":"US","admin1_id":5001836,)"
+    R"("admin2_id":4990732,"timezone":"America/Detroit","population":677116,)"
+    R"("postcodes":["48201","48202","48204","48205","48206","48207","48208","48209"],)"
+    R"("country_id":6252001,"country":"United States","admin1":"Michigan","admin2":"Wayne"}],)"
+    R"("generationtime_ms":0.7209778})";
+
+static const char WEATHER_CURRENT[] =
+    R"({"latitude":42.33427,"longitude":-83.04999,"generationtime_ms":0.0540018081665039,)"
+    R"("utc_offset_seconds":-14400,"timezone":"America/Detroit","timezone_abbreviation":"GMT-4",)"
+    R"("elevation":192.0,"current_units":{"time":"iso8601","interval":"seconds",)"
+    R"("temperature_2m":"°C","weather_code":"wmo code"},"current":{"time":"2026-10-18T21:45",)"
+    R"("interval":900,"temperature_2m":11.3,"weather_code":3},"daily_units":{"time":"iso8601",)"
+    R"("temperature_2m_max":"°C","temperature_2m_min":"°C"},"daily":{"time":["2026-10-18",)"
+    R"("2026-10-19","2026-10-20","2026-10-21","2026-10-22","2026-10-23","2026-10-24"],)"
+    R"("temperature_2m_max":[16.4,14.9,12.1,9.8,13.3,15.0,11.7],)"
+    R"("temperature_2m_min":[7.9,8.2,5.5,2.1,4.0,8.8,6.3]}})";
+
+static const char WEATHER_FORECAST[] =
+    R"({"latitude":28.538,"longitude":-81.37739,"generationtime_ms":0.03898143768310547,)"
+    R"("utc_offset_seconds":-14400,"timezone":"America/New_York","timezone_abbreviation":"GMT-4",)"
+    R"("elevation":32.0,"daily_units":{"time":"iso8601","weather_code":"wmo code",)"
+    R"("temperature_2m_max":"°C","temperature_2m_min":"°C"},"daily":{"time":["2026-10-18",)"
+    R"("2026-10-19","2026-10-20","2026-10-21","2026-10-22","2026-10-23","2026-10-24"],)"
+    R"("weather_code":[95,80,3,2,61,1,0],"temperature_2m_max":[30.2,29.6,28.1,27.9,28.4,29.0,29.3],)"
+    R"("temperature_2m_min":[22.4,21.9,20.3,19.8,20.7,21.2,21.6]}})";
+
+static const char JOKE_SINGLE[] = R"({
+    "error": false,
+    "category": "Programming",
+    "type": "single",
+    "joke": "A SQL query walks into a bar, walks up to two tables and asks, \"Can I join you?\"",
+    "flags": {
+        "nsfw": false,
+        "religious": false,
+        "political": false,
+        "racist": false,
+        "sexist": false,
+        "explicit": false
+    },
+    "id": 11,
+    "safe": true,
+    "lang": "en"
+})";
+
+static const char JOKE_TWOPART[] = R"({
+    "error": false,
+    "category": "Pun",
+    "type": "twopart",
+    "setup": "What's the best thing about Switzerland?",
+    "delivery": "I don't know, but the flag is a big plus.\n\t— Anonymous",
+    "flags": {
+        "nsfw": false,
+        "religious": false,
+        "political": false,
+        "racist": false,
+        "sexist": false,
+        "explicit": false
+    },
+    "id": 196,
+    "safe": true,
+    "lang": "en"
+})";
+
+static const char MAIL_INBOX[] =
+    R"({"success":true,"emails":[{"to":"esperthertu_post_office@storyboardacs.com",)"
+    R"("from":"friend@example.com","subject":"Re: Esperthertu Post Office Delivery!",)"
+    R"("body":"Hi Bob \ud83d\ude00\r\nSee https:\/\/example.com\/map \u2014 caf\u00e9 at noon.\r\n\r\n)"
+    R"(A message from Bob - The Adventurer:","messageId":"UID0000a1f3","displayName":"bob",)"
+    R"("recipient":"bob"},{"to":"esperthertu_post_office@storyboardacs.com",)"
+    R"("from":"\"Ann Lee\" <ann@example.com>","subject":"Hello","body":"Tabs\tand \\backslashes\\",)"
+    R"("messageId":"UID0000a1f4","displayName":"ann","recipient":""}],"count":2,"errors":[]})";
+
+static const char DOWNLOAD_LIST[] = R"([
+    {
+        "name": "rooms.txt",
+        "size": 204877,
+        "modified": "2026-10-12 14:03:51"
+    },
+    {
+        "name": "npcs.vxd",
+        "size": 18433,
+        "modified": "2026-10-09 08:40:02"
+    },
+    {
+        "name": "quest_dialog.txt",
+        "size": 3120,
+        "modified": "2026-09-30 22:17:45"
+    }
+])";
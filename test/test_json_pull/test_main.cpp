@@ -0,0 +1,410 @@
+// Streaming JSON path extractor (src/JsonPull.h)
+//
+//   pio test -e native -f test_json_pull
+//
+// Decodes the bodies the MUD's endpoints send (payloads.h), fed whole, in
+// two pieces split at every offset, and a byte at a time.  Peak heap is
+// compared with the path it replaced: getString() into one String, then
+// searching that.
+
+#include <unity.h>
+#include <JsonPull.h>
+#include "payloads.h"
+
+#include <stdlib.h>
+#include <new>
+
+// ------------------------------------------------------------
+// Heap accounting: every operator new in the program goes through here
+// ------------------------------------------------------------
+
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+
+void *operator new(size_t size) {
+    size_t *block = (size_t *)malloc(size + sizeof(max_align_t));
+    if (!block) throw std::bad_alloc();
+    *block = size;
+    heapInUse += size;
+    if (heapInUse > heapPeak) heapPeak = heapInUse;
+    return (char *)block + sizeof(max_align_t);
+}
+
+void operator delete(void *p) noexcept {
+    if (!p) return;
+    size_t *block = (size_t *)((char *)p - sizeof(max_align_t));
+    heapInUse -= *block;
+    free(block);
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+static void heapMark() { heapPeak = heapInUse; }
+static size_t heapUsedSinceMark(size_t base) { return heapPeak - base; }
+
+// ------------------------------------------------------------
+// Helpers
+// ------------------------------------------------------------
+
+static bool parse(JsonPathExtractor &json, const char *text) {
+    return jsonExtract(json, String(text));
+}
+
+// Feed in HTTPClient::writeToStream()-sized pieces, as the HTTP worker does
+static void feedStreamed(JsonPathExtractor &json, const char *text, size_t piece = 1024) {
+    json.reset();
+    size_t len = strlen(text);
+    for (size_t at = 0; at < len; at += piece) {
+        size_t n = len - at < piece ? len - at : piece;
+        json.write((const uint8_t *)text + at, n);
+    }
+    json.finish();
+}
+
+static String decodeString(const char *jsonString) {
+    JsonPathExtractor json;
+    json.want("s");
+    String doc = String("{\"s\":") + jsonString + "}";
+    TEST_ASSERT_TRUE(jsonExtract(json, doc));
+    return json.get("s");
+}
+
+void setUp() {}
+void tearDown() {}
+
+// ------------------------------------------------------------
+// \uXXXX decoding
+// ------------------------------------------------------------
+
+void test_bmp_escapes_become_utf8() {
+    TEST_ASSERT_EQUAL_STRING("caf\xC3\xA9", decodeString("\"caf\\u00e9\"").c_str());
+    TEST_ASSERT_EQUAL_STRING("\xE2\x82\xAC" "5", decodeString("\"\\u20AC5\"").c_str());
+    TEST_ASSERT_EQUAL_STRING("A", decodeString("\"\\u0041\"").c_str());
+}
+
+void test_surrogate_pair_is_one_four_byte_character() {
+    TEST_ASSERT_EQUAL_STRING("\xF0\x9F\x98\x80", decodeString("\"\\ud83d\\ude00\"").c_str());
+    TEST_ASSERT_EQUAL_STRING("a\xF0\x9F\x8E\x89z", decodeString("\"a\\uD83C\\uDF89z\"").c_str());
+    TEST_ASSERT_EQUAL_STRING("\xF4\x8F\xBF\xBF", decodeString("\"\\udbff\\udfff\"").c_str());   // U+10FFFF
+}
+
+void test_unpaired_surrogates_become_replacement_character() {
+    const char *fffd = "\xEF\xBF\xBD";
+    TEST_ASSERT_EQUAL_STRING((String(fffd) + "x").c_str(), decodeString("\"\\ud83dx\"").c_str());
+    TEST_ASSERT_EQUAL_STRING(fffd, decodeString("\"\\ud83d\"").c_str());
+    TEST_ASSERT_EQUAL_STRING((String("a") + fffd + "b").c_str(), decodeString("\"a\\ude00b\"").c_str());
+    TEST_ASSERT_EQUAL_STRING((String(fffd) + "\n").c_str(), decodeString("\"\\ud83d\\n\"").c_str());
+    TEST_ASSERT_EQUAL_STRING((String(fffd) + "\xF0\x9F\x98\x80").c_str(),
+                             decodeString("\"\\ud83d\\ud83d\\ude00\"").c_str());
+}
+
+void test_surrogates_in_keys() {
+    JsonPathExtractor json;
+    json.want("\xF0\x9F\x98\x80.n");
+    TEST_ASSERT_TRUE(parse(json, "{\"\\ud83d\\ude00\":{\"n\":1}}"));
+    TEST_ASSERT_EQUAL_STRING("1", json.get("\xF0\x9F\x98\x80.n").c_str());
+}
+
+void test_pair_split_across_writes() {
+    const char *doc = "{\"s\":\"x\\ud83d\\ude00y\"}";
+    for (size_t cut = 1; cut < strlen(doc); cut++) {
+        JsonPathExtractor json;
+        json.want("s");
+        json.reset();
+        json.write((const uint8_t *)doc, cut);
+        json.write((const uint8_t *)doc + cut, strlen(doc) - cut);
+        json.finish();
+        TEST_ASSERT_TRUE(json.ok());
+        TEST_ASSERT_EQUAL_STRING("x\xF0\x9F\x98\x80y", json.get("s").c_str());
+    }
+}
+
+// A body cut off mid-escape must not leak into the next one
+void test_reset_after_a_body_cut_inside_a_surrogate() {
+    JsonPathExtractor json;
+    json.want("s");
+    json.reset();
+    const char *cut = "{\"s\":\"\\ud83d";
+    json.write((const uint8_t *)cut, strlen(cut));
+    TEST_ASSERT_TRUE(jsonExtract(json, "{\"s\":\"\\ude00\"}"));
+    TEST_ASSERT_EQUAL_STRING("\xEF\xBF\xBD", json.get("s").c_str());
+
+    const char *midDigits = "{\"s\":\"\\u00";
+    json.reset();
+    json.write((const uint8_t *)midDigits, strlen(midDigits));
+    TEST_ASSERT_TRUE(jsonExtract(json, "{\"s\":\"ab\"}"));
+    TEST_ASSERT_EQUAL_STRING("ab", json.get("s").c_str());
+}
+
+// ------------------------------------------------------------
+// Path patterns
+// ------------------------------------------------------------
+
+void test_patterns_match_indexes_and_keys_exactly() {
+    JsonPathExtractor json;
+    json.want("a[1][2]");
+    json.want("b[]");
+    json.want("c.d");
+    TEST_ASSERT_TRUE(parse(json, "{\"a\":[[0],[0,0,7],[0,0,8]],\"a1\":[[9,9,9]],"
+                                 "\"b\":[1,[2],3],\"c\":{\"dd\":1,\"d\":2},\"cd\":3}"));
+    TEST_ASSERT_EQUAL(4, (int)json.values.size());
+    TEST_ASSERT_EQUAL_STRING("7", json.get("a[1][2]").c_str());
+    TEST_ASSERT_EQUAL_STRING("1", json.get("b[0]").c_str());
+    TEST_ASSERT_EQUAL_STRING("3", json.get("b[2]").c_str());
+    TEST_ASSERT_EQUAL_STRING("2", json.get("c.d").c_str());
+
+    // A multi-digit index is not a prefix match
+    JsonPathExtractor ten;
+    ten.want("[1]");
+    TEST_ASSERT_TRUE(parse(ten, "[0,1,2,3,4,5,6,7,8,9,10,11]"));
+    TEST_ASSERT_EQUAL(1, (int)ten.values.size());
+    TEST_ASSERT_EQUAL_STRING("1", ten.get("[1]").c_str());
+}
+
+// ------------------------------------------------------------
+// The endpoints' own bodies
+// ------------------------------------------------------------
+
+void test_geocode_response() {
+    JsonPathExtractor json;
+    json.want("results[0].latitude");
+    json.want("results[0].longitude");
+    TEST_ASSERT_TRUE(parse(json, GEOCODE_DETROIT));
+    TEST_ASSERT_EQUAL_STRING("42.33143", json.get("results[0].latitude").c_str());
+    TEST_ASSERT_EQUAL_STRING("-83.04575", json.get("results[0].longitude").c_str());
+    TEST_ASSERT_EQUAL(2, (int)json.values.size());
+}
+
+void test_current_weather_response() {
+    JsonPathExtractor json;
+    json.want("current.temperature_2m");
+    json.want("current.weather_code");
+    json.want("daily.temperature_2m_max[]");
+    json.want("daily.temperature_2m_min[]");
+    TEST_ASSERT_TRUE(parse(json, WEATHER_CURRENT));
+    TEST_ASSERT_EQUAL_STRING("11.3", json.get("current.temperature_2m").c_str());
+    TEST_ASSERT_EQUAL_STRING("3", json.get("current.weather_code").c_str());
+    TEST_ASSERT_EQUAL_STRING("16.4", json.get("daily.temperature_2m_max[0]").c_str());
+    TEST_ASSERT_EQUAL_STRING("6.3", json.get("daily.temperature_2m_min[6]").c_str());
+    TEST_ASSERT_FALSE(json.find("current_units.temperature_2m"));   // "°C" not wanted
+}
+
+void test_forecast_response() {
+    JsonPathExtractor json;
+    json.want("daily.weather_code[]");
+    json.want("daily.temperature_2m_max[]");
+    TEST_ASSERT_TRUE(parse(json, WEATHER_FORECAST));
+    TEST_ASSERT_EQUAL_STRING("95", json.get("daily.weather_code[0]").c_str());
+    TEST_ASSERT_EQUAL_STRING("2", json.get("daily.weather_code[3]").c_str());
+    TEST_ASSERT_EQUAL_STRING("29.3", json.get("daily.temperature_2m_max[6]").c_str());
+    TEST_ASSERT_EQUAL(14, (int)json.values.size());
+}
+
+void test_joke_responses() {
+    JsonPathExtractor json;
+    json.want("error");
+    json.want("type");
+    json.want("id");
+    json.want("joke");
+    json.want("setup");
+    json.want("delivery");
+
+    TEST_ASSERT_TRUE(parse(json, JOKE_SINGLE));
+    TEST_ASSERT_EQUAL_STRING("false", json.get("error").c_str());
+    TEST_ASSERT_EQUAL_STRING("single", json.get("type").c_str());
+    TEST_ASSERT_EQUAL_STRING("11", json.get("id").c_str());
+    TEST_ASSERT_FALSE(json.find("id")->isString);
+    TEST_ASSERT_EQUAL_STRING("A SQL query walks into a bar, walks up to two tables and asks, \"Can I join you?\"",
+                             json.get("joke").c_str());
+
+    TEST_ASSERT_TRUE(parse(json, JOKE_TWOPART));
+    TEST_ASSERT_EQUAL_STRING("twopart", json.get("type").c_str());
+    TEST_ASSERT_EQUAL_STRING("What's the best thing about Switzerland?", json.get("setup").c_str());
+    TEST_ASSERT_EQUAL_STRING("I don't know, but the flag is a big plus.\n\t\xE2\x80\x94 Anonymous",
+                             json.get("delivery").c_str());
+}
+
+void test_mail_response() {
+    JsonPathExtractor json;
+    json.want("success");
+    json.want("count");
+    json.want("emails[].from");
+    json.want("emails[].body");
+    json.want("emails[].messageId");
+    json.want("emails[].recipient");
+    TEST_ASSERT_TRUE(parse(json, MAIL_INBOX));
+    TEST_ASSERT_EQUAL_STRING("true", json.get("success").c_str());
+    TEST_ASSERT_EQUAL_STRING("2", json.get("count").c_str());
+    TEST_ASSERT_EQUAL_STRING("Hi Bob \xF0\x9F\x98\x80\r\nSee https://example.com/map \xE2\x80\x94 caf\xC3\xA9 at noon.\r\n\r\n"
+                             "A message from Bob - The Adventurer:",
+                             json.get("emails[0].body").c_str());
+    TEST_ASSERT_EQUAL_STRING("UID0000a1f3", json.get("emails[0].messageId").c_str());
+    TEST_ASSERT_EQUAL_STRING("bob", json.get("emails[0].recipient").c_str());
+    TEST_ASSERT_EQUAL_STRING("\"Ann Lee\" <ann@example.com>", json.get("emails[1].from").c_str());
+    TEST_ASSERT_EQUAL_STRING("Tabs\tand \\backslashes\\", json.get("emails[1].body").c_str());
+    TEST_ASSERT_EQUAL_STRING("", json.get("emails[1].recipient", "missing").c_str());
+}
+
+void test_download_list_response() {
+    JsonPathExtractor json;
+    json.want("[].name");
+    json.want("[].size");
+    json.want("[].modified");
+    TEST_ASSERT_TRUE(parse(json, DOWNLOAD_LIST));
+    TEST_ASSERT_EQUAL_STRING("rooms.txt", json.get("[0].name").c_str());
+    TEST_ASSERT_EQUAL_STRING("204877", json.get("[0].size").c_str());
+    TEST_ASSERT_EQUAL_STRING("quest_dialog.txt", json.get("[2].name").c_str());
+    TEST_ASSERT_EQUAL_STRING("2026-09-30 22:17:45", json.get("[2].modified").c_str());
+    TEST_ASSERT_EQUAL(9, (int)json.values.size());
+}
+
+// Every payload gives the same values whole, in two pieces cut anywhere,
+// and a byte at a time
+void test_payloads_split_at_every_offset() {
+    const char *payloads[] = {GEOCODE_DETROIT, WEATHER_CURRENT, JOKE_TWOPART, MAIL_INBOX, DOWNLOAD_LIST};
+    for (const char *doc : payloads) {
+        JsonPathExtractor whole;
+        for (const char *p : {"results[0].latitude", "current.temperature_2m", "daily.temperature_2m_min[]",
+                              "delivery", "emails[].body", "emails[].from", "[].name", "[].size"})
+            whole.want(p);
+        JsonPathExtractor split = whole;
+        TEST_ASSERT_TRUE(parse(whole, doc));
+        TEST_ASSERT_TRUE(whole.values.size() > 0);
+
+        size_t len = strlen(doc);
+        for (size_t cut = 0; cut <= len; cut++) {
+            split.reset();
+            split.write((const uint8_t *)doc, cut);
+            split.write((const uint8_t *)doc + cut, len - cut);
+            split.finish();
+            TEST_ASSERT_TRUE(split.ok());
+            TEST_ASSERT_EQUAL(whole.values.size(), split.values.size());
+            for (size_t i = 0; i < whole.values.size(); i++)
+                TEST_ASSERT_EQUAL_STRING(whole.values[i].value.c_str(), split.values[i].value.c_str());
+        }
+        feedStreamed(split, doc, 1);
+        TEST_ASSERT_EQUAL(whole.values.size(), split.values.size());
+    }
+}
+
+void test_truncated_and_malformed_bodies_fail() {
+    JsonPathExtractor json;
+    json.want("current.temperature_2m");
+    String cut = String(WEATHER_CURRENT).substring(0, 200);
+    TEST_ASSERT_FALSE(jsonExtract(json, cut));
+    TEST_ASSERT_FALSE(jsonExtract(json, "<html>502 Bad Gateway</html>"));
+    TEST_ASSERT_FALSE(jsonExtract(json, "{\"s\":\"\\uZZZZ\"}"));
+}
+
+// ------------------------------------------------------------
+// Peak heap: streamed extraction vs. buffering the body
+// ------------------------------------------------------------
+
+// What the code before the extractor did: getString() grows one String
+// with the whole body, then the fields are cut out of it with indexOf
+static size_t bufferedPeak(const char *doc, const char *key) {
+    size_t base = heapInUse;
+    heapMark();
+    {
+        String body;
+        size_t len = strlen(doc);
+        for (size_t at = 0; at < len; at += 1024) body.concat(doc + at, len - at < 1024 ? len - at : 1024);
+        String search = String("\"") + key + "\":";
+        int at = body.indexOf(search);
+        String value = at >= 0 ? body.substring(at + search.length(), body.indexOf(',', at)) : String();
+    }
+    return heapUsedSinceMark(base);
+}
+
+static size_t streamedPeak(const char *doc, const char *pattern) {
+    size_t base = heapInUse;
+    heapMark();
+    {
+        JsonPathExtractor json;
+        json.want(pattern);
+        feedStreamed(json, doc);
+        TEST_ASSERT_TRUE(json.ok());
+    }
+    return heapUsedSinceMark(base);
+}
+
+void test_peak_heap_against_buffered_body() {
+    struct Case { const char *name; const char *doc; const char *key; const char *pattern; };
+    const Case cases[] = {
+        {"geocode", GEOCODE_DETROIT, "latitude", "results[0].latitude"},
+        {"current weather", WEATHER_CURRENT, "temperature_2m", "current.temperature_2m"},
+        {"forecast", WEATHER_FORECAST, "weather_code", "daily.weather_code[]"},
+        {"joke", JOKE_SINGLE, "joke", "joke"},
+        {"mail", MAIL_INBOX, "body", "emails[].body"},
+        {"file list", DOWNLOAD_LIST, "name", "[].name"},
+    };
+    for (const Case &c : cases) {
+        size_t buffered = bufferedPeak(c.doc, c.key);
+        size_t streamed = streamedPeak(c.doc, c.pattern);
+        char line[96];
+        snprintf(line, sizeof(line), "%-16s body %5u B  buffered peak %5u B  streamed peak %5u B",
+                 c.name, (unsigned)strlen(c.doc), (unsigned)buffered, (unsigned)streamed);
+        TEST_MESSAGE(line);
+        TEST_ASSERT_TRUE(buffered >= strlen(c.doc));
+    }
+
+    // A 64 KB body with one wanted value: buffering holds all of it, the
+    // extractor holds a few hundred bytes whatever the size
+    String big = "{\"hourly\":{\"temperature_2m\":[";
+    for (int i = 0; i < 16000; i++) big += (i ? ",1.5" : "1.5");
+    big += "]},\"current\":{\"temperature_2m\":11.3}}";
+    size_t buffered = bufferedPeak(big.c_str(), "temperature_2m");
+    size_t streamed = streamedPeak(big.c_str(), "current.temperature_2m");
+    char line[96];
+    snprintf(line, sizeof(line), "%-16s body %5u B  buffered peak %5u B  streamed peak %5u B",
+             "64 KB hourly", (unsigned)big.length(), (unsigned)buffered, (unsigned)streamed);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_TRUE(buffered >= big.length());
+    TEST_ASSERT_LESS_THAN(2048, streamed);
+}
+
+// Values nobody asked for are skipped without touching the heap
+void test_unwanted_values_cost_no_heap() {
+    JsonPathExtractor json;
+    json.want("current.temperature_2m");
+    json.reset();
+    const char *head = "{\"hourly\":{\"temperature_2m\":[";
+    json.write((const uint8_t *)head, strlen(head));
+
+    size_t base = heapInUse;
+    heapMark();
+    for (int i = 0; i < 1000; i++) json.write((const uint8_t *)"1.5,", 4);
+    json.write((const uint8_t *)"\"x\",true,null", 13);
+    TEST_ASSERT_EQUAL(0, (int)heapUsedSinceMark(base));
+
+    const char *tail = "]},\"current\":{\"temperature_2m\":11.3}}";
+    json.write((const uint8_t *)tail, strlen(tail));
+    json.finish();
+    TEST_ASSERT_TRUE(json.ok());
+    TEST_ASSERT_EQUAL_STRING("11.3", json.get("current.temperature_2m").c_str());
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_bmp_escapes_become_utf8);
+    RUN_TEST(test_surrogate_pair_is_one_four_byte_character);
+    RUN_TEST(test_unpaired_surrogates_become_replacement_character);
+    RUN_TEST(test_surrogates_in_keys);
+    RUN_TEST(test_pair_split_across_writes);
+    RUN_TEST(test_reset_after_a_body_cut_inside_a_surrogate);
+    RUN_TEST(test_patterns_match_indexes_and_keys_exactly);
+    RUN_TEST(test_geocode_response);
+    RUN_TEST(test_current_weather_response);
+    RUN_TEST(test_forecast_response);
+    RUN_TEST(test_joke_responses);
+    RUN_TEST(test_mail_response);
+    RUN_TEST(test_download_list_response);
+    RUN_TEST(test_payloads_split_at_every_offset);
+    RUN_TEST(test_truncated_and_malformed_bodies_fail);
+    RUN_TEST(test_peak_heap_against_buffered_body);
+    RUN_TEST(test_unwanted_values_cost_no_heap);
+    return UNITY_END();
+}
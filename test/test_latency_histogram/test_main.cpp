@@ -0,0 +1,88 @@
+// Log-linear latency histograms against exact values
+//
+//   pio test -e native -f test_latency_histogram
+//
+// Buckets must tile the whole range without gaps, each within the stated
+// width, and percentiles read back from two million lognormal samples
+// must land in the bucket of the exact percentile of the sorted samples.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <LatencyHistogram.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+template <typename H>
+static void checkBuckets(double maxWidth) {
+    uint32_t low = 0;
+    for (int i = 0; i < H::BUCKETS; i++) {
+        uint32_t top = H::bucketTop(i);
+        TEST_ASSERT_TRUE(top >= low);
+        TEST_ASSERT_EQUAL(i, H::bucketOf(low));                 // no gap below
+        TEST_ASSERT_EQUAL(i, H::bucketOf(top));
+        if (low >= (uint32_t)H::SUB_BUCKETS) {
+            TEST_ASSERT_TRUE((double)(top - low + 1) / low <= maxWidth);
+        }
+        low = top + 1;
+    }
+    TEST_ASSERT_EQUAL(H::BUCKETS - 1, H::bucketOf(0xFFFFFFFFu));  // past the range: last bucket
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_buckets_are_contiguous_and_narrow() {
+    checkBuckets<LatencyHistogram>(0.125);
+    checkBuckets<CoarseLatencyHistogram>(0.25);
+}
+
+void test_percentiles_match_sorted_samples() {
+    std::mt19937 rng(3);
+    std::lognormal_distribution<double> dist(5.0, 1.5);       // median ~150 us, long tail
+    LatencyHistogram h;
+    std::vector<uint32_t> samples;
+    uint64_t total = 0;
+    for (int i = 0; i < 2000000; i++) {
+        uint32_t us = (uint32_t)dist(rng);
+        samples.push_back(us);
+        total += us;
+        h.record(us);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    TEST_ASSERT_EQUAL(2000000, (int)h.count);                 // exact, though buckets were halved
+    TEST_ASSERT_EQUAL(samples.back(), h.maxUs);
+    TEST_ASSERT_EQUAL((uint32_t)(total / samples.size()), h.averageUs());
+
+    for (double pct : {50.0, 90.0, 99.0, 99.9}) {
+        uint32_t exact = samples[(size_t)(pct / 100 * samples.size()) - 1];
+        uint32_t got = h.percentile(pct);
+        // Halving rounds the buckets down, so allow the neighbouring bucket
+        int off = LatencyHistogram::bucketOf(got) - LatencyHistogram::bucketOf(exact);
+        char msg[64];
+        snprintf(msg, sizeof(msg), "p%.1f exact %u got %u", pct, exact, got);
+        TEST_ASSERT_TRUE_MESSAGE(off >= -1 && off <= 1, msg);
+        TEST_ASSERT_TRUE_MESSAGE(got <= h.maxUs, msg);
+    }
+}
+
+void test_empty_and_reset() {
+    LatencyHistogram h;
+    TEST_ASSERT_EQUAL(0, h.percentile(99));
+    TEST_ASSERT_EQUAL(0, h.averageUs());
+    h.record(1000);
+    TEST_ASSERT_EQUAL(1000, h.percentile(50));                // bucket top capped at the max
+    h.reset();
+    TEST_ASSERT_EQUAL(0, (int)h.count);
+    TEST_ASSERT_EQUAL(0, h.percentile(50));
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_buckets_are_contiguous_and_narrow);
+    RUN_TEST(test_percentiles_match_sorted_samples);
+    RUN_TEST(test_empty_and_reset);
+    return UNITY_END();
+}
@@ -0,0 +1,97 @@
+// Post office poll against a mock inbox on 127.0.0.1
+//
+//   pio test -e native -f test_mail_poll
+//
+// The whole sketch is compiled in with MAIL_POLL_URL pointed at the stub.
+// A letter that cannot be filed must hold the "since=" cursor back, so the
+// server keeps it and sends it again on the next poll.
+
+#include <unity.h>
+#include <Arduino.h>
+#include "../stub_http.h"
+
+static StubHttpServer stub;
+static String stubUrl(const char *path) { return String(stub.url(path).c_str()); }
+
+#define MAIL_POLL_URL stubUrl("/mail")
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+
+static std::string letterJson(const char *id, const char *recipient) {
+    return std::string("{\"from\":\"friend@example.com\",\"subject\":\"Hi\",\"body\":\"Hello there\",") +
+           "\"messageId\":\"" + id + "\",\"displayName\":\"" + recipient + "\",\"recipient\":\"" + recipient + "\"}";
+}
+
+// The inbox holds three letters; "since=<id>" drops everything up to <id>
+static std::string mockInbox(const StubRequest &req) {
+    static const char *ids[] = {"UID01", "UID02", "UID03"};
+    static const char *to[] = {"ann", "dead/bob", "ann"};
+    size_t since = req.path.find("since=");
+    int first = 0;
+    if (since != std::string::npos) {
+        std::string cursor = req.path.substr(since + 6);
+        for (int i = 0; i < 3; i++) if (cursor == ids[i]) first = i + 1;
+    }
+    std::string body = "{\"success\":true,\"emails\":[";
+    for (int i = first; i < 3; i++) body += (i > first ? "," : "") + letterJson(ids[i], to[i]);
+    body += "],\"count\":" + std::to_string(3 - first) + ",\"errors\":[]}";
+    return stubResponse(200, body, "ETag: \"inbox-" + std::to_string(first) + "\"\r\n");
+}
+
+static void poll() {
+    startMailPoll();
+    for (int i = 0; i < 500 && mailPoll.jobId != 0; i++) {
+        httpJobPump();
+        delay(10);
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_unfiled_letter_holds_the_cursor() {
+    // /mail_dead/bob.txt has no parent directory, so filing to that box
+    // fails the way a full flash would
+    poll();
+    TEST_ASSERT_EQUAL_STRING("UID01", mailPoll.lastMessageId.c_str());
+    TEST_ASSERT_EQUAL(1, mailPoll.filed);
+    TEST_ASSERT_EQUAL(1, mailPoll.failures);
+    TEST_ASSERT_EQUAL_STRING("", mailPoll.etag.c_str());
+    TEST_ASSERT_EQUAL(1, mailWaiting("ann"));       // UID03 was not filed past the failure
+
+    File f = LittleFS.open(MAIL_CURSOR_PATH, "r");
+    f.readStringUntil('\n');
+    String cursor = f.readStringUntil('\n');
+    cursor.trim();
+    f.close();
+    TEST_ASSERT_EQUAL_STRING("UID01", cursor.c_str());
+}
+
+void test_next_poll_fetches_it_again() {
+    LittleFS.mkdir("/mail_dead");                   // the box can be written now
+    poll();
+    StubRequest sent = stub.last();
+    TEST_ASSERT_TRUE(sent.path.find("since=UID01") != std::string::npos);
+    TEST_ASSERT_EQUAL_STRING("", sent.ifNoneMatch.c_str());
+
+    TEST_ASSERT_EQUAL_STRING("UID03", mailPoll.lastMessageId.c_str());
+    TEST_ASSERT_EQUAL(3, mailPoll.filed);
+    TEST_ASSERT_EQUAL(1, mailPoll.failures);
+    TEST_ASSERT_EQUAL_STRING("\"inbox-1\"", mailPoll.etag.c_str());
+    TEST_ASSERT_EQUAL(1, mailWaiting("dead/bob"));
+    TEST_ASSERT_EQUAL(2, mailWaiting("ann"));
+}
+
+int main() {
+    TempLittleFS fs("mail");
+    LittleFS.open("/user_ann.txt", "w").close();
+    LittleFS.mkdir("/user_dead");
+    LittleFS.open("/user_dead/bob.txt", "w").close();
+    stub.start(mockInbox);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_unfiled_letter_holds_the_cursor);
+    RUN_TEST(test_next_poll_fetches_it_again);
+    return UNITY_END();
+}
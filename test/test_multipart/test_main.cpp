@@ -0,0 +1,189 @@
+// Streaming multipart/form-data parser with crafted bodies
+//
+//   pio test -e native -f test_multipart
+//
+// Every body is fed whole, a byte at a time, and split in two at every
+// offset; the parts seen must be the same each way.
+
+#include <unity.h>
+#include <MultipartStream.h>
+#include <string>
+#include <vector>
+
+struct Part {
+    std::string name, filename, data;
+};
+
+struct Result {
+    std::vector<Part> parts;
+    size_t largestPiece = 0;
+    bool finished = false;
+    bool error = false;
+};
+
+// Feed body in pieces that start at the given offsets (plus 0)
+static Result parse(const std::string &boundary, const std::string &body, std::vector<size_t> cuts = {},
+                    std::function<bool(const String &)> accept = nullptr) {
+    Result r;
+    MultipartParser mp;
+    mp.begin(boundary.c_str());
+    mp.onPartBegin = [&](const String &name, const String &filename) {
+        r.parts.push_back({name.c_str(), filename.c_str(), ""});
+        return accept ? accept(name) : true;
+    };
+    mp.onData = [&](const uint8_t *data, size_t len) {
+        r.parts.back().data.append((const char *)data, len);
+        if (len > r.largestPiece) r.largestPiece = len;
+        return true;
+    };
+    cuts.push_back(body.size());
+    size_t from = 0;
+    for (size_t cut : cuts) {
+        mp.feed((const uint8_t *)body.data() + from, cut - from);
+        from = cut;
+    }
+    r.finished = mp.finished();
+    r.error = mp.hasError();
+    return r;
+}
+
+static bool same(const Result &a, const Result &b) {
+    if (a.finished != b.finished || a.error != b.error || a.parts.size() != b.parts.size()) return false;
+    for (size_t i = 0; i < a.parts.size(); i++) {
+        if (a.parts[i].name != b.parts[i].name || a.parts[i].filename != b.parts[i].filename ||
+            a.parts[i].data != b.parts[i].data) return false;
+    }
+    return true;
+}
+
+// Whole, byte by byte, and split at every offset must all agree with want
+static void checkAllSplits(const std::string &boundary, const std::string &body, const Result &want) {
+    TEST_ASSERT_TRUE_MESSAGE(same(parse(boundary, body), want), "whole body");
+
+    std::vector<size_t> bytes;
+    for (size_t i = 1; i < body.size(); i++) bytes.push_back(i);
+    TEST_ASSERT_TRUE_MESSAGE(same(parse(boundary, body, bytes), want), "byte at a time");
+
+    for (size_t i = 1; i < body.size(); i++) {
+        if (!same(parse(boundary, body, {i}), want)) {
+            char msg[64];
+            snprintf(msg, sizeof(msg), "split at offset %zu of %zu", i, body.size());
+            TEST_FAIL_MESSAGE(msg);
+        }
+    }
+}
+
+static const std::string B = "----WebKitFormBoundary7MA4YWxkTrZu0gW";
+
+static std::string filePart(const std::string &name, const std::string &filename, const std::string &data) {
+    return "--" + B + "\r\nContent-Disposition: form-data; name=\"" + name + "\"; filename=\"" + filename +
+           "\"\r\nContent-Type: application/octet-stream\r\n\r\n" + data + "\r\n";
+}
+
+static Result expect(std::vector<Part> parts, bool finished = true, bool error = false) {
+    Result r;
+    r.parts = parts;
+    r.finished = finished;
+    r.error = error;
+    return r;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_two_files_at_every_split() {
+    std::string body = filePart("file", "rooms.txt", "1|Town Square|A bustling square.") +
+                       filePart("file", "npcs.txt", "guard|10|5") + "--" + B + "--\r\n";
+    checkAllSplits(B, body, expect({{"file", "rooms.txt", "1|Town Square|A bustling square."},
+                                    {"file", "npcs.txt", "guard|10|5"}}));
+}
+
+void test_crlf_inside_data_is_kept() {
+    // CRLF line ends, a bare CR, a bare LF, a trailing CRLF before the
+    // delimiter, and near-misses of the delimiter itself
+    std::string data = "line one\r\nline two\rthree\nfour\r\n\r\n--" + B.substr(0, 10) + "x\r\n-\r\n--\r\n";
+    std::string body = filePart("file", "quest_dialog.txt", data) + "--" + B + "--";
+    checkAllSplits(B, body, expect({{"file", "quest_dialog.txt", data}}));
+}
+
+void test_boundary_text_without_leading_crlf_is_data() {
+    std::string data = "--" + B + " is only a delimiter after CRLF";
+    std::string body = filePart("file", "a.txt", data) + "--" + B + "--";
+    checkAllSplits(B, body, expect({{"file", "a.txt", data}}));
+}
+
+void test_preamble_and_epilogue_are_ignored() {
+    std::string body = "This is the preamble.\r\n" + filePart("file", "a.txt", "abc") + "--" + B +
+                       "--\r\nThis is the epilogue.\r\n";
+    checkAllSplits(B, body, expect({{"file", "a.txt", "abc"}}));
+}
+
+void test_missing_final_dashes_is_not_finished() {
+    Part part = {"file", "items.txt", "sword|3"};
+
+    // Body stops after the data: the part never ended, so its buffered
+    // (sub-chunk) data was not handed over either
+    std::string body = filePart("file", "items.txt", "sword|3");
+    checkAllSplits(B, body, expect({{"file", "items.txt", ""}}, false));
+
+    // Delimiter, but no closing "--"
+    body = filePart("file", "items.txt", "sword|3") + "--" + B;
+    checkAllSplits(B, body, expect({part}, false));
+
+    // Delimiter followed by CRLF: another part was expected
+    body = filePart("file", "items.txt", "sword|3") + "--" + B + "\r\n";
+    checkAllSplits(B, body, expect({part}, false));
+
+    // One dash only
+    body = filePart("file", "items.txt", "sword|3") + "--" + B + "-";
+    checkAllSplits(B, body, expect({part}, false));
+}
+
+void test_garbage_after_delimiter_is_an_error() {
+    std::string body = filePart("file", "a.txt", "abc") + "--" + B + "X";
+    checkAllSplits(B, body, expect({{"file", "a.txt", "abc"}}, false, true));
+}
+
+void test_large_part_arrives_in_chunks() {
+    std::string data;
+    for (int i = 0; i < 5000; i++) data += (char)('a' + i % 26);
+    std::string body = filePart("file", "big.txt", data) + "--" + B + "--";
+    Result r = parse(B, body, {1, 700, 2100, 2101, 4000});
+    TEST_ASSERT_TRUE(r.finished);
+    TEST_ASSERT_EQUAL(1, (int)r.parts.size());
+    TEST_ASSERT_TRUE(r.parts[0].data == data);
+    TEST_ASSERT_EQUAL(MULTIPART_CHUNK, r.largestPiece);
+}
+
+void test_declined_part_is_skipped() {
+    std::string body = "--" + B + "\r\nContent-Disposition: form-data; name=\"note\"\r\n\r\nhello\r\n" +
+                       filePart("file", "a.txt", "abc") + "--" + B + "--";
+    Result r = parse(B, body, {}, [](const String &name) { return name == "file"; });
+    TEST_ASSERT_TRUE(r.finished);
+    TEST_ASSERT_EQUAL(2, (int)r.parts.size());
+    TEST_ASSERT_EQUAL_STRING("note", r.parts[0].name.c_str());
+    TEST_ASSERT_EQUAL_STRING("", r.parts[0].data.c_str());
+    TEST_ASSERT_EQUAL_STRING("abc", r.parts[1].data.c_str());
+}
+
+void test_overlong_header_line_is_an_error() {
+    std::string body = "--" + B + "\r\nContent-Disposition: form-data; name=\"" +
+                       std::string(MULTIPART_MAX_HEADER_LINE, 'n') + "\"\r\n\r\nx\r\n--" + B + "--";
+    Result r = parse(B, body);
+    TEST_ASSERT_FALSE(r.finished);
+    TEST_ASSERT_TRUE(r.error);
+}
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_two_files_at_every_split);
+    RUN_TEST(test_crlf_inside_data_is_kept);
+    RUN_TEST(test_boundary_text_without_leading_crlf_is_data);
+    RUN_TEST(test_preamble_and_epilogue_are_ignored);
+    RUN_TEST(test_missing_final_dashes_is_not_finished);
+    RUN_TEST(test_garbage_after_delimiter_is_an_error);
+    RUN_TEST(test_large_part_arrives_in_chunks);
+    RUN_TEST(test_declined_part_is_skipped);
+    RUN_TEST(test_overlong_header_line_is_an_error);
+    return UNITY_END();
+}
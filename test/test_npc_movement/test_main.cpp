@@ -0,0 +1,150 @@
+// Mobile NPC movement at 50, 500 and 2000 NPCs
+//
+//   pio test -e native -f test_npc_movement
+//
+// The whole sketch is compiled in, with a pool of 2000.  NPCs wander a
+// 64x64 grid for 30 simulated minutes, one movement tick every TICK_MS;
+// in the last run a tenth of them start up to 20 rooms from their spawn
+// and must walk home.  At the end every NPC must be within its wander
+// radius and found in its room's index.  The time per tick is printed
+// (average, p99.9, max), and p99.9 must stay under TICK_BUDGET_NS.  A
+// tick looks at a fixed number of pool slots and takes a bounded number
+// of steps, so its cost grows far slower than the NPC count; walking home
+// adds one bounded slice of search a tick.  The max is printed only: a
+// single tick is at the mercy of the host scheduler.
+
+#define MAX_NPCS 2000
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+static const int GRID = 64;
+static const int GRID_X = 200;
+static const int GRID_Y = 200;
+
+// p99.9 per movement tick on the host, a few times what the walk-home
+// run measures; a tick that rebuilds a whole field misses it
+static const double TICK_BUDGET_NS = 500000;
+
+// Every room has all eight flat exits that stay on the grid (north is -y)
+static void writeGrid() {
+    File f = LittleFS.open("/rooms.txt", "w");
+    f.println("x,y,z,name,long_desc,ex_n,ex_s,ex_e,ex_w,ex_ne,ex_nw,ex_se,ex_sw,ex_u,ex_d");
+    for (int x = 0; x < GRID; x++) {
+        for (int y = 0; y < GRID; y++) {
+            bool n = y > 0, s = y + 1 < GRID, e = x + 1 < GRID, w = x > 0;
+            f.printf("%d,%d,50,Field,A field.,%d,%d,%d,%d,%d,%d,%d,%d,0,0\n", GRID_X + x, GRID_Y + y,
+                     n, s, e, w, n && e, n && w, s && e, s && w);
+        }
+    }
+    f.close();
+    loadRoomGraph();
+}
+
+static void spawnNpcs(int count, bool displaced) {
+    npcInstances.clear();
+    npcMoveCursor = 0;
+    for (int i = 0; i < count; i++) {
+        NpcInstance n;
+        n.npcId = "rat";
+        n.templateIndex = findNpcTemplate("rat");
+        n.x = n.spawnX = GRID_X + rand() % GRID;
+        n.y = n.spawnY = GRID_Y + rand() % GRID;
+        n.z = n.spawnZ = 50;
+        if (displaced && i % 10 == 0) {         // must walk home first
+            n.spawnX = std::min(std::max(n.x + rand() % 41 - 20, GRID_X), GRID_X + GRID - 1);
+            n.spawnY = std::min(std::max(n.y + rand() % 41 - 20, GRID_Y), GRID_Y + GRID - 1);
+        }
+        n.alive = true;
+        n.mobile = true;
+        n.targetPlayer = -1;
+        TEST_ASSERT_NOT_NULL(npcInstances.add(n));
+    }
+}
+
+// A few players about, so leave/arrive text is built now and then
+static void seatPlayers() {
+    for (int i = 0; i < 5; i++) {
+        Player &p = players[i];
+        initPlayer(p);
+        p.active = p.loggedIn = true;
+        p.roomX = GRID_X + rand() % GRID;
+        p.roomY = GRID_Y + rand() % GRID;
+        p.roomZ = 50;
+    }
+}
+
+static void runMovement(int count, bool displaced) {
+    srand(7);
+    randomSeed(7);
+    spawnNpcs(count, displaced);
+    seatPlayers();
+
+    std::vector<int> startX(count), startY(count);
+    for (int i = 0; i < count; i++) {
+        startX[i] = npcInstances[i].x;
+        startY[i] = npcInstances[i].y;
+    }
+
+    const long TICKS = 30L * 60000 / TICK_MS;
+    std::vector<double> ns;
+    ns.reserve(TICKS);
+    for (long t = 1; t <= TICKS; t++) {
+        auto start = std::chrono::steady_clock::now();
+        updateNpcMovement(t * TICK_MS);
+        ns.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    int moved = 0;
+    for (int i = 0; i < count; i++) {
+        NpcInstance &n = npcInstances[i];
+        if (n.x != startX[i] || n.y != startY[i]) moved++;
+        TEST_ASSERT_TRUE(abs(n.x - n.spawnX) <= NPC_WANDER_RADIUS);
+        TEST_ASSERT_TRUE(abs(n.y - n.spawnY) <= NPC_WANDER_RADIUS);
+        bool indexed = false;
+        for (NpcInstance *here : npcInstances.at(n.x, n.y, n.z)) indexed |= here == &n;
+        TEST_ASSERT_TRUE(indexed);
+    }
+    TEST_ASSERT_TRUE(moved > count * 9 / 10);
+
+    double total = 0;
+    for (double v : ns) total += v;
+    std::sort(ns.begin(), ns.end());
+    char msg[120];
+    snprintf(msg, sizeof(msg), "npcs=%5d%s  avg=%5.0f ns/tick  p99.9=%7.0f ns  max=%7.0f ns  moved=%d",
+             count, displaced ? " (10% away)" : "", total / ns.size(), ns[(size_t)(ns.size() * 0.999)],
+             ns.back(), moved);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_TRUE_MESSAGE(ns[(size_t)(ns.size() * 0.999)] < TICK_BUDGET_NS, "p99.9 tick over budget");
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_50_npcs() { runMovement(50, false); }
+void test_500_npcs() { runMovement(500, false); }
+void test_2000_npcs() { runMovement(2000, false); }
+void test_npcs_out_of_range_walk_home() { runMovement(2000, true); }
+
+int main() {
+    TempLittleFS fs("movement");
+    allocateSessionPool();
+
+    npcDefs["rat"].attributes = {{"name", "rat"}, {"hp", "5"}};
+    compileNpcTemplates();
+    writeGrid();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_50_npcs);
+    RUN_TEST(test_500_npcs);
+    RUN_TEST(test_2000_npcs);
+    RUN_TEST(test_npcs_out_of_range_walk_home);
+    return UNITY_END();
+}
@@ -0,0 +1,164 @@
+// NPC pool and its per-voxel index against a brute-force scan
+//
+//   pio test -e native -f test_npc_pool
+//
+// The whole sketch is compiled in.  NPCs are moved and killed at random;
+// after every step a room query must list exactly the live NPCs a scan of
+// the whole pool finds there, in the same (id) order.  Handles must stop
+// resolving once their slot is refilled or its NPC respawns, and a player
+// fighting such a slot must drop out of combat.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include <cstdlib>
+
+static NpcPool pool;
+
+// The live NPCs at x,y,z, the slow way
+static std::vector<NpcInstance *> scan(int x, int y, int z) {
+    std::vector<NpcInstance *> out;
+    for (auto &n : pool) {
+        if (n.alive && n.x == x && n.y == y && n.z == z) out.push_back(&n);
+    }
+    return out;
+}
+
+static void checkRoom(int x, int y, int z) {
+    std::vector<NpcInstance *> want = scan(x, y, z);
+    NpcRoomList got = pool.at(x, y, z);
+    TEST_ASSERT_EQUAL((int)want.size(), got.count);
+    for (int i = 0; i < got.count; i++) TEST_ASSERT_TRUE(got.items[i] == want[i]);
+}
+
+static NpcInstance npcAt(int x, int y, int z) {
+    NpcInstance n;
+    n.x = n.spawnX = x;
+    n.y = n.spawnY = y;
+    n.z = n.spawnZ = z;
+    n.alive = true;
+    return n;
+}
+
+void setUp() {
+    pool.clear();
+    srand(1);
+}
+
+void tearDown() {}
+
+void test_add_stops_at_capacity() {
+    for (int i = 0; i < MAX_NPCS + 10; i++) {
+        NpcInstance *added = pool.add(npcAt(i % 5, 0, 50));
+        TEST_ASSERT_EQUAL(i < MAX_NPCS, added != nullptr);
+        if (added) TEST_ASSERT_EQUAL(i, added->poolId);
+    }
+    TEST_ASSERT_EQUAL(MAX_NPCS, pool.size());
+}
+
+void test_room_queries_match_a_scan() {
+    for (int i = 0; i < MAX_NPCS; i++) pool.add(npcAt(rand() % 5, rand() % 5, 50));
+
+    for (int step = 0; step < 20000; step++) {
+        NpcInstance &n = pool[rand() % MAX_NPCS];
+        if (rand() % 7 == 0) n.alive = !n.alive;
+        pool.moveTo(n, rand() % 5, rand() % 5, 50 + rand() % 2);
+        checkRoom(n.x, n.y, n.z);
+        checkRoom(rand() % 5, rand() % 5, 50 + rand() % 2);
+    }
+    for (int x = 0; x < 5; x++) {
+        for (int y = 0; y < 5; y++) {
+            checkRoom(x, y, 50);
+            checkRoom(x, y, 51);
+        }
+    }
+}
+
+void test_slots_never_move() {
+    for (int i = 0; i < 20; i++) pool.add(npcAt(i, 0, 50));
+    NpcInstance *fifth = &pool[5];
+    for (int i = 0; i < 20; i++) pool.add(npcAt(i, 1, 50));
+    pool.moveTo(*fifth, 9, 9, 50);
+    TEST_ASSERT_TRUE(fifth == &pool[5]);
+    TEST_ASSERT_TRUE(pool.at(9, 9, 50).items[0] == fifth);
+}
+
+void test_clear_leaves_stale_pointers_on_a_dead_npc() {
+    for (int i = 0; i < 10; i++) pool.add(npcAt(1, 1, 50));
+    NpcInstance *stale = &pool[3];
+    pool.clear();
+    TEST_ASSERT_FALSE(stale->alive);
+    TEST_ASSERT_EQUAL(0, pool.size());
+    TEST_ASSERT_TRUE(pool.at(1, 1, 50).empty());
+}
+
+void test_handles_go_stale_when_the_slot_moves_on() {
+    for (int i = 0; i < 10; i++) pool.add(npcAt(1, 1, 50));
+    NpcHandle h = pool.handle(pool[3]);
+    TEST_ASSERT_TRUE(pool.get(h) == &pool[3]);
+
+    // Moving, dying and other NPCs arriving keep it
+    pool.moveTo(pool[3], 2, 2, 50);
+    pool[3].alive = false;
+    pool.add(npcAt(1, 1, 50));
+    TEST_ASSERT_TRUE(pool.get(h) == &pool[3]);
+
+    // A respawn is a new NPC as far as old handles go
+    pool.renew(pool[3]);
+    pool[3].alive = true;
+    TEST_ASSERT_NULL(pool.get(h));
+    NpcHandle reborn = pool.handle(pool[3]);
+    TEST_ASSERT_TRUE(pool.get(reborn) == &pool[3]);
+
+    // Refilling the pool reuses the slot, not the handle
+    pool.clear();
+    TEST_ASSERT_NULL(pool.get(reborn));
+    for (int i = 0; i < 10; i++) pool.add(npcAt(5, 5, 50));
+    TEST_ASSERT_NULL(pool.get(reborn));
+    TEST_ASSERT_NULL(pool.get(NpcHandle()));
+}
+
+void test_combat_ends_when_the_target_slot_is_refilled() {
+    npcDefs["rat"].attributes = {{"name", "rat"}, {"hp", "5"}};
+    compileNpcTemplates();
+
+    NpcInstance rat = npcAt(1, 1, 50);
+    rat.npcId = "rat";
+    rat.templateIndex = findNpcTemplate("rat");
+    rat.hp = 5;
+    rat.targetPlayer = -1;
+    npcInstances.clear();
+    NpcInstance *first = npcInstances.add(rat);
+
+    Player &p = players[0];
+    initPlayer(p);
+    p.active = p.loggedIn = true;
+    p.roomX = p.roomY = 1;
+    p.roomZ = 50;
+    p.inCombat = true;
+    p.combatTarget = npcInstances.handle(*first);
+
+    // The world is reset and a fresh rat lands in the same slot and room
+    npcInstances.clear();
+    NpcInstance *second = npcInstances.add(rat);
+    TEST_ASSERT_TRUE(first == second);
+
+    doCombatRound(p, 0);
+    TEST_ASSERT_FALSE(p.inCombat);
+    TEST_ASSERT_EQUAL(5, second->hp);                  // never hit
+    TEST_ASSERT_NULL(npcInstances.get(p.combatTarget));
+}
+
+int main() {
+    allocateSessionPool();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_add_stops_at_capacity);
+    RUN_TEST(test_room_queries_match_a_scan);
+    RUN_TEST(test_slots_never_move);
+    RUN_TEST(test_clear_leaves_stale_pointers_on_a_dead_npc);
+    RUN_TEST(test_handles_go_stale_when_the_slot_moves_on);
+    RUN_TEST(test_combat_ends_when_the_target_slot_is_refilled);
+    return UNITY_END();
+}
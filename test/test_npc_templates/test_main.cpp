@@ -0,0 +1,133 @@
+// Compiled NPC templates against the attribute map they replace
+//
+//   pio test -e native -f test_npc_templates
+//
+// The whole sketch is compiled in.  A sample /npcs.vxd (full definitions,
+// missing keys, odd case and spacing, values that are not numbers) is
+// loaded the way setup() does, and every template must hold what the old
+// per-use lookups read from npcDefs: atoi of the value, or the same
+// fallback when the key is absent.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+
+static const char *SAMPLE_NPCS =
+    "# sample definitions\n"
+    "goblin_warrior|monster|name=Goblin Warrior|hp=10|attack=3|defense=7|gold=5|aggressive=1|xp=25"
+    "|desc=A snarling goblin.|dialog_1=You dare challenge me?|dialog_2=Prepare to die!|dialog_3=Taste my blade!\n"
+    "\n"
+    "rat|animal|name=rat|hp=5\n"
+    "shopkeeper|merchant| Name = Old Tom |HP= 40 |aggressive=0|dialog_2=Fine wares!\n"
+    "blob|monster\n"
+    "wisp|spirit|aggressive=yes|xp=abc|attack=-2|gold=12coins|defense=\n";
+
+// What the code before the templates did with a key
+static int oldNumber(const NpcDefinition &def, const char *key, int fallback) {
+    auto it = def.attributes.find(key);
+    return it != def.attributes.end() ? atoi(it->second.c_str()) : fallback;
+}
+
+static String oldText(const NpcDefinition &def, const char *key, const char *fallback) {
+    auto it = def.attributes.find(key);
+    return String(it != def.attributes.end() ? it->second.c_str() : fallback);
+}
+
+static const NpcTemplate &templateFor(const char *npcId) {
+    int index = findNpcTemplate(npcId);
+    TEST_ASSERT_TRUE_MESSAGE(index >= 0, npcId);
+    return npcTemplates[index];
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_every_template_matches_the_attribute_map() {
+    TEST_ASSERT_EQUAL(5, (int)npcDefs.size());
+    TEST_ASSERT_EQUAL((int)npcDefs.size(), (int)npcTemplates.size());
+
+    for (auto &pair : npcDefs) {
+        const NpcDefinition &def = pair.second;
+        const NpcTemplate &t = templateFor(pair.first.c_str());
+        TEST_ASSERT_EQUAL_STRING(oldText(def, "name", "creature").c_str(), t.name.c_str());
+        TEST_ASSERT_EQUAL_STRING(oldText(def, "desc", "").c_str(), t.desc.c_str());
+        TEST_ASSERT_EQUAL(oldNumber(def, "hp", 1), t.hp);
+        TEST_ASSERT_EQUAL(oldNumber(def, "gold", 0), t.gold);
+        TEST_ASSERT_EQUAL(oldNumber(def, "attack", 1), t.attack);
+        TEST_ASSERT_EQUAL(oldNumber(def, "defense", 5), t.defense);
+        TEST_ASSERT_EQUAL(oldNumber(def, "xp", 5), t.xp);
+        TEST_ASSERT_EQUAL(oldNumber(def, "aggressive", 0) == 1, t.aggressive);
+        for (int i = 0; i < NPC_DIALOG_LINES; i++) {
+            String key = "dialog_" + String(i + 1);
+            TEST_ASSERT_EQUAL_STRING(oldText(def, key.c_str(), "").c_str(), t.dialog[i].c_str());
+        }
+    }
+}
+
+void test_full_definition() {
+    const NpcTemplate &t = templateFor("goblin_warrior");
+    TEST_ASSERT_EQUAL_STRING("Goblin Warrior", t.name.c_str());
+    TEST_ASSERT_EQUAL_STRING("A snarling goblin.", t.desc.c_str());
+    TEST_ASSERT_EQUAL(10, t.hp);
+    TEST_ASSERT_EQUAL(5, t.gold);
+    TEST_ASSERT_EQUAL(3, t.attack);
+    TEST_ASSERT_EQUAL(7, t.defense);
+    TEST_ASSERT_EQUAL(25, t.xp);
+    TEST_ASSERT_TRUE(t.aggressive);
+    TEST_ASSERT_EQUAL_STRING("You dare challenge me?", t.dialog[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("Taste my blade!", t.dialog[2].c_str());
+}
+
+void test_missing_keys_take_the_defaults() {
+    const NpcTemplate &blob = templateFor("blob");
+    TEST_ASSERT_EQUAL_STRING("creature", blob.name.c_str());
+    TEST_ASSERT_EQUAL_STRING("", blob.desc.c_str());
+    TEST_ASSERT_EQUAL(1, blob.hp);
+    TEST_ASSERT_EQUAL(0, blob.gold);
+    TEST_ASSERT_EQUAL(1, blob.attack);
+    TEST_ASSERT_EQUAL(5, blob.defense);
+    TEST_ASSERT_EQUAL(5, blob.xp);
+    TEST_ASSERT_FALSE(blob.aggressive);
+    for (int i = 0; i < NPC_DIALOG_LINES; i++) TEST_ASSERT_EQUAL_STRING("", blob.dialog[i].c_str());
+
+    const NpcTemplate &rat = templateFor("rat");
+    TEST_ASSERT_EQUAL(5, rat.hp);
+    TEST_ASSERT_EQUAL(5, rat.defense);
+}
+
+void test_keys_are_trimmed_and_lowercased() {
+    const NpcTemplate &t = templateFor("shopkeeper");
+    TEST_ASSERT_EQUAL_STRING("Old Tom", t.name.c_str());
+    TEST_ASSERT_EQUAL(40, t.hp);
+    TEST_ASSERT_FALSE(t.aggressive);
+    TEST_ASSERT_EQUAL_STRING("", t.dialog[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("Fine wares!", t.dialog[1].c_str());
+}
+
+void test_values_that_are_not_numbers() {
+    const NpcTemplate &t = templateFor("wisp");
+    TEST_ASSERT_FALSE(t.aggressive);             // only "1" ever meant aggressive
+    TEST_ASSERT_EQUAL(0, t.xp);                  // atoi("abc")
+    TEST_ASSERT_EQUAL(-2, t.attack);
+    TEST_ASSERT_EQUAL(12, t.gold);
+    TEST_ASSERT_EQUAL(5, t.defense);             // "defense=" has no value: not stored
+    TEST_ASSERT_EQUAL(-1, findNpcTemplate("nobody"));
+}
+
+int main() {
+    TempLittleFS fs("templates");
+    File f = LittleFS.open("/npcs.vxd", "w");
+    f.print(SAMPLE_NPCS);
+    f.close();
+    loadAllNPCDefinitions();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_every_template_matches_the_attribute_map);
+    RUN_TEST(test_full_definition);
+    RUN_TEST(test_missing_keys_take_the_defaults);
+    RUN_TEST(test_keys_are_trimmed_and_lowercased);
+    RUN_TEST(test_values_that_are_not_numbers);
+    return UNITY_END();
+}
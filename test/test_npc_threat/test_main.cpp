@@ -0,0 +1,185 @@
+// NPC threat lists and who the NPC fights back against
+//
+//   pio test -e native -f test_npc_threat
+//
+// The whole sketch is compiled in.  An NPC must target the player in its
+// room with the most threat, drop the weakest entry when its list is
+// full, let the threat of players who left fade away, and forget a slot
+// whose connection is gone.  In a combat round it must retarget as soon
+// as a hit changes the threat, and strike its target - not whoever's
+// round it is - once a round.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const int FIGHTERS = NPC_AGGRO_SLOTS + 1;
+static int farEnd[FIGHTERS] = {-1, -1, -1, -1, -1};
+static NpcInstance *ogre;
+
+static void seat(int index) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    Player &p = players[index];
+    initPlayer(p);
+    p.client = WiFiClient(fds[0]);
+    if (farEnd[index] >= 0) close(farEnd[index]);
+    farEnd[index] = fds[1];
+    p.active = p.loggedIn = true;
+    snprintf(p.name, sizeof(p.name), "player%d", index);
+    p.roomX = p.roomY = 1;
+    p.roomZ = 50;
+    p.hp = 1000;
+    p.wimpMode = false;
+}
+
+static void engage(int index) {
+    players[index].inCombat = true;
+    players[index].combatTarget = npcInstances.handle(*ogre);
+}
+
+static int threatOf(const NpcInstance &npc, int index) {
+    int i = npcAggroFind(npc, index);
+    return i < 0 ? 0 : npc.aggro[i].threat;
+}
+
+void setUp() {
+    NpcInstance n;
+    n.npcId = "ogre";
+    n.templateIndex = findNpcTemplate("ogre");
+    n.x = n.spawnX = 1;
+    n.y = n.spawnY = 1;
+    n.z = n.spawnZ = 50;
+    n.hp = 1000;
+    n.alive = true;
+    n.targetPlayer = -1;
+    npcInstances.clear();
+    ogre = npcInstances.add(n);
+    for (int i = 0; i < FIGHTERS; i++) seat(i);
+}
+
+void tearDown() {}
+
+void test_the_most_threat_present_is_the_target() {
+    npcAddThreat(*ogre, 0, 5);
+    npcAddThreat(*ogre, 1, 9);
+    npcAddThreat(*ogre, 2, 3);
+    TEST_ASSERT_EQUAL(1, npcRetarget(*ogre));
+
+    players[1].roomX = 2;                       // out of the room: next in line
+    TEST_ASSERT_EQUAL(0, npcRetarget(*ogre));
+    players[0].loggedIn = false;
+    TEST_ASSERT_EQUAL(2, npcRetarget(*ogre));
+    players[2].active = false;
+    TEST_ASSERT_EQUAL(-1, npcRetarget(*ogre));
+    TEST_ASSERT_EQUAL(-1, ogre->targetPlayer);
+
+    // A full list gives up its weakest entry for a newcomer
+    npcAddThreat(*ogre, 3, 4);
+    TEST_ASSERT_EQUAL(NPC_AGGRO_SLOTS, (int)ogre->aggroCount);
+    npcAddThreat(*ogre, 4, 1);
+    TEST_ASSERT_EQUAL(NPC_AGGRO_SLOTS, (int)ogre->aggroCount);
+    TEST_ASSERT_FALSE(npcHostileTo(*ogre, 2));
+    TEST_ASSERT_EQUAL(1, threatOf(*ogre, 4));
+    TEST_ASSERT_EQUAL(9, threatOf(*ogre, 1));
+}
+
+void test_threat_fades_once_the_player_leaves() {
+    npcAddThreat(*ogre, 0, 100);
+    npcAddThreat(*ogre, 1, 100);
+    players[1].roomX = 2;
+
+    npcDecayThreat(*ogre);
+    TEST_ASSERT_EQUAL(100, threatOf(*ogre, 0));
+    TEST_ASSERT_EQUAL(74, threatOf(*ogre, 1));
+
+    int rounds = 1;
+    while (npcHostileTo(*ogre, 1)) {
+        npcDecayThreat(*ogre);
+        TEST_ASSERT_TRUE(++rounds < 40);
+    }
+    TEST_ASSERT_EQUAL(1, (int)ogre->aggroCount);
+    TEST_ASSERT_EQUAL(100, threatOf(*ogre, 0));
+}
+
+void test_the_counterattack_follows_the_threat_list() {
+    npcAddThreat(*ogre, 0, 1);
+    npcAddThreat(*ogre, 1, 50);
+    engage(0);
+    engage(1);
+    players[0].attack = players[1].attack = 1;  // too weak to get past its defense
+
+    doCombatRound(players[0], 0);
+    TEST_ASSERT_EQUAL(1, ogre->targetPlayer);
+    TEST_ASSERT_EQUAL(1000, players[0].hp);
+    TEST_ASSERT_TRUE(players[1].hp < 1000);
+
+    // One strike a round, however many players are fighting it
+    int hp = players[1].hp;
+    doCombatRound(players[1], 1);
+    TEST_ASSERT_EQUAL(hp, players[1].hp);
+    ogre->nextStrikeTime = millis();
+    doCombatRound(players[1], 1);
+    TEST_ASSERT_TRUE(players[1].hp < hp);
+    TEST_ASSERT_EQUAL(1000, players[0].hp);
+}
+
+void test_a_hit_retargets_within_the_round() {
+    ogre->templateIndex = findNpcTemplate("goblin");      // defense 0: every swing lands
+    npcAddThreat(*ogre, 1, 1);
+    npcAddThreat(*ogre, 0, 1);
+    ogre->targetPlayer = 1;
+    engage(0);
+    players[0].attack = 20;
+
+    doCombatRound(players[0], 0);
+    TEST_ASSERT_TRUE(threatOf(*ogre, 0) > 1);
+    TEST_ASSERT_EQUAL(0, ogre->targetPlayer);
+    TEST_ASSERT_TRUE(players[0].hp < 1000);
+    TEST_ASSERT_EQUAL(1000, players[1].hp);
+}
+
+void test_a_dropped_connection_is_forgotten() {
+    NpcInstance n = *ogre;
+    n.aggroCount = 0;
+    NpcInstance *troll = npcInstances.add(n);
+    npcAddThreat(*ogre, 0, 5);
+    npcAddThreat(*ogre, 1, 9);
+    npcAddThreat(*troll, 1, 2);
+    npcRetarget(*ogre);
+    npcRetarget(*troll);
+    TEST_ASSERT_EQUAL(1, ogre->targetPlayer);
+    TEST_ASSERT_EQUAL(1, troll->targetPlayer);
+
+    players[1].active = false;
+    npcForgetPlayer(1);
+    TEST_ASSERT_FALSE(npcHostileTo(*ogre, 1));
+    TEST_ASSERT_FALSE(npcHostileTo(*troll, 1));
+    TEST_ASSERT_EQUAL(0, ogre->targetPlayer);
+    TEST_ASSERT_EQUAL(-1, troll->targetPlayer);
+
+    // Whoever connects into the slot next starts with a clean sheet
+    seat(1);
+    TEST_ASSERT_EQUAL(0, npcRetarget(*ogre));
+}
+
+int main() {
+    allocateSessionPool();
+    npcDefs["ogre"].attributes = {{"name", "ogre"}, {"hp", "1000"}, {"attack", "50"}, {"defense", "100"}};
+    npcDefs["goblin"].attributes = {{"name", "goblin"}, {"hp", "1000"}, {"attack", "50"}, {"defense", "0"}};
+    compileNpcTemplates();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_the_most_threat_present_is_the_target);
+    RUN_TEST(test_threat_fades_once_the_player_leaves);
+    RUN_TEST(test_the_counterattack_follows_the_threat_list);
+    RUN_TEST(test_a_hit_retargets_within_the_round);
+    RUN_TEST(test_a_dropped_connection_is_forgotten);
+    int failures = UNITY_END();
+
+    for (int fd : farEnd) close(fd);
+    return failures;
+}
@@ -0,0 +1,188 @@
+// Per-slot pending prompts
+//
+//   pio test -e native -f test_prompts
+//
+// The whole sketch is compiled in.  Two players hold prompts at once and
+// each answer must reach only its own slot's handler; handlers chain the
+// next question, pass lines on or give up; unanswered prompts time out
+// (login drops the player, password change is cancelled); and a
+// PROMPT_SECRET answer is masked for the replay journal.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static int farEnd[2] = {-1, -1};       // test side of each player's socket
+
+static void seat(int index) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    Player &p = players[index];
+    initPlayer(p);
+    p.client = WiFiClient(fds[0]);
+    if (farEnd[index] >= 0) close(farEnd[index]);
+    farEnd[index] = fds[1];
+    p.active = p.loggedIn = true;
+    snprintf(p.name, sizeof(p.name), "player%d", index);
+    clearPrompt(index);
+}
+
+static std::string drain(int index) {
+    std::string out;
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(farEnd[index], buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+    return out;
+}
+
+static String answers[2];
+
+void setUp() {
+    seat(0);
+    seat(1);
+    answers[0] = answers[1] = "";
+}
+
+void tearDown() {}
+
+void test_two_slots_prompt_at_once() {
+    for (int i = 0; i < 2; i++) {
+        setPrompt(players[i], i, "Pick a number:", PROMPT_TEXT,
+                  [](Player &, int idx, const String &line) {
+                      answers[idx] = line;
+                      return PROMPT_DONE;
+                  });
+    }
+    TEST_ASSERT_TRUE(drain(0).find("Pick a number:") != std::string::npos);
+    TEST_ASSERT_TRUE(drain(1).find("Pick a number:") != std::string::npos);
+
+    TEST_ASSERT_TRUE(dispatchPrompt(players[1], 1, "7"));
+    TEST_ASSERT_EQUAL_STRING("7", answers[1].c_str());
+    TEST_ASSERT_EQUAL_STRING("", answers[0].c_str());
+    TEST_ASSERT_FALSE(promptPending(1));
+    TEST_ASSERT_TRUE(promptPending(0));
+
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, "3"));
+    TEST_ASSERT_EQUAL_STRING("3", answers[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("7", answers[1].c_str());
+    TEST_ASSERT_FALSE(promptPending(0));
+
+    // Nothing pending: the line is a command
+    TEST_ASSERT_FALSE(dispatchPrompt(players[0], 0, "look"));
+}
+
+void test_blank_lines_pass_results_and_chaining() {
+    setPrompt(players[0], 0, "", PROMPT_TEXT, [](Player &, int, const String &) { return PROMPT_DONE; });
+    TEST_ASSERT_FALSE(dispatchPrompt(players[0], 0, ""));     // PROMPT_TEXT: blank is not an answer
+    TEST_ASSERT_TRUE(promptPending(0));
+
+    setPrompt(players[0], 0, "", PROMPT_ANY, [](Player &, int, const String &) { return PROMPT_DONE; });
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, ""));
+    TEST_ASSERT_FALSE(promptPending(0));
+
+    setPrompt(players[0], 0, "", PROMPT_TEXT, [](Player &, int, const String &) { return PROMPT_RETRY; });
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, "x"));
+    TEST_ASSERT_TRUE(promptPending(0));
+
+    setPrompt(players[0], 0, "", PROMPT_TEXT, [](Player &, int, const String &) { return PROMPT_PASS; });
+    TEST_ASSERT_FALSE(dispatchPrompt(players[0], 0, "look"));
+    TEST_ASSERT_TRUE(promptPending(0));
+
+    setPrompt(players[0], 0, "", PROMPT_TEXT, [](Player &, int, const String &) { return PROMPT_ABANDON; });
+    TEST_ASSERT_FALSE(dispatchPrompt(players[0], 0, "look"));
+    TEST_ASSERT_FALSE(promptPending(0));
+
+    // A handler that asks the next question keeps it, though it says DONE
+    setPrompt(players[0], 0, "", PROMPT_TEXT, [](Player &pl, int idx, const String &) {
+        setPrompt(pl, idx, "Second question:", PROMPT_TEXT, [](Player &, int i, const String &line) {
+            answers[i] = line;
+            return PROMPT_DONE;
+        });
+        return PROMPT_DONE;
+    });
+    drain(0);
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, "first"));
+    TEST_ASSERT_TRUE(promptPending(0));
+    TEST_ASSERT_TRUE(drain(0).find("Second question:") != std::string::npos);
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, "second"));
+    TEST_ASSERT_EQUAL_STRING("second", answers[0].c_str());
+    TEST_ASSERT_FALSE(promptPending(0));
+}
+
+void test_password_change_times_out() {
+    strncpy(players[0].storedPassword, "hunter2", sizeof(players[0].storedPassword) - 1);
+    cmdPassword(players[0], 0);
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, "hunter2"));
+    TEST_ASSERT_TRUE(promptPending(0));                       // now asking for the new one
+    drain(0);
+
+    unsigned long asked = millis();
+    updatePromptTimeouts(asked + PASSWORD_PROMPT_TIMEOUT - 1000);
+    TEST_ASSERT_TRUE(promptPending(0));
+    updatePromptTimeouts(asked + PASSWORD_PROMPT_TIMEOUT + 1000);
+    TEST_ASSERT_FALSE(promptPending(0));
+    TEST_ASSERT_TRUE(drain(0).find("Password change timed out") != std::string::npos);
+    TEST_ASSERT_EQUAL_STRING("hunter2", players[0].storedPassword);
+
+    // The next line after the timeout is an ordinary command again
+    TEST_ASSERT_FALSE(dispatchPrompt(players[0], 0, "newpass9"));
+}
+
+void test_login_times_out_and_drops_only_that_player() {
+    players[0].loggedIn = players[1].loggedIn = false;
+    startLogin(players[0], 0);
+    unsigned long second = millis() + LOGIN_TIMEOUT_MS / 2;
+    startLogin(players[1], 1);
+    pendingPrompts[1].startedAt = second;                     // player 1 connected later
+
+    updatePromptTimeouts(millis() + LOGIN_TIMEOUT_MS + 1000);
+    TEST_ASSERT_FALSE(players[0].active);
+    TEST_ASSERT_FALSE(promptPending(0));
+    TEST_ASSERT_TRUE(drain(0).find("Login timed out.") != std::string::npos);
+    TEST_ASSERT_TRUE(players[1].active);
+    TEST_ASSERT_TRUE(promptPending(1));
+
+    updatePromptTimeouts(second + LOGIN_TIMEOUT_MS + 1000);
+    TEST_ASSERT_FALSE(players[1].active);
+    TEST_ASSERT_FALSE(promptPending(1));
+}
+
+void test_secret_prompts_are_masked() {
+    cmdPassword(players[0], 0);
+    setPrompt(players[1], 1, "Promote to?", PROMPT_TEXT,
+              [](Player &, int, const String &) { return PROMPT_DONE; });
+    TEST_ASSERT_TRUE(inputIsSecret(0));
+    TEST_ASSERT_FALSE(inputIsSecret(1));
+
+    TEST_ASSERT_TRUE(dispatchPrompt(players[0], 0, "wrongpw"));   // cancelled
+    TEST_ASSERT_FALSE(inputIsSecret(0));
+
+    // The login password stage is secret too, the name stage is not
+    players[1].loggedIn = false;
+    startLogin(players[1], 1);
+    TEST_ASSERT_FALSE(inputIsSecret(1));
+    loginState[1].stage = LOGIN_PASSWORD;
+    TEST_ASSERT_TRUE(inputIsSecret(1));
+}
+
+int main() {
+    TempLittleFS fs("prompt");
+    allocateSessionPool();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_two_slots_prompt_at_once);
+    RUN_TEST(test_blank_lines_pass_results_and_chaining);
+    RUN_TEST(test_password_change_times_out);
+    RUN_TEST(test_login_times_out_and_drops_only_that_player);
+    RUN_TEST(test_secret_prompts_are_masked);
+    int failures = UNITY_END();
+
+    close(farEnd[0]);
+    close(farEnd[1]);
+    return failures;
+}
@@ -0,0 +1,82 @@
+// Every occupied room stays in the room cache
+//
+//   pio test -e native -f test_room_cache
+//
+// The whole sketch is compiled in.  A full pool of players stands in as
+// many different rooms, and each of them runs commands in turn; once every
+// room has been read once, no command may miss the cache (a miss is a
+// FindVoxel read of rooms.txt on flash).
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+
+static void writeRooms(int count) {
+    File f = LittleFS.open("/rooms.txt", "w");
+    f.println("x,y,z,name,description,n,s,e,w,ne,nw,se,sw,u,d");
+    for (int i = 0; i < count; i++) {
+        f.printf("%d,250,50,Room %d,A plain room.,0,0,%d,%d,0,0,0,0,0,0\n",
+                 200 + i, i, i + 1 < count ? 1 : 0, i > 0 ? 1 : 0);
+    }
+    f.close();
+}
+
+static void seatPlayers() {
+    for (int i = 0; i < maxPlayers; i++) {
+        Player &p = players[i];
+        initPlayer(p);
+        p.active = true;
+        p.loggedIn = true;
+        snprintf(p.name, sizeof(p.name), "player%c", 'a' + i % 26);
+        p.raceId = 0;
+        p.xp = 0;
+        p.level = 1;
+        p.hp = p.maxHp = 20;
+        p.roomX = 200 + i;
+        p.roomY = 250;
+        p.roomZ = 50;
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_cache_holds_a_room_per_player() {
+    TEST_ASSERT_TRUE(maxPlayers > 8);                       // more than the old fixed cache
+    TEST_ASSERT_EQUAL(maxPlayers + ROOM_CACHE_SLOTS, roomCacheSlots);
+}
+
+void test_commands_in_occupied_rooms_never_miss() {
+    seatPlayers();
+    for (int i = 0; i < maxPlayers; i++) TEST_ASSERT_NOT_NULL(cachedRoom(200 + i, 250, 50));
+    uint32_t missesBefore = roomCacheMisses;
+
+    const char *verbs[] = {"score", "exits", "inventory", "who"};
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < maxPlayers; i++) handleCommand(players[i], i, verbs[round]);
+    }
+    TEST_ASSERT_EQUAL(missesBefore, roomCacheMisses);
+
+    // Each player still sees their own room
+    for (int i = 0; i < maxPlayers; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Room %d", i);
+        TEST_ASSERT_EQUAL_STRING(name, playerRoom(players[i]).name);
+    }
+    TEST_ASSERT_EQUAL(missesBefore, roomCacheMisses);
+}
+
+int main() {
+    TempLittleFS fs("rooms");
+
+    writeRooms(MAX_PLAYERS + 8);
+    allocateSessionPool();
+    loadRoomGraph();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_cache_holds_a_room_per_player);
+    RUN_TEST(test_commands_in_occupied_rooms_never_miss);
+    return UNITY_END();
+}
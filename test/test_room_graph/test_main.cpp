@@ -0,0 +1,244 @@
+// Room graph and BFS distance fields against a brute-force search
+//
+//   pio test -e native -f test_room_graph
+//
+// The whole sketch is compiled in.  A random two-floor map (holes, one-way
+// exits, exits into missing rooms, a portal) is written to rooms.txt and
+// loaded; every field must give the same distances as a relaxation over
+// the exits in the file, and every next hop must be one step closer.  A
+// search run a slice at a time and stopped early must still hold the
+// whole route from where it stopped.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <sys/socket.h>
+#include <tuple>
+#include <unistd.h>
+
+typedef std::tuple<int, int, int> Voxel;
+
+// rooms.txt exit columns, in file order
+static const int FILE_DIRS[10] = {DIR_NORTH, DIR_SOUTH, DIR_EAST, DIR_WEST, DIR_NE,
+                                  DIR_NW,    DIR_SE,    DIR_SW,   DIR_UP,   DIR_DOWN};
+
+static std::map<Voxel, uint16_t> mapExits;       // what rooms.txt says, by Direction bit
+static Voxel portalFrom(230, 230, 50), portalTo(245, 245, 51);
+
+static void writeMap(const std::map<Voxel, uint16_t> &rooms, bool withPortal) {
+    File f = LittleFS.open("/rooms.txt", "w");
+    f.println("x,y,z,name,long_desc,ex_n,ex_s,ex_e,ex_w,ex_ne,ex_nw,ex_se,ex_sw,ex_u,ex_d,px,py,pz,portal_command,portal_text");
+    for (auto &r : rooms) {
+        int x, y, z;
+        std::tie(x, y, z) = r.first;
+        String line = String(x) + "," + String(y) + "," + String(z) + ",Room,A room.";
+        for (int d : FILE_DIRS) line += (r.second & (1 << d)) ? ",1" : ",0";
+        if (withPortal && r.first == portalFrom) {
+            line += "," + String(std::get<0>(portalTo)) + "," + String(std::get<1>(portalTo)) + "," +
+                    String(std::get<2>(portalTo)) + ",enter gate,You step through.";
+        } else {
+            line += ",,,,,";
+        }
+        f.println(line);
+    }
+    f.close();
+    loadRoomGraph();
+}
+
+// 40x40 ground floor and a 10x10 upper floor with holes; each exit is
+// drawn on its own, so many are one-way and some lead nowhere
+static void writeRandomMap() {
+    srand(7);
+    mapExits.clear();
+    for (int z = 50; z <= 51; z++) {
+        int lo = z == 50 ? 230 : 240, hi = z == 50 ? 270 : 250;
+        for (int x = lo; x < hi; x++) {
+            for (int y = lo; y < hi; y++) {
+                if (rand() % 10 == 0) continue;
+                uint16_t exits = 0;
+                for (int d = 0; d < 10; d++) {
+                    int chance = (d == DIR_UP || d == DIR_DOWN) ? 30 : (d >= DIR_NE ? 15 : 60);
+                    if (rand() % 100 < chance) exits |= 1 << d;
+                }
+                mapExits[Voxel(x, y, z)] = exits;
+            }
+        }
+    }
+    for (auto &lm : roomLandmarks) mapExits[Voxel(lm.x, lm.y, lm.z)] |= 1 << DIR_WEST;
+    mapExits[portalFrom] |= 0;
+    mapExits[portalTo] |= 0;
+    writeMap(mapExits, true);
+}
+
+static int ordinal(const Voxel &v) {
+    return roomOrdinal(std::get<0>(v), std::get<1>(v), std::get<2>(v));
+}
+
+// Steps from every room to target, relaxing over the file's exits until
+// nothing changes
+static std::vector<int> bruteForce(int target) {
+    const int INF = 1 << 30;
+    std::vector<int> dist(roomNodes.size(), INF);
+    dist[target] = 0;
+    for (bool changed = true; changed; ) {
+        changed = false;
+        for (auto &r : mapExits) {
+            int u = ordinal(r.first);
+            int x, y, z;
+            std::tie(x, y, z) = r.first;
+            for (int d = 0; d < 10; d++) {
+                if (!(r.second & (1 << d))) continue;
+                int dx, dy, dz;
+                voxelDelta(d, dx, dy, dz);
+                int v = roomOrdinal(x + dx, y + dy, z + dz);
+                if (v >= 0 && dist[v] != INF && dist[v] + 1 < dist[u]) {
+                    dist[u] = dist[v] + 1;
+                    changed = true;
+                }
+            }
+            if (r.first == portalFrom) {
+                int v = ordinal(portalTo);
+                if (dist[v] != INF && dist[v] + 1 < dist[u]) {
+                    dist[u] = dist[v] + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (auto &d : dist) if (d == INF) d = -1;
+    return dist;
+}
+
+static void checkField(int target) {
+    std::vector<int> want = bruteForce(target);
+    const RoomField *field = roomFieldTo(target);
+    TEST_ASSERT_NOT_NULL(field);
+    TEST_ASSERT_TRUE(field->complete);
+
+    int reached = 0;
+    for (int u = 0; u < (int)roomNodes.size(); u++) {
+        if (want[u] < 0) {
+            TEST_ASSERT_FALSE(field->reaches(u));
+            continue;
+        }
+        reached++;
+        TEST_ASSERT_EQUAL(want[u], field->steps(u));
+        if (u == target) continue;
+        int next = roomNeighbor(u, field->nextDir(u));
+        TEST_ASSERT_TRUE(next >= 0);
+        TEST_ASSERT_EQUAL(want[u] - 1, want[next]);
+    }
+    TEST_ASSERT_TRUE(reached > 1);
+}
+
+// What a player is told, via a socketpair
+static std::string run(void (*cmd)(Player &, const String &), int x, int y, int z, const char *args,
+                       bool wizard = false) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    Player p;
+    p.client = WiFiClient(fds[0]);
+    p.IsWizard = wizard;
+    p.roomX = x;
+    p.roomY = y;
+    p.roomZ = z;
+    cmd(p, args);
+    p.client.stop();
+    std::string out;
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT)) > 0) out.append(buf, n);
+    close(fds[1]);
+    return out;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_exits_match_rooms_txt() {
+    writeRandomMap();
+    TEST_ASSERT_EQUAL((int)mapExits.size(), (int)roomNodes.size());
+    for (auto &r : mapExits) {
+        int u = ordinal(r.first);
+        TEST_ASSERT_TRUE(u >= 0);
+        int x, y, z;
+        std::tie(x, y, z) = r.first;
+        for (int d = 0; d < 10; d++) {
+            int dx, dy, dz;
+            voxelDelta(d, dx, dy, dz);
+            int there = roomOrdinal(x + dx, y + dy, z + dz);
+            int want = (r.second & (1 << d)) ? there : -1;   // exits into missing rooms are dropped
+            TEST_ASSERT_EQUAL(want, roomNeighbor(u, d));
+        }
+    }
+    TEST_ASSERT_EQUAL(ordinal(portalTo), roomNeighbor(ordinal(portalFrom), ROOM_EXIT_PORTAL));
+}
+
+void test_fields_match_brute_force() {
+    writeRandomMap();
+    for (auto &lm : roomLandmarks) checkField(roomOrdinal(lm.x, lm.y, lm.z));
+    checkField(ordinal(portalTo));
+    for (int i = 0; i < 5; i++) checkField(rand() % roomNodes.size());
+}
+
+void test_partial_field_covers_the_route() {
+    writeRandomMap();
+    int target = roomOrdinal(250, 250, 50);
+    std::vector<int> want = bruteForce(target);
+    for (int i = 0; i < 20; i++) {
+        int from = rand() % roomNodes.size();
+        RoomFieldSearch search;
+        roomFieldSearchBegin(search, target, from);
+        int slices = 1;
+        while (!roomFieldSearchRun(search, 7)) slices++;       // a few rooms at a time
+        TEST_ASSERT_TRUE(slices >= want[from] / 7);
+        const RoomField *field = &search.field;
+        TEST_ASSERT_EQUAL(want[from] >= 0, field->reaches(from));
+        if (want[from] < 0) continue;
+        TEST_ASSERT_EQUAL(want[from], field->steps(from));
+        for (int room = from; field->steps(room) > 0; ) {            // the whole route is in it
+            int next = roomNeighbor(room, field->nextDir(room));
+            TEST_ASSERT_EQUAL(want[room] - 1, want[next]);
+            room = next;
+        }
+    }
+}
+
+void test_path_folds_the_route() {
+    // A corridor west of the church, a step north, and a portal back
+    std::map<Voxel, uint16_t> rooms;
+    for (int x = 245; x <= 249; x++) rooms[Voxel(x, 251, 50)] = (1 << DIR_EAST) | (1 << DIR_WEST);
+    rooms[Voxel(250, 251, 50)] = (1 << DIR_NORTH) | (1 << DIR_WEST);
+    rooms[Voxel(250, 250, 50)] = 1 << DIR_SOUTH;
+    rooms[Voxel(230, 230, 50)] = 0;             // only way out is the portal
+    portalTo = Voxel(245, 251, 50);
+    writeMap(rooms, true);
+
+    TEST_ASSERT_TRUE(run(cmdPath, 245, 251, 50, "church").find("Path to the church (6 steps): 5 east, north.") !=
+                     std::string::npos);
+    TEST_ASSERT_TRUE(run(cmdPath, 230, 230, 50, "church").find("(7 steps): 'enter gate', 5 east, north.") !=
+                     std::string::npos);
+    TEST_ASSERT_TRUE(run(cmdWhere, 248, 251, 50, "church").find("The church is 3 steps away; head east.") !=
+                     std::string::npos);
+    TEST_ASSERT_TRUE(run(cmdPath, 250, 250, 50, "church").find("You are at the church.") != std::string::npos);
+    TEST_ASSERT_TRUE(run(cmdPath, 250, 250, 50, "230,230,50", true).find("can't see a way") != std::string::npos);
+    TEST_ASSERT_TRUE(run(cmdPath, 250, 250, 50, "230,230,50").find("Usage") != std::string::npos);
+    portalTo = Voxel(245, 245, 51);
+}
+
+int main() {
+    TempLittleFS fs("graph");
+    allocateSessionPool();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_exits_match_rooms_txt);
+    RUN_TEST(test_fields_match_brute_force);
+    RUN_TEST(test_partial_field_covers_the_route);
+    RUN_TEST(test_path_folds_the_route);
+    return UNITY_END();
+}
@@ -0,0 +1,201 @@
+// Hierarchical tick scheduler on a simulated clock
+//
+//   pio test -e native -f test_tick_scheduler
+//
+// millis() and micros() are replaced by a clock the test moves, so 70 hours
+// of ticks run in a few seconds.  Every task must fire on the first
+// run() at or after its due time, also across a millis() wrap; the budget,
+// skip-ahead, cancel and reschedule must behave as the header says.
+
+#include <unity.h>
+#include <Arduino.h>
+
+static unsigned long simMs = 0;
+static unsigned long simUs = 0;
+static unsigned long simMillis() { return simMs; }
+static unsigned long simMicros() { return simUs; }
+
+#define millis simMillis
+#define micros simMicros
+#include <TickScheduler.h>
+#undef millis
+#undef micros
+
+#include <cstdlib>
+
+static TickScheduler ticks;
+
+// What each task should see, kept independently of the wheel
+struct Expect {
+    unsigned long period;
+    unsigned long nextDue;
+    bool oneShot;
+    int fired;
+};
+static Expect expect[TICK_MAX_TASKS];
+static unsigned long previousRunMs = 0;
+static int lateOrEarly = 0;
+
+template <int I>
+static void expectTask(unsigned long now) {
+    Expect &e = expect[I];
+    // Due by now, and not yet due at the previous run()
+    if ((long)(e.nextDue - now) > 0 || (long)(e.nextDue - previousRunMs) <= 0) lateOrEarly++;
+    e.fired++;
+    e.nextDue += e.period;
+    simUs += 50;
+}
+
+static TickFn expectFns[TICK_MAX_TASKS];
+
+template <int N>
+static void fillExpectFns() {
+    if constexpr (N > 0) {
+        expectFns[N - 1] = expectTask<N - 1>;
+        fillExpectFns<N - 1>();
+    }
+}
+
+static int counted = 0;
+static void countTask(unsigned long) { counted++; }
+static void slowTask(unsigned long) {
+    counted++;
+    simUs += 5000;
+}
+
+static void resetClock(unsigned long ms) {
+    simMs = ms;
+    simUs = 0;
+    counted = 0;
+    ticks.reset(simMs);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void runRandomTasks(unsigned long start) {
+    resetClock(start);
+    srand(1);
+    lateOrEarly = 0;
+    int ids[TICK_MAX_TASKS];
+    for (int i = 0; i < TICK_MAX_TASKS; i++) {
+        unsigned long period;
+        switch (i % 4) {
+            case 0: period = 10 + rand() % 500; break;              // combat-like
+            case 1: period = 1000 + rand() % 60000; break;          // dialog, healing
+            case 2: period = 600000 + rand() % 3600000; break;      // restock
+            default: period = 1000 + rand() % 9000; break;
+        }
+        period = period / TICK_MS * TICK_MS;
+        expect[i] = {period, simMs + period, i % 7 == 3, 0};
+        ids[i] = expect[i].oneShot ? ticks.after("once", period, expectFns[i])
+                                   : ticks.every("every", period, expectFns[i]);
+        TEST_ASSERT_EQUAL(i, ids[i]);
+    }
+
+    int missed = 0;
+    unsigned long end = simMs + 70UL * 3600000UL;
+    while ((long)(end - simMs) > 0) {
+        previousRunMs = simMs;
+        simMs += 1 + rand() % 25;
+        ticks.run(simMs, 1000000);
+        for (int i = 0; i < TICK_MAX_TASKS; i++) {
+            Expect &e = expect[i];
+            if (e.oneShot && e.fired) continue;
+            if ((long)(simMs - e.nextDue) >= 0) {
+                missed++;
+                e.nextDue += e.period;
+            }
+        }
+    }
+
+    TEST_ASSERT_EQUAL(0, missed);
+    TEST_ASSERT_EQUAL(0, lateOrEarly);
+    for (int i = 0; i < TICK_MAX_TASKS; i++) {
+        if (expect[i].oneShot) {
+            TEST_ASSERT_EQUAL(1, expect[i].fired);
+            TEST_ASSERT_FALSE(ticks.task(ids[i]).active);
+        } else {
+            TEST_ASSERT_EQUAL((int)(70UL * 3600000UL / expect[i].period), expect[i].fired);
+        }
+    }
+}
+
+void test_tasks_fire_on_time() {
+    runRandomTasks(0);
+}
+
+void test_tasks_fire_on_time_across_millis_wrap() {
+    runRandomTasks(0xFFFF0000UL);
+}
+
+void test_budget_defers_the_rest() {
+    resetClock(0);
+    for (int i = 0; i < 10; i++) ticks.every("slow", 1000, slowTask);
+    simMs = 1000;
+    TEST_ASSERT_EQUAL(2, ticks.run(simMs, 8000));            // 5 ms each, 8 ms budget
+    TEST_ASSERT_EQUAL(8, (int)ticks.deferred());
+    TEST_ASSERT_TRUE(ticks.pending());
+    TEST_ASSERT_EQUAL(2, ticks.run(simMs, 8000));
+    while (ticks.pending()) ticks.run(simMs, 8000);
+    TEST_ASSERT_EQUAL(10, counted);
+
+    // One task longer than the whole budget still runs
+    resetClock(0);
+    ticks.every("slow", 1000, slowTask);
+    simMs = 1000;
+    TEST_ASSERT_EQUAL(1, ticks.run(simMs, 1000));
+}
+
+void test_fallen_behind_task_skips_missed_runs() {
+    resetClock(0);
+    int id = ticks.every("heal", 1000, countTask);
+    simMs = 1000;
+    ticks.run(simMs, 1000000);
+    simMs = 6500;                                            // 5.5 s without a run()
+    ticks.run(simMs, 1000000);
+    TEST_ASSERT_EQUAL(2, (int)ticks.task(id).runs);
+    TEST_ASSERT_EQUAL(4, (int)ticks.task(id).skipped);
+    TEST_ASSERT_EQUAL(4500, (int)ticks.task(id).maxLateMs);
+
+    simMs = 6999;                                            // fixed step: next due at 7000
+    ticks.run(simMs, 1000000);
+    TEST_ASSERT_EQUAL(2, counted);
+    simMs = 7000;
+    ticks.run(simMs, 1000000);
+    TEST_ASSERT_EQUAL(3, counted);
+}
+
+void test_cancel_and_reschedule() {
+    resetClock(0);
+    int a = ticks.every("a", 100, countTask);
+    int b = ticks.every("b", 100, countTask);
+    ticks.cancel(a);
+    simMs = 100;
+    ticks.run(simMs, 1000000);
+    TEST_ASSERT_EQUAL(1, counted);
+    TEST_ASSERT_FALSE(ticks.task(a).active);
+
+    ticks.reschedule(b, 5000);
+    simMs = 5090;
+    ticks.run(simMs, 1000000);
+    TEST_ASSERT_EQUAL(1, counted);
+    simMs = 5100;
+    ticks.run(simMs, 1000000);
+    TEST_ASSERT_EQUAL(2, counted);
+
+    // A cancelled slot is handed out again
+    TEST_ASSERT_EQUAL(a, ticks.after("c", 10, countTask));
+}
+
+int main() {
+    fillExpectFns<TICK_MAX_TASKS>();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_tasks_fire_on_time);
+    RUN_TEST(test_tasks_fire_on_time_across_millis_wrap);
+    RUN_TEST(test_budget_defers_the_rest);
+    RUN_TEST(test_fallen_behind_task_skips_missed_runs);
+    RUN_TEST(test_cancel_and_reschedule);
+    return UNITY_END();
+}
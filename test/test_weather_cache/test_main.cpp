@@ -0,0 +1,131 @@
+// Weather cache, geocode memo and request coalescing against a mock
+// open-meteo on 127.0.0.1
+//
+//   pio test -e native -f test_weather_cache
+//
+// The whole sketch is compiled in, with the two weather endpoints pointed
+// at the stub; the test drives requestWeather() the way cmdWeather does and
+// counts what reaches the server.
+
+#include <unity.h>
+#include <Arduino.h>
+#include "../stub_http.h"
+
+static StubHttpServer stub;
+static String stubUrl(const char *path) { return String(stub.url(path).c_str()); }
+
+#define WEATHER_GEOCODE_URL stubUrl("/v1/search")
+#define WEATHER_FORECAST_URL stubUrl("/v1/forecast")
+#include <ESP32MUD.cpp>
+
+static std::string mockOpenMeteo(const StubRequest &req) {
+    if (req.path.rfind("/v1/search?name=nowhere", 0) == 0) return stubResponse(200, "{\"generationtime_ms\":0.5}");
+    if (req.path.rfind("/v1/search", 0) == 0)
+        return stubResponse(200, "{\"results\":[{\"id\":1,\"name\":\"X\",\"latitude\":42.33,\"longitude\":-83.05}]}");
+    if (req.path.rfind("/v1/forecast", 0) == 0)
+        return stubChunked({"{\"latitude\":42.33,\"current\":{\"temperature_2m\":20.0,\"weather_code\":1},",
+                            "\"daily\":{\"temperature_2m_max\":[25.0,26.0,27.0],\"temperature_2m_min\":[10.0,11.0,12.0],",
+                            "\"weather_code\":[0,2,61]}}"});
+    return stubResponse(404, "");
+}
+
+// Run the request list and the job queue until nothing is in flight
+static void settle() {
+    for (int i = 0; i < 500 && (!weatherRequests.empty() || httpJobsOutstanding() > 0); i++) {
+        updateWeatherRequests();
+        httpJobPump();
+        delay(10);
+    }
+}
+
+void setUp() {
+    weatherCache.clear();
+    geoCache.clear();
+    weatherRequests.clear();
+    weatherCacheStats = WeatherCacheStats();
+    weatherCacheTtlMs = 10UL * 60UL * 1000UL;
+    lastWeatherData = WeatherData();
+}
+
+void tearDown() {}
+
+void test_repeat_city_is_served_from_cache() {
+    size_t geo = stub.count("/v1/search"), forecast = stub.count("/v1/forecast");
+
+    requestWeather("Detroit", false);
+    settle();
+    TEST_ASSERT_EQUAL(geo + 1, stub.count("/v1/search"));
+    TEST_ASSERT_EQUAL(forecast + 1, stub.count("/v1/forecast"));
+    TEST_ASSERT_TRUE(lastWeatherData.current.startsWith("Current Temperature: 68"));
+
+    lastWeatherData = WeatherData();
+    requestWeather("  DETROIT ", false);        // same normalised key
+    settle();
+    TEST_ASSERT_EQUAL(geo + 1, stub.count("/v1/search"));
+    TEST_ASSERT_EQUAL(forecast + 1, stub.count("/v1/forecast"));
+    TEST_ASSERT_EQUAL(1, weatherCacheStats.weatherHits);
+    TEST_ASSERT_EQUAL(1, weatherCacheStats.weatherMisses);
+    TEST_ASSERT_TRUE(lastWeatherData.current.startsWith("Current Temperature: 68"));
+}
+
+void test_identical_requests_share_one_fetch() {
+    size_t total = stub.count();
+    requestWeather("Paris", true);
+    requestWeather("paris", true);
+    requestWeather(" Paris", true);
+    TEST_ASSERT_EQUAL(1, (int)weatherRequests.size());
+    TEST_ASSERT_EQUAL(2, weatherCacheStats.coalesced);
+
+    settle();
+    TEST_ASSERT_EQUAL(total + 2, stub.count());     // one geocode, one forecast
+    TEST_ASSERT_EQUAL_STRING("3-Day Forecast", lastWeatherData.current.c_str());
+}
+
+void test_geocode_is_memoised_across_kinds() {
+    requestWeather("Lansing", false);
+    settle();
+    size_t geo = stub.count("/v1/search"), forecast = stub.count("/v1/forecast");
+
+    requestWeather("Lansing", true);            // different cache key, same city
+    settle();
+    TEST_ASSERT_EQUAL(geo, stub.count("/v1/search"));
+    TEST_ASSERT_EQUAL(forecast + 1, stub.count("/v1/forecast"));
+    TEST_ASSERT_EQUAL(1, weatherCacheStats.geoHits);
+}
+
+void test_expired_result_refetches_forecast_only() {
+    weatherCacheTtlMs = 30;
+    requestWeather("Flint", false);
+    settle();
+    size_t geo = stub.count("/v1/search"), forecast = stub.count("/v1/forecast");
+
+    delay(50);
+    requestWeather("Flint", false);
+    settle();
+    TEST_ASSERT_EQUAL(geo, stub.count("/v1/search"));
+    TEST_ASSERT_EQUAL(forecast + 1, stub.count("/v1/forecast"));
+    TEST_ASSERT_EQUAL(2, weatherCacheStats.weatherMisses);
+}
+
+void test_failed_lookup_is_not_cached() {
+    size_t geo = stub.count("/v1/search");
+    requestWeather("Nowhere", false);
+    settle();
+    requestWeather("Nowhere", false);
+    settle();
+    TEST_ASSERT_EQUAL(geo + 2, stub.count("/v1/search"));
+    TEST_ASSERT_EQUAL(0, (int)weatherCache.size());
+    TEST_ASSERT_EQUAL(0, (int)geoCache.size());
+}
+
+int main() {
+    stub.start(mockOpenMeteo);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_repeat_city_is_served_from_cache);
+    RUN_TEST(test_identical_requests_share_one_fetch);
+    RUN_TEST(test_geocode_is_memoised_across_kinds);
+    RUN_TEST(test_expired_result_refetches_forecast_only);
+    RUN_TEST(test_failed_lookup_is_not_cached);
+    return UNITY_END();
+}
@@ -0,0 +1,257 @@
+// Warm-restart snapshot: round trip and rejection
+//
+//   pio test -e native -f test_world_snapshot
+//
+// The whole sketch is compiled in.  A world of items, NPCs, shop stock and
+// two games in progress is saved to /world.snap and loaded back into an
+// emptied world; a snapshot that is corrupted, truncated or taken against
+// other data files must be refused and leave the world alone.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <ESP32MUD.cpp>
+
+#include "../temp_littlefs.h"
+#include <string>
+
+static const int ITEMS = 400;
+static const int NPCS = 40;
+
+static void writeFile(const char *path, const char *text) {
+    File f = LittleFS.open(path, "w");
+    f.print(text);
+    f.close();
+}
+
+static void defineWorld() {
+    itemDefs.clear();
+    itemDefs["torch"].attributes = {{"name", "Torch"}, {"desc", "A torch"}};
+    itemDefs["chest"].attributes = {{"name", "Chest"}};
+    npcDefs.clear();
+    npcDefs["rat"].attributes = {{"name", "rat"}, {"hp", "5"}};
+    compileNpcTemplates();
+    writeFile("/items.vxd", "torch|...\n");
+    writeFile("/npcs.vxd", "rat|...\n");
+}
+
+static void buildWorld() {
+    worldItems.clear();
+    for (int i = 0; i < ITEMS; i++) {
+        WorldItem wi;
+        wi.x = 250 + i % 5;
+        wi.y = 250;
+        wi.z = 50;
+        wi.name = i % 3 ? "torch" : "chest";
+        wi.value = i;
+        wi.attributes = itemDefs[wi.name.c_str()].attributes;
+        if (i == 7) wi.attributes["desc"] = "scorched";
+        worldItems.push_back(wi);
+    }
+    WorldItem carried;                          // top-level inventory: saved with its owner
+    carried.x = carried.y = carried.z = -1;
+    carried.name = "torch";
+    carried.ownerName = "bob";
+    worldItems.push_back(carried);
+
+    npcInstances.clear();
+    for (int i = 0; i < NPCS; i++) {
+        NpcInstance n;
+        n.npcId = "rat";
+        n.templateIndex = findNpcTemplate("rat");
+        n.x = n.spawnX = i;
+        n.y = n.spawnY = 2;
+        n.z = n.spawnZ = 50;
+        n.hp = i;
+        n.gold = 3;
+        n.alive = i % 4 != 0;
+        n.respawnTime = n.alive ? 0 : millis() + 60000;
+        n.nextDialogTime = millis() + 5000;
+        n.targetPlayer = 1;
+        n.mobile = i % 5 == 0;
+        n.suppressDeathMessage = false;
+        npcInstances.add(n);
+    }
+
+    shops.clear();
+    Shop s;
+    s.x = 254;
+    s.y = 244;
+    s.z = 50;
+    s.inventory.push_back({1, "dagger", "Dagger", 5, 25});
+    s.inventory.push_back({2, "sword", "Sword", 3, 150});
+    shops.push_back(s);
+}
+
+static void seat(int slot, const char *name) {
+    Player &p = players[slot];
+    p = Player();
+    strncpy(p.name, name, sizeof(p.name) - 1);
+    p.active = p.loggedIn = true;
+}
+
+void setUp() {
+    defineWorld();
+    buildWorld();
+}
+
+void tearDown() {}
+
+void test_round_trip_restores_the_world() {
+    shops[0].inventory[0].quantity = 1;
+    globalHighLowPot = 777;
+
+    seat(2, "alice");
+    HighLowSession &hl = highLowSessions[2];
+    hl.gameActive = true;
+    hl.gameRoomX = 247;
+    hl.gameRoomY = 248;
+    hl.gameRoomZ = 50;
+    for (int i = 0; i < 90; i++) hl.deck.push_back({i % 13 + 1, i % 4, i % 13 == 0});
+
+    seat(5, "carol");
+    ChessSession &cs = chessSessions[5];
+    cs.gameActive = true;
+    cs.gameEnded = false;
+    cs.gameRoomX = 247;
+    cs.gameRoomY = 248;
+    cs.gameRoomZ = 50;
+    for (int i = 0; i < 64; i++) cs.board[i] = i % 13;
+    cs.moveCount = 17;
+    cs.lastPlayerMove = "e2e4";
+
+    std::vector<WorldItem> expectItems;
+    for (auto &wi : worldItems) if (wi.ownerName.length() == 0) expectItems.push_back(wi);
+    std::vector<NpcInstance> expectNpcs(npcInstances.begin(), npcInstances.end());
+
+    TEST_ASSERT_TRUE(saveWorldSnapshot());
+
+    // A cold world, as at boot before the world files are read
+    worldItems.clear();
+    npcInstances.clear();
+    globalHighLowPot = 50;
+    highLowSessions[2] = HighLowSession();
+    chessSessions[5] = ChessSession();
+    players[2] = Player();
+    players[5] = Player();
+
+    unsigned long start = micros();
+    TEST_ASSERT_TRUE(loadWorldSnapshot());
+    char msg[64];
+    snprintf(msg, sizeof(msg), "loaded in %lu us", micros() - start);
+    TEST_MESSAGE(msg);
+    TEST_ASSERT_FALSE(LittleFS.exists(WORLD_SNAPSHOT_PATH));        // single use
+
+    TEST_ASSERT_EQUAL(777, globalHighLowPot);
+    TEST_ASSERT_EQUAL((int)expectItems.size(), (int)worldItems.size());
+    for (size_t i = 0; i < worldItems.size(); i++) {
+        TEST_ASSERT_EQUAL_STRING(expectItems[i].name.c_str(), worldItems[i].name.c_str());
+        TEST_ASSERT_EQUAL(expectItems[i].value, worldItems[i].value);
+        TEST_ASSERT_TRUE(expectItems[i].attributes == worldItems[i].attributes);
+    }
+
+    TEST_ASSERT_EQUAL((int)expectNpcs.size(), npcInstances.size());
+    for (int i = 0; i < npcInstances.size(); i++) {
+        NpcInstance &n = npcInstances[i];
+        TEST_ASSERT_EQUAL(expectNpcs[i].x, n.x);
+        TEST_ASSERT_EQUAL(expectNpcs[i].hp, n.hp);
+        TEST_ASSERT_EQUAL(expectNpcs[i].alive, n.alive);
+        TEST_ASSERT_EQUAL(expectNpcs[i].mobile, n.mobile);
+        TEST_ASSERT_EQUAL(!expectNpcs[i].alive, n.respawnTime != 0);
+        TEST_ASSERT_EQUAL(0, n.aggroCount);                     // connections do not survive
+        TEST_ASSERT_EQUAL(n.alive ? 1 : 0, npcInstances.at(n.x, n.y, n.z).count);   // indexed again
+    }
+
+    TEST_ASSERT_EQUAL(1, shops[0].inventory[0].quantity);
+    TEST_ASSERT_EQUAL(3, shops[0].inventory[1].quantity);
+    TEST_ASSERT_EQUAL(2, (int)snapshotSessions.size());
+
+    // carol logs in somewhere else: her game is dropped
+    seat(0, "Carol");
+    players[0].roomX = 250;
+    players[0].roomY = 250;
+    players[0].roomZ = 50;
+    restoreSnapshotSessions(players[0], 0);
+    TEST_ASSERT_FALSE(chessSessions[0].gameActive);
+    TEST_ASSERT_EQUAL(1, (int)snapshotSessions.size());
+
+    // alice comes back to the parlor: the dealer deals from her saved deck
+    seat(3, "alice");
+    players[3].roomX = 247;
+    players[3].roomY = 248;
+    players[3].roomZ = 50;
+    restoreSnapshotSessions(players[3], 3);
+    TEST_ASSERT_TRUE(highLowSessions[3].gameActive);
+    TEST_ASSERT_TRUE(highLowSessions[3].deck.size() > 80 && highLowSessions[3].deck.size() <= 90);
+    TEST_ASSERT_EQUAL(0, (int)snapshotSessions.size());
+}
+
+// A refused snapshot is deleted and the world is left as it was
+static void assertRefused(const char *why) {
+    worldItems.clear();
+    TEST_ASSERT_FALSE(loadWorldSnapshot());
+    TEST_ASSERT_EQUAL(0, (int)worldItems.size());
+    TEST_ASSERT_EQUAL(NPCS, npcInstances.size());
+    TEST_ASSERT_FALSE(LittleFS.exists(WORLD_SNAPSHOT_PATH));
+    TEST_ASSERT_TRUE_MESSAGE(worldSnapshotStatus.indexOf(why) >= 0, worldSnapshotStatus.c_str());
+}
+
+static std::string readSnapshot() {
+    File f = LittleFS.open(WORLD_SNAPSHOT_PATH, "r");
+    std::string s(f.size(), '\0');
+    f.read((uint8_t *)&s[0], s.size());
+    f.close();
+    return s;
+}
+
+static void writeSnapshot(const std::string &s) {
+    File f = LittleFS.open(WORLD_SNAPSHOT_PATH, "w");
+    f.write((const uint8_t *)s.data(), s.size());
+    f.close();
+}
+
+void test_flipped_byte_is_refused() {
+    TEST_ASSERT_TRUE(saveWorldSnapshot());
+    std::string s = readSnapshot();
+    s[100] ^= 0x5A;
+    writeSnapshot(s);
+    assertRefused("CRC");
+}
+
+void test_truncated_snapshot_is_refused() {
+    TEST_ASSERT_TRUE(saveWorldSnapshot());
+    writeSnapshot(readSnapshot().substr(0, 500));
+    assertRefused("truncated");
+}
+
+void test_other_data_files_are_refused() {
+    TEST_ASSERT_TRUE(saveWorldSnapshot());
+    writeFile("/npcs.vxd", "rat|changed\n");
+    assertRefused("other data files");
+}
+
+void test_older_version_is_refused() {
+    TEST_ASSERT_TRUE(saveWorldSnapshot());
+    std::string s = readSnapshot();
+    s[4] = (char)(WORLD_SNAPSHOT_VERSION - 1);
+    writeSnapshot(s);
+    assertRefused("version");
+}
+
+void test_missing_snapshot_is_a_cold_boot() {
+    LittleFS.remove(WORLD_SNAPSHOT_PATH);
+    assertRefused("no snapshot");
+}
+
+int main() {
+    TempLittleFS fs("snapshot");
+    allocateSessionPool();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_restores_the_world);
+    RUN_TEST(test_flipped_byte_is_refused);
+    RUN_TEST(test_truncated_snapshot_is_refused);
+    RUN_TEST(test_other_data_files_are_refused);
+    RUN_TEST(test_older_version_is_refused);
+    RUN_TEST(test_missing_snapshot_is_a_cold_boot);
+    return UNITY_END();
+}
@@ -0,0 +1,197 @@
+// YMODEM receiver against a mock serial port
+//
+//   pio test -e native -f test_ymodem
+//
+// The sender's side of a batch is built up front (header block, 1K data
+// blocks, EOT, end-of-batch header) and fed to the receiver through a mock
+// Serial.  The tests check what lands on LittleFS and what was ACKed, and
+// report the receive throughput.
+
+#include <unity.h>
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "../temp_littlefs.h"
+#include <string>
+
+// Everything the receiver reads or writes goes through here
+class MockSerial : public Stream {
+public:
+    std::string in;         // what the sender has sent
+    size_t pos = 0;
+    std::string out;        // what the receiver answered
+
+    int available() override { return (int)(in.size() - pos); }
+    int read() override { return pos < in.size() ? (uint8_t)in[pos++] : -1; }
+    int peek() override { return pos < in.size() ? (uint8_t)in[pos] : -1; }
+    size_t write(uint8_t c) override { out += (char)c; return 1; }
+    using Print::write;
+    explicit operator bool() const { return true; }
+};
+
+static MockSerial mockSerial;
+#define Serial mockSerial
+#include <YmodemBootloader.h>
+#undef Serial
+
+// ------------------------------------------------------------
+// Sender side
+// ------------------------------------------------------------
+
+// CRC-16/XMODEM, bit at a time, independent of the receiver's table
+static uint16_t crc16(const std::string &data) {
+    uint16_t crc = 0;
+    for (unsigned char c : data) {
+        crc ^= (uint16_t)c << 8;
+        for (int i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+static std::string block(uint8_t type, uint8_t num, std::string data, bool corrupt = false) {
+    data.resize(type == SOH ? 128 : 1024, type == SOH ? '\0' : 0x1A);
+    uint16_t crc = crc16(data) ^ (corrupt ? 1 : 0);
+    return std::string(1, (char)type) + (char)num + (char)(0xFF - num) + data + (char)(crc >> 8) + (char)crc;
+}
+
+static std::string header(const std::string &name, size_t size) {
+    return block(SOH, 0, name + '\0' + std::to_string(size));
+}
+
+// One file: header, data blocks, EOT.  badBlock (1-based) is sent with a
+// bad CRC first and then again intact, as a sender does after the NAK.
+static std::string sendFile(const std::string &name, const std::string &content, int badBlock = 0) {
+    std::string s = header(name, content.size());
+    int num = 1;                                // sent modulo 256
+    for (size_t off = 0; off < content.size(); off += 1024, num++) {
+        std::string chunk = content.substr(off, 1024);
+        if (num == badBlock) s += block(STX, (uint8_t)num, chunk, true);
+        s += block(STX, (uint8_t)num, chunk);
+    }
+    return s + (char)EOT;
+}
+
+static std::string endOfBatch() {
+    return block(SOH, 0, "");
+}
+
+static std::string makeContent(size_t size, uint32_t seed) {
+    std::string s(size, '\0');
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        s[i] = (char)(seed >> 16);
+    }
+    return s;
+}
+
+static std::string readFile(const char *path) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return "<missing>";
+    std::string s(f.size(), '\0');
+    f.read((uint8_t *)&s[0], s.size());
+    f.close();
+    return s;
+}
+
+static int count(const std::string &s, char c) {
+    int n = 0;
+    for (char x : s) n += x == c;
+    return n;
+}
+
+// ------------------------------------------------------------
+// Tests
+// ------------------------------------------------------------
+
+void setUp() {
+    mockSerial.in.clear();
+    mockSerial.pos = 0;
+    mockSerial.out.clear();
+}
+
+void tearDown() {}
+
+void test_large_upload_throughput() {
+    const size_t size = 600 * 1024 + 321;
+    std::string content = makeContent(size, 1);
+    mockSerial.in = sendFile("rooms.txt", content) + endOfBatch();
+
+    uint32_t start = micros();
+    TEST_ASSERT_TRUE(ymodem_receiveSession(2000));
+    uint32_t us = micros() - start;
+
+    TEST_ASSERT_EQUAL(mockSerial.in.size(), mockSerial.pos);
+    TEST_ASSERT_TRUE(readFile("/rooms.txt") == content);
+    TEST_ASSERT_FALSE(LittleFS.exists("/rooms.txt.part"));
+    TEST_ASSERT_EQUAL(0, count(mockSerial.out, (char)NAK));
+    TEST_ASSERT_EQUAL((int)(size + 1023) / 1024 + 3, count(mockSerial.out, (char)ACK));
+
+    // The session includes its fixed 300 ms settle delay; leave it out
+    uint32_t transferUs = us > 300000 ? us - 300000 : 1;
+    char msg[96];
+    snprintf(msg, sizeof(msg), "%u bytes in %u us: %u KB/s", (unsigned)size, transferUs,
+             (unsigned)((uint64_t)size * 1000000 / transferUs / 1024));
+    TEST_MESSAGE(msg);
+}
+
+// The "KB/s" figure in the log is kilobytes per second
+void test_logged_rate_is_kilobytes_per_second() {
+    mockSerial.in = sendFile("npcs.vxd", makeContent(300 * 1024, 2)) + endOfBatch();
+    TEST_ASSERT_TRUE(ymodem_receiveSession(2000));
+
+    std::string log = readFile("/ymodem_debug.txt");
+    size_t at = log.find("File staged: npcs.vxd");
+    TEST_ASSERT_TRUE(at != std::string::npos);
+    unsigned long received = 0, elapsed = 0, rate = 0;
+    const char *line = log.c_str() + at;
+    const char *p = strstr(line, "finalSize=");
+    TEST_ASSERT_NOT_NULL(p);
+    received = strtoul(p + 10, nullptr, 10);
+    p = strstr(line, " in ");
+    TEST_ASSERT_NOT_NULL(p);
+    elapsed = strtoul(p + 4, nullptr, 10);
+    p = strstr(line, "ms (");
+    TEST_ASSERT_NOT_NULL(p);
+    rate = strtoul(p + 4, nullptr, 10);
+
+    TEST_ASSERT_EQUAL(300 * 1024, received);
+    unsigned long expected = elapsed ? (unsigned long)((uint64_t)received * 1000 / elapsed / 1024) : 0;
+    TEST_ASSERT_EQUAL(expected, rate);
+}
+
+void test_bad_crc_is_nakked_and_resent() {
+    std::string content = makeContent(5000, 3);
+    mockSerial.in = sendFile("quests.txt", content, 3) + endOfBatch();
+    TEST_ASSERT_TRUE(ymodem_receiveSession(2000));
+    TEST_ASSERT_EQUAL(1, count(mockSerial.out, (char)NAK));
+    TEST_ASSERT_TRUE(readFile("/quests.txt") == content);
+}
+
+void test_batch_of_files_commits_together() {
+    std::string a = makeContent(1500, 4), b = makeContent(130, 5);
+    mockSerial.in = sendFile("a.txt", a) + sendFile("b.txt", b) + endOfBatch();
+    TEST_ASSERT_TRUE(ymodem_receiveSession(2000));
+    TEST_ASSERT_TRUE(readFile("/a.txt") == a);
+    TEST_ASSERT_TRUE(readFile("/b.txt") == b);
+}
+
+void test_cancelled_upload_leaves_live_file() {
+    LittleFS.open("/items.txt", "w").print("old items");
+    std::string full = sendFile("items.txt", makeContent(8000, 6));
+    size_t cut = header("items.txt", 8000).size() + 3 * block(STX, 1, "").size();
+    mockSerial.in = full.substr(0, cut) + (char)CAN + (char)CAN;   // sender aborts after block 3
+    TEST_ASSERT_FALSE(ymodem_receiveSession(500));
+    TEST_ASSERT_TRUE(readFile("/items.txt") == "old items");
+    TEST_ASSERT_EQUAL(3 * 1024, (int)LittleFS.open("/items.txt.part", "r").size());  // kept for a resume
+}
+
+int main() {
+    TempLittleFS fs("ymodem");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_large_upload_throughput);
+    RUN_TEST(test_logged_rate_is_kilobytes_per_second);
+    RUN_TEST(test_bad_crc_is_nakked_and_resent);
+    RUN_TEST(test_batch_of_files_commits_together);
+    RUN_TEST(test_cancelled_upload_leaves_live_file);
+    return UNITY_END();
+}